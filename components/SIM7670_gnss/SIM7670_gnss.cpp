@@ -10,8 +10,9 @@
  */
 #include <string_view>
 #include <charconv>
-#include <sstream>
 #include <list>
+#include <vector>
+#include <algorithm>
 #include "sdkconfig.h"
 #include "esp_log.h"
 #include "cxx_include/esp_modem_dte.hpp"
@@ -20,7 +21,13 @@
 #include "cxx_include/esp_modem_api.hpp"
 #include "cxx_include/esp_modem_command_library_utils.hpp"
 #include "SIM7670_gnss.hpp"
+#if CONFIG_IDF_TARGET_LINUX
+// host builds have no GPIO driver, the DTR line is not simulated
+#define gpio_set_direction(pin, mode)
+#define gpio_set_level(pin, level)
+#else
 #include "driver/gpio.h"
+#endif
 #include <sys/time.h>
 
 constexpr auto const TAG = "SIM7670_gnss";
@@ -137,7 +144,7 @@ esp_modem::command_result get_gnss_information_sim76xx_lib(esp_modem::Commandabl
     // Fix status
     {
         std::string_view fix_status = out.substr(0, pos);
-        if (fix_status.length() > 1)
+        if (!fix_status.empty())
         {
             int Fix_status;
             if (std::from_chars(out.data(), out.data() + pos, Fix_status).ec == std::errc::invalid_argument)
@@ -295,7 +302,7 @@ esp_modem::command_result get_gnss_information_sim76xx_lib(esp_modem::Commandabl
     // Fix Mode
     {
         std::string_view FixModesubstr = out.substr(0, pos);
-        if (FixModesubstr.length() > 1)
+        if (!FixModesubstr.empty())
         {
             int Fix_Mode;
             if (std::from_chars(out.data(), out.data() + pos, Fix_Mode).ec == std::errc::invalid_argument)
@@ -378,7 +385,7 @@ esp_modem::command_result get_gnss_information_sim76xx_lib(esp_modem::Commandabl
     // sats_in_view
     {
         std::string_view sats_in_view = out.substr(0, pos);
-        if (sats_in_view.length() > 1)
+        if (!sats_in_view.empty())
         {
             if (std::from_chars(out.data(), out.data() + pos, gps.sat.num).ec == std::errc::invalid_argument)
             {
@@ -494,12 +501,13 @@ esp_modem::command_result DCE_gnss::set_sms_text_mode(bool text_mode)
     return device->set_sms_text_mode(text_mode);
 }
 
-esp_modem::command_result get_unread_sms_list_lib(esp_modem::CommandableIf *t, std::list<sms_t> &sms_list)
+esp_modem::command_result list_sms_lib(esp_modem::CommandableIf *t, sms_list_status_t status, const std::function<bool(const sms_view_t &)> &cb)
 {
+    static const char *const status_names[] = {"REC UNREAD", "REC READ", "ALL"};
     std::string str_out;
-    ESP_LOGI(TAG, "asking SMS unread list");
+    ESP_LOGI(TAG, "asking SMS list %s", status_names[(int)status]);
     set_sms_text_mode_lib(t, true);
-    auto ret = esp_modem::dce_commands::at_raw(t, "AT+CMGL=\"REC UNREAD\"\r", str_out, "OK", "FAIL", 5000); // esp_modem::dce_commands::generic_get_string(t, "AT+CMGL=\"REC UNREAD\"\r", str_out, 5000);
+    auto ret = esp_modem::dce_commands::at_raw(t, std::string("AT+CMGL=\"") + status_names[(int)status] + "\"\r", str_out, "OK", "FAIL", 5000);
     if (ret != esp_modem::command_result::OK)
     {
         ESP_LOGE(TAG, "get sms failed, ret = %d , str = %s", (int)ret, str_out.c_str());
@@ -511,74 +519,40 @@ esp_modem::command_result get_unread_sms_list_lib(esp_modem::CommandableIf *t, s
         ESP_LOGE(TAG, "get sms failed not find OK, ret = %d , strout=%s", (int)ret, str_out.c_str());
         return esp_modem::command_result::FAIL;
     }
-    //ESP_LOGI(TAG, "get sms  strout=%s", str_out.c_str());
-
-    sms_list.clear();
-    std::stringstream ss(str_out);
-    std::string line;
-
-    while (std::getline(ss, line))
+    const size_t count = parse_sms_list(str_out, cb);
+    if (count > 0)
     {
-        if (line.rfind("+CMGL: ", 0) == 0)
-        {
-            sms_t current_sms;
-            std::string header = line;
-            // Try to get message content from the next line
-            if (std::getline(ss, line))
-            {
-                current_sms.content = line;
-                // Trim trailing \r if present
-                if (!current_sms.content.empty() && current_sms.content.back() == '\r')
-                {
-                    current_sms.content.pop_back();
-                }
-            }
-
-            // Parse header: +CMGL: <index>,<stat>,<oa>,[<alpha>],<scts>
-            std::stringstream header_ss(header.substr(7)); // Skip "+CMGL: "
-            std::string segment;
-
-            // 1. Index
-            if (!std::getline(header_ss, segment, ','))
-                continue;
-            current_sms.index = std::stoi(segment);
-
-            // 2. Status
-            if (!std::getline(header_ss, segment, ','))
-                continue;
-            current_sms.status = segment;
-
-            // 3. Sender
-            if (!std::getline(header_ss, segment, ','))
-                continue;
-            current_sms.sender = segment;
-
-            // 4. Alpha (skip)
-            if (!std::getline(header_ss, segment, ','))
-                continue;
-
-            // 5. Timestamp
-            if (!std::getline(header_ss, segment))
-                continue;
-            current_sms.timestamp = segment;
-            // Remove quotes from strings
-            current_sms.status.erase(std::remove(current_sms.status.begin(), current_sms.status.end(), '"'), current_sms.status.end());
-            current_sms.sender.erase(std::remove(current_sms.sender.begin(), current_sms.sender.end(), '"'), current_sms.sender.end());
-            current_sms.timestamp.erase(std::remove(current_sms.timestamp.begin(), current_sms.timestamp.end(), '"'), current_sms.timestamp.end());
-            sms_list.push_back(current_sms);
-        }
-    }
-    if (sms_list.size() > 0)
-    {
-        ESP_LOGI(TAG, "got %d unread sms ", (int)sms_list.size());
+        ESP_LOGI(TAG, "got %d sms ", (int)count);
     }
     else
     {
-        ESP_LOGI(TAG, "no unread sms found");
+        ESP_LOGI(TAG, "no sms found");
     }
     return esp_modem::command_result::OK;
 }
 
+/*! @copydoc SIM7670_gnss::list_sms */
+esp_modem::command_result SIM7670_gnss::list_sms(sms_list_status_t status, const std::function<bool(const sms_view_t &)> &cb)
+{
+    return list_sms_lib(dte.get(), status, cb);
+}
+
+/*! @copydoc DCE_gnss::list_sms */
+esp_modem::command_result DCE_gnss::list_sms(sms_list_status_t status, const std::function<bool(const sms_view_t &)> &cb)
+{
+    return device->list_sms(status, cb);
+}
+
+esp_modem::command_result get_unread_sms_list_lib(esp_modem::CommandableIf *t, std::list<sms_t> &sms_list)
+{
+    sms_list.clear();
+    return list_sms_lib(t, sms_list_status_t::UNREAD, [&sms_list](const sms_view_t &sms)
+                        {
+                            sms_list.push_back({sms.index, std::string(sms.status), std::string(sms.sender),
+                                                std::string(sms.timestamp), std::string(sms.content)});
+                            return true; });
+}
+
 /*! @copydoc SIM7670_gnss::get_unread_sms_list */
 esp_modem::command_result SIM7670_gnss::get_unread_sms_list(std::list<sms_t> &sms_list)
 {
@@ -614,6 +588,29 @@ esp_modem::command_result DCE_gnss::delete_sms(int index)
     return device->delete_sms(index);
 }
 
+esp_modem::command_result delete_all_sms_lib(esp_modem::CommandableIf *t, sms_delete_flag_t flag)
+{
+    // bulk deletes walk the whole storage, give the SIM more time than a single delete
+    auto ret = esp_modem::dce_commands::generic_command(t, "AT+CMGD=1," + std::to_string((int)flag) + "\r", "OK", "ERROR", 25000);
+    if (ret != esp_modem::command_result::OK)
+    {
+        ESP_LOGE(TAG, "bulk delete sms failed, flag = %d, ret = %d", (int)flag, (int)ret);
+    }
+    return ret;
+}
+
+/*! @copydoc SIM7670_gnss::delete_all_sms */
+esp_modem::command_result SIM7670_gnss::delete_all_sms(sms_delete_flag_t flag)
+{
+    return delete_all_sms_lib(dte.get(), flag);
+}
+
+/*! @copydoc DCE_gnss::delete_all_sms */
+esp_modem::command_result DCE_gnss::delete_all_sms(sms_delete_flag_t flag)
+{
+    return device->delete_all_sms(flag);
+}
+
 esp_modem::command_result set_auto_answer_lib(esp_modem::CommandableIf *t, int rings)
 {
     return esp_modem::dce_commands::generic_command(t, "ATS0=" + std::to_string(rings) + "\r", "OK", "ERROR", 1000);
@@ -818,4 +815,355 @@ esp_modem::command_result SIM7670_gnss::set_ring_indicator_mode(ring_indicator_m
 esp_modem::command_result DCE_gnss::set_ring_indicator_mode(ring_indicator_mode_t mode)
 {
     return device->set_ring_indicator_mode(mode);
-}
\ No newline at end of file
+}
+
+esp_modem::command_result set_gnss_start_mode_lib(esp_modem::CommandableIf *t, gnss_start_mode_t mode)
+{
+    switch (mode)
+    {
+    case gnss_start_mode_t::HOT:
+        return esp_modem::dce_commands::generic_command(t, "AT+CGPSHOT\r", "OK", "ERROR", 2000);
+    case gnss_start_mode_t::WARM:
+        return esp_modem::dce_commands::generic_command(t, "AT+CGPSWARM\r", "OK", "ERROR", 2000);
+    default:
+        return esp_modem::dce_commands::generic_command(t, "AT+CGPSCOLD\r", "OK", "ERROR", 2000);
+    }
+}
+
+/*! @copydoc SIM7670_gnss::set_gnss_start_mode */
+esp_modem::command_result SIM7670_gnss::set_gnss_start_mode(gnss_start_mode_t mode)
+{
+    return set_gnss_start_mode_lib(dte.get(), mode);
+}
+
+/*! @copydoc DCE_gnss::set_gnss_start_mode */
+esp_modem::command_result DCE_gnss::set_gnss_start_mode(gnss_start_mode_t mode)
+{
+    return device->set_gnss_start_mode(mode);
+}
+
+esp_modem::command_result enable_gnss_xtra_lib(esp_modem::CommandableIf *t, bool enable)
+{
+    int mode = enable ? 1 : 0;
+    auto ret = esp_modem::dce_commands::generic_command(t, "AT+CGPSXE=" + std::to_string(mode) + "\r", "OK", "ERROR", 1000);
+    if (ret != esp_modem::command_result::OK)
+    {
+        ESP_LOGW(TAG, "XTRA not available, ret = %d", (int)ret);
+        return ret;
+    }
+    return esp_modem::dce_commands::generic_command(t, "AT+CGPSXDAUTO=" + std::to_string(mode) + "\r", "OK", "ERROR", 1000);
+}
+
+/*! @copydoc SIM7670_gnss::enable_gnss_xtra */
+esp_modem::command_result SIM7670_gnss::enable_gnss_xtra(bool enable)
+{
+    return enable_gnss_xtra_lib(dte.get(), enable);
+}
+
+/*! @copydoc DCE_gnss::enable_gnss_xtra */
+esp_modem::command_result DCE_gnss::enable_gnss_xtra(bool enable)
+{
+    return device->enable_gnss_xtra(enable);
+}
+
+/**
+ * @brief Longest command line sent by `send_batch`, well below the modem's input buffer.
+ */
+static constexpr size_t AT_BATCH_MAX_LINE = 256;
+
+esp_modem::command_result send_batch_lib(esp_modem::CommandableIf *t, const std::vector<std::string> &commands,
+                                         std::vector<esp_modem::command_result> &results, uint32_t timeout_ms, size_t max_per_line)
+{
+    auto overall = esp_modem::command_result::OK;
+    results.assign(commands.size(), esp_modem::command_result::FAIL);
+    size_t i = 0;
+    while (i < commands.size())
+    {
+        std::string line = "AT" + commands[i];
+        size_t n = 1;
+        while (i + n < commands.size() && n < max_per_line && line.size() + commands[i + n].size() + 2 <= AT_BATCH_MAX_LINE)
+        {
+            line += ';';
+            line += commands[i + n];
+            n++;
+        }
+        auto ret = esp_modem::dce_commands::generic_command(t, line + "\r", "OK", "ERROR", timeout_ms);
+        if (ret == esp_modem::command_result::OK)
+        {
+            std::fill(results.begin() + i, results.begin() + i + n, ret);
+        }
+        else if (n == 1)
+        {
+            results[i] = ret;
+            overall = esp_modem::command_result::FAIL;
+        }
+        else
+        {
+            // the modem stops at the first failing command without saying which, so retry singly
+            ESP_LOGW(TAG, "batch \"%s\" failed, ret = %d, retrying one by one", line.c_str(), (int)ret);
+            for (size_t k = i; k < i + n; k++)
+            {
+                results[k] = esp_modem::dce_commands::generic_command(t, "AT" + commands[k] + "\r", "OK", "ERROR", timeout_ms);
+                if (results[k] != esp_modem::command_result::OK)
+                {
+                    overall = esp_modem::command_result::FAIL;
+                }
+            }
+        }
+        // keep the DTR sleep bookkeeping of enable_terminal_sleep_mode() valid for batched CSCLK
+        for (size_t k = i; k < i + n; k++)
+        {
+            if (results[k] == esp_modem::command_result::OK && commands[k].rfind("+CSCLK=", 0) == 0)
+            {
+                modem_is_in_sleep_mode = commands[k].compare(7, std::string::npos, "0") != 0;
+            }
+        }
+        i += n;
+    }
+    return overall;
+}
+
+/*! @copydoc SIM7670_gnss::send_batch */
+esp_modem::command_result SIM7670_gnss::send_batch(const std::vector<std::string> &commands, std::vector<esp_modem::command_result> &results,
+                                                   uint32_t timeout_ms, size_t max_per_line)
+{
+    return send_batch_lib(dte.get(), commands, results, timeout_ms, max_per_line);
+}
+
+/*! @copydoc DCE_gnss::send_batch */
+esp_modem::command_result DCE_gnss::send_batch(const std::vector<std::string> &commands, std::vector<esp_modem::command_result> &results,
+                                               uint32_t timeout_ms, size_t max_per_line)
+{
+    return device->send_batch(commands, results, timeout_ms, max_per_line);
+}
+
+/**
+ * @brief Sends a command that answers with a '>' prompt, then the data it asked for.
+ *
+ * Same flow as the SMS send in esp_modem: wait for the prompt, then write the raw data
+ * and wait for `pass` or `fail`.
+ */
+static esp_modem::command_result send_with_prompt(esp_modem::CommandableIf *t, const std::string &command, const std::string &data,
+                                                  const std::string &pass, const std::string &fail, uint32_t timeout_ms)
+{
+    auto ret = t->command(command, [&](uint8_t *buf, size_t len)
+    {
+        std::string_view response((char *)buf, len);
+        if (response.find('>') != std::string_view::npos)
+        {
+            return esp_modem::command_result::OK;
+        }
+        if (response.find("ERROR") != std::string_view::npos)
+        {
+            return esp_modem::command_result::FAIL;
+        }
+        return esp_modem::command_result::TIMEOUT;
+    }, 5000, '>');
+    if (ret != esp_modem::command_result::OK)
+    {
+        return ret;
+    }
+    return esp_modem::dce_commands::generic_command(t, data, pass, fail, timeout_ms);
+}
+
+esp_modem::command_result mqtt_upload_cert_lib(esp_modem::CommandableIf *t, const std::string &name, const std::string &pem)
+{
+    return send_with_prompt(t, "AT+CCERTDOWN=\"" + name + "\"," + std::to_string(pem.size()) + "\r", pem, "OK", "ERROR", 10000);
+}
+
+/*! @copydoc SIM7670_gnss::mqtt_upload_cert */
+esp_modem::command_result SIM7670_gnss::mqtt_upload_cert(const std::string &name, const std::string &pem)
+{
+    return mqtt_upload_cert_lib(dte.get(), name, pem);
+}
+
+/*! @copydoc DCE_gnss::mqtt_upload_cert */
+esp_modem::command_result DCE_gnss::mqtt_upload_cert(const std::string &name, const std::string &pem)
+{
+    return device->mqtt_upload_cert(name, pem);
+}
+
+esp_modem::command_result mqtt_open_lib(esp_modem::CommandableIf *t, const modem_mqtt_config_t &config, int *error)
+{
+    if (error != nullptr)
+    {
+        *error = -1;
+    }
+    // the service may still run from an earlier session, then AT+CMQTTSTART answers ERROR
+    esp_modem::dce_commands::generic_command(t, "AT+CMQTTSTART\r", "+CMQTTSTART: 0", "ERROR", 12000);
+    auto ret = esp_modem::dce_commands::generic_command(t, "AT+CMQTTACCQ=0,\"" + config.client_id + "\"," + (config.tls ? "1" : "0") + "\r", "OK", "ERROR", 1000);
+    if (ret != esp_modem::command_result::OK)
+    {
+        ESP_LOGW(TAG, "mqtt client 0 already acquired");
+    }
+    if (config.tls)
+    {
+        std::vector<std::string> ssl = {"+CSSLCFG=\"sslversion\",0,4", "+CSSLCFG=\"authmode\",0," + std::string(config.ca_file.empty() ? "0" : "1")};
+        if (!config.ca_file.empty())
+        {
+            ssl.push_back("+CSSLCFG=\"cacert\",0,\"" + config.ca_file + "\"");
+        }
+        ssl.push_back("+CSSLCFG=\"enableSNI\",0,1");
+        ssl.push_back("+CMQTTSSLCFG=0,0");
+        std::vector<esp_modem::command_result> results;
+        ret = send_batch_lib(t, ssl, results, 2000, 4);
+        if (ret != esp_modem::command_result::OK)
+        {
+            ESP_LOGE(TAG, "mqtt ssl config failed");
+            return ret;
+        }
+    }
+    std::string command = "AT+CMQTTCONNECT=0,\"tcp://" + config.host + ":" + std::to_string(config.port) + "\"," +
+                          std::to_string(config.keepalive_s) + "," + (config.clean_session ? "1" : "0");
+    if (!config.user.empty())
+    {
+        command += ",\"" + config.user + "\",\"" + config.password + "\"";
+    }
+    // the result comes as +CMQTTCONNECT: 0,<err> after the OK, the code tells a TLS failure from a refusal
+    int code = -1;
+    ret = t->command(command + "\r", [&](uint8_t *buf, size_t len)
+    {
+        std::string_view response((char *)buf, len);
+        const std::string_view tag = "+CMQTTCONNECT: 0,";
+        const size_t pos = response.find(tag);
+        if (pos == std::string_view::npos)
+        {
+            return response.find("ERROR") != std::string_view::npos ? esp_modem::command_result::FAIL : esp_modem::command_result::TIMEOUT;
+        }
+        const size_t end = response.find_first_of("\r\n", pos);
+        if (end == std::string_view::npos)
+        {
+            return esp_modem::command_result::TIMEOUT;
+        }
+        if (std::from_chars(response.data() + pos + tag.size(), response.data() + end, code).ec != std::errc())
+        {
+            return esp_modem::command_result::FAIL;
+        }
+        return code == 0 ? esp_modem::command_result::OK : esp_modem::command_result::FAIL;
+    }, 30000);
+    if (error != nullptr)
+    {
+        *error = code;
+    }
+    if (ret != esp_modem::command_result::OK)
+    {
+        ESP_LOGE(TAG, "mqtt connect to %s:%d failed, ret = %d, error %d", config.host.c_str(), config.port, (int)ret, code);
+    }
+    return ret;
+}
+
+/*! @copydoc SIM7670_gnss::mqtt_open */
+esp_modem::command_result SIM7670_gnss::mqtt_open(const modem_mqtt_config_t &config, int *error)
+{
+    return mqtt_open_lib(dte.get(), config, error);
+}
+
+/*! @copydoc DCE_gnss::mqtt_open */
+esp_modem::command_result DCE_gnss::mqtt_open(const modem_mqtt_config_t &config, int *error)
+{
+    return device->mqtt_open(config, error);
+}
+
+esp_modem::command_result mqtt_publish_lib(esp_modem::CommandableIf *t, const std::string &topic, const std::string &payload, int qos)
+{
+    auto ret = send_with_prompt(t, "AT+CMQTTTOPIC=0," + std::to_string(topic.size()) + "\r", topic, "OK", "ERROR", 2000);
+    if (ret != esp_modem::command_result::OK)
+    {
+        return ret;
+    }
+    ret = send_with_prompt(t, "AT+CMQTTPAYLOAD=0," + std::to_string(payload.size()) + "\r", payload, "OK", "ERROR", 5000);
+    if (ret != esp_modem::command_result::OK)
+    {
+        return ret;
+    }
+    ret = esp_modem::dce_commands::generic_command(t, "AT+CMQTTPUB=0," + std::to_string(qos) + ",60\r", "+CMQTTPUB: 0,0", "+CMQTTPUB: 0,", 65000);
+    if (ret != esp_modem::command_result::OK)
+    {
+        ESP_LOGE(TAG, "mqtt publish to %s failed, ret = %d", topic.c_str(), (int)ret);
+    }
+    return ret;
+}
+
+/*! @copydoc SIM7670_gnss::mqtt_publish */
+esp_modem::command_result SIM7670_gnss::mqtt_publish(const std::string &topic, const std::string &payload, int qos)
+{
+    return mqtt_publish_lib(dte.get(), topic, payload, qos);
+}
+
+/*! @copydoc DCE_gnss::mqtt_publish */
+esp_modem::command_result DCE_gnss::mqtt_publish(const std::string &topic, const std::string &payload, int qos)
+{
+    return device->mqtt_publish(topic, payload, qos);
+}
+
+esp_modem::command_result mqtt_subscribe_lib(esp_modem::CommandableIf *t, const std::string &topic, int qos)
+{
+    auto ret = send_with_prompt(t, "AT+CMQTTSUB=0," + std::to_string(topic.size()) + "," + std::to_string(qos) + "\r", topic,
+                                "+CMQTTSUB: 0,0", "+CMQTTSUB: 0,", 65000);
+    if (ret != esp_modem::command_result::OK)
+    {
+        ESP_LOGE(TAG, "mqtt subscribe to %s failed, ret = %d", topic.c_str(), (int)ret);
+    }
+    return ret;
+}
+
+/*! @copydoc SIM7670_gnss::mqtt_subscribe */
+esp_modem::command_result SIM7670_gnss::mqtt_subscribe(const std::string &topic, int qos)
+{
+    return mqtt_subscribe_lib(dte.get(), topic, qos);
+}
+
+/*! @copydoc DCE_gnss::mqtt_subscribe */
+esp_modem::command_result DCE_gnss::mqtt_subscribe(const std::string &topic, int qos)
+{
+    return device->mqtt_subscribe(topic, qos);
+}
+
+/*! @copydoc SIM7670_gnss::mqtt_set_receive_cb */
+esp_modem::command_result SIM7670_gnss::mqtt_set_receive_cb(mqtt_rx_parser::message_cb cb)
+{
+#ifdef CONFIG_ESP_MODEM_URC_HANDLER
+    if (!cb)
+    {
+        dte->set_urc_cb(nullptr);
+        return esp_modem::command_result::OK;
+    }
+    // the handler sees the whole buffer of the pending command, the parser skips what it already read
+    auto parser = std::make_shared<mqtt_rx_parser>(std::move(cb));
+    dte->set_urc_cb([parser](uint8_t *data, size_t len)
+    {
+        parser->feed_buffer(data, len);
+        return esp_modem::command_result::TIMEOUT; // never completes the pending command
+    });
+    return esp_modem::command_result::OK;
+#else
+    ESP_LOGE(TAG, "mqtt receive needs CONFIG_ESP_MODEM_URC_HANDLER");
+    return esp_modem::command_result::FAIL;
+#endif
+}
+
+/*! @copydoc DCE_gnss::mqtt_set_receive_cb */
+esp_modem::command_result DCE_gnss::mqtt_set_receive_cb(mqtt_rx_parser::message_cb cb)
+{
+    return device->mqtt_set_receive_cb(std::move(cb));
+}
+
+esp_modem::command_result mqtt_close_lib(esp_modem::CommandableIf *t)
+{
+    auto ret = esp_modem::dce_commands::generic_command(t, "AT+CMQTTDISC=0,60\r", "+CMQTTDISC: 0,0", "+CMQTTDISC: 0,", 65000);
+    esp_modem::dce_commands::generic_command(t, "AT+CMQTTREL=0\r", "OK", "ERROR", 1000);
+    esp_modem::dce_commands::generic_command(t, "AT+CMQTTSTOP\r", "+CMQTTSTOP: 0", "ERROR", 12000);
+    return ret;
+}
+
+/*! @copydoc SIM7670_gnss::mqtt_close */
+esp_modem::command_result SIM7670_gnss::mqtt_close()
+{
+    return mqtt_close_lib(dte.get());
+}
+
+/*! @copydoc DCE_gnss::mqtt_close */
+esp_modem::command_result DCE_gnss::mqtt_close()
+{
+    return device->mqtt_close();
+}
@@ -14,8 +14,13 @@
 #include "cxx_include/esp_modem_dce_factory.hpp"
 #include "cxx_include/esp_modem_dce_module.hpp"
 #include "sim76xx_gps.h"
+#include "SIM7670_sms.hpp"
+#include "SIM7670_mqtt_rx.hpp"
 #include <time.h>
 #include <list>
+#include <vector>
+#include <string_view>
+#include <functional>
 
 /**
  * @brief A custom SIM7670 class with added GNSS capabilities.
@@ -36,6 +41,25 @@ struct sms_t {
     std::string content;    /*!< The message body */
 };
 
+/**
+ * @brief Message status filter for AT+CMGL.
+ */
+enum class sms_list_status_t {
+    UNREAD = 0, /*!< "REC UNREAD". Listing marks the messages as read. */
+    READ = 1,   /*!< "REC READ" */
+    ALL = 2     /*!< "ALL" */
+};
+
+/**
+ * @brief Bulk delete forms of AT+CMGD (the <delflag> parameter).
+ */
+enum class sms_delete_flag_t {
+    READ = 1,             /*!< Delete all read messages. */
+    READ_SENT = 2,        /*!< Delete all read and sent mobile originated messages. */
+    READ_SENT_UNSENT = 3, /*!< Delete all read, sent and unsent mobile originated messages. */
+    ALL = 4               /*!< Delete every message in storage, including unread ones. */
+};
+
 /**
  * @brief Modem functionality levels, corresponding to the AT+CFUN command.
  */
@@ -52,6 +76,30 @@ enum class ring_indicator_mode_t {
     SMS_CALL_URC = 1   /*!< RI pin will be asserted for calls, SMS, and other Unsolicited Result Codes (URCs). This is the most versatile option. */
 };
 
+/**
+ * @brief GNSS engine start modes, corresponding to the AT+CGPSHOT/AT+CGPSWARM/AT+CGPSCOLD commands.
+ */
+enum class gnss_start_mode_t {
+    HOT = 0,  /*!< Hot start (AT+CGPSHOT). Reuses stored time, position and valid ephemeris/XTRA data. */
+    WARM = 1, /*!< Warm start (AT+CGPSWARM). Keeps almanac and last position, discards ephemeris. */
+    COLD = 2  /*!< Cold start (AT+CGPSCOLD). Discards all assistance data. */
+};
+
+/**
+ * @brief Connection parameters for the modem's internal MQTT client (AT+CMQTT*).
+ */
+struct modem_mqtt_config_t {
+    std::string host;           /*!< Broker host name, without scheme */
+    int port = 8883;            /*!< Broker port */
+    std::string client_id;      /*!< MQTT client id */
+    std::string user;           /*!< User name, empty for none */
+    std::string password;       /*!< Password, empty for none */
+    bool tls = true;            /*!< Use the modem SSL context 0 */
+    std::string ca_file;        /*!< CA file stored on the modem (AT+CCERTDOWN), empty to skip server verification */
+    int keepalive_s = 60;       /*!< Keep alive interval */
+    bool clean_session = true;  /*!< Clean session flag */
+};
+
 class SIM7670_gnss: public esp_modem::SIM7600 {
 private:
     int dtr_pin = -1;
@@ -107,6 +155,23 @@ public:
      */
     esp_modem::command_result delete_sms(int index);
 
+    /**
+     * @brief Lists SMS messages with a single AT+CMGL and visits them without copying.
+     *
+     * @param status Which messages to list.
+     * @param cb Called for each message while the response buffer is alive, return false to stop.
+     * @return esp_modem::command_result::OK on success.
+     */
+    esp_modem::command_result list_sms(sms_list_status_t status, const std::function<bool(const sms_view_t &)> &cb);
+
+    /**
+     * @brief Deletes a group of messages with a single AT+CMGD=1,<delflag>.
+     *
+     * @param flag Which messages to delete.
+     * @return esp_modem::command_result::OK on success.
+     */
+    esp_modem::command_result delete_all_sms(sms_delete_flag_t flag);
+
     /**
      * @brief Sets the modem to automatically answer incoming calls.
      *
@@ -179,6 +244,104 @@ public:
      * @return esp_modem::command_result::OK on success.
      */
     esp_modem::command_result set_ring_indicator_mode(ring_indicator_mode_t mode);
+
+    /**
+     * @brief Restarts the GNSS engine with the given start mode.
+     *
+     * Uses AT+CGPSHOT, AT+CGPSWARM or AT+CGPSCOLD. The GNSS engine must be powered.
+     * @param mode The start mode, HOT when the cached fix and assistance data are still fresh.
+     * @return esp_modem::command_result::OK on success.
+     */
+    esp_modem::command_result set_gnss_start_mode(gnss_start_mode_t mode);
+
+    /**
+     * @brief Enables or disables XTRA (predicted ephemeris) assistance.
+     *
+     * Uses AT+CGPSXE to enable XTRA and AT+CGPSXDAUTO to let the modem refresh the
+     * XTRA file by itself whenever a data connection is available.
+     * @param enable True to enable XTRA assistance.
+     * @return esp_modem::command_result::OK on success.
+     */
+    esp_modem::command_result enable_gnss_xtra(bool enable);
+
+    /**
+     * @brief Sends several set commands joined on as few command lines as possible.
+     *
+     * Commands are given without the "AT" prefix (e.g. "+CSCLK=1", "S0=2") and are joined
+     * as "AT+A;+B;S0=2", so a whole group costs one round trip. Only commands answering a
+     * plain OK/ERROR may be batched. When a joined line fails, its commands are retried one
+     * by one so every command gets its own result.
+     * @param commands Commands to send, in order.
+     * @param[out] results Result of each command, same order as `commands`.
+     * @param timeout_ms Timeout for each command line.
+     * @param max_per_line Maximum number of commands joined on one line.
+     * @return esp_modem::command_result::OK if every command succeeded.
+     */
+    esp_modem::command_result send_batch(const std::vector<std::string> &commands, std::vector<esp_modem::command_result> &results,
+                                         uint32_t timeout_ms = 5000, size_t max_per_line = 4);
+
+    /**
+     * @brief Stores a certificate file on the modem file system.
+     *
+     * Uses AT+CCERTDOWN. The file can then be referenced as `ca_file` in `modem_mqtt_config_t`.
+     * @param name File name on the modem, e.g. "ca.pem".
+     * @param pem PEM contents.
+     * @return esp_modem::command_result::OK on success.
+     */
+    esp_modem::command_result mqtt_upload_cert(const std::string &name, const std::string &pem);
+
+    /**
+     * @brief Starts the modem MQTT service and connects client 0 to the broker.
+     *
+     * Runs AT+CMQTTSTART, AT+CMQTTACCQ, the SSL context setup (AT+CSSLCFG, AT+CMQTTSSLCFG)
+     * when `tls` is set, and AT+CMQTTCONNECT. The modem must be registered with a PDP
+     * context available; no PPP session is needed.
+     * @param config Broker and session parameters.
+     * @param error If set, receives the +CMQTTCONNECT error code, e.g. 32 for a failed TLS
+     *              handshake or 33 for a missing certificate, -1 if the modem reported none.
+     * @return esp_modem::command_result::OK once the broker accepted the connection.
+     */
+    esp_modem::command_result mqtt_open(const modem_mqtt_config_t &config, int *error = nullptr);
+
+    /**
+     * @brief Publishes a message through the modem MQTT client.
+     *
+     * Uses AT+CMQTTTOPIC and AT+CMQTTPAYLOAD to load the message, then AT+CMQTTPUB.
+     * @param topic Topic to publish to.
+     * @param payload Message payload, at most 10240 bytes.
+     * @param qos QoS level 0..2.
+     * @return esp_modem::command_result::OK once the modem reports the publish done (PUBACK for QoS 1).
+     */
+    esp_modem::command_result mqtt_publish(const std::string &topic, const std::string &payload, int qos);
+
+    /**
+     * @brief Subscribes client 0 to a topic.
+     *
+     * Uses AT+CMQTTSUB. Messages arrive as +CMQTTRX* URCs, see `mqtt_set_receive_cb`.
+     * @param topic Topic filter, wildcards allowed.
+     * @param qos QoS level 0..2.
+     * @return esp_modem::command_result::OK once the broker acknowledged the subscription.
+     */
+    esp_modem::command_result mqtt_subscribe(const std::string &topic, int qos);
+
+    /**
+     * @brief Installs the receiver of messages for the subscribed topics.
+     *
+     * The +CMQTTRX* URCs are reassembled by `mqtt_rx_parser` and passed to `cb` from the
+     * DTE task, so `cb` must not send AT commands itself. Needs CONFIG_ESP_MODEM_URC_HANDLER.
+     * @param cb Receives topic and payload of each message, nullptr removes the receiver.
+     * @return esp_modem::command_result::OK, or FAIL if the URC handler is not enabled.
+     */
+    esp_modem::command_result mqtt_set_receive_cb(mqtt_rx_parser::message_cb cb);
+
+    /**
+     * @brief Disconnects client 0 and stops the modem MQTT service.
+     *
+     * Uses AT+CMQTTDISC, AT+CMQTTREL and AT+CMQTTSTOP. Errors of the single steps are ignored
+     * so the service is always left stopped.
+     * @return esp_modem::command_result::OK if the disconnect was clean.
+     */
+    esp_modem::command_result mqtt_close();
 };
 
 /**
@@ -247,6 +410,23 @@ public:
      */
     esp_modem::command_result delete_sms(int index);
 
+    /**
+     * @brief Forwards the `list_sms` command to the device.
+     *
+     * @param status Which messages to list.
+     * @param cb Called for each message, return false to stop.
+     * @return esp_modem::command_result::OK on success.
+     */
+    esp_modem::command_result list_sms(sms_list_status_t status, const std::function<bool(const sms_view_t &)> &cb);
+
+    /**
+     * @brief Forwards the `delete_all_sms` command to the device.
+     *
+     * @param flag Which messages to delete.
+     * @return esp_modem::command_result::OK on success.
+     */
+    esp_modem::command_result delete_all_sms(sms_delete_flag_t flag);
+
     /**
      * @brief Forwards the `set_auto_answer` command to the device.
      *
@@ -308,6 +488,64 @@ public:
      * @return esp_modem::command_result::OK on success.
      */
     esp_modem::command_result set_ring_indicator_mode(ring_indicator_mode_t mode);
+
+    /**
+     * @brief Forwards the `set_gnss_start_mode` command to the device.
+     *
+     * @param mode The GNSS start mode.
+     * @return esp_modem::command_result::OK on success.
+     */
+    esp_modem::command_result set_gnss_start_mode(gnss_start_mode_t mode);
+
+    /**
+     * @brief Forwards the `enable_gnss_xtra` command to the device.
+     *
+     * @param enable True to enable XTRA assistance.
+     * @return esp_modem::command_result::OK on success.
+     */
+    esp_modem::command_result enable_gnss_xtra(bool enable);
+
+    /**
+     * @brief Forwards the `send_batch` command to the device.
+     *
+     * @param commands Commands to send without the "AT" prefix, in order.
+     * @param[out] results Result of each command.
+     * @param timeout_ms Timeout for each command line.
+     * @param max_per_line Maximum number of commands joined on one line.
+     * @return esp_modem::command_result::OK if every command succeeded.
+     */
+    esp_modem::command_result send_batch(const std::vector<std::string> &commands, std::vector<esp_modem::command_result> &results,
+                                         uint32_t timeout_ms = 5000, size_t max_per_line = 4);
+
+    /**
+     * @brief Forwards the `mqtt_upload_cert` command to the device.
+     */
+    esp_modem::command_result mqtt_upload_cert(const std::string &name, const std::string &pem);
+
+    /**
+     * @brief Forwards the `mqtt_open` command to the device.
+     */
+    esp_modem::command_result mqtt_open(const modem_mqtt_config_t &config, int *error = nullptr);
+
+    /**
+     * @brief Forwards the `mqtt_publish` command to the device.
+     */
+    esp_modem::command_result mqtt_publish(const std::string &topic, const std::string &payload, int qos);
+
+    /**
+     * @brief Forwards the `mqtt_subscribe` command to the device.
+     */
+    esp_modem::command_result mqtt_subscribe(const std::string &topic, int qos);
+
+    /**
+     * @brief Forwards the `mqtt_set_receive_cb` command to the device.
+     */
+    esp_modem::command_result mqtt_set_receive_cb(mqtt_rx_parser::message_cb cb);
+
+    /**
+     * @brief Forwards the `mqtt_close` command to the device.
+     */
+    esp_modem::command_result mqtt_close();
 };
 
 
@@ -0,0 +1,146 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file SIM7670_mqtt_rx.cpp
+ * @brief +CMQTTRX* URC parser of the SIM7670 driver.
+ */
+#include <charconv>
+#include <algorithm>
+#include "SIM7670_mqtt_rx.hpp"
+
+static constexpr size_t MAX_LINE = 128;  // URC lines are short, longer ones are noise
+static constexpr size_t MAX_TOPIC = 256; // longer topics are not ours
+
+/**
+ * @brief Reads the last comma separated number of a URC line, e.g. 12 of "+CMQTTRXTOPIC: 0,12".
+ */
+static bool last_number(std::string_view args, size_t &value)
+{
+    const size_t comma = args.rfind(',');
+    if (comma != std::string_view::npos)
+    {
+        args.remove_prefix(comma + 1);
+    }
+    while (!args.empty() && args.front() == ' ')
+    {
+        args.remove_prefix(1);
+    }
+    return !args.empty() && std::from_chars(args.data(), args.data() + args.size(), value).ec == std::errc();
+}
+
+mqtt_rx_parser::mqtt_rx_parser(message_cb cb, size_t max_payload)
+    : cb(std::move(cb)), max_payload(max_payload)
+{
+}
+
+void mqtt_rx_parser::reset_message()
+{
+    in_message = false;
+    overflow = false;
+    topic.clear();
+    payload.clear();
+}
+
+void mqtt_rx_parser::on_line(std::string_view l)
+{
+    constexpr std::string_view start_tag = "+CMQTTRXSTART:";
+    constexpr std::string_view topic_tag = "+CMQTTRXTOPIC:";
+    constexpr std::string_view payload_tag = "+CMQTTRXPAYLOAD:";
+    constexpr std::string_view end_tag = "+CMQTTRXEND:";
+    size_t n = 0;
+    if (l.rfind(start_tag, 0) == 0)
+    {
+        if (in_message)
+        {
+            drops++; // the previous one never ended
+        }
+        reset_message();
+        in_message = true;
+    }
+    else if (!in_message)
+    {
+        return;
+    }
+    else if (l.rfind(topic_tag, 0) == 0 && last_number(l.substr(topic_tag.size()), n))
+    {
+        state = state_t::TOPIC;
+        raw_left = n;
+        overflow |= topic.size() + n > MAX_TOPIC;
+    }
+    else if (l.rfind(payload_tag, 0) == 0 && last_number(l.substr(payload_tag.size()), n))
+    {
+        state = state_t::PAYLOAD;
+        raw_left = n;
+        overflow |= payload.size() + n > max_payload;
+    }
+    else if (l.rfind(end_tag, 0) == 0)
+    {
+        if (overflow || topic.empty())
+        {
+            drops++;
+        }
+        else
+        {
+            count++;
+            cb(topic, payload);
+        }
+        reset_message();
+    }
+}
+
+void mqtt_rx_parser::feed(const uint8_t *data, size_t len)
+{
+    const char *p = reinterpret_cast<const char *>(data);
+    const char *end = p + len;
+    while (p < end)
+    {
+        if (state != state_t::LINE)
+        {
+            // the raw data starts right after the line break of its header line
+            const size_t take = std::min(raw_left, (size_t)(end - p));
+            if (!overflow)
+            {
+                (state == state_t::TOPIC ? topic : payload).append(p, take);
+            }
+            p += take;
+            raw_left -= take;
+            if (raw_left == 0)
+            {
+                state = state_t::LINE;
+            }
+            continue;
+        }
+        const char c = *p++;
+        if (c == '\n')
+        {
+            if (!line.empty() && line.back() == '\r')
+            {
+                line.pop_back();
+            }
+            if (!line.empty())
+            {
+                on_line(line);
+            }
+            line.clear();
+        }
+        else if (line.size() < MAX_LINE)
+        {
+            line.push_back(c);
+        }
+    }
+}
+
+void mqtt_rx_parser::feed_buffer(const uint8_t *data, size_t len)
+{
+    const std::string_view now(reinterpret_cast<const char *>(data), len);
+    size_t from = 0;
+    if (!seen.empty() && len >= seen.size() && now.compare(0, seen.size(), seen) == 0)
+    {
+        from = seen.size();
+    }
+    seen.assign(now);
+    feed(data + from, len - from);
+}
@@ -0,0 +1,90 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file SIM7670_mqtt_rx.hpp
+ * @brief +CMQTTRX* URC parser of the SIM7670 driver.
+ *
+ * Plain C++ with no esp_modem or IDF dependency, test/host builds it.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <functional>
+
+/**
+ * @brief Reassembles messages the modem MQTT client received from the URC stream.
+ *
+ * The modem reports a message as
+ * @code
+ * +CMQTTRXSTART: <client>,<topic_len>,<payload_len>
+ * +CMQTTRXTOPIC: <client>,<n>
+ * <n bytes of topic>
+ * +CMQTTRXPAYLOAD: <client>,<n>
+ * <n bytes of payload>          (repeated for long payloads)
+ * +CMQTTRXEND: <client>
+ * @endcode
+ * Topic and payload are raw bytes and may contain line breaks, so they are read by
+ * length, not by line. Lines that are not part of a message are ignored.
+ */
+class mqtt_rx_parser {
+public:
+    /**
+     * @brief Called once per complete message; the views are only valid inside the call.
+     */
+    using message_cb = std::function<void(std::string_view topic, std::string_view payload)>;
+
+    /**
+     * @param cb Receives every complete message.
+     * @param max_payload Messages with a longer payload are dropped.
+     */
+    explicit mqtt_rx_parser(message_cb cb, size_t max_payload = 4096);
+
+    /**
+     * @brief Feeds the next bytes of the stream, in any split.
+     */
+    void feed(const uint8_t *data, size_t len);
+
+    /**
+     * @brief Feeds a receive buffer that grows while a command is pending.
+     *
+     * The esp_modem URC handler gets the whole buffer received so far on every read,
+     * not only the new bytes. Only the part past the previously seen prefix is fed;
+     * a buffer that does not start with that prefix is a new one and is fed whole.
+     */
+    void feed_buffer(const uint8_t *data, size_t len);
+
+    /**
+     * @brief Number of messages passed to the callback.
+     */
+    size_t delivered() const { return count; }
+
+    /**
+     * @brief Number of messages dropped as malformed or too long.
+     */
+    size_t dropped() const { return drops; }
+
+private:
+    enum class state_t { LINE, TOPIC, PAYLOAD };
+
+    void on_line(std::string_view line);
+    void reset_message();
+
+    message_cb cb;
+    size_t max_payload;
+    state_t state = state_t::LINE;
+    size_t raw_left = 0;     /*!< bytes of topic or payload still to read */
+    bool in_message = false; /*!< between +CMQTTRXSTART and +CMQTTRXEND */
+    bool overflow = false;   /*!< the current message exceeds max_payload */
+    std::string line;
+    std::string topic;
+    std::string payload;
+    std::string seen;        /*!< feed_buffer(): the buffer as of the previous call */
+    size_t count = 0;
+    size_t drops = 0;
+};
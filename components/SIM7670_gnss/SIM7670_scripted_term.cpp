@@ -0,0 +1,260 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file SIM7670_scripted_term.cpp
+ * @brief Scripted modem terminal for host (linux target) builds of the SIM7670 driver.
+ */
+#include <algorithm>
+#include <cstring>
+#include "esp_log.h"
+#include "esp_modem_config.h"
+#include "SIM7670_scripted_term.hpp"
+
+constexpr auto const TAG = "SIM7670_script";
+
+static const char *outcome_name(SIM7670_scripted_term::outcome_t outcome)
+{
+    switch (outcome) {
+    case SIM7670_scripted_term::outcome_t::REPLIED:
+        return "ok";
+    case SIM7670_scripted_term::outcome_t::ERROR:
+        return "error";
+    case SIM7670_scripted_term::outcome_t::TIMEOUT:
+        return "timeout";
+    default:
+        return "unexpected";
+    }
+}
+
+static bool command_matches(const std::string &expected, const std::string &command)
+{
+    if (!expected.empty() && expected.back() == '*') {
+        return command.compare(0, expected.size() - 1, expected, 0, expected.size() - 1) == 0;
+    }
+    return expected == command;
+}
+
+SIM7670_scripted_term::SIM7670_scripted_term()
+{
+    worker = std::thread([this] { run(); });
+}
+
+SIM7670_scripted_term::~SIM7670_scripted_term()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        exiting = true;
+    }
+    wake.notify_all();
+    worker.join();
+}
+
+SIM7670_scripted_term &SIM7670_scripted_term::expect(const std::string &command, const std::string &reply, uint32_t latency_ms)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    script.push_back({command, reply, latency_ms, outcome_t::REPLIED, {}});
+    return *this;
+}
+
+SIM7670_scripted_term &SIM7670_scripted_term::expect_error(const std::string &command, uint32_t latency_ms)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    script.push_back({command, "ERROR", latency_ms, outcome_t::ERROR, {}});
+    return *this;
+}
+
+SIM7670_scripted_term &SIM7670_scripted_term::expect_timeout(const std::string &command)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    script.push_back({command, "", 0, outcome_t::TIMEOUT, {}});
+    return *this;
+}
+
+SIM7670_scripted_term &SIM7670_scripted_term::urc(const std::string &text, uint32_t after_ms)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (script.empty()) {
+        startup_urcs.emplace_back(text, after_ms);
+    } else {
+        script.back().urcs.emplace_back(text, after_ms);
+    }
+    return *this;
+}
+
+void SIM7670_scripted_term::set_default_latency(uint32_t ms)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    default_latency_ms = ms;
+}
+
+void SIM7670_scripted_term::set_strict(bool enable)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    strict = enable;
+}
+
+bool SIM7670_scripted_term::finished()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return script.empty();
+}
+
+std::vector<SIM7670_scripted_term::trace_t> SIM7670_scripted_term::trace()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return records;
+}
+
+uint32_t SIM7670_scripted_term::elapsed_ms()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (!timing_started) {
+        return 0;
+    }
+    return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(last_reply - first_command).count();
+}
+
+void SIM7670_scripted_term::report()
+{
+    const auto records_copy = trace();
+    const uint32_t total = elapsed_ms();
+    size_t steps_left;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        steps_left = script.size();
+    }
+    uint32_t unexpected = 0, timeouts = 0;
+    for (const auto &r : records_copy) {
+        ESP_LOGI(TAG, "%6u ms  %-10s %s", (unsigned)r.sent_ms, outcome_name(r.outcome), r.command.c_str());
+        unexpected += r.outcome == outcome_t::UNEXPECTED;
+        timeouts += r.outcome == outcome_t::TIMEOUT;
+    }
+    ESP_LOGI(TAG, "%u round trips, %u timeouts, %u unexpected, %u ms wall time, %u steps left",
+             (unsigned)records_copy.size(), (unsigned)timeouts, (unsigned)unexpected, (unsigned)total, (unsigned)steps_left);
+}
+
+void SIM7670_scripted_term::reset_trace()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    records.clear();
+    timing_started = false;
+}
+
+uint32_t SIM7670_scripted_term::now_ms()
+{
+    if (!timing_started) {
+        timing_started = true;
+        first_command = std::chrono::steady_clock::now();
+        last_reply = first_command;
+    }
+    return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - first_command).count();
+}
+
+// called with `lock` held
+void SIM7670_scripted_term::schedule(std::string bytes, uint32_t delay_ms)
+{
+    deliveries.push_back({std::chrono::steady_clock::now() + std::chrono::milliseconds(delay_ms), std::move(bytes)});
+    std::stable_sort(deliveries.begin(), deliveries.end(), [](const delivery_t &a, const delivery_t &b) {
+        return a.at < b.at;
+    });
+    wake.notify_all();
+}
+
+int SIM7670_scripted_term::write(uint8_t *data, size_t len)
+{
+    std::string command(reinterpret_cast<const char *>(data), len);
+    while (!command.empty() && (command.back() == '\r' || command.back() == '\n')) {
+        command.pop_back();
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    trace_t record = {command, "", now_ms(), 0, outcome_t::UNEXPECTED};
+    if (!script.empty() && command_matches(script.front().command, command)) {
+        step_t step = std::move(script.front());
+        script.pop_front();
+        record.outcome = step.outcome;
+        record.latency_ms = step.latency_ms ? step.latency_ms : default_latency_ms;
+        if (step.outcome != outcome_t::TIMEOUT) {
+            record.reply = step.reply;
+            schedule("\r\n" + step.reply + "\r\n", record.latency_ms);
+        }
+        uint32_t urc_at = record.latency_ms;
+        for (auto &u : step.urcs) {
+            urc_at += u.second;
+            schedule("\r\n" + u.first + "\r\n", urc_at);
+        }
+    } else {
+        ESP_LOGW(TAG, "unexpected command \"%s\", expected \"%s\"", command.c_str(),
+                 script.empty() ? "<end of script>" : script.front().command.c_str());
+        if (!strict) {
+            record.reply = "OK";
+            record.latency_ms = default_latency_ms;
+            schedule("\r\nOK\r\n", default_latency_ms);
+        }
+    }
+    records.push_back(std::move(record));
+    return (int)len;
+}
+
+int SIM7670_scripted_term::read(uint8_t *data, size_t len)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    const size_t n = std::min(len, rx.size());
+    memcpy(data, rx.data(), n);
+    rx.erase(0, n);
+    return (int)n;
+}
+
+void SIM7670_scripted_term::start()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    running = true;
+    for (auto &u : startup_urcs) {
+        schedule("\r\n" + u.first + "\r\n", u.second);
+    }
+    startup_urcs.clear();
+}
+
+void SIM7670_scripted_term::stop()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    running = false;
+}
+
+// delivers scheduled bytes the way the UART terminal task does: buffer them, then signal the DTE
+void SIM7670_scripted_term::run()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    while (!exiting) {
+        if (deliveries.empty() || !running) {
+            wake.wait(guard);
+            continue;
+        }
+        if (wake.wait_until(guard, deliveries.front().at) == std::cv_status::no_timeout && deliveries.front().at > std::chrono::steady_clock::now()) {
+            continue; // new delivery scheduled or exiting, re-evaluate
+        }
+        if (exiting || deliveries.empty()) {
+            continue;
+        }
+        rx += deliveries.front().bytes;
+        deliveries.erase(deliveries.begin());
+        last_reply = std::chrono::steady_clock::now();
+        const size_t available = rx.size();
+        guard.unlock();
+        if (on_read) {
+            on_read(nullptr, available);
+        }
+        guard.lock();
+    }
+}
+
+std::shared_ptr<esp_modem::DTE> create_scripted_dte(SIM7670_scripted_term *&term)
+{
+    auto owned = std::make_unique<SIM7670_scripted_term>();
+    term = owned.get();
+    owned->start(); // like create_uart_terminal(), the DTE expects a running terminal
+    esp_modem_dte_config_t dte_config = ESP_MODEM_DTE_DEFAULT_CONFIG();
+    return std::make_shared<esp_modem::DTE>(&dte_config, std::move(owned));
+}
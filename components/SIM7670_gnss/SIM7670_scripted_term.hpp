@@ -0,0 +1,187 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file SIM7670_scripted_term.hpp
+ * @brief Scripted modem terminal for host (linux target) builds of the SIM7670 driver.
+ *
+ * The real `esp_modem::DTE` runs on top of this terminal, so `SIM7670_gnss`,
+ * `DCE_gnss` and every `*_lib` command behave exactly as on the board, including
+ * their own timeouts. Only the bytes on the wire are scripted.
+ */
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include "cxx_include/esp_modem_terminal.hpp"
+#include "cxx_include/esp_modem_dte.hpp"
+
+/**
+ * @brief A fake modem UART that answers AT commands from a script.
+ *
+ * Each step expects one command written by the DTE and schedules a reply after a
+ * configurable latency. A step can also swallow the command (the caller times out)
+ * or answer ERROR, and URCs can be queued after any step. Every command is recorded
+ * in a trace together with the wall time at which it was sent, so a sequence such as
+ * `init()` or `sleep()` can be replayed and timed.
+ *
+ * Example:
+ * @code
+ * SIM7670_scripted_term *term;
+ * auto dte = create_scripted_dte(term);
+ * term->expect("AT+CMGF=1")
+ *     .expect("AT+CMGL=\"REC UNREAD\"", "+CMGL: 1,\"REC UNREAD\",\"123\",\"\",\"25/12/05,10:00:00+08\"\r\nhi\r\n\r\nOK", 120)
+ *     .urc("+CMTI: \"SM\",2", 50);
+ * esp_modem_dce_config_t dce_config = ESP_MODEM_DCE_DEFAULT_CONFIG("internet");
+ * SIM7670_gnss device(dte, &dce_config);
+ * device.list_sms(sms_list_status_t::UNREAD, [](const sms_view_t &) { return true; });
+ * term->report();
+ * @endcode
+ */
+class SIM7670_scripted_term : public esp_modem::Terminal {
+public:
+    /**
+     * @brief What the terminal did with a command.
+     */
+    enum class outcome_t {
+        REPLIED = 0,    /*!< The scripted reply was sent. */
+        ERROR = 1,      /*!< The script answered ERROR. */
+        TIMEOUT = 2,    /*!< The script swallowed the command. */
+        UNEXPECTED = 3  /*!< The command did not match the next step. */
+    };
+
+    /**
+     * @brief One recorded command.
+     */
+    struct trace_t {
+        std::string command;  /*!< Command as written, without the trailing CR */
+        std::string reply;    /*!< Reply sent back, empty on timeout */
+        uint32_t sent_ms;     /*!< Wall time since the first command */
+        uint32_t latency_ms;  /*!< Scripted reply latency */
+        outcome_t outcome;
+    };
+
+    SIM7670_scripted_term();
+    ~SIM7670_scripted_term() override;
+
+    /**
+     * @brief Expects a command and answers it.
+     *
+     * @param command Expected command without the trailing CR. A trailing '*' matches any suffix.
+     * @param reply Response lines without the outer CRLF framing, "OK" by default.
+     * @param latency_ms Delay before the reply, the default latency when 0.
+     * @return The terminal, for chaining.
+     */
+    SIM7670_scripted_term &expect(const std::string &command, const std::string &reply = "OK", uint32_t latency_ms = 0);
+
+    /**
+     * @brief Expects a command and answers ERROR.
+     */
+    SIM7670_scripted_term &expect_error(const std::string &command, uint32_t latency_ms = 0);
+
+    /**
+     * @brief Expects a command and never answers it, so the caller runs into its timeout.
+     */
+    SIM7670_scripted_term &expect_timeout(const std::string &command);
+
+    /**
+     * @brief Queues an unsolicited result code after the reply of the last scripted step.
+     *
+     * Without any step it is sent `after_ms` after the terminal starts.
+     * @param text URC line without the CRLF framing.
+     * @param after_ms Delay after the reply.
+     */
+    SIM7670_scripted_term &urc(const std::string &text, uint32_t after_ms = 0);
+
+    /**
+     * @brief Latency used by steps scripted with latency 0.
+     */
+    void set_default_latency(uint32_t ms);
+
+    /**
+     * @brief Selects how commands that do not match the script are handled.
+     *
+     * @param strict True to leave them unanswered (the caller times out), false to answer OK.
+     */
+    void set_strict(bool strict);
+
+    /**
+     * @return True when every scripted step has been consumed.
+     */
+    bool finished();
+
+    /**
+     * @return The recorded commands, in order.
+     */
+    std::vector<trace_t> trace();
+
+    /**
+     * @return Wall time from the first command to the last reply, in milliseconds.
+     */
+    uint32_t elapsed_ms();
+
+    /**
+     * @brief Logs the trace, the number of round trips and the total wall time.
+     */
+    void report();
+
+    /**
+     * @brief Clears the trace and the wall-time reference, keeping the remaining script.
+     */
+    void reset_trace();
+
+    int write(uint8_t *data, size_t len) override;
+    int read(uint8_t *data, size_t len) override;
+    void start() override;
+    void stop() override;
+
+private:
+    struct step_t {
+        std::string command;
+        std::string reply;
+        uint32_t latency_ms;
+        outcome_t outcome;
+        std::vector<std::pair<std::string, uint32_t>> urcs;
+    };
+
+    struct delivery_t {
+        std::chrono::steady_clock::time_point at;
+        std::string bytes;
+    };
+
+    uint32_t now_ms();
+    void schedule(std::string bytes, uint32_t delay_ms);
+    void run();
+
+    std::mutex lock;
+    std::condition_variable wake;
+    std::deque<step_t> script;
+    std::vector<std::pair<std::string, uint32_t>> startup_urcs;
+    std::vector<delivery_t> deliveries;
+    std::string rx;
+    std::vector<trace_t> records;
+    std::chrono::steady_clock::time_point first_command;
+    std::chrono::steady_clock::time_point last_reply;
+    bool timing_started = false;
+    uint32_t default_latency_ms = 0;
+    bool strict = true;
+    bool running = false;
+    bool exiting = false;
+    std::thread worker;
+};
+
+/**
+ * @brief Creates a DTE whose primary terminal is a new scripted terminal.
+ *
+ * @param[out] term Set to the terminal, owned by the returned DTE.
+ * @return The DTE, to be passed to `SIM7670_gnss` or `create_SIM7670_GNSS_dce()`.
+ */
+std::shared_ptr<esp_modem::DTE> create_scripted_dte(SIM7670_scripted_term *&term);
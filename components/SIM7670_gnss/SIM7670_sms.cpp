@@ -0,0 +1,99 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file SIM7670_sms.cpp
+ * @brief AT+CMGL response parser of the SIM7670 driver.
+ */
+#include <charconv>
+#include "SIM7670_sms.hpp"
+
+/**
+ * @brief Splits off the next comma separated field, commas inside quotes do not split.
+ * Surrounding quotes are removed from the returned field.
+ */
+static std::string_view next_sms_field(std::string_view &line)
+{
+    size_t i = 0;
+    bool quoted = false;
+    while (i < line.size() && (quoted || line[i] != ','))
+    {
+        if (line[i] == '"')
+        {
+            quoted = !quoted;
+        }
+        i++;
+    }
+    std::string_view field = line.substr(0, i);
+    line.remove_prefix(i < line.size() ? i + 1 : i);
+    if (field.size() >= 2 && field.front() == '"' && field.back() == '"')
+    {
+        field = field.substr(1, field.size() - 2);
+    }
+    return field;
+}
+
+static std::string_view trim_line_end(std::string_view s)
+{
+    while (!s.empty() && (s.back() == '\r' || s.back() == '\n'))
+    {
+        s.remove_suffix(1);
+    }
+    return s;
+}
+
+size_t parse_sms_list(std::string_view response, const std::function<bool(const sms_view_t &)> &cb)
+{
+    constexpr std::string_view header_tag = "+CMGL: ";
+    constexpr std::string_view next_tag = "\n+CMGL: ";
+    size_t count = 0;
+    size_t pos = response.rfind(header_tag, 0) == 0 ? 0 : response.find(next_tag);
+    if (pos != std::string_view::npos && pos != 0)
+    {
+        pos++; // skip the '\n' of the match
+    }
+    while (pos != std::string_view::npos)
+    {
+        const size_t eol = response.find('\n', pos);
+        if (eol == std::string_view::npos)
+        {
+            break;
+        }
+        // Parse header: +CMGL: <index>,<stat>,<oa>,[<alpha>],<scts>
+        std::string_view header = trim_line_end(response.substr(pos + header_tag.size(), eol - pos - header_tag.size()));
+        // the body runs until the next header, or the final result code for the last message
+        const size_t next = response.find(next_tag, eol);
+        std::string_view body = response.substr(eol + 1, (next == std::string_view::npos ? response.size() : next) - eol - 1);
+        body = trim_line_end(body);
+        if (next == std::string_view::npos)
+        {
+            const size_t last_line = body.rfind('\n');
+            const std::string_view tail = last_line == std::string_view::npos ? body : body.substr(last_line + 1);
+            if (tail == "OK")
+            {
+                body = trim_line_end(body.substr(0, body.size() - tail.size()));
+            }
+        }
+        pos = next == std::string_view::npos ? next : next + 1;
+
+        sms_view_t sms;
+        const std::string_view index = next_sms_field(header);
+        if (std::from_chars(index.data(), index.data() + index.size(), sms.index).ec != std::errc())
+        {
+            continue;
+        }
+        sms.status = next_sms_field(header);
+        sms.sender = next_sms_field(header);
+        next_sms_field(header); // alpha, not used
+        sms.timestamp = next_sms_field(header);
+        sms.content = body;
+        count++;
+        if (!cb(sms))
+        {
+            break;
+        }
+    }
+    return count;
+}
@@ -0,0 +1,40 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file SIM7670_sms.hpp
+ * @brief AT+CMGL response parser of the SIM7670 driver.
+ *
+ * Plain C++ with no esp_modem or IDF dependency, test/host builds it.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <string_view>
+#include <functional>
+
+/**
+ * @brief Non-owning view of one SMS inside an AT+CMGL response buffer.
+ *
+ * The views are only valid inside the callback that receives the record.
+ */
+struct sms_view_t {
+    int index;                  /*!< Message index in storage */
+    std::string_view status;    /*!< "REC READ", "REC UNREAD", etc., without quotes */
+    std::string_view sender;    /*!< Sender's phone number, without quotes */
+    std::string_view timestamp; /*!< Service center timestamp, without quotes */
+    std::string_view content;   /*!< The message body, may span several lines */
+};
+
+/**
+ * @brief Parses an AT+CMGL text mode response in place.
+ *
+ * Header fields may be quoted and contain commas. A message body runs until the
+ * next "+CMGL:" line or the final result code, so multi-line bodies are kept whole.
+ * @param response The raw response buffer.
+ * @param cb Called for each message, return false to stop.
+ * @return Number of messages passed to the callback.
+ */
+size_t parse_sms_list(std::string_view response, const std::function<bool(const sms_view_t &)> &cb);
@@ -13,6 +13,7 @@
 #include <string>
 #include <sstream>
 #include <iomanip>
+#include <time.h>
 /**
  * @brief GPS fix type
  *
@@ -143,6 +144,22 @@ struct sim76xx_gps
     gps_satellite_t sat;     /*!< Number of satellites in view */
     float hpa;               /*!< Horizontal Position Accuracy  */
     float vpa;               /*!< Vertical Position Accuracy  */
+    inline time_t utc_epoch() const
+    {
+        if (date.year == 0)
+        {
+            return 0;
+        }
+        // days from civil date, avoids mktime() and the local TZ setting
+        int y = date.year - (date.month <= 2 ? 1 : 0);
+        const unsigned m = date.month;
+        const int era = (y >= 0 ? y : y - 399) / 400;
+        const unsigned yoe = (unsigned)(y - era * 400);
+        const unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + date.day - 1;
+        const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+        const int64_t days = (int64_t)era * 146097 + (int64_t)doe - 719468;
+        return (time_t)(days * 86400 + tim.hour * 3600 + tim.minute * 60 + tim.second);
+    } /*!< UTC time of the fix as unix epoch, 0 when no date */
     inline const std::string google_maps_url() const
     {
         std::stringstream ss;
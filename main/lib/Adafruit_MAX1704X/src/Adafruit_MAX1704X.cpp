@@ -295,6 +295,73 @@ uint8_t Adafruit_MAX17048::getAlertStatus(void)
   return status_reg->read() & 0x7F;
 }
 
+/*!
+ *    @brief Clear alert flags and release the ALRT pin
+ *    @param flags The MAX1704X_ALERTFLAG_* bits to clear
+ *    @returns True on success
+ */
+bool Adafruit_MAX17048::clearAlert(uint8_t flags)
+{
+  if (!clearAlertFlag(flags))
+    return false;
+  Adafruit_BusIO_Register config_reg =
+      Adafruit_BusIO_Register(i2c_dev, MAX1704X_CONFIG_REG, 2, MSBFIRST);
+  Adafruit_BusIO_RegisterBits alert_bit =
+      Adafruit_BusIO_RegisterBits(&config_reg, 1, 5);
+  return alert_bit.write(0);
+}
+
+/*!
+ *    @brief Alert on every 1% change of the state of charge (CONFIG.ALSC)
+ *    @param en True to enable the alert
+ */
+void Adafruit_MAX17048::enableSOCChangeAlert(bool en)
+{
+  Adafruit_BusIO_Register config_reg =
+      Adafruit_BusIO_Register(i2c_dev, MAX1704X_CONFIG_REG, 2, MSBFIRST);
+  Adafruit_BusIO_RegisterBits alsc_bit =
+      Adafruit_BusIO_RegisterBits(&config_reg, 1, 6);
+  alsc_bit.write(en);
+}
+
+/*!
+ *    @brief Alert when the state of charge falls below `percent` (CONFIG.ATHD)
+ *    @param percent Threshold, 1 to 32 %
+ */
+void Adafruit_MAX17048::setEmptyAlertThreshold(uint8_t percent)
+{
+  Adafruit_BusIO_Register config_reg =
+      Adafruit_BusIO_Register(i2c_dev, MAX1704X_CONFIG_REG, 2, MSBFIRST);
+  Adafruit_BusIO_RegisterBits athd_bits =
+      Adafruit_BusIO_RegisterBits(&config_reg, 5, 0);
+  percent = min(32, max(1, (int)percent));
+  athd_bits.write(32 - percent);
+}
+
+/*!
+ *    @brief Read voltage, state of charge, charge rate and the alert flags in
+ *    two burst transfers, VCELL..SOC and CRATE..STATUS, instead of one
+ *    transfer per register plus a version check each
+ *    @param snap Filled on success
+ *    @returns True if both transfers succeeded
+ */
+bool Adafruit_MAX17048::readSnapshot(MAX17048_snapshot_t &snap)
+{
+  uint8_t reg = MAX1704X_VCELL_REG;
+  uint8_t cell[4];
+  if (!i2c_dev->write_then_read(&reg, 1, cell, sizeof(cell)))
+    return false;
+  reg = MAX1704X_CRATE_REG;
+  uint8_t tail[6]; // CRATE, VRESET/ID, STATUS
+  if (!i2c_dev->write_then_read(&reg, 1, tail, sizeof(tail)))
+    return false;
+  snap.voltage = (float)((cell[0] << 8) | cell[1]) * 78.125 / 1000000;
+  snap.percent = (float)((cell[2] << 8) | cell[3]) / 256.0;
+  snap.rate = (float)(int16_t)((tail[0] << 8) | tail[1]) * 0.208;
+  snap.status = tail[4] & 0x7F;
+  return true;
+}
+
 /*!
  *    @brief The voltage change that will trigger exiting hibernation mode.
  *    If at any ADC sample abs(OCVCELL) is greater than ActThr, the IC exits
@@ -48,6 +48,17 @@
 #define MAX1704X_ALERTFLAG_RESET_INDICATOR                                     \
   0x01 ///< Alert flag for IC reset notification
 
+/*!
+ *    @brief  Cell voltage, state of charge, charge rate and alert flags read
+ *            together by readSnapshot()
+ */
+typedef struct {
+  float voltage; ///< cell voltage in V
+  float percent; ///< state of charge in %
+  float rate;    ///< (dis)charge rate in %/hr
+  uint8_t status; ///< MAX1704X_ALERTFLAG_* bits set in the status register
+} MAX17048_snapshot_t;
+
 /*!
  *    @brief  Class that stores state and functions for interacting with
  *            the MAX17048 I2C battery monitor
@@ -78,6 +89,11 @@ public:
 
   bool isActiveAlert(void);
   uint8_t getAlertStatus(void);
+  bool clearAlert(uint8_t flags);
+  void enableSOCChangeAlert(bool en);
+  void setEmptyAlertThreshold(uint8_t percent);
+
+  bool readSnapshot(MAX17048_snapshot_t &snap);
 
   void setActivityThreshold(float actthresh);
   float getActivityThreshold(void);
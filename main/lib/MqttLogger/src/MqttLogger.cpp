@@ -1,15 +1,25 @@
 #include "MqttLogger.h"
 #include "Arduino.h"
 
-SemaphoreHandle_t mqttSem;
+// a queued line: header, topic (empty for the logger topic), then the text, line ends are added by the task
+struct __attribute__((packed)) LogItem
+{
+    uint8_t level;
+    uint8_t topicLen;
+};
+
 MqttLogger::MqttLogger(PubSubClient &client, const char *topic, MqttLoggerMode mode, const bool retained)
 {
-    vSemaphoreCreateBinary(mqttSem);
-    xSemaphoreGive(mqttSem);
     this->setClient(client);
     this->setTopic(topic);
     this->setMode(mode);
     this->setRetained(retained);
+    // errors and warnings are never throttled by default, chatty levels are
+    for (auto &t : throttle)
+        t = {0, 0, 0, 0};
+    setThrottle(MqttLogLevel::Info, 20, 40);
+    setThrottle(MqttLogLevel::Debug, 5, 20);
+    ring = xRingbufferCreate(MQTT_LOGGER_RING_SIZE, RINGBUF_TYPE_NOSPLIT);
 }
 
 MqttLogger::~MqttLogger()
@@ -21,145 +31,301 @@ void MqttLogger::setClient(PubSubClient &client)
     this->client = &client;
 }
 
+void MqttLogger::setClientLock(SemaphoreHandle_t lock)
+{
+    this->clientLock = lock;
+}
+
 void MqttLogger::setTopic(const char *_topic)
 {
     this->topic = _topic;
 }
 
-size_t MqttLogger::printf(const char *format, ...)
+void MqttLogger::setMode(MqttLoggerMode mode)
 {
-    xSemaphoreTake(mqttSem, pdMS_TO_TICKS(100));
-    char loc_buf[300];
-    char *temp = loc_buf;
-    va_list arg, copy;
-    va_start(arg, format);
-    va_copy(copy, arg);
-    int len = vsnprintf(temp, sizeof(loc_buf), format, copy);
-    va_end(copy);
+    this->mode = mode;
+}
 
-    if (len < 0)
-    {
-        va_end(arg);
+void MqttLogger::setRetained(const boolean &retained)
+{
+    this->retained = retained;
+}
+
+void MqttLogger::setLevel(MqttLogLevel level)
+{
+    this->level = level;
+}
+
+MqttLogLevel MqttLogger::getLevel()
+{
+    return this->level;
+}
+
+void MqttLogger::setThrottle(MqttLogLevel lvl, uint16_t perSecond, uint16_t burst)
+{
+    portENTER_CRITICAL(&throttleMux);
+    Throttle &t = throttle[(uint8_t)lvl];
+    t.perSecond = perSecond;
+    t.burst = burst;
+    t.tokens = (uint32_t)burst * 1000;
+    t.lastMs = millis();
+    portEXIT_CRITICAL(&throttleMux);
+}
+
+void MqttLogger::setOfflineSink(MqttLoggerOfflineSink sink)
+{
+    this->offlineSink = sink;
+}
+
+const MqttLoggerStats &MqttLogger::getStats()
+{
+    return stats;
+}
+
+size_t MqttLogger::queued()
+{
+    if (ring == nullptr)
         return 0;
-    }
+    return MQTT_LOGGER_RING_SIZE - xRingbufferGetCurFreeSize(ring);
+}
 
-    if (len >= (int)sizeof(loc_buf))
+bool MqttLogger::flush(uint32_t timeout_ms)
+{
+    const uint32_t start = millis();
+    flushRequested = true;
+    bool ok = true;
+    while (queued() > 0 || batchUsed > 0)
     {
-        temp = (char *)malloc(len + 1);
-        if (!temp)
+        if (millis() - start >= timeout_ms)
         {
-            va_end(arg);
-            return 0;
+            ok = false;
+            break;
         }
-        vsnprintf(temp, len + 1, format, arg);
+        delay(5);
     }
-    va_end(arg);
+    flushRequested = false;
+    return ok;
+}
 
+bool MqttLogger::allow(MqttLogLevel lvl)
+{
+    if (lvl > level)
+        return false;
     bool ok = true;
-    if (this->mode != MqttLoggerMode::MqttOnly)
-        Serial.printf("%s\r\n", temp);
+    const uint32_t now = millis();
+    portENTER_CRITICAL(&throttleMux);
+    Throttle &t = throttle[(uint8_t)lvl];
+    if (t.perSecond != 0)
+    {
+        const uint32_t cap = (uint32_t)t.burst * 1000;
+        const uint32_t refill = (now - t.lastMs) * t.perSecond;
+        t.tokens = (refill >= cap - t.tokens) ? cap : t.tokens + refill;
+        t.lastMs = now;
+        if (t.tokens >= 1000)
+            t.tokens -= 1000;
+        else
+            ok = false;
+    }
+    portEXIT_CRITICAL(&throttleMux);
+    if (!ok)
+        stats.droppedThrottled[(uint8_t)lvl]++;
+    return ok;
+}
 
-    if (this->mode != MqttLoggerMode::SerialOnly && client && client->connected())
-        ok = this->client->publish(this->topic, temp, retained);
+// reserves a ring item for `len` text bytes and fills in the header and topic, never waits for room
+char *MqttLogger::reserve(MqttLogLevel lvl, const char *_topic, size_t len, void **slot)
+{
+    if (!taskStarted.exchange(true))
+        xTaskCreate(MqttLogger::task, "mqttLog", MQTT_LOGGER_TASK_STACK, this, MQTT_LOGGER_TASK_PRIORITY, nullptr);
+    const size_t topicLen = _topic ? strnlen(_topic, MQTT_LOGGER_MAX_TOPIC) : 0;
+    if (ring == nullptr || xRingbufferSendAcquire(ring, slot, sizeof(LogItem) + topicLen + len, 0) != pdTRUE)
+    {
+        stats.droppedFull++;
+        return nullptr;
+    }
+    LogItem *item = (LogItem *)*slot;
+    item->level = (uint8_t)lvl;
+    item->topicLen = (uint8_t)topicLen;
+    if (topicLen)
+        memcpy((char *)*slot + sizeof(LogItem), _topic, topicLen);
+    return (char *)*slot + sizeof(LogItem) + topicLen;
+}
 
-    if (temp != loc_buf)
-        free(temp);
-    xSemaphoreGive(mqttSem);
+void MqttLogger::commit(void *slot)
+{
+    xRingbufferSendComplete(ring, slot);
+    stats.queued++;
+    const size_t used = queued();
+    if (used > stats.ringHighWater)
+        stats.ringHighWater = used;
+}
 
-    return ok ? (size_t)len : 0;
+size_t MqttLogger::enqueueText(MqttLogLevel lvl, const char *_topic, const char *s, size_t len)
+{
+    void *slot;
+    char *text = reserve(lvl, _topic, len, &slot);
+    if (text == nullptr)
+        return 0;
+    memcpy(text, s, len);
+    commit(slot);
+    return len;
 }
 
-size_t MqttLogger::printf(const char *_topic, const char *format, ...)
+size_t MqttLogger::enqueue(MqttLogLevel lvl, const char *_topic, const char *format, va_list arg)
 {
-    xSemaphoreTake(mqttSem, pdMS_TO_TICKS(100));
+    if (!allow(lvl))
+        return 0;
     char loc_buf[300];
-    char *temp = loc_buf;
-    va_list arg, copy;
-    va_start(arg, format);
+    va_list copy;
     va_copy(copy, arg);
-    int len = vsnprintf(temp, sizeof(loc_buf), format, copy);
+    int len = vsnprintf(loc_buf, sizeof(loc_buf), format, copy);
     va_end(copy);
-
     if (len < 0)
-    {
-        va_end(arg);
         return 0;
-    }
+    if (len < (int)sizeof(loc_buf))
+        return enqueueText(lvl, _topic, loc_buf, len);
+    // long line: format straight into the ring item instead of a heap copy, the terminator is stripped by the task
+    void *slot;
+    char *text = reserve(lvl, _topic, len + 1, &slot);
+    if (text == nullptr)
+        return 0;
+    vsnprintf(text, len + 1, format, arg);
+    commit(slot);
+    return len;
+}
 
-    if (len >= (int)sizeof(loc_buf))
-    {
-        temp = (char *)malloc(len + 1);
-        if (!temp)
-        {
-            va_end(arg);
-            return 0;
-        }
-        vsnprintf(temp, len + 1, format, arg);
-    }
+size_t MqttLogger::printf(const char *format, ...)
+{
+    va_list arg;
+    va_start(arg, format);
+    size_t ret = enqueue(MqttLogLevel::Info, nullptr, format, arg);
     va_end(arg);
+    return ret;
+}
 
-    bool ok = true;
-    if (this->mode != MqttLoggerMode::MqttOnly)
-        Serial.printf("%s : %s\r\n", _topic, temp);
-
-    if (this->mode != MqttLoggerMode::SerialOnly && client && client->connected())
-        ok = this->client->publish(_topic, temp, retained);
+size_t MqttLogger::printf(const char *_topic, const char *format, ...)
+{
+    va_list arg;
+    va_start(arg, format);
+    size_t ret = enqueue(MqttLogLevel::Info, _topic, format, arg);
+    va_end(arg);
+    return ret;
+}
 
-    if (temp != loc_buf)
-        free(temp);
-    xSemaphoreGive(mqttSem);
-    return ok ? (size_t)len : 0;
+size_t MqttLogger::printf(MqttLogLevel lvl, const char *format, ...)
+{
+    va_list arg;
+    va_start(arg, format);
+    size_t ret = enqueue(lvl, nullptr, format, arg);
+    va_end(arg);
+    return ret;
 }
 
 size_t MqttLogger::println(const char *_topic, const char *s)
 {
-    xSemaphoreTake(mqttSem, pdMS_TO_TICKS(100));
-    if (s == nullptr)
+    if (s == nullptr || !allow(MqttLogLevel::Info))
         return 0;
-    bool ret = true;
-    if (this->mode != MqttLoggerMode::MqttOnly)
-    {
-        Serial.printf("topic %s: %s\n", _topic, s);
-    }
-    if (this->mode != MqttLoggerMode::SerialOnly && client != nullptr)
-    {
-        if (this->client->connected() == true)
-        {
-            ret = this->client->publish(_topic, s, retained);
-        }
-    }
-    xSemaphoreGive(mqttSem);
-
-    return ret ? (size_t)strlen(s) : -1;
+    return enqueueText(MqttLogLevel::Info, _topic, s, strlen(s));
 }
 
 size_t MqttLogger::println(const char *s)
 {
-    xSemaphoreTake(mqttSem, pdMS_TO_TICKS(100));
-    if (s == nullptr)
+    return println(MqttLogLevel::Info, s);
+}
+
+size_t MqttLogger::println(MqttLogLevel lvl, const char *s)
+{
+    if (s == nullptr || !allow(lvl))
         return 0;
-    bool ret = true;
-    if (this->mode != MqttLoggerMode::MqttOnly)
+    return enqueueText(lvl, nullptr, s, strlen(s));
+}
+
+void MqttLogger::flushBatch()
+{
+    if (batchUsed == 0)
+        return;
+    if (clientLock != nullptr)
+        xSemaphoreTakeRecursive(clientLock, portMAX_DELAY);
+    const bool sent = client != nullptr && client->connected() && client->publish(batchTopic, (const uint8_t *)batch, batchUsed, retained);
+    if (clientLock != nullptr)
+        xSemaphoreGiveRecursive(clientLock);
+    if (sent)
     {
-        Serial.println(s);
+        stats.published += batchLines;
+        stats.batches++;
     }
-    if (this->mode != MqttLoggerMode::SerialOnly && client != nullptr)
+    else if (offlineSink != nullptr && offlineSink(batchTopic, batch, batchUsed))
     {
-        if (this->client->connected() == true)
-        {
-            ret = this->client->publish(this->topic, s, retained);
-        }
+        stats.spooled += batchLines;
     }
-    xSemaphoreGive(mqttSem);
-    return ret ? (size_t)strlen(s) : -1;
+    else
+    {
+        stats.droppedOffline += batchLines;
+    }
+    batchUsed = 0;
+    batchLines = 0;
 }
 
-void MqttLogger::setMode(MqttLoggerMode mode)
+void MqttLogger::run()
 {
-    this->mode = mode;
+    for (;;)
+    {
+        size_t size = 0;
+        // block until a line arrives, or publish the partial batch once the burst is over or flush() waits for it
+        char *raw = (char *)xRingbufferReceive(ring, &size, batchUsed ? pdMS_TO_TICKS(MQTT_LOGGER_POLL_MS) : portMAX_DELAY);
+        if (raw == nullptr)
+        {
+            if (flushRequested || millis() - lastLineMs >= MQTT_LOGGER_FLUSH_MS)
+                flushBatch();
+            continue;
+        }
+        lastLineMs = millis();
+        const LogItem *item = (const LogItem *)raw;
+        const char *itemTopic = raw + sizeof(LogItem);
+        const char *text = itemTopic + item->topicLen;
+        size_t len = size - sizeof(LogItem) - item->topicLen;
+        // the task ends every line itself
+        while (len > 0 && (text[len - 1] == '\n' || text[len - 1] == '\r' || text[len - 1] == '\0'))
+            len--;
+        if (mode != MqttLoggerMode::MqttOnly)
+        {
+            if (item->topicLen)
+            {
+                Serial.write((const uint8_t *)itemTopic, item->topicLen);
+                Serial.print(" : ");
+            }
+            Serial.write((const uint8_t *)text, len);
+            Serial.print("\r\n");
+        }
+        if (mode != MqttLoggerMode::SerialOnly)
+        {
+            char lineTopic[MQTT_LOGGER_MAX_TOPIC + 1];
+            if (item->topicLen)
+            {
+                memcpy(lineTopic, itemTopic, item->topicLen);
+                lineTopic[item->topicLen] = '\0';
+            }
+            else
+            {
+                strncpy(lineTopic, topic ? topic : "", sizeof(lineTopic) - 1);
+                lineTopic[sizeof(lineTopic) - 1] = '\0';
+            }
+            if (batchUsed > 0 && (strcmp(lineTopic, batchTopic) != 0 || batchUsed + 1 + len > sizeof(batch)))
+                flushBatch();
+            if (batchUsed == 0)
+                strcpy(batchTopic, lineTopic);
+            else
+                batch[batchUsed++] = '\n';
+            const size_t n = len < sizeof(batch) - batchUsed ? len : sizeof(batch) - batchUsed;
+            memcpy(batch + batchUsed, text, n);
+            batchUsed += n;
+            batchLines++;
+        }
+        vRingbufferReturnItem(ring, raw);
+    }
 }
 
-void MqttLogger::setRetained(const boolean &retained)
+void MqttLogger::task(void *arg)
 {
-    this->retained = retained;
+    static_cast<MqttLogger *>(arg)->run();
 }
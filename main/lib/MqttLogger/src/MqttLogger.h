@@ -4,6 +4,12 @@
 
   Claus Denk
   https://androbi.com
+
+  Log calls only format the line into a ring buffer and return, a background task
+  writes Serial and publishes the lines in batches (one per line, newline joined),
+  so a slow or absent broker never blocks the caller.
+  PubSubClient is not thread safe, when other tasks use the same client they share a
+  recursive mutex with the logger task, see setClientLock().
 */
 
 #ifndef MqttLogger_h
@@ -14,6 +20,21 @@
 #define MQTT_SOCKET_TIMEOUT 30
 
 #include <PubSubClient.h>
+#include <atomic>
+#include "freertos/FreeRTOS.h"
+#include "freertos/ringbuf.h"
+#include "freertos/semphr.h"
+
+#define MQTT_LOGGER_RING_SIZE 8192     // bytes of queued lines
+#define MQTT_LOGGER_BATCH_SIZE 900     // joined payload, below the packet size PubSubClient is built with
+#define MQTT_LOGGER_MAX_TOPIC 96
+#define MQTT_LOGGER_FLUSH_MS 250       // a partial batch is published after this idle time
+#define MQTT_LOGGER_POLL_MS 10         // idle check period while a partial batch is held
+#define MQTT_LOGGER_TASK_STACK 4096
+#define MQTT_LOGGER_TASK_PRIORITY 1
+
+// receives batches that could not be published, e.g. to store them until the next connection
+typedef bool (*MqttLoggerOfflineSink)(const char *topic, const char *data, size_t len);
 
 enum MqttLoggerMode
 {
@@ -22,29 +43,100 @@ enum MqttLoggerMode
     MqttAndSerial = 2,
 };
 
-class MqttLogger 
+enum class MqttLogLevel : uint8_t
+{
+    Error = 0,
+    Warn,
+    Info, // level of the calls without an explicit level
+    Debug,
+};
+
+struct MqttLoggerStats
+{
+    uint32_t queued;
+    uint32_t published;          // lines published
+    uint32_t batches;            // publishes
+    uint32_t droppedFull;        // ring buffer full
+    uint32_t droppedOffline;     // no mqtt connection when the batch was due, and no offline sink
+    uint32_t spooled;            // lines handed to the offline sink
+    uint32_t droppedThrottled[4]; // per MqttLogLevel
+    uint32_t ringHighWater;      // most bytes queued at once
+};
+
+class MqttLogger
 {
 private:
     const char *topic = nullptr;
     PubSubClient *client = nullptr;
+    SemaphoreHandle_t clientLock = nullptr;
     MqttLoggerMode mode = MqttLoggerMode::MqttAndSerial;
     bool retained = false;
+    MqttLogLevel level = MqttLogLevel::Debug;
+    MqttLoggerOfflineSink offlineSink = nullptr;
+
+    // token bucket per level, tokens are scaled by 1000
+    struct Throttle
+    {
+        uint16_t perSecond; // 0 = unlimited
+        uint16_t burst;
+        uint32_t tokens;
+        uint32_t lastMs;
+    };
+    Throttle throttle[4];
+    portMUX_TYPE throttleMux = portMUX_INITIALIZER_UNLOCKED;
+
+    RingbufHandle_t ring = nullptr;
+    std::atomic<bool> taskStarted{false};
+    std::atomic<bool> flushRequested{false}; // flush() does not wait for the idle time
+    MqttLoggerStats stats = {};
+
+    // owned by the logger task
+    char batch[MQTT_LOGGER_BATCH_SIZE];
+    size_t batchUsed = 0;
+    uint16_t batchLines = 0;
+    uint32_t lastLineMs = 0;
+    char batchTopic[MQTT_LOGGER_MAX_TOPIC + 1];
+
+    bool allow(MqttLogLevel lvl);
+    size_t enqueue(MqttLogLevel lvl, const char *_topic, const char *format, va_list arg);
+    size_t enqueueText(MqttLogLevel lvl, const char *_topic, const char *s, size_t len);
+    char *reserve(MqttLogLevel lvl, const char *_topic, size_t len, void **slot);
+    void commit(void *slot);
+    void flushBatch();
+    void run();
+    static void task(void *arg);
 
 public:
     explicit MqttLogger(PubSubClient &client, const char *topic, MqttLoggerMode mode = MqttLoggerMode::MqttAndSerial, const bool retained = false);
     ~MqttLogger();
 
     void setClient(PubSubClient &client);
+    // recursive mutex held by every user of the client, taken around each batch publish
+    void setClientLock(SemaphoreHandle_t lock);
     void setTopic(const char *topic);
     void setMode(MqttLoggerMode mode);
     void setRetained(const boolean &retained);
-    
+    // lines above `level` are discarded
+    void setLevel(MqttLogLevel level);
+    MqttLogLevel getLevel();
+    // at most `perSecond` lines of `level` with bursts of `burst`, 0 for no limit
+    void setThrottle(MqttLogLevel level, uint16_t perSecond, uint16_t burst);
+    // called from the logger task with each batch that could not be published
+    void setOfflineSink(MqttLoggerOfflineSink sink);
+    const MqttLoggerStats &getStats();
+    // bytes waiting in the ring buffer
+    size_t queued();
+    // wait until queued lines are written and published, e.g. before deep sleep
+    bool flush(uint32_t timeout_ms);
+
     // formatted print helpers (default behavior: write into MqttLogger's buffer)
     size_t printf(const char *_topic, const char *format, ...); // printf that sets topic for that message
     size_t printf(const char *format, ...); // printf that sets topic for that message
+    size_t printf(MqttLogLevel level, const char *format, ...);
     // simple topic-aware print/println
     size_t println(const char *_topic, const char *s);
     size_t println(const char *s);
+    size_t println(MqttLogLevel level, const char *s);
 };
 
 #endif
@@ -466,7 +466,9 @@ boolean PubSubClient::beginPublish(const char* topic, unsigned int plength, bool
 }
 
 int PubSubClient::endPublish() {
- return 1;
+    // write() sends right away, a failed or dropped socket shows in the connection state.
+    // No _client->flush(): on the ESP32 WiFiClient it discards received bytes, a PUBACK among them
+    return connected() ? 1 : 0;
 }
 
 size_t PubSubClient::write(uint8_t data) {
@@ -479,12 +481,12 @@ size_t PubSubClient::write(const uint8_t *buffer, size_t size) {
     return _client->write(buffer,size);
 }
 
-size_t PubSubClient::buildHeader(uint8_t header, uint8_t* buf, uint16_t length) {
+size_t PubSubClient::buildHeader(uint8_t header, uint8_t* buf, uint32_t length) {
     uint8_t lenBuf[4];
     uint8_t llen = 0;
     uint8_t digit;
     uint8_t pos = 0;
-    uint16_t len = length;
+    uint32_t len = length;
     do {
         digit = len % 128;
         len = len / 128;
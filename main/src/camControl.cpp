@@ -11,6 +11,9 @@ static uint32_t WifiTimeout = 1000U * 60U * 5U;  //
 static uint32_t No_MotionTimeout = 20U * 1000U;  //
 static uint32_t SecureModeTimeout = 60U * 1000U; //
 static uint64_t SnapShotTime = 1 * 60U * 1000U;  // 2 hours
+static uint32_t UploadTime = 6U * 3600U * 1000U;   // queued telemetry sent while parked
+static uint32_t GnssTime = 12U * 3600U * 1000U;    // position refresh while parked
+static uint32_t BatteryTime = 2U * 3600U * 1000U;  // gauge sample while parked
 
 void loadTimingPref()
 {
@@ -20,6 +23,9 @@ void loadTimingPref()
     No_MotionTimeout = pref.getULong("nomotiontm", No_MotionTimeout);    //
     SecureModeTimeout = pref.getULong("securmodetm", SecureModeTimeout); //
     SnapShotTime = pref.getULong64("SnapShotTime", SnapShotTime);        //
+    UploadTime = pref.getULong("uploadtm", UploadTime);
+    GnssTime = pref.getULong("gnsstm", GnssTime);
+    BatteryTime = pref.getULong("batterytm", BatteryTime);
     mqttLogger.printf(" timing wifitm %d , nomotiontm %d , securmodetm %d \n", WifiTimeout, No_MotionTimeout, SecureModeTimeout);
 }
 
@@ -43,6 +49,21 @@ uint32_t getSecureModeTimeout()
     return SecureModeTimeout;
 }
 
+uint32_t getUploadTime()
+{
+    return UploadTime;
+}
+
+uint32_t getGnssTime()
+{
+    return GnssTime;
+}
+
+uint32_t getBatteryCheckTime()
+{
+    return BatteryTime;
+}
+
 void turnOnCamera()
 {
     if (CamisOn == false)
@@ -0,0 +1,139 @@
+/**
+ * @file batteryTrend.hpp
+ * @author rami zayat
+ * @brief hourly min, max and mean of the car battery voltage and its resting drain slope
+ * @version 0.1
+ * @date 2025-12-12
+ *
+ * @copyright Copyright (c) 2025
+ *
+ * Plain C++ with no platform dependency, it builds on a host as is. BatteryTrend_t is a POD
+ * kept in RTC memory and saved to NVS, it has no constructor so a wake does not reset it.
+ *
+ * Bucket `hour` (unix time / 3600) lives at slot hour % BUCKETS, a slot holding another hour
+ * is stale. Reading the bucket of any hour is a single index, no scan. Samples taken while
+ * the engine runs mark the bucket CHARGED, only the other buckets are resting voltage and
+ * enter the drain slope, a least squares fit of the mean mV over the last hours.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+namespace batteryTrend
+{
+    static const uint32_t MAGIC = 0x43425431; // "CBT1"
+    static const uint8_t BUCKETS = 48;
+    static const uint8_t SLOPE_HOURS = 24;    // fit window
+    static const uint8_t SLOPE_MIN_POINTS = 4; // resting buckets needed for a slope
+    static const uint8_t CHARGED = 0x01;      // a sample was taken with the engine on
+
+    typedef struct
+    {
+        uint32_t hour; // unix time / 3600, 0 if empty
+        uint16_t min_mv;
+        uint16_t max_mv;
+        uint32_t sum_mv;
+        uint16_t count;
+        uint8_t flags;
+    } Bucket_t;
+
+    typedef struct
+    {
+        uint32_t magic;
+        uint32_t last_hour; // hour of the newest sample
+        Bucket_t buckets[BUCKETS];
+    } BatteryTrend_t;
+
+    inline void reset(BatteryTrend_t &t)
+    {
+        t = {};
+        t.magic = MAGIC;
+    }
+
+    inline bool valid(const BatteryTrend_t &t)
+    {
+        return t.magic == MAGIC;
+    }
+
+    /**
+     * @brief add one sample
+     * @return true if the sample opened a new hour bucket, the previous one is complete
+     */
+    inline bool add(BatteryTrend_t &t, uint32_t time, uint16_t mv, bool engine_on)
+    {
+        const uint32_t hour = time / 3600;
+        Bucket_t &b = t.buckets[hour % BUCKETS];
+        const bool opened = b.hour != hour;
+        if (opened)
+        {
+            b = {};
+            b.hour = hour;
+            b.min_mv = mv;
+            b.max_mv = mv;
+        }
+        b.min_mv = mv < b.min_mv ? mv : b.min_mv;
+        b.max_mv = mv > b.max_mv ? mv : b.max_mv;
+        b.sum_mv += mv;
+        b.count++;
+        b.flags |= engine_on ? CHARGED : 0;
+        if (hour > t.last_hour)
+            t.last_hour = hour;
+        return opened;
+    }
+
+    // bucket `ago` hours before the newest sample, nullptr if that hour has no sample
+    inline const Bucket_t *get(const BatteryTrend_t &t, uint8_t ago)
+    {
+        if (ago >= BUCKETS || t.last_hour < ago)
+            return nullptr;
+        const uint32_t hour = t.last_hour - ago;
+        const Bucket_t &b = t.buckets[hour % BUCKETS];
+        return b.hour == hour && b.count != 0 ? &b : nullptr;
+    }
+
+    inline uint16_t mean(const Bucket_t &b)
+    {
+        return b.count ? (uint16_t)((b.sum_mv + b.count / 2) / b.count) : 0;
+    }
+
+    /**
+     * @brief resting voltage slope over the last SLOPE_HOURS
+     * @param mv_per_hour set to the slope, negative while the battery drains
+     * @param mv_now set to the fitted voltage at the newest hour
+     * @return false with fewer than SLOPE_MIN_POINTS resting buckets
+     */
+    inline bool slope(const BatteryTrend_t &t, float &mv_per_hour, float &mv_now)
+    {
+        double n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+        for (uint8_t ago = 0; ago < SLOPE_HOURS; ago++)
+        {
+            const Bucket_t *b = get(t, ago);
+            if (b == nullptr || (b->flags & CHARGED))
+                continue;
+            const double x = -(double)ago, y = mean(*b);
+            n++;
+            sx += x;
+            sy += y;
+            sxx += x * x;
+            sxy += x * y;
+        }
+        const double d = n * sxx - sx * sx;
+        if (n < SLOPE_MIN_POINTS || d <= 0)
+            return false;
+        mv_per_hour = (float)((n * sxy - sx * sy) / d);
+        mv_now = (float)((sy - mv_per_hour * sx) / n);
+        return true;
+    }
+
+    /**
+     * @brief hours until the resting voltage reaches `threshold_mv` at the current slope
+     * @return -1 when there is no slope or the voltage is not falling, 0 if already below
+     */
+    inline float hoursTo(const BatteryTrend_t &t, uint16_t threshold_mv)
+    {
+        float rate, now;
+        if (!slope(t, rate, now) || rate >= 0.0f)
+            return -1.0f;
+        return now <= threshold_mv ? 0.0f : (now - threshold_mv) / -rate;
+    }
+}
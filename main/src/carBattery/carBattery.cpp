@@ -1,13 +1,18 @@
 #include "carBattery.hpp"
+#include "wifi/wifi.hpp"
+#include "system.hpp"
+#include "esp_adc/adc_cali_scheme.h"
+#include "esp_adc/adc_oneshot.h"
+#include <algorithm>
+#include <time.h>
+
+static const uint32_t VALID_TIME = 1700000000; // before this the clock was not set since power on
+static RTC_DATA_ATTR batteryTrend::BatteryTrend_t trend;
 
 CarBattery::CarBattery() : lowBatteryThreshold(11.8f) { // Default value
 }
 
 void CarBattery::begin() {
-    // Initialize GPIO pins
-    pinMode(ADC_PIN, INPUT);
-    pinMode(ENGINE_SENSE_PIN, INPUT_PULLDOWN); // Assuming the pin will be pulled HIGH when engine is on
-
     // Initialize Preferences
     preferences.begin(preferences_namespace, false); // false for read/write
 
@@ -15,31 +20,238 @@ void CarBattery::begin() {
     // If the key doesn't exist, it will use the default value provided (11.8f)
     lowBatteryThreshold = preferences.getFloat(nvs_key_low_batt, 11.9f);
     preferences.end();
+    setupAdc();
 }
 
-float CarBattery::getBatteryVoltage() {
-    // Read the ADC value
-    int adcValue = analogRead(ADC_PIN);
+// channel and eFuse calibration, shared by the DMA sampling and the one-shot reading of short wakes
+bool CarBattery::setupAdc() {
+    if (adcReady)
+        return true;
+    if (failed)
+        return false; // not an ADC1 pin
+    adc_unit_t unit;
+    if (adc_continuous_io_to_channel(ADC_PIN, &unit, &channel) != ESP_OK || unit != ADC_UNIT_1) {
+        mqttLogger.printf(MqttLogLevel::Error, "car battery: GPIO%d is not an ADC1 pin\n", ADC_PIN);
+        failed = true;
+        return false;
+    }
+    // the curve fitting scheme is the one the S3 has
+    adc_cali_curve_fitting_config_t cali_config = {};
+    cali_config.unit_id = ADC_UNIT_1;
+    cali_config.chan = channel;
+    cali_config.atten = ADC_ATTEN_DB_12;
+    cali_config.bitwidth = ADC_BITWIDTH_12;
+    if (adc_cali_create_scheme_curve_fitting(&cali_config, &cali) != ESP_OK) {
+        mqttLogger.println(MqttLogLevel::Warn, "car battery: no ADC calibration in eFuse, using the nominal curve");
+        cali = nullptr;
+    }
+    adcReady = true;
+    return true;
+}
+
+float CarBattery::toVolts(int raw) {
+    int mv = 0;
+    if (cali == nullptr || adc_cali_raw_to_voltage(cali, raw, &mv) != ESP_OK)
+        mv = raw * 3100 / 4095; // 12 dB attenuation full scale, uncalibrated
+    return mv * VOLTAGE_DIVIDER_RATIO / 1000.0f;
+}
+
+bool IRAM_ATTR CarBattery::onFrame(adc_continuous_handle_t, const adc_continuous_evt_data_t *, void *arg) {
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(((CarBattery *)arg)->task, &woken);
+    return woken == pdTRUE;
+}
+
+bool CarBattery::startAdc() {
+    adc_continuous_handle_cfg_t handle_config = {};
+    handle_config.max_store_buf_size = FRAME_RESULTS * SOC_ADC_DIGI_RESULT_BYTES * 4;
+    handle_config.conv_frame_size = FRAME_RESULTS * SOC_ADC_DIGI_RESULT_BYTES;
+    if (adc_continuous_new_handle(&handle_config, &adc) != ESP_OK) {
+        adc = nullptr;
+        return false;
+    }
+    adc_digi_pattern_config_t pattern = {};
+    pattern.atten = ADC_ATTEN_DB_12;
+    pattern.channel = channel;
+    pattern.unit = ADC_UNIT_1;
+    pattern.bit_width = ADC_BITWIDTH_12;
+    adc_continuous_config_t config = {};
+    config.pattern_num = 1;
+    config.adc_pattern = &pattern;
+    config.sample_freq_hz = SAMPLE_HZ;
+    config.conv_mode = ADC_CONV_SINGLE_UNIT_1;
+    config.format = ADC_DIGI_OUTPUT_FORMAT_TYPE2;
+    adc_continuous_evt_cbs_t cbs = {};
+    cbs.on_conv_done = onFrame;
+    if (adc_continuous_config(adc, &config) != ESP_OK || adc_continuous_register_event_callbacks(adc, &cbs, this) != ESP_OK ||
+        adc_continuous_start(adc) != ESP_OK) {
+        adc_continuous_deinit(adc);
+        adc = nullptr;
+        return false;
+    }
+    return true;
+}
 
-    // Convert ADC value to voltage at the pin
-    float pinVoltage = (adcValue / (float)ADC_MAX_VALUE) * ADC_REF_VOLTAGE;
+void CarBattery::stopAdc() {
+    adc_continuous_stop(adc);
+    adc_continuous_deinit(adc);
+    adc = nullptr;
+}
+
+// a stop is picked up by the task, a start while it is still stopping is retried by the next call
+void CarBattery::setSampling(bool on) {
+    if (on && !running && !failed && setupAdc()) {
+        stop = false;
+        running = true;
+        xTaskCreate(loopSampling, "carBatt", 3072, this, 2, &task);
+    } else if (!on && running && !stop) {
+        stop = true;
+        xTaskNotifyGive(task);
+    }
+}
+
+bool CarBattery::isSampling() {
+    return running && !stop;
+}
 
-    // Convert pin voltage to actual battery voltage using the divider ratio
-    // It is better to use analogReadMilliVolts() for more accurate readings if available and calibrated
-    // For now, we use the basic analogRead and a theoretical ratio
-    float batteryVoltage = pinVoltage * VOLTAGE_DIVIDER_RATIO;
+void CarBattery::loopSampling(void *arg) {
+    CarBattery &self = *(CarBattery *)arg;
+    static uint8_t frame[FRAME_RESULTS * SOC_ADC_DIGI_RESULT_BYTES];
+    if (!self.startAdc()) {
+        mqttLogger.println(MqttLogLevel::Error, "car battery: ADC continuous mode start failed");
+        self.failed = true;
+        self.running = false;
+        vTaskDelete(NULL);
+    }
+    while (!self.stop) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+        uint32_t len = 0;
+        while (!self.stop && adc_continuous_read(self.adc, frame, sizeof(frame), &len, 0) == ESP_OK) {
+            for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= len; i += SOC_ADC_DIGI_RESULT_BYTES) {
+                const adc_digi_output_data_t *p = (const adc_digi_output_data_t *)&frame[i];
+                if (p->type2.channel == (uint32_t)self.channel)
+                    self.addSample(p->type2.data);
+            }
+        }
+    }
+    self.stopAdc();
+    self.running = false;
+    vTaskDelete(NULL);
+}
+
+// oversampling: DECIMATE conversions averaged give one sample with less noise
+void CarBattery::addSample(uint32_t raw) {
+    rawSum += raw;
+    if (++rawCount < DECIMATE)
+        return;
+    const int avg = (int)((rawSum + rawCount / 2) / rawCount);
+    rawSum = 0;
+    rawCount = 0;
+    const float v = toVolts(avg);
+    const float a = 1.0f / (FILTER_TAU_S * DECIMATED_HZ);
+    const float b = 1.0f / (REST_TAU_S * DECIMATED_HZ);
+    portENTER_CRITICAL(&mux);
+    window[windowHead] = v;
+    windowHead = (windowHead + 1) % WINDOW;
+    if (windowFill < WINDOW)
+        windowFill++;
+    if (filtered == 0.0f) {
+        filtered = v;
+        rest = v;
+    } else {
+        filtered += a * (v - filtered);
+        if (dipStartMs == 0)
+            rest += b * (v - rest); // the dip itself does not pull the reference down
+    }
+    portEXIT_CRITICAL(&mux);
+    detectEngine(v);
+}
 
-    return batteryVoltage;
+void CarBattery::detectEngine(float v) {
+    // the dip is timed in samples, frames are handled in bursts and millis() would jitter
+    if (v < rest - CRANK_DIP_V) {
+        if (dipStartMs == 0) {
+            dipStartMs = millis() | 1;
+            dipSamples = 0;
+            dipMin = v;
+        }
+        dipSamples++;
+        dipMin = std::min(dipMin, v);
+    } else if (dipStartMs != 0) {
+        const uint32_t dipMs = dipSamples * 1000U / DECIMATED_HZ;
+        dipStartMs = 0;
+        if (dipMs >= CRANK_MIN_MS && dipMs <= CRANK_MAX_MS) {
+            crankCount++;
+            lastCrankMs = millis() | 1;
+            mqttLogger.printf("car battery: crank dip to %.2f V from %.2f V, %lu ms\n", dipMin, rest, (unsigned long)dipMs);
+            postSystemEvent(EVENT_ENGINE);
+        }
+    }
+    const bool above = filtered >= CHARGING_V;
+    if (!charging && above) {
+        if (chargingSinceMs == 0)
+            chargingSinceMs = millis() | 1;
+        else if (millis() - chargingSinceMs >= CHARGING_HOLD_MS) {
+            charging = true;
+            mqttLogger.printf("car battery: charging at %.2f V, engine on\n", filtered);
+            postSystemEvent(EVENT_ENGINE);
+        }
+    } else if (!above) {
+        chargingSinceMs = 0;
+        if (charging && filtered < CHARGING_V - CHARGING_HYSTERESIS_V) {
+            charging = false;
+            mqttLogger.printf("car battery: charging stopped at %.2f V\n", filtered);
+            postSystemEvent(EVENT_ENGINE);
+        }
+    }
+}
+
+float CarBattery::getBatteryVoltage() {
+    if (!isSampling()) {
+        // on the cell the DMA sampling is off unless CONFIG_CAR_BATTERY_SAMPLE_ALWAYS
+        if (onceMs == 0 || millis() - onceMs >= ONESHOT_MAX_AGE_MS)
+            sampleOnce();
+        return onceVoltage;
+    }
+    portENTER_CRITICAL(&mux);
+    const float v = filtered;
+    portEXIT_CRITICAL(&mux);
+    return v;
+}
+
+float CarBattery::getWindowMinVoltage() {
+    float v = 0.0f;
+    portENTER_CRITICAL(&mux);
+    for (uint16_t i = 0; i < windowFill; i++)
+        v = i == 0 ? window[i] : std::min(v, window[i]);
+    portEXIT_CRITICAL(&mux);
+    return v;
+}
+
+bool CarBattery::hasReading() {
+    return getBatteryVoltage() > 0.0f;
 }
 
 bool CarBattery::isEngineOn() {
-    // Read the digital GPIO pin
-    // We assume that the signal is HIGH when the engine is running
-    return digitalRead(ENGINE_SENSE_PIN) == HIGH;
+    // the battery alone: VBUS may be a USB supply or always on, and would mark every trend bucket CHARGED
+    const uint32_t crank = lastCrankMs;
+    return charging || (crank != 0 && millis() - crank < CRANK_HOLD_MS);
+}
+
+bool CarBattery::isCharging() {
+    return charging;
+}
+
+uint32_t CarBattery::getCrankCount() {
+    return crankCount;
+}
+
+uint32_t CarBattery::getLastCrankMs() {
+    return lastCrankMs;
 }
 
 bool CarBattery::isBatteryLow() {
-    return getBatteryVoltage() < lowBatteryThreshold;
+    return hasReading() && getBatteryVoltage() < lowBatteryThreshold;
 }
 
 void CarBattery::setLowBatteryThreshold(float voltage) {
@@ -55,3 +267,81 @@ float CarBattery::getLowBatteryThreshold() {
     preferences.end();
     return threshold;
 }
+
+float CarBattery::sampleOnce() {
+    if (isSampling()) {
+        portENTER_CRITICAL(&mux);
+        const float v = filtered;
+        portEXIT_CRITICAL(&mux);
+        return v;
+    }
+    if (running || !setupAdc())
+        return 0.0f; // the DMA task still owns ADC1 while it stops
+    adc_oneshot_unit_handle_t unit;
+    adc_oneshot_unit_init_cfg_t unit_config = {};
+    unit_config.unit_id = ADC_UNIT_1;
+    if (adc_oneshot_new_unit(&unit_config, &unit) != ESP_OK)
+        return 0.0f;
+    adc_oneshot_chan_cfg_t chan_config = {};
+    chan_config.atten = ADC_ATTEN_DB_12;
+    chan_config.bitwidth = ADC_BITWIDTH_12;
+    uint32_t sum = 0;
+    uint8_t n = 0;
+    if (adc_oneshot_config_channel(unit, channel, &chan_config) == ESP_OK) {
+        for (uint8_t i = 0; i < ONESHOT_SAMPLES; i++) {
+            int raw;
+            if (adc_oneshot_read(unit, channel, &raw) == ESP_OK) {
+                sum += raw;
+                n++;
+            }
+        }
+    }
+    adc_oneshot_del_unit(unit);
+    if (n == 0)
+        return 0.0f;
+    const float v = toVolts((int)((sum + n / 2) / n));
+    onceVoltage = v;
+    onceMs = millis() | 1;
+    return v;
+}
+
+void CarBattery::updateTrend(bool force) {
+    if (!force && lastTrendMs != 0 && millis() - lastTrendMs < TREND_PERIOD_MS)
+        return;
+    lastTrendMs = millis() | 1;
+    const time_t now = time(nullptr);
+    if (now < (time_t)VALID_TIME)
+        return; // hours need the wall clock, the trend outlives the RTC domain in NVS
+    if (!batteryTrend::valid(trend)) {
+        // power on: restore what was saved, the RTC copy is the live one after that
+        preferences.begin(preferences_namespace, true);
+        if (preferences.getBytesLength("trend") != sizeof(trend) || preferences.getBytes("trend", &trend, sizeof(trend)) != sizeof(trend) ||
+            !batteryTrend::valid(trend))
+            batteryTrend::reset(trend);
+        preferences.end();
+    }
+    const float v = sampleOnce();
+    if (v <= 0.0f)
+        return;
+    if (batteryTrend::add(trend, (uint32_t)now, (uint16_t)std::min(v * 1000.0f, 65535.0f), isEngineOn())) {
+        // one NVS write per hour at most, when a bucket opens
+        preferences.begin(preferences_namespace, false);
+        preferences.putBytes("trend", &trend, sizeof(trend));
+        preferences.end();
+        float rate, mv;
+        if (batteryTrend::slope(trend, rate, mv))
+            mqttLogger.printf("car battery: resting %.2f V, %+.1f mV/h\n", mv / 1000.0f, rate);
+    }
+}
+
+const batteryTrend::BatteryTrend_t &CarBattery::getTrend() {
+    return trend;
+}
+
+uint32_t CarBattery::stretchInterval(uint32_t ms) {
+    if (!batteryTrend::valid(trend))
+        return ms;
+    const float hours = batteryTrend::hoursTo(trend, (uint16_t)(getLowBatteryThreshold() * 1000.0f));
+    const uint32_t factor = hours < 0.0f ? 1 : hours < TREND_DAYS_H ? 4 : hours < TREND_WEEK_H ? 2 : 1;
+    return (uint32_t)std::min<uint64_t>((uint64_t)ms * factor, UINT32_MAX);
+}
@@ -4,21 +4,58 @@
 #include <Arduino.h>
 #include <Preferences.h>
 #include "pins.hpp"
+#include "esp_adc/adc_continuous.h"
+#include "esp_adc/adc_cali.h"
+#include "carBattery/batteryTrend.hpp"
 
+// Car battery voltage from continuous (DMA) ADC sampling, calibrated with the eFuse curve.
+// SAMPLE_HZ raw conversions are averaged DECIMATE at a time into a WINDOW_MS ring of
+// DECIMATED_HZ samples. A low pass of that stream is the battery voltage, the ring catches
+// the starter motor dip, a sustained alternator voltage says the engine runs.
+// Readings are cached, nothing blocks on a conversion. Without DMA sampling the voltage is a
+// one-shot reading, refreshed when it is older than ONESHOT_MAX_AGE_MS.
+// Every wake also adds a one-shot reading to an hourly trend (batteryTrend.hpp) whose resting
+// drain slope stretches the snapshot interval when the battery is running down.
 class CarBattery {
 public:
+#if CONFIG_CAR_BATTERY_SAMPLE_ALWAYS
+    static const bool SAMPLE_ALWAYS = true;
+#else
+    static const bool SAMPLE_ALWAYS = false; // only while VBUS is present
+#endif
+
     CarBattery();
     void begin();
-    float getBatteryVoltage();
-    bool isEngineOn();
+    // start or stop the DMA sampling, the ADC driver holds an APB lock while it runs
+    void setSampling(bool on);
+    bool isSampling();
+
+    float getBatteryVoltage();      // filtered while sampling, else the last one-shot reading, 0 if none
+    float getWindowMinVoltage();    // lowest sample of the last WINDOW_MS
+    bool hasReading();
+    bool isEngineOn();              // alternator charging or a crank in the last CRANK_HOLD_MS
+    bool isCharging();
+    uint32_t getCrankCount();
+    uint32_t getLastCrankMs();      // millis() of the last crank dip, 0 if none
     bool isBatteryLow();
     void setLowBatteryThreshold(float voltage);
     float getLowBatteryThreshold();
 
+    // oversampled one-shot reading, also cached for getBatteryVoltage(), the filtered value while DMA
+    // sampling runs, 0 on error
+    float sampleOnce();
+    // add a reading to the trend, at most every TREND_PERIOD_MS unless forced
+    void updateTrend(bool force);
+    const batteryTrend::BatteryTrend_t &getTrend();
+    /**
+     * @brief lengthen a wake interval while the car battery drains towards the low threshold
+     * @return `ms` times 2 under TREND_WEEK_H hours to the threshold, times 4 under TREND_DAYS_H
+     */
+    uint32_t stretchInterval(uint32_t ms);
+
 private:
     // Hardcoded GPIO pins
     static const int ADC_PIN = 1;       // GPIO 1 for battery voltage ADC
-    static const int ENGINE_SENSE_PIN = VBUS_INPUT_PIN; // GPIO 2 for engine running status
 
     // Voltage divider calibration.
     // Assumes a voltage divider brings the car battery voltage (~14V) down to the ESP32's ADC range (~3.3V).
@@ -27,9 +64,73 @@ private:
     // For example, with R1=100k and R2=27k, the ratio is (100k + 27k) / 27k = 4.703
     static constexpr float VOLTAGE_DIVIDER_RATIO = 4.703f;
 
-    // ADC characteristics
-    static const int ADC_MAX_VALUE = 4095;    // 12-bit ADC
-    static constexpr float ADC_REF_VOLTAGE = 3.3f; // ADC reference voltage
+    // sampling
+    static const uint32_t SAMPLE_HZ = CONFIG_CAR_BATTERY_SAMPLE_HZ;
+    static const uint16_t DECIMATE = 40;
+    static const uint32_t DECIMATED_HZ = SAMPLE_HZ / DECIMATE;
+    static const uint16_t WINDOW_MS = 500;
+    static const uint16_t WINDOW = DECIMATED_HZ * WINDOW_MS / 1000;
+    static const uint16_t FRAME_RESULTS = 256; // conversions per DMA frame
+    static constexpr float FILTER_TAU_S = 0.1f; // battery voltage low pass
+    static constexpr float REST_TAU_S = 5.0f;   // reference the crank dip is measured from
+
+    // engine detection
+    static constexpr float CRANK_DIP_V = 1.0f;  // below the rest voltage
+    static const uint16_t CRANK_MIN_MS = 20;
+    static const uint16_t CRANK_MAX_MS = 3000;
+    static const uint32_t CRANK_HOLD_MS = 60U * 1000U;
+    static constexpr float CHARGING_V = 13.3f;
+    static constexpr float CHARGING_HYSTERESIS_V = 0.3f;
+    static const uint16_t CHARGING_HOLD_MS = 2000;
+
+    // trend
+    static const uint8_t ONESHOT_SAMPLES = 64;
+    static const uint32_t ONESHOT_MAX_AGE_MS = 60U * 1000U;
+    static const uint32_t TREND_PERIOD_MS = 10U * 60U * 1000U;
+    static const uint16_t TREND_WEEK_H = 7 * 24;
+    static const uint16_t TREND_DAYS_H = 2 * 24;
+
+    static bool IRAM_ATTR onFrame(adc_continuous_handle_t handle, const adc_continuous_evt_data_t *edata, void *arg);
+    static void loopSampling(void *arg);
+    bool setupAdc();
+    float toVolts(int raw);
+    bool startAdc();
+    void stopAdc();
+    void addSample(uint32_t raw);
+    void detectEngine(float v);
+
+    adc_continuous_handle_t adc = nullptr;
+    adc_cali_handle_t cali = nullptr;
+    adc_channel_t channel = ADC_CHANNEL_0;
+    TaskHandle_t task = nullptr;
+    volatile bool running = false; // sampling task alive
+    volatile bool stop = false;    // asks the task to stop the ADC and exit
+    bool failed = false;           // wrong pin or the DMA did not start, not retried
+    bool adcReady = false;         // channel and calibration looked up
+    uint32_t lastTrendMs = 0;
+    volatile float onceVoltage = 0.0f; // last one-shot reading
+    volatile uint32_t onceMs = 0;      // millis() of it, 0 if none
+    portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+
+    // decimator, written by the sampling task only
+    uint32_t rawSum = 0;
+    uint16_t rawCount = 0;
+
+    // ring and filters, read under `mux`
+    float window[WINDOW] = {};
+    uint16_t windowHead = 0;
+    uint16_t windowFill = 0;
+    float filtered = 0.0f;
+    float rest = 0.0f;
+
+    // engine state
+    uint32_t dipStartMs = 0;
+    uint32_t dipSamples = 0;
+    float dipMin = 0.0f;
+    uint32_t chargingSinceMs = 0;
+    volatile bool charging = false;
+    volatile uint32_t crankCount = 0;
+    volatile uint32_t lastCrankMs = 0;
 
     float lowBatteryThreshold;
 
@@ -0,0 +1,228 @@
+/**
+ * @file linkBench.cpp
+ * @author rami zayat
+ * @brief UART loopback throughput and error rate at the modem link rates
+ * @version 0.1
+ * @date 2025-12-12
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include "linkBench.hpp"
+#include "pppos_client.hpp"
+#include "power/pm.hpp"
+#include "wifi/wifi.hpp"
+#include "driver/uart.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include <algorithm>
+
+namespace linkBench
+{
+    static const char *TAG = "linkBench";
+    static const uart_port_t PORT = UART_NUM_2; // not used by anything else
+    static const uint8_t MAGIC[2] = {0xA5, 0x5A};
+    static const size_t FRAME_SIZE = 256;                     // magic, seq, payload, crc
+    static const size_t PAYLOAD_SIZE = FRAME_SIZE - 2 - 4 - 4;
+    static const uint32_t IDLE_MS = 300;                      // read timeout once the writer is done
+
+    static Result_t lastResults[MAX_RESULTS];
+    static uint8_t resultCount = 0;
+    static volatile bool busy = false;
+    static pm::Lock benchLock("linkbench", ESP_PM_APB_FREQ_MAX);
+
+    typedef struct
+    {
+        uint32_t frames;
+        volatile bool done;
+    } Writer_t;
+
+    static void put32(uint8_t *p, uint32_t v)
+    {
+        p[0] = v;
+        p[1] = v >> 8;
+        p[2] = v >> 16;
+        p[3] = v >> 24;
+    }
+
+    static uint32_t get32(const uint8_t *p)
+    {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+
+    static void buildFrame(uint8_t *f, uint32_t seq)
+    {
+        f[0] = MAGIC[0];
+        f[1] = MAGIC[1];
+        put32(f + 2, seq);
+        uint32_t x = seq * 2654435761u + 1; // xorshift, a different pattern per frame
+        for (size_t i = 0; i < PAYLOAD_SIZE; i++)
+        {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            f[6 + i] = x;
+        }
+        put32(f + FRAME_SIZE - 4, esp_rom_crc32_le(0, f + 2, FRAME_SIZE - 6));
+    }
+
+    static void writerTask(void *arg)
+    {
+        Writer_t *w = (Writer_t *)arg;
+        uint8_t frame[FRAME_SIZE];
+        for (uint32_t seq = 0; seq < w->frames; seq++)
+        {
+            buildFrame(frame, seq);
+            uart_write_bytes(PORT, frame, FRAME_SIZE);
+        }
+        uart_wait_tx_done(PORT, pdMS_TO_TICKS(5000));
+        w->done = true;
+        vTaskDelete(NULL);
+    }
+
+    static bool runOne(uint32_t baud, bool flow, uint32_t frames, Result_t &r)
+    {
+        r = {};
+        r.baud = baud;
+        r.flow = flow;
+        r.sent = frames;
+        uart_config_t cfg = {};
+        cfg.baud_rate = baud;
+        cfg.data_bits = UART_DATA_8_BITS;
+        cfg.parity = UART_PARITY_DISABLE;
+        cfg.stop_bits = UART_STOP_BITS_1;
+        cfg.flow_ctrl = flow ? UART_HW_FLOWCTRL_CTS_RTS : UART_HW_FLOWCTRL_DISABLE;
+        cfg.rx_flow_ctrl_thresh = SOC_UART_FIFO_LEN - 8;
+        cfg.source_clk = UART_SCLK_DEFAULT;
+        if (uart_param_config(PORT, &cfg) != ESP_OK || uart_set_loop_back(PORT, true) != ESP_OK)
+        {
+            return false;
+        }
+        uart_flush_input(PORT);
+
+        Writer_t w = {frames, false};
+        const int64_t start = esp_timer_get_time();
+        if (xTaskCreate(writerTask, "benchTx", 3072, &w, 3, NULL) != pdPASS)
+        {
+            return false;
+        }
+        uint8_t frame[FRAME_SIZE];
+        uint8_t rx[512];
+        size_t pos = 0;
+        uint32_t expected = 0;
+        int64_t last = start;
+        int64_t idleSince = 0;
+        while (r.ok + r.bad + r.lost < frames)
+        {
+            const int n = uart_read_bytes(PORT, rx, sizeof(rx), pdMS_TO_TICKS(20));
+            if (n <= 0)
+            {
+                if (!w.done)
+                    continue;
+                if (idleSince == 0)
+                    idleSince = esp_timer_get_time();
+                if (esp_timer_get_time() - idleSince > IDLE_MS * 1000)
+                    break;
+                continue;
+            }
+            idleSince = 0;
+            for (int i = 0; i < n; i++)
+            {
+                const uint8_t b = rx[i];
+                if (pos < 2 && b != MAGIC[pos])
+                {
+                    pos = 0; // resync on the frame magic
+                    continue;
+                }
+                frame[pos++] = b;
+                if (pos < FRAME_SIZE)
+                    continue;
+                pos = 0;
+                if (get32(frame + FRAME_SIZE - 4) != esp_rom_crc32_le(0, frame + 2, FRAME_SIZE - 6))
+                {
+                    r.bad++;
+                    continue;
+                }
+                const uint32_t seq = get32(frame + 2);
+                if (seq < expected || seq >= frames)
+                {
+                    r.bad++; // a corrupted frame that happened to pass, or a misaligned one
+                    continue;
+                }
+                r.lost += seq - expected;
+                expected = seq + 1;
+                r.ok++;
+                last = esp_timer_get_time();
+            }
+        }
+        while (!w.done)
+            vTaskDelay(pdMS_TO_TICKS(10));
+        r.lost += frames - std::min(frames, r.ok + r.bad + r.lost);
+        const int64_t us = last - start;
+        r.kbps = us > 0 ? (uint32_t)((uint64_t)r.ok * PAYLOAD_SIZE * 8 * 1000 / us) : 0;
+        return true;
+    }
+
+    static void run(uint32_t frames)
+    {
+        pm::Guard guard(benchLock);
+        resultCount = 0;
+        if (uart_driver_install(PORT, CONFIG_MODEM_UART_RX_BUFFER_SIZE, CONFIG_MODEM_UART_TX_BUFFER_SIZE, 0, nullptr, 0) != ESP_OK)
+        {
+            mqttLogger.println(MqttLogLevel::Warn, "link bench: cannot install the UART driver");
+            return;
+        }
+        for (uint32_t baud : ModemSim7670::BAUD_RATES)
+        {
+            if (baud > CONFIG_MODEM_UART_BAUD_RATE)
+                continue;
+            for (bool flow : {false, true})
+            {
+                Result_t &r = lastResults[resultCount];
+                if (!runOne(baud, flow, frames, r))
+                {
+                    ESP_LOGW(TAG, "%lu baud %s: not run", (unsigned long)baud, flow ? "RTS/CTS" : "no flow");
+                    continue;
+                }
+                resultCount++;
+                mqttLogger.printf(MqttLogLevel::Info, "link bench %lu baud %s: %lu kbps, %lu/%lu frames ok, %lu bad, %lu lost\n",
+                                  (unsigned long)baud, flow ? "RTS/CTS" : "no flow", (unsigned long)r.kbps,
+                                  (unsigned long)r.ok, (unsigned long)r.sent, (unsigned long)r.bad, (unsigned long)r.lost);
+            }
+        }
+        uart_driver_delete(PORT);
+    }
+
+    static void benchTask(void *arg)
+    {
+        run((uint32_t)(uintptr_t)arg);
+        busy = false;
+        vTaskDelete(NULL);
+    }
+
+    bool start(uint32_t kbytes)
+    {
+        if (busy)
+            return false;
+        const uint32_t frames = std::max<uint32_t>(1, kbytes * 1024 / FRAME_SIZE);
+        busy = true;
+        if (xTaskCreate(benchTask, "linkBench", 4096, (void *)(uintptr_t)frames, 2, NULL) != pdPASS)
+        {
+            busy = false;
+            return false;
+        }
+        return true;
+    }
+
+    bool running()
+    {
+        return busy;
+    }
+
+    uint8_t results(const Result_t *&out)
+    {
+        out = lastResults;
+        return busy ? 0 : resultCount;
+    }
+}
@@ -0,0 +1,46 @@
+/**
+ * @file linkBench.hpp
+ * @author rami zayat
+ * @brief UART loopback throughput and error rate at the modem link rates
+ * @version 0.1
+ * @date 2025-12-12
+ *
+ * @copyright Copyright (c) 2025
+ *
+ * Runs on the spare UART2 in internal loopback, TX to RX and RTS to CTS, with the driver
+ * buffers of the modem link, so no pin and no modem is involved. For each standard rate up
+ * to CONFIG_MODEM_UART_BAUD_RATE, without and with RTS/CTS, a writer task sends numbered
+ * frames with a CRC32 while the bench task reads them back. A frame with a bad CRC counts
+ * as an error, a gap in the sequence as lost, e.g. an RX buffer overflow.
+ *
+ * Started with the "modem bench" command, the results are logged and kept for "modem get".
+ */
+#pragma once
+#include <stdint.h>
+
+namespace linkBench
+{
+    static const uint8_t MAX_RESULTS = 12; // 6 rates, without and with flow control
+
+    typedef struct
+    {
+        uint32_t baud;
+        bool flow;        // RTS/CTS
+        uint32_t kbps;    // payload of the good frames over the time from first write to last read
+        uint32_t sent;    // frames
+        uint32_t ok;
+        uint32_t bad;     // CRC mismatch
+        uint32_t lost;    // sequence gaps and frames never seen
+    } Result_t;
+
+    /**
+     * @brief start the bench in its own task
+     * @param kbytes data sent per rate and flow control setting
+     * @return false if a bench is already running or the task could not be created
+     */
+    bool start(uint32_t kbytes);
+    bool running();
+
+    // results of the last run, valid until the next start()
+    uint8_t results(const Result_t *&out);
+}
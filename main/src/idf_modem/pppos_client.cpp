@@ -15,12 +15,135 @@
 #include "esp_log.h"
 #include "esp_event.h"
 #include "power/power.hpp"
+#include "power/pm.hpp"
+#include "power/wakeProfile.hpp"
 #include "driver/rtc_io.h"
+#include "Preferences.h"
+#include "driver/uart.h"
 #include <thread>
 
 using namespace esp_modem;
 std::thread init_async_thread;
 static ModemSim7670::SleepMode_t RTC_DATA_ATTR SleepMODE = ModemSim7670::SleepMode_t::UNKNOWN;
+static ModemSim7670::GnssCache_t RTC_DATA_ATTR gnssCache;
+static const time_t GNSS_HOT_MAX_AGE_S = 2 * 3600;       // broadcast ephemeris validity
+static const time_t GNSS_WARM_MAX_AGE_S = 7 * 24 * 3600; // XTRA / almanac validity
+static uint32_t RTC_DATA_ATTR modemBaud = 0;               // last baud rate the modem answered at
+static uint32_t RTC_DATA_ATTR modemBaudCap = 0;            // highest rate that passed the link check
+// the UART baud comes from APB, held from init until the modem sleeps or is shut down
+static pm::Lock modemLock("modem", ESP_PM_APB_FREQ_MAX);
+
+static void loadGnssCache()
+{
+    if (gnssCache.valid)
+    {
+        return;
+    }
+    Preferences pref;
+    if (pref.begin("gnss", true))
+    {
+        if (pref.getBytesLength("last") == sizeof(gnssCache))
+        {
+            pref.getBytes("last", &gnssCache, sizeof(gnssCache));
+        }
+        pref.end();
+    }
+}
+
+static void saveGnssCache()
+{
+    Preferences pref;
+    if (pref.begin("gnss", false))
+    {
+        pref.putBytes("last", &gnssCache, sizeof(gnssCache));
+        pref.end();
+    }
+}
+
+static gnss_start_mode_t gnssStartMode()
+{
+    loadGnssCache();
+    if (!gnssCache.valid)
+    {
+        return gnss_start_mode_t::COLD;
+    }
+    const time_t now = time(nullptr);
+    if (now < gnssCache.utc)
+    {
+        return gnss_start_mode_t::WARM; // system clock not set yet, age unknown
+    }
+    const time_t age = now - gnssCache.utc;
+    if (age <= GNSS_HOT_MAX_AGE_S)
+    {
+        return gnss_start_mode_t::HOT;
+    }
+    return age <= GNSS_WARM_MAX_AGE_S ? gnss_start_mode_t::WARM : gnss_start_mode_t::COLD;
+}
+
+// the modem keeps AT+IPR across power cycles, so the rate is remembered across resets too
+static uint32_t loadModemBaud()
+{
+    if (modemBaud == 0)
+    {
+        Preferences pref;
+        if (pref.begin("modem", true))
+        {
+            modemBaud = pref.getUInt("baud", 0);
+            pref.end();
+        }
+    }
+    return modemBaud ? modemBaud : CONFIG_MODEM_UART_BAUD_RATE;
+}
+
+static void saveModemBaud(uint32_t baud)
+{
+    if (baud == modemBaud)
+    {
+        return;
+    }
+    modemBaud = baud;
+    Preferences pref;
+    if (pref.begin("modem", false))
+    {
+        pref.putUInt("baud", baud);
+        pref.end();
+    }
+}
+
+// rates above the ceiling failed the link check before and are not probed again, the ceiling
+// is kept per configured target so a new target starts from the top
+static uint32_t loadBaudCap()
+{
+    if (modemBaudCap == 0)
+    {
+        Preferences pref;
+        if (pref.begin("modem", true))
+        {
+            if (pref.getUInt("baud_cfg", 0) == CONFIG_MODEM_UART_BAUD_RATE)
+            {
+                modemBaudCap = pref.getUInt("baud_cap", 0);
+            }
+            pref.end();
+        }
+    }
+    return modemBaudCap ? modemBaudCap : CONFIG_MODEM_UART_BAUD_RATE;
+}
+
+static void saveBaudCap(uint32_t baud)
+{
+    if (baud == modemBaudCap)
+    {
+        return;
+    }
+    modemBaudCap = baud;
+    Preferences pref;
+    if (pref.begin("modem", false))
+    {
+        pref.putUInt("baud_cfg", CONFIG_MODEM_UART_BAUD_RATE);
+        pref.putUInt("baud_cap", baud);
+        pref.end();
+    }
+}
 
 class StatusHandler
 {
@@ -116,6 +239,7 @@ bool ModemSim7670::init()
     {
         return true;
     }
+    wakeProfile::Span span(wakeProfile::MODEM);
     /* Init and register system/core components */
     pinMode(BOARD_MODEM_PWR_PIN, OUTPUT);
     digitalWrite(BOARD_MODEM_PWR_PIN, HIGH);
@@ -124,12 +248,21 @@ bool ModemSim7670::init()
     esp_event_loop_create_default();
     esp_err_t esp_err = esp_netif_init();
     dte_config = ESP_MODEM_DTE_DEFAULT_CONFIG();
-    dte_config.uart_config.baud_rate = 460800;
+    link_baud = loadModemBaud();
+    dte_config.uart_config.baud_rate = link_baud;
     dte_config.uart_config.tx_io_num = BOARD_MODEM_RXD_PIN;
     dte_config.uart_config.rx_io_num = BOARD_MODEM_TXD_PIN;
-    dte_config.uart_config.rts_io_num = -1;
-    dte_config.uart_config.cts_io_num = -1;
+    // RTS/CTS are only routed by enableFlowControl(), once the modem uses flow control too
+    dte_config.uart_config.rts_io_num = uart_rts_pin;
+    dte_config.uart_config.cts_io_num = uart_cts_pin;
     dte_config.uart_config.flow_control = ESP_MODEM_FLOW_CONTROL_NONE;
+    dte_config.uart_config.rx_buffer_size = CONFIG_MODEM_UART_RX_BUFFER_SIZE;
+    dte_config.uart_config.tx_buffer_size = CONFIG_MODEM_UART_TX_BUFFER_SIZE;
+    dte_config.uart_config.event_queue_size = CONFIG_MODEM_UART_EVENT_QUEUE_SIZE;
+    dte_config.dte_buffer_size = CONFIG_MODEM_DTE_BUFFER_SIZE;
+    flow_control = false;
+    if (!modemLock.held())
+        modemLock.acquire();
     dte = create_uart_dte(&dte_config);
     assert(dte);
     netif_ppp_config = ESP_NETIF_DEFAULT_PPP();
@@ -158,7 +291,7 @@ bool ModemSim7670::init()
     {
         delay(200);
     }
-    if (dce->sync() != command_result::OK)
+    if (dce->sync() != command_result::OK && findModemBaud() == 0)
     {
         ESP_LOGE(TAG, "Cannot sync modem");
         this->shutdown();
@@ -167,6 +300,9 @@ bool ModemSim7670::init()
     ESP_LOGI(TAG, "modem terminal ready.");
     auto end = millis();
     ESP_LOGI(TAG, "modem on after %d ms", end - now);
+    tuneLink();
+    enableFlowControl();
+    ESP_LOGI(TAG, "modem link %lu baud, %s", (unsigned long)link_baud, flow_control ? "RTS/CTS" : "no flow control");
     bool pin_ok = true;
     if (dce->read_pin(pin_ok) == command_result::OK)
     {
@@ -177,9 +313,11 @@ bool ModemSim7670::init()
             return false;
         }
     }
-    dce->set_functionality_level(functionality_level_t::FULL);
+    // radio on and auto answer after 2 rings in one round trip
+    std::vector<command_result> results;
+    dce->send_batch({"+CFUN=1,0", "S0=2"}, results);
     std::string str;
-    dce->at("AT+CPMVT=0\r", str, 4000); // set NO LOW VOLTAGE // something not OK ( battery pin ?)
+    dce->at("AT+CPMVT=0\r", str, 4000); // set NO LOW VOLTAGE // something not OK ( battery pin ?) , kept out of the batch so its ERROR does not force a retry
     str = "";
     now = millis();
     timeout = 60U * 1000U;
@@ -212,7 +350,6 @@ bool ModemSim7670::init()
     {
         std::cout << "Modem IMSI number:" << str << std::endl;
     }
-    dce->set_auto_answer(2);
     res = esp_modem::command_result::FAIL;
     initialized = true;
     return true;
@@ -239,6 +376,129 @@ bool ModemSim7670::GetNetworkTime(uint8_t timeout_seconds, struct tm &timeinfo)
     return true;
 }
 
+uint32_t ModemSim7670::getLinkBaud()
+{
+    return dce ? link_baud : 0;
+}
+
+bool ModemSim7670::setHostBaud(uint32_t baud)
+{
+    if (uart_set_baudrate(dte_config.uart_config.port_num, baud) != ESP_OK)
+    {
+        return false;
+    }
+    delay(20);
+    uart_flush_input(dte_config.uart_config.port_num);
+    link_baud = baud;
+    return true;
+}
+
+bool ModemSim7670::linkStable()
+{
+    // a few short round trips and one longer reply, framing errors show up as failed parses
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        if (dce->sync() != command_result::OK)
+        {
+            return false;
+        }
+    }
+    std::string name;
+    return dce->get_module_name(name) == command_result::OK && !name.empty();
+}
+
+uint32_t ModemSim7670::findModemBaud()
+{
+    if (setHostBaud(loadModemBaud()) && dce->sync() == command_result::OK)
+    {
+        return link_baud;
+    }
+    for (uint32_t baud : BAUD_RATES)
+    {
+        if (baud != modemBaud && setHostBaud(baud) && dce->sync() == command_result::OK && dce->sync() == command_result::OK)
+        {
+            ESP_LOGI(TAG, "modem found at %lu baud", (unsigned long)baud);
+            saveModemBaud(baud);
+            return baud;
+        }
+    }
+    return 0;
+}
+
+void ModemSim7670::tuneLink()
+{
+    // highest standard rate up to the configured one and the remembered ceiling that passes the stability check
+    const uint32_t cap = loadBaudCap();
+    bool stable = false;
+    for (uint32_t baud : BAUD_RATES)
+    {
+        if (baud > CONFIG_MODEM_UART_BAUD_RATE || baud > cap)
+        {
+            continue;
+        }
+        if (baud == link_baud)
+        {
+            stable = true; // already there, the link is known to work
+            break;
+        }
+        std::vector<command_result> results;
+        if (dce->send_batch({"+IPR=" + std::to_string(baud)}, results, 1000) != command_result::OK)
+        {
+            continue;
+        }
+        const uint32_t previous = link_baud;
+        setHostBaud(baud);
+        if (linkStable())
+        {
+            ESP_LOGI(TAG, "modem link %lu -> %lu baud", (unsigned long)previous, (unsigned long)baud);
+            stable = true;
+            break;
+        }
+        ESP_LOGW(TAG, "modem link not stable at %lu baud", (unsigned long)baud);
+        if (findModemBaud() == 0)
+        {
+            ESP_LOGE(TAG, "modem lost while tuning the link");
+            return;
+        }
+    }
+    saveModemBaud(link_baud);
+    if (stable)
+    {
+        saveBaudCap(link_baud);
+    }
+}
+
+void ModemSim7670::enableFlowControl()
+{
+    if (uart_rts_pin < 0 || uart_cts_pin < 0)
+    {
+        ESP_LOGI(TAG, "no RTS/CTS wired, modem link without flow control");
+        return;
+    }
+    // the DTE is created without flow control, so esp_modem left RTS/CTS unrouted
+    if (uart_set_pin(dte_config.uart_config.port_num, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE, uart_rts_pin, uart_cts_pin) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "cannot route RTS/CTS to %d/%d", uart_rts_pin, uart_cts_pin);
+        return;
+    }
+    std::vector<command_result> results;
+    if (dce->send_batch({"+IFC=2,2"}, results, 1000) != command_result::OK)
+    {
+        ESP_LOGW(TAG, "modem refused hardware flow control");
+        return;
+    }
+    uart_set_hw_flow_ctrl(dte_config.uart_config.port_num, UART_HW_FLOWCTRL_CTS_RTS, SOC_UART_FIFO_LEN - 8);
+    if (!linkStable())
+    {
+        ESP_LOGW(TAG, "link not stable with RTS/CTS, falling back to no flow control");
+        uart_set_hw_flow_ctrl(dte_config.uart_config.port_num, UART_HW_FLOWCTRL_DISABLE, 0);
+        dce->send_batch({"+IFC=0,0"}, results, 1000);
+        return;
+    }
+    flow_control = true;
+    ESP_LOGI(TAG, "modem link with RTS/CTS flow control");
+}
+
 std::unique_ptr<DCE_gnss> &ModemSim7670::GetDce()
 {
     return dce;
@@ -257,15 +517,66 @@ bool ModemSim7670::EnableGnss(bool enable)
     }
     if (enable)
     {
-        return dce->set_gnss_power_mode(false) == command_result::OK;
+        if (gnss_enabled)
+        {
+            return true;
+        }
+        dce->enable_gnss_xtra(true); // must be set while the engine is off
+        if (dce->set_gnss_power_mode(false) != command_result::OK)
+        {
+            return false;
+        }
+        gnss_enabled = true;
+        gnss_start_ms = millis();
+        gnssCache.start_mode = gnssStartMode();
+        dce->set_gnss_start_mode(gnssCache.start_mode);
+        ESP_LOGI(TAG, "gnss start mode %d", (int)gnssCache.start_mode);
+        return true;
     }
-    else
+    gnss_enabled = false;
+    return dce->set_gnss_power_mode(true) == command_result::OK;
+}
+
+bool ModemSim7670::waitGnssFix(sim76xx_gps_t &gps, uint16_t timeout_seconds, float max_hdop)
+{
+    if (!dce || !initialized)
     {
-        return dce->set_gnss_power_mode(true) == command_result::OK;
+        return false;
     }
+    if (!EnableGnss(true))
+    {
+        return false;
+    }
+    auto now = millis();
+    while ((millis() - now) < (timeout_seconds * 1000U))
+    {
+        if (dce->get_gnss_information_sim76xx(gps) == esp_modem::command_result::OK &&
+            gps.fix != GPS_FIX_INVALID && gps.fix_mode != GPS_MODE_INVALID &&
+            gps.dop_h > 0.0f && gps.dop_h <= max_hdop)
+        {
+            gnssCache.valid = true;
+            gnssCache.latitude = gps.latitude;
+            gnssCache.longitude = gps.longitude;
+            gnssCache.altitude = gps.altitude;
+            gnssCache.utc = gps.utc_epoch() ? gps.utc_epoch() : time(nullptr);
+            gnssCache.ttff_ms = millis() - gnss_start_ms;
+            saveGnssCache();
+            ESP_LOGI(TAG, "gnss fix after %lu ms, start mode %d, hdop %.1f, sats %d",
+                     (unsigned long)gnssCache.ttff_ms, (int)gnssCache.start_mode, gps.dop_h, gps.sat.num);
+            return true;
+        }
+        delay(1000);
+    }
+    ESP_LOGW(TAG, "no gnss fix within %d s", timeout_seconds);
     return false;
 }
 
+const ModemSim7670::GnssCache_t &ModemSim7670::getGnssCache()
+{
+    loadGnssCache();
+    return gnssCache;
+}
+
 bool ModemSim7670::get_gnss(sim76xx_gps_t &gps, uint16_t timeout_seconds)
 {
     if (!dce || !initialized)
@@ -328,6 +639,7 @@ bool ModemSim7670::shutdown()
     digitalWrite(BOARD_MODEM_PWR_PIN, LOW);
     Serial.println("modem shutdown");
     initialized = false;
+    modemLock.release();
     return true;
 }
 
@@ -338,26 +650,32 @@ bool ModemSim7670::sleep(SleepMode_t mode)
         return false;
     }
     SleepMODE = mode;
-    this->EnableGnss(false);
+    if (gnss_enabled)
+    {
+        this->EnableGnss(false);
+    }
     switch (mode)
     {
     case SLEEP:
     {
-        dce->enable_terminal_sleep_mode(true);
+        // CSCLK only lets the modem sleep once DTR goes high, so CFUN still runs on the same line
+        std::vector<command_result> results;
+        dce->send_batch({"+CSCLK=1", "+CFUN=0,0"}, results);
         dce->wake_via_dtr(false);
-        dce->set_functionality_level(functionality_level_t::MINIMUM);
         initialized = false;
+        modemLock.release();
         ESP_LOGI(TAG, "modem sleep");
         break;
     }
     case INTERRUPT_READY:
     {
-        dce->set_ring_indicator_mode(ring_indicator_mode_t::SMS_CALL_ONLY);
-        dce->enable_terminal_sleep_mode(true);
+        std::vector<command_result> results;
+        dce->send_batch({"+CFGRI=0", "+CSCLK=1"}, results, 1000);
         dce->wake_via_dtr(false);
         gpio_wakeup_enable((gpio_num_t)BOARD_MODEM_RI_PIN, GPIO_INTR_LOW_LEVEL);
         esp_sleep_enable_gpio_wakeup();
         initialized = false;
+        modemLock.release(); // RI wakes the chip from light sleep
         ESP_LOGI(TAG, "modem sleep INTERRUPT_READY");
         break;
     }
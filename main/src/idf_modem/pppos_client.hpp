@@ -27,7 +27,7 @@ class StatusHandler;
 class ModemSim7670
 {
 public:
-    ModemSim7670(int uart_rx_pin = BOARD_MODEM_RXD_PIN, int uart_tx_pin = BOARD_MODEM_TXD_PIN, int dtr_pin = BOARD_MODEM_DTR_PIN, int uart_rts_pin = -1, int uart_cts_pin = -1);
+    ModemSim7670(int uart_rx_pin = BOARD_MODEM_RXD_PIN, int uart_tx_pin = BOARD_MODEM_TXD_PIN, int dtr_pin = BOARD_MODEM_DTR_PIN, int uart_rts_pin = CONFIG_MODEM_UART_RTS_PIN, int uart_cts_pin = CONFIG_MODEM_UART_CTS_PIN);
 
     ~ModemSim7670();
     
@@ -42,6 +42,18 @@ public:
 
     } SleepMode_t;
 
+    // last good fix, kept in RTC memory and NVS to pick the GNSS start mode
+    typedef struct GnssCache
+    {
+        bool valid;
+        float latitude;
+        float longitude;
+        float altitude;
+        time_t utc;       // fix time, unix epoch
+        uint32_t ttff_ms; // time to first fix of the session that produced it
+        gnss_start_mode_t start_mode;
+    } GnssCache_t;
+
     bool init();
     void initAsync();
 
@@ -53,6 +65,11 @@ public:
 
     bool get_gnss(sim76xx_gps_t &gps, uint16_t timeout_seconds);
 
+    // poll until a 2D/3D fix with hdop <= max_hdop, records time to first fix in the cache
+    bool waitGnssFix(sim76xx_gps_t &gps, uint16_t timeout_seconds, float max_hdop = 5.0f);
+
+    const GnssCache_t &getGnssCache();
+
     bool shutdown();
 
     bool wakeupDTR(bool wake);
@@ -69,7 +86,20 @@ public:
 
     bool sleep(SleepMode_t mode);
 
+    // baud rate the UART link currently runs at, 0 before init
+    uint32_t getLinkBaud();
+
+    // standard rates tried for the link, fastest first
+    static constexpr uint32_t BAUD_RATES[] = {3686400, 3000000, 921600, 460800, 230400, 115200};
+
 private:
+    // UART link tuning, see the "Modem UART link" menu
+    bool setHostBaud(uint32_t baud);
+    bool linkStable();
+    uint32_t findModemBaud();
+    void tuneLink();
+    void enableFlowControl();
+
     /* Configure and create the DTE */
     esp_modem_dte_config_t dte_config = {};
     esp_modem_dce_config_t dce_config = {};
@@ -77,6 +107,7 @@ private:
     esp_netif_config_t netif_ppp_config = {};
     bool initialized = false;
     bool gnss_enabled = false;
+    uint32_t gnss_start_ms = 0;
     esp_netif_t *esp_netif = nullptr;
     std::unique_ptr<DCE_gnss> dce = nullptr;
     int uart_rx_pin = -1;
@@ -84,6 +115,8 @@ private:
     int uart_rts_pin = -1;
     int uart_cts_pin = -1;
     int dtr_pin = -1;
+    uint32_t link_baud = 0;
+    bool flow_control = false;
     const char *TAG = "modem-pppos";
 };
 
@@ -31,8 +31,10 @@
 #include "pins.hpp"
 #include <atomic>
 #include "power/power.hpp"
+#include "power/pm.hpp"
 #include <Preferences.h>
 #include "imu6500/motionCalc.hpp"
+#include "system.hpp"
 
 namespace imu6500_dmp
 {
@@ -59,6 +61,11 @@ namespace imu6500_dmp
   // Motion detection state
   // Baseline linear acceleration (gravity removed) in g's
   static baseline_t baseline;
+  // the IMU keeps its WOM configuration through deep sleep, set by imu_setup(WOM), cleared by any other setup
+  static RTC_DATA_ATTR bool womArmed = false;
+  static const uint8_t INT_STATUS_REG = 0x3A;
+  // FIFO drains run at the maximum clock and end sooner, the chip sleeps again in between
+  static pm::Lock fifoLock("imu_fifo", ESP_PM_CPU_FREQ_MAX);
   float dax = 0.0f, day = 0.0f, daz = 0.0f, droll = 0.0f, dyaw = 0.0f, dpitch = 0.0f;
   float qf[4];
   uint16_t calibrationDebounce = 0;
@@ -88,6 +95,7 @@ namespace imu6500_dmp
         if (res == pdTRUE)
         {
           IMUInterrupt = false;
+          pm::Guard busy(fifoLock);
           mpu6500_dmp_irq_handler();
           xSemaphoreGive(wireMutex);
         }
@@ -110,6 +118,7 @@ namespace imu6500_dmp
       globalMotion.ts = millis();
       lastMoved_timestamp = millis();
       xSemaphoreGive(getterSem);
+      postSystemEvent(EVENT_MOTION);
       break;
     }
     case MPU6500_INTERRUPT_DMP:
@@ -147,8 +156,21 @@ namespace imu6500_dmp
     mpu6500_dmp_deinit();
     xSemaphoreGive(wireMutex);
     ImuMode = NA;
+    womArmed = false;
     return true;
   }
+
+  bool clearWakeInterrupt()
+  {
+    if (!womArmed || mpu6500_interface_iic_init() != 0)
+      return false;
+    // the interrupt is latched and cleared by reading its status, the pin must be released before sleeping again
+    uint8_t status = 0;
+    const bool ok = mpu6500_interface_iic_read(MPU6500_ADDRESS_AD0_LOW, INT_STATUS_REG, &status, 1) == 0;
+    mpu6500_interface_iic_deinit();
+    pinMode(MOTION_INTRRUPT_PIN, INPUT);
+    return ok && digitalRead(MOTION_INTRRUPT_PIN) == HIGH;
+  }
   void powerCycle()
   {
   }
@@ -167,6 +189,7 @@ namespace imu6500_dmp
     LoadImuPreferences();
     /*Verify connection*/
     ImuMode = mode;
+    womArmed = false;
     Serial.println(F("starting MPU6050 connection..."));
     if (ImuMode == WOM)
     {
@@ -198,6 +221,10 @@ namespace imu6500_dmp
       {
         Serial.println("MPU6050 WOM successful");
       }
+#if CONFIG_MOTION_WAKE_STUB
+      // the wake stub cannot clear a latched interrupt over I2C, a 50 us pulse releases the pin by itself
+      mpu6500_set_interrupt_latch(mpu6500_get_handle(), MPU6500_BOOL_FALSE);
+#endif
     }
     else
     {
@@ -225,8 +252,9 @@ namespace imu6500_dmp
     }
     detachInterrupt(MOTION_INTRRUPT_PIN);
     pinMode(MOTION_INTRRUPT_PIN, INPUT);
-    attachInterrupt(MOTION_INTRRUPT_PIN, IMUDataInterrupt, FALLING);
+    pm::attachWakeInterrupt(MOTION_INTRRUPT_PIN, IMUDataInterrupt, FALLING);
     imu_dmp_loop = true;
+    womArmed = ImuMode == WOM;
     xTaskCreate(imu_Interrupt_loop, "IMU", 4096, NULL, 3, NULL);
 
     return true;
@@ -242,6 +270,8 @@ namespace imu6500_dmp
   // Exposed function to report motion. Returns true once if motion detected since last call.
   MotionDtect_t getMotion()
   { // Atomically consume the flag
+    if (getterSem == NULL)
+      return MotionDtect_t(); // not set up, e.g. on a fast timer wake
     xSemaphoreTake(getterSem, pdMS_TO_TICKS(30));
     MotionDtect_t str = globalMotion;
     globalMotion.reset();
@@ -506,6 +536,7 @@ namespace imu6500_dmp
           if (globalMotion)
           {
             lastMoved_timestamp = millis();
+            postSystemEvent(EVENT_MOTION);
             if (droll > 1 || dpitch > 1 || dyaw > 1 || dax > 0.1f || day > 0.1f || daz > 0.1f)
             {
               if (calibrationDebounce++ > 15)
@@ -56,6 +56,8 @@ namespace imu6500_dmp
   baseline_t getbaseline();
   bool setupLowPowerMode();
   bool shutdown();
+  // release the latched wake-on-motion pin without a full setup, false if the IMU is not known to be in WOM
+  bool clearWakeInterrupt();
   bool restart(imuSetupType mode);
   bool SetWakeOnMotionThresh(float val);
   bool set_wom_lpf(mpu6500_accelerometer_low_pass_filter_t lp);
@@ -24,16 +24,32 @@
 #include "system.hpp"
 #include "CarBattery/CarBattery.hpp"
 #include "wifi/mqtt_client.hpp"
+#include "outbox/outbox.hpp"
+#include "track/trackLog.hpp"
+#include "track/trackSimplify.hpp"
+#include "spool/spool.hpp"
+#include "telemetry/telemetry.hpp"
+#include "publisher/publisher.hpp"
+#include "power/schedule.hpp"
+#include "power/pm.hpp"
+#include "power/wakeProfile.hpp"
 
 bool simulatedMotionTrigger = false;
 bool simulatedLowPowerTrigger = false;
 bool simulatedCriticalLowPowerTrigger = false;
+volatile bool remoteGnssRequest = false;       // set by the MQTT command handler, posted from the main loop
+char remoteGnssDest[outbox::MAX_DEST] = "";
 bool ota_needValidation = false;
 uint64_t LastWifiOnTimestamp = 0;
 uint32_t RTC_DATA_ATTR motionCounter;
 uint32_t RTC_DATA_ATTR motionOngoing;
-uint32_t OTA_VALIDATION_COUNTER = 0;
+uint32_t RTC_DATA_ATTR motionStartTs; // start of the ongoing motion episode, unix time
 CarBattery carBattery;
+static const char *OWNER_NUMBER = "0758829590";
+static const uint32_t MOTION_ALERT_DELAY_S = 2U * 60U; // motion alerts wait this long to be batched with the episode summary
+static const uint32_t OUTBOX_RETRY_MS = 60U * 1000U;   // while awake, a failed outbox flush is retried this often
+static const uint32_t LOOP_IDLE_MS = 1000;              // loop() runs at least this often without events, for its timeouts
+static const uint32_t OTA_VALIDATION_MS = 20U * 1000U;  // uptime before a new image is marked valid
 
 static inline bool NoMotionSince(const uint32_t timeout)
 {
@@ -42,7 +58,7 @@ static inline bool NoMotionSince(const uint32_t timeout)
 
 static inline bool NoVbusSince(const uint32_t timeout)
 {
-    return (millis() - power::getLastVbusRemovedTs() > timeout);
+    return !power::isPowerVBUSOn() && (power::rtcMillis() - power::getLastVbusRemovedTs() > timeout);
 }
 
 void CheckMotionCount()
@@ -55,9 +71,90 @@ void CheckMotionCount()
     }
 }
 
+// snapshots are spaced out while the car battery drains towards its low threshold
+static uint32_t snapshotInterval()
+{
+    return carBattery.stretchInterval((uint32_t)getSnapShotTime());
+}
+
+// periodic jobs keep their deadline across wakes and may run early on a wake another job paid for,
+// the outbox deadline follows its queue. On a low battery only the battery is watched until VBUS is back
+static void scheduleSleepJobs()
+{
+    if (power::isBatLowLevel())
+    {
+        schedule::clearAll(schedule::bit(schedule::BATTERY_CHECK));
+        schedule::ensure(schedule::BATTERY_CHECK, getBatteryCheckTime());
+        return;
+    }
+    schedule::ensure(schedule::SNAPSHOT, snapshotInterval());
+    schedule::ensure(schedule::TELEMETRY_UPLOAD, getUploadTime(), getUploadTime() / 4);
+    schedule::ensure(schedule::GNSS_REFRESH, getGnssTime(), getGnssTime() / 4);
+    schedule::ensure(schedule::BATTERY_CHECK, getBatteryCheckTime(), getBatteryCheckTime() / 2);
+    const int32_t due = outbox::secondsUntilDue();
+    if (due >= 0)
+        schedule::set(schedule::OUTBOX_FLUSH, max(due, (int32_t)1) * 1000U);
+    else
+        schedule::clear(schedule::OUTBOX_FLUSH);
+}
+
+static void flushOutboxIfDue()
+{
+    const bool upload = (schedule::expired() & schedule::bit(schedule::TELEMETRY_UPLOAD)) && publisher::pending() > 0;
+    if ((outbox::isDue() || upload) && power::isBatLowLevel() == false)
+    {
+        wakeProfile::flush(true); // the modem is powered anyway, send the profiles with the rest
+        outbox::flush(modem);
+    }
+}
+
+// jobs collected at boot, run by the wakes that go back to sleep, the modem work is left to flushOutboxIfDue()
+static void runExpiredJobs()
+{
+    const uint32_t jobs = schedule::expired();
+    if (jobs & schedule::bit(schedule::SNAPSHOT))
+    {
+        builtinLed.setFade(0, LedStrip::_rgb(50, 50, 50), 0, 1000, 2);
+        mqttLogger.println("wake FROM Timer for snapshot...");
+        delay(2500);
+    }
+    if (jobs & schedule::bit(schedule::AFTER_MOTION))
+    {
+        motionCounter++;
+        motionOngoing = false;
+        telemetry::publishMotion(motionCounter, (uint16_t)std::min<time_t>(time(nullptr) - motionStartTs, UINT16_MAX), false);
+        builtinLed.setFade(0, LedStrip::_rgb(50, 50, 50), 0, 500, 0, 5000);
+        mqttLogger.println("wake FROM Timer after no motion .. turn off Cam");
+        delay(500);
+        if (power::isBatLowLevel() == false)
+        {
+            char sms[96];
+            snprintf(sms, sizeof(sms), "motion detection done, counter=%lu. batt:%.1f%%, v=%.1f", (unsigned long)motionCounter, power::getCellPercent(), power::getCellVoltage());
+            mqttLogger.println(sms);
+            outbox::post(outbox::Kind::SMS, outbox::Key::NONE, OWNER_NUMBER, sms);
+        }
+    }
+    if (jobs & schedule::bit(schedule::BATTERY_CHECK))
+    {
+        mqttLogger.printf("battery check %.1f%%, %.3f v\n", power::getCellPercent(), power::getCellVoltage());
+        telemetry::publishBattery(power::getCellPercent(), power::getCellVoltage(), 0.0f,
+                                  (power::isBatLowLevel() ? telemetry::BAT_LOW : 0) | (power::isBatCriticalLevel() ? telemetry::BAT_CRITICAL : 0), true);
+    }
+    if ((jobs & schedule::bit(schedule::GNSS_REFRESH)) && power::isBatLowLevel() == false)
+    {
+        outbox::post(outbox::Kind::GNSS, outbox::Key::GNSS_TRACK, "", "", outbox::Priority::URGENT);
+    }
+    if (jobs & schedule::bit(schedule::OUTBOX_FLUSH))
+    {
+        mqttLogger.println("wake FROM Timer for outbox flush");
+    }
+}
+
 void handleWakeup()
 {
     power::WakeUpReason_t wu = power::Get_wake_reason();
+    telemetry::publishWake(wu, (uint8_t)schedule::expired());
+    wakeProfile::flush(false); // only once the RTC ring is nearly full, queuing costs a flash write
     switch (wu)
     {
     case power::WakeUpReason_t::UNKNOWN:
@@ -91,18 +188,19 @@ void handleWakeup()
             // power::Sleep_EnablePinWakeup(power::WakeUpPin_t::START_PIN);
             if (power::isBatLowLevel())
             {
+                scheduleSleepJobs();
                 power::DeepSleep(); // dont keep waking up for new motion !
             }
             else
             {
-                if (motionOngoing == false)
-                {
-                    motionOngoing = true;
-                    modem.init();
-                    modem.sendSMS("0758829590", "Motion detected!");
-                    modem.shutdown();
-                }
-                power::Sleep_EnableTimer(power::AFTER_MOTION, getNoMotionTimeout());
+                if (!motionOngoing)
+                    motionStartTs = time(nullptr);
+                motionOngoing = true;
+                runExpiredJobs();
+                outbox::post(outbox::Kind::SMS, outbox::Key::MOTION, OWNER_NUMBER, "Motion detected!", outbox::Priority::NORMAL, MOTION_ALERT_DELAY_S);
+                flushOutboxIfDue();
+                schedule::set(schedule::AFTER_MOTION, getNoMotionTimeout());
+                scheduleSleepJobs();
                 power::Sleep_EnablePinWakeup(power::WakeUpPin_t::MOTION_PIN);
                 power::DeepSleep(); // wake up and reset timer if new motion is detected before expires
             }
@@ -115,49 +213,16 @@ void handleWakeup()
         mqttLogger.println("wake FROM TIMER");
         if (!imu6500_dmp::getMotion() && !power::isPowerVBUSOn())
         {
-            switch (power::getTimerWakeReason())
-            {
-            case power::SLEEP_SNAP_SHOT:
-            {
-                builtinLed.setFade(0, LedStrip::_rgb(50, 50, 50), 0, 1000, 2);
-                mqttLogger.println("wake FROM Timer for snapshot...");
-                delay(2500);
-                break;
-            }
-            case power::AFTER_MOTION:
-            {
-                motionCounter++;
-                motionOngoing = false;
-                builtinLed.setFade(0, LedStrip::_rgb(50, 50, 50), 0, 500, 0, 5000);
-                mqttLogger.println("wake FROM Timer after no motion .. turn off Cam");
-                delay(500);
-                if (power::isBatLowLevel() == false)
-                {
-                    // here try wakeup modem and send SMS
-                    modem.init();
-                    std::stringstream ss;
-                    ss << std::fixed << std::setprecision(1);
-                    ss << ("motion detection done, counter=") << (motionCounter) << (". batt:") << (power::getCellPercent()) << ("%, v=") << power::getCellVoltage();
-                    const std::string &sms = ss.str();
-                    mqttLogger.println(sms.c_str());
-                    modem.sendSMS("0758829590", sms.c_str());
-                    modem.shutdown();
-                }
-                break;
-            }
-            default:
-            {
-                break;
-            }
-            }
+            runExpiredJobs();
             turnOffCamera();
+            flushOutboxIfDue();
 
             if (power::isBatLowLevel())
                 builtinLed.setSolid(0, LedStrip::_rgb(2, 0, 0)); // turn off led before sleep
             else
                 builtinLed.setSolid(0, LedStrip::_rgb(0, 0, 2)); // turn off led before sleep
             delay(50);
-            power::Sleep_EnableTimer(power::SLEEP_SNAP_SHOT, getSnapShotTime());
+            scheduleSleepJobs();
             power::Sleep_EnablePinWakeup(power::WakeUpPin_t::MOTION_PIN);
             // power::Sleep_EnablePinWakeup(power::WakeUpPin_t::START_PIN);
             power::DeepSleep();
@@ -170,34 +235,42 @@ void handleWakeup()
         {
             // here try wakeup modem and send SMS
             modem.init();
-            std::list<sms_t> sms_list;
-            modem.GetDce()->get_unread_sms_list(sms_list);
-            if (sms_list.size() > 0)
+            // one listing and one bulk delete for the whole inbox, requests from the owner get a single answer
+            std::string request;
+            bool ownerRequest = false;
+            modem.GetDce()->list_sms(sms_list_status_t::UNREAD, [&](const sms_view_t &sms)
+                                     {
+                                         ESP_LOGI("sms", " sms index %d ts : %.*s received from %.*s , content %.*s  ", sms.index, (int)sms.timestamp.size(), sms.timestamp.data(),
+                                                  (int)sms.sender.size(), sms.sender.data(), (int)sms.content.size(), sms.content.data());
+                                         if (sms.sender == OWNER_NUMBER)
+                                         {
+                                             ownerRequest = true;
+                                             request.assign(sms.content.data(), sms.content.size());
+                                         }
+                                         return true; });
+            // listing marked the messages as read, anything that arrived since stays unread
+            modem.GetDce()->delete_all_sms(sms_delete_flag_t::READ);
+            if (ownerRequest)
             {
-                for (auto &sms : sms_list)
+                std::string response = " respond wake up after got " + request;
+                modem.sendSMS(OWNER_NUMBER, response.c_str());
+                sim76xx_gps_t gps;
+                bool ret = modem.waitGnssFix(gps, 90);
+                modem.EnableGnss(false);
+                if (ret)
+                {
+                    track::append(gps);
+                    track::flush();
+                    telemetry::publishFix(gps);
+                    response = gps.pretty_string();
+                    modem.sendSMS(OWNER_NUMBER, response.c_str());
+                }
+                else
                 {
-                    ESP_LOGI("sms", " sms index %d ts : %d received from %s , content %s  ", sms.index, sms.timestamp, sms.sender.c_str(), sms.content.c_str());
-                    if (sms.sender == "0758829590")
-                    {
-                        std::string response = " respond wake up after got " + sms.content;
-                        modem.sendSMS("0758829590", response.c_str());
-                        modem.EnableGnss(true);
-                        power::light_sleep(30);
-                        sim76xx_gps_t gps;
-                        bool ret = modem.get_gnss(gps, 60);
-                        if (ret)
-                        {
-                            response = gps.pretty_string();
-                            modem.sendSMS("0758829590", response.c_str());
-                        }
-                        else
-                        {
-                            modem.sendSMS("0758829590", "no gps fix");
-                        }
-                    }
-                    modem.GetDce()->delete_sms(sms.index);
+                    modem.sendSMS(OWNER_NUMBER, "no gps fix");
                 }
             }
+            outbox::flush(modem); // the modem is already up, send whatever is queued
         }
         break;
     }
@@ -209,23 +282,55 @@ void handleWakeup()
     }
 }
 
+// timer and motion wakes without VBUS only update RTC state, notify and sleep again,
+// they need the gauge, the camera, the built-in LED and the outbox but not the full boot
+static bool isSleepBoundWake(power::WakeUpReason_t wu)
+{
+    if (ota_needValidation || power::isPowerVBUSOn())
+        return false;
+    switch (wu)
+    {
+    case power::WakeUpReason_t::TIMER:
+        return true;
+    case power::WakeUpReason_t::MOTION:
+        return imu6500_dmp::clearWakeInterrupt(); // otherwise WOM has to be set up again
+    default:
+        return false;
+    }
+}
+
 void setup()
 {
     // uint8_t counter = 0;
+    wakeProfile::boot();
     Serial.begin(115200);
+    mqttLogger.setOfflineSink(spool::append); // keep what is logged while WiFi is off
+    pm::setup();
+    wakeProfile::begin(wakeProfile::POWER);
     power::setupPower();
+    wakeProfile::end(wakeProfile::POWER);
+    schedule::collect();
+    ota_needValidation = check_rollback();
+    loadTimingPref();
     builtinLed.begin();
-    NotifyLed.begin();
+    turnOnCamera();
     carBattery.begin();
-    ota_needValidation = check_rollback();
+    carBattery.updateTrend(true); // every wake, the short timer wakes included
+    const bool fastWake = isSleepBoundWake(power::Get_wake_reason());
+    if (fastWake)
+    {
+        handleWakeup(); // ends in deep sleep, returns only if the wake needs the full boot after all
+        mqttLogger.println("fast wake continues with the full boot");
+    }
+    NotifyLed.begin();
     delay(1500);
-    setCpuFrequencyMhz(80);
     builtinLed.setSolid(0, LedStrip::_rgb(0, 0, 25), LedStrip::Priority::NORMAL);
     NotifyLed.setSolid(0, LedStrip::_rgb(0, 0, 10), LedStrip::Priority::NORMAL);
     NotifyLed.setSolid(1, LedStrip::_rgb(0, 0, 5), LedStrip::Priority::NORMAL);
-    turnOnCamera();
-    loadTimingPref();
-    if (imu6500_dmp::imu_setup(imu6500_dmp::WOM))
+    wakeProfile::begin(wakeProfile::IMU);
+    const bool imuOk = imu6500_dmp::imu_setup(imu6500_dmp::WOM);
+    wakeProfile::end(wakeProfile::IMU);
+    if (imuOk)
     {
         Serial.println("IMU setup complete ");
     }
@@ -248,7 +353,7 @@ void setup()
         StartWifi();
         LastWifiOnTimestamp = millis();
     }
-    else
+    else if (!fastWake)
     {
         handleWakeup();
     }
@@ -278,7 +383,7 @@ void loopPowerCheck()
         builtinLed.setBlink(0, LedStrip::_rgb(20, 0, 0), 0, 75, 125, 500);
         delay(500);
         builtinLed.clear(0);
-        power::Sleep_DisableTimer();
+        schedule::clearAll(); // nothing but VBUS wakes it up
         power::Sleep_EnablePinWakeup(power::WakeUpPin_t::START_PIN);
         power::DeepSleep();
     }
@@ -287,6 +392,7 @@ void loopPowerCheck()
         mqttLogger.printf("Battery low level detected in main loop \n");
         builtinLed.setSolid(0, LedStrip::_rgb(2, 0, 0)); // turn off led before sleep
         delay(30);
+        scheduleSleepJobs();
         // power::Sleep_EnablePinWakeup(power::WakeUpPin_t::START_PIN);
         power::Sleep_EnablePinWakeup(power::WakeUpPin_t::MOTION_PIN);
         power::DeepSleep();
@@ -303,7 +409,7 @@ void loopImuMotion()
         delay(150);
         Serial.println("motion detected");
     }
-    if (power::isPowerVBUSOn())
+    if (carBattery.isEngineOn())
     {
         waitForCarhelper = true;
         return;
@@ -314,7 +420,10 @@ void loopImuMotion()
         mqttLogger.println("starting secure mode");
         turnOffCamera();
         builtinLed.setSolid(0, LedStrip::_rgb(0, 0, 2)); //
-        power::Sleep_EnableTimer(power::SLEEP_SNAP_SHOT, getSnapShotTime());
+        track::queueUpload(track::getLastUploadTs(), time(nullptr)); // trip is over, send what was tracked since the last upload
+        schedule::clear(schedule::AFTER_MOTION); // the trip replaced the motion episode
+        schedule::set(schedule::SNAPSHOT, snapshotInterval());
+        scheduleSleepJobs();
         // power::Sleep_EnablePinWakeup(power::WakeUpPin_t::START_PIN);
         power::Sleep_EnablePinWakeup(power::WakeUpPin_t::MOTION_PIN);
         power::DeepSleep();
@@ -353,17 +462,37 @@ void loopWifiStatus()
     }
 }
 
+// entries that become due while awake, e.g. a GNSS request received over MQTT
+void loopOutbox()
+{
+    static uint32_t lastAttemptMs = 0;
+    if (remoteGnssRequest)
+    {
+        outbox::post(outbox::Kind::GNSS, outbox::Key::NONE, remoteGnssDest, "", outbox::Priority::URGENT);
+        remoteGnssRequest = false;
+        lastAttemptMs = 0;
+    }
+    if (!outbox::isDue() || (lastAttemptMs != 0 && millis() - lastAttemptMs < OUTBOX_RETRY_MS))
+        return;
+    lastAttemptMs = millis();
+    flushOutboxIfDue();
+}
+
 void loop()
 {
+    // the car battery is sampled while the car supplies VBUS, on the cell it would keep the chip out of light sleep
+    carBattery.setSampling(CarBattery::SAMPLE_ALWAYS || power::isPowerVBUSOn());
+    carBattery.updateTrend(false);
     loopWifiStatus();
     loopPowerCheck();
     loopImuMotion();
-    if (ota_needValidation && OTA_VALIDATION_COUNTER++ > 2000)
+    loopOutbox();
+    if (ota_needValidation && millis() > OTA_VALIDATION_MS)
     {
         ota_needValidation = false;
         set_ota_valid(true);
     }
-    delay(10);
+    waitSystemEvent(LOOP_IDLE_MS); // key, VBUS, battery, motion and command events cut the wait short
 }
 
 extern "C" void app_main(void)
@@ -20,9 +20,14 @@ uint32_t getSecureModeTimeout();
 
 uint64_t getSnapShotTime();
 
+uint32_t getUploadTime();
+
+uint32_t getGnssTime();
+
+uint32_t getBatteryCheckTime();
+
 void checkOTA_rollback(void *arg);
 
-extern uint32_t OTA_VALIDATION_COUNTER;
 
 void light_sleep(uint16_t seconds);
 #endif // MAIN_H_
\ No newline at end of file
@@ -0,0 +1,322 @@
+/**
+ * @file outbox.cpp
+ * @author rami zayat
+ * @brief RTC-memory outbox of pending notifications, flushed in a single modem session
+ * @version 0.1
+ * @date 2025-12-02
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include "outbox/outbox.hpp"
+#include "pppos_client.hpp"
+#include "publisher/publisher.hpp"
+#include "wifi/wifi.hpp"
+#include "track/trackLog.hpp"
+#include "telemetry/telemetry.hpp"
+#include "power/wakeProfile.hpp"
+#include "esp_attr.h"
+#include <string.h>
+#include <algorithm>
+
+namespace outbox
+{
+    typedef struct
+    {
+        Kind kind;
+        Key key;
+        Priority prio;
+        uint16_t count; // number of coalesced posts
+        time_t first;
+        time_t last;
+        time_t deadline;
+        char dest[MAX_DEST];
+        char text[MAX_TEXT];
+    } Entry_t;
+
+    typedef struct
+    {
+        uint8_t count;
+        uint8_t failures; // flushes in a row that left something undelivered
+        time_t retry_at;  // no flush before this after a failure, 0 if none
+        Entry_t entries[MAX_ENTRIES];
+    } Outbox_t;
+
+    static RTC_DATA_ATTR Outbox_t box;
+    static const size_t SMS_MAX_LEN = 160;
+    static const uint16_t GNSS_FIX_TIMEOUT_S = 90;
+    static const uint32_t BACKOFF_MIN_S = 60;          // after the first failed flush, doubled by each one after it
+    static const uint32_t BACKOFF_MAX_S = 4U * 3600U;
+
+    static const char *keyName(Key key)
+    {
+        switch (key)
+        {
+        case Key::MOTION:
+            return "motion";
+        case Key::BATTERY:
+            return "battery";
+        case Key::SNAPSHOT:
+            return "snapshot";
+        case Key::GNSS_TRACK:
+            return "track";
+        default:
+            return "";
+        }
+    }
+
+    static void copyStr(char *dst, const char *src, size_t len)
+    {
+        if (src == nullptr)
+        {
+            dst[0] = '\0';
+            return;
+        }
+        strncpy(dst, src, len - 1);
+        dst[len - 1] = '\0';
+    }
+
+    // render one entry, prefixing a summary line when several posts were coalesced
+    static int formatEntry(const Entry_t &e, char *buf, size_t len)
+    {
+        if (e.count <= 1)
+        {
+            return snprintf(buf, len, "%s", e.text);
+        }
+        struct tm timeinfo;
+        localtime_r(&e.last, &timeinfo);
+        return snprintf(buf, len, "%u %s events, last at %02d:%02d:%02d. %s", e.count, keyName(e.key),
+                        timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec, e.text);
+    }
+
+    bool post(Kind kind, Key key, const char *dest, const char *text, Priority prio, uint32_t max_delay_s)
+    {
+        const time_t now = time(nullptr);
+        const time_t deadline = now + max_delay_s;
+        if (prio == Priority::URGENT)
+            box.retry_at = 0; // worth a new attempt, the failure count still sets the next backoff
+        if (key != Key::NONE)
+        {
+            for (uint8_t i = 0; i < box.count; i++)
+            {
+                Entry_t &e = box.entries[i];
+                if (e.kind == kind && e.key == key && strncmp(e.dest, dest ? dest : "", MAX_DEST) == 0)
+                {
+                    e.count++;
+                    e.last = now;
+                    copyStr(e.text, text, MAX_TEXT);
+                    if (prio > e.prio)
+                        e.prio = prio;
+                    if (deadline < e.deadline)
+                        e.deadline = deadline;
+                    return true;
+                }
+            }
+        }
+        if (box.count >= MAX_ENTRIES)
+        {
+            mqttLogger.printf("outbox full, dropping %s\n", text ? text : "");
+            return false;
+        }
+        Entry_t &e = box.entries[box.count++];
+        e.kind = kind;
+        e.key = key;
+        e.prio = prio;
+        e.count = 1;
+        e.first = now;
+        e.last = now;
+        e.deadline = deadline;
+        copyStr(e.dest, dest, MAX_DEST);
+        copyStr(e.text, text, MAX_TEXT);
+        return true;
+    }
+
+    uint8_t pending()
+    {
+        return box.count;
+    }
+
+    int32_t secondsUntilDue()
+    {
+        if (box.count == 0)
+            return -1;
+        const time_t now = time(nullptr);
+        // undelivered entries are past their deadline, they wait for the backoff of the failed flush
+        const int32_t backoff = box.retry_at > now ? (int32_t)(box.retry_at - now) : 0;
+        if (box.count >= MAX_ENTRIES)
+            return backoff;
+        time_t earliest = box.entries[0].deadline;
+        for (uint8_t i = 0; i < box.count; i++)
+        {
+            if (box.entries[i].prio == Priority::URGENT)
+                return backoff;
+            if (box.entries[i].deadline < earliest)
+                earliest = box.entries[i].deadline;
+        }
+        return std::max(backoff, earliest <= now ? 0 : (int32_t)(earliest - now));
+    }
+
+    bool isDue()
+    {
+        return secondsUntilDue() == 0;
+    }
+
+    void clear()
+    {
+        box.count = 0;
+        box.failures = 0;
+        box.retry_at = 0;
+    }
+
+    // capped exponential backoff after a flush that left entries queued, reset by a complete one
+    static void backoff(bool failed)
+    {
+        if (!failed)
+        {
+            box.failures = 0;
+            box.retry_at = 0;
+            return;
+        }
+        if (box.failures < UINT8_MAX)
+            box.failures++;
+        const uint32_t s = box.failures > 8 ? BACKOFF_MAX_S : std::min(BACKOFF_MAX_S, BACKOFF_MIN_S << (box.failures - 1));
+        box.retry_at = time(nullptr) + s;
+        mqttLogger.printf("outbox flush failed %u times, next attempt in %lu s\n", box.failures, (unsigned long)s);
+    }
+
+    // SMS entries are joined per destination up to one SMS length
+    static void sendSms(ModemSim7670 &modem, bool *delivered)
+    {
+        char msg[SMS_MAX_LEN + 1];
+        char part[MAX_TEXT + 64];
+        for (uint8_t i = 0; i < box.count; i++)
+        {
+            const Entry_t &head = box.entries[i];
+            if (delivered[i] || head.kind != Kind::SMS)
+                continue;
+            bool included[MAX_ENTRIES] = {};
+            size_t used = 0;
+            msg[0] = '\0';
+            for (uint8_t j = i; j < box.count; j++)
+            {
+                const Entry_t &e = box.entries[j];
+                if (delivered[j] || e.kind != Kind::SMS || strcmp(e.dest, head.dest) != 0)
+                    continue;
+                int len = formatEntry(e, part, sizeof(part));
+                if (len <= 0)
+                    continue;
+                const size_t sep = used > 0 ? 1 : 0;
+                if (used > 0 && used + sep + len > SMS_MAX_LEN)
+                    continue; // goes into the next SMS
+                if (sep)
+                    msg[used++] = '\n';
+                copyStr(msg + used, part, sizeof(msg) - used);
+                used = strlen(msg);
+                included[j] = true;
+            }
+            if (modem.sendSMS(head.dest, msg))
+            {
+                for (uint8_t j = i; j < box.count; j++)
+                    delivered[j] |= included[j];
+            }
+        }
+    }
+
+    // one fix serves every pending GNSS request
+    static void answerGnss(ModemSim7670 &modem, bool *delivered)
+    {
+        bool requested = false;
+        for (uint8_t i = 0; i < box.count; i++)
+            requested |= (box.entries[i].kind == Kind::GNSS);
+        if (!requested)
+            return;
+        sim76xx_gps_t gps;
+        const bool fix = modem.waitGnssFix(gps, GNSS_FIX_TIMEOUT_S);
+        if (fix)
+        {
+            track::append(gps);
+            track::flush();
+            telemetry::publishFix(gps);
+        }
+        const std::string response = fix ? gps.pretty_string() : std::string("no gps fix");
+        modem.EnableGnss(false);
+        for (uint8_t i = 0; i < box.count; i++)
+        {
+            const Entry_t &e = box.entries[i];
+            if (e.kind != Kind::GNSS)
+                continue;
+            // requests made over MQTT carry a topic, the answer joins the publisher queue
+            if (e.dest[0] == '\0')
+                delivered[i] = true; // scheduled refresh, the fix went to the track and telemetry above
+            else if (strchr(e.dest, '/') != nullptr)
+                delivered[i] = publisher::publish(e.dest, response.c_str()) != publisher::Result::FULL;
+            else if (modem.sendSMS(e.dest, response.c_str()))
+                delivered[i] = true;
+        }
+    }
+
+    // MQTT entries move to the publisher queue, which keeps them on flash until the broker acknowledges them
+    static void queueMqtt(bool *delivered)
+    {
+        char part[MAX_TEXT + 64];
+        for (uint8_t i = 0; i < box.count; i++)
+        {
+            const Entry_t &e = box.entries[i];
+            if (delivered[i])
+                continue;
+            publisher::Result ret;
+            if (e.kind == Kind::MQTT)
+            {
+                formatEntry(e, part, sizeof(part));
+                ret = publisher::publish(e.dest, part);
+            }
+            else if (e.kind == Kind::MQTT_FILE)
+            {
+                ret = publisher::publishFile(e.dest, e.text);
+            }
+            else
+            {
+                continue;
+            }
+            delivered[i] = ret == publisher::Result::SENT || ret == publisher::Result::QUEUED;
+        }
+    }
+
+    bool flush(ModemSim7670 &modem)
+    {
+        if (box.count == 0 && publisher::pending() == 0)
+            return true;
+        const bool wasUp = modem.isInitialized();
+        mqttLogger.printf("outbox flush, %d pending, %lu queued mqtt\n", box.count, (unsigned long)publisher::pending());
+        if (!wasUp && !modem.init())
+        {
+            mqttLogger.println("outbox flush: modem init failed");
+            backoff(box.count > 0);
+            return false;
+        }
+        bool delivered[MAX_ENTRIES] = {};
+        wakeProfile::begin(wakeProfile::SEND);
+        sendSms(modem, delivered);
+        wakeProfile::end(wakeProfile::SEND);
+        answerGnss(modem, delivered);
+        queueMqtt(delivered);
+        publisher::flush(modem); // MQTT goes last since the PPP session leaves command mode
+        if (!wasUp)
+            modem.shutdown();
+
+        uint8_t kept = 0;
+        for (uint8_t i = 0; i < box.count; i++)
+        {
+            if (!delivered[i])
+            {
+                if (kept != i)
+                    box.entries[kept] = box.entries[i];
+                kept++;
+            }
+        }
+        box.count = kept;
+        backoff(kept > 0);
+        mqttLogger.printf("outbox flush done, %d left\n", kept);
+        return kept == 0;
+    }
+}
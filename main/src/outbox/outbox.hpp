@@ -0,0 +1,81 @@
+/**
+ * @file outbox.hpp
+ * @author rami zayat
+ * @brief RTC-memory outbox of pending notifications, flushed in a single modem session
+ * @version 0.1
+ * @date 2025-12-02
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#pragma once
+#include <stdint.h>
+#include <time.h>
+
+class ModemSim7670;
+
+namespace outbox
+{
+    enum class Kind : uint8_t
+    {
+        SMS = 0,
+        MQTT,
+        MQTT_FILE, // text holds a path on the storage partition, published then removed
+        GNSS,      // GNSS fix request, the result is sent by SMS to `dest`, published when `dest` is a topic, only tracked when empty
+    };
+
+    enum class Priority : uint8_t
+    {
+        LOW = 0,
+        NORMAL,
+        URGENT, // power the modem on the next flush opportunity
+    };
+
+    // entries posted with the same key (other than NONE) are coalesced into one
+    enum class Key : uint8_t
+    {
+        NONE = 0,
+        MOTION,
+        BATTERY,
+        SNAPSHOT,
+        GNSS_TRACK,
+    };
+
+    static const uint8_t MAX_ENTRIES = 8;
+    static const uint16_t MAX_TEXT = 192;
+    static const uint8_t MAX_DEST = 48;
+    static const uint32_t DEFAULT_DELAY_S = 30U * 60U;
+
+    /**
+     * @brief queue a notification
+     * @param kind what to send
+     * @param key coalescing key, entries with the same key and destination are merged
+     * @param dest phone number (SMS/GNSS) or topic (MQTT)
+     * @param text message body, payload or file path
+     * @param prio URGENT makes the outbox due immediately
+     * @param max_delay_s latest acceptable send time, relative to now
+     * @return false if the outbox is full and the entry was dropped
+     */
+    bool post(Kind kind, Key key, const char *dest, const char *text, Priority prio = Priority::NORMAL, uint32_t max_delay_s = DEFAULT_DELAY_S);
+
+    // number of queued entries
+    uint8_t pending();
+
+    // true when an entry is URGENT, a deadline has passed or the outbox is full, and no retry backoff runs
+    bool isDue();
+
+    // seconds until the earliest deadline or the end of the retry backoff, 0 if due, -1 if empty.
+    // A flush that leaves entries queued waits 60 s, doubled by each failure after it up to 4 h,
+    // a new URGENT post ends the wait
+    int32_t secondsUntilDue();
+
+    /**
+     * @brief power the modem once and send everything queued
+     * @param modem modem to use, initialized here if needed and shut down after unless it was already up
+     * @return true if every entry was delivered, failed entries stay queued
+     */
+    bool flush(ModemSim7670 &modem);
+
+    // drop all entries
+    void clear();
+}
@@ -6,7 +6,7 @@ const gpio_num_t I2C_SDA_PIN = GPIO_NUM_39; //
 const gpio_num_t I2C_SCL_PIN = GPIO_NUM_41; //
 const gpio_num_t MOTION_INTRRUPT_PIN = GPIO_NUM_8; //
 const gpio_num_t CAM_PIN = GPIO_NUM_9;
-const gpio_num_t VBUS_INPUT_PIN = GPIO_NUM_9;
+const gpio_num_t VBUS_INPUT_PIN = (gpio_num_t)CONFIG_VBUS_SENSE_PIN; // GPIO_NUM_NC if not wired
 
 const gpio_num_t BOOT_INPUT_PIN = GPIO_NUM_0;
 const gpio_num_t PIXEL_LED_PIN = GPIO_NUM_38;
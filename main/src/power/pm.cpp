@@ -0,0 +1,213 @@
+/**
+ * @file pm.cpp
+ * @author rami zayat
+ * @brief dynamic frequency scaling, automatic light sleep and the PM locks that hold them off
+ * @version 0.1
+ * @date 2025-12-12
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include "power/pm.hpp"
+#include "wifi/wifi.hpp"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+#include "hal/gpio_ll.h"
+#include "soc/gpio_struct.h"
+#include <algorithm>
+
+namespace pm
+{
+    static const uint8_t MAX_WAKE_PINS = 6;
+
+    // zero initialized before the static Lock objects are constructed
+    static Lock *locks[MAX_LOCKS];
+    static uint8_t lockTotal = 0;
+    static portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+
+    typedef struct
+    {
+        gpio_num_t pin;
+        void (*isr)();
+        int mode;
+        bool high; // level the interrupt waits for
+    } WakePin_t;
+    static WakePin_t wakePins[MAX_WAKE_PINS];
+    static uint8_t wakePinTotal = 0;
+    static bool gpioWake = false;
+
+    Lock::Lock(const char *name, esp_pm_lock_type_t type) : lockName(name), lockType(type)
+    {
+        // fails with ESP_ERR_NOT_SUPPORTED without CONFIG_PM_ENABLE, the lock then only counts
+        if (esp_pm_lock_create(type, 0, name, &handle) != ESP_OK)
+            handle = nullptr;
+        if (lockTotal < MAX_LOCKS)
+            locks[lockTotal++] = this;
+    }
+
+    void Lock::acquire()
+    {
+        portENTER_CRITICAL(&mux);
+        if (depth++ == 0)
+        {
+            since_us = esp_timer_get_time();
+            acquired++;
+        }
+        portEXIT_CRITICAL(&mux);
+        if (handle != nullptr)
+            esp_pm_lock_acquire(handle);
+    }
+
+    void Lock::release()
+    {
+        portENTER_CRITICAL(&mux);
+        if (depth == 0)
+        {
+            portEXIT_CRITICAL(&mux);
+            return; // not held, keep the esp_pm count balanced
+        }
+        if (--depth == 0)
+        {
+            const uint32_t held = (uint32_t)std::min<int64_t>(esp_timer_get_time() - since_us, UINT32_MAX);
+            total_us += held;
+            max_us = std::max(max_us, held);
+        }
+        portEXIT_CRITICAL(&mux);
+        if (handle != nullptr)
+            esp_pm_lock_release(handle);
+    }
+
+    uint64_t Lock::heldMs() const
+    {
+        portENTER_CRITICAL(&mux);
+        uint64_t us = total_us;
+        if (depth != 0)
+            us += esp_timer_get_time() - since_us;
+        portEXIT_CRITICAL(&mux);
+        return us / 1000;
+    }
+
+    uint32_t Lock::maxMs() const
+    {
+        portENTER_CRITICAL(&mux);
+        uint64_t us = max_us;
+        if (depth != 0)
+            us = std::max<uint64_t>(us, esp_timer_get_time() - since_us);
+        portEXIT_CRITICAL(&mux);
+        return (uint32_t)(us / 1000);
+    }
+
+    bool setup()
+    {
+#if !CONFIG_PM_ENABLE
+        mqttLogger.printf("pm: disabled, CPU stays at %d MHz\n", getCpuFrequencyMhz());
+        return false;
+#else
+        esp_pm_config_t config = {};
+        config.max_freq_mhz = CONFIG_POWER_DFS_MAX_MHZ;
+        config.min_freq_mhz = CONFIG_POWER_DFS_MIN_MHZ;
+#if CONFIG_POWER_AUTO_LIGHT_SLEEP
+        config.light_sleep_enable = true;
+#endif
+        const esp_err_t err = esp_pm_configure(&config);
+        if (err != ESP_OK)
+        {
+            mqttLogger.printf(MqttLogLevel::Warn, "pm: configure failed %s, CPU stays at %d MHz\n", esp_err_to_name(err),
+                              getCpuFrequencyMhz());
+            return false;
+        }
+        mqttLogger.printf("pm: %d-%d MHz, light sleep %s\n", config.min_freq_mhz, config.max_freq_mhz,
+                          config.light_sleep_enable ? "on" : "off");
+        return true;
+#endif
+    }
+
+    // the level that fired is the one the pin is at, arm the opposite one: a level interrupt
+    // behaving as an edge interrupt, levels are what wakes the chip from light sleep
+    static void IRAM_ATTR wakeIsr(void *arg)
+    {
+        WakePin_t *w = (WakePin_t *)arg;
+        const bool rose = w->high;
+        w->high = !w->high;
+        gpio_ll_set_intr_type(&GPIO, w->pin, w->high ? GPIO_INTR_HIGH_LEVEL : GPIO_INTR_LOW_LEVEL);
+        if (w->mode == CHANGE || (w->mode == RISING && rose) || (w->mode == FALLING && !rose))
+            w->isr();
+    }
+
+    void attachWakeInterrupt(gpio_num_t pin, void (*isr)(), int mode)
+    {
+        WakePin_t *w = nullptr;
+        for (uint8_t i = 0; i < wakePinTotal && w == nullptr; i++)
+        {
+            if (wakePins[i].pin == pin)
+                w = &wakePins[i];
+        }
+        if (w == nullptr)
+        {
+            if (wakePinTotal >= MAX_WAKE_PINS)
+            {
+                mqttLogger.printf(MqttLogLevel::Error, "pm: no wake slot left for GPIO%d\n", pin);
+                return;
+            }
+            w = &wakePins[wakePinTotal++];
+        }
+        gpio_intr_disable(pin);
+        *w = {pin, isr, mode, gpio_get_level(pin) == 0};
+        const esp_err_t err = gpio_install_isr_service(0); // shared with attachInterrupt()
+        if (err != ESP_OK && err != ESP_ERR_INVALID_STATE)
+            return;
+        gpio_isr_handler_remove(pin);
+        gpio_isr_handler_add(pin, wakeIsr, w);
+        gpio_wakeup_enable(pin, w->high ? GPIO_INTR_HIGH_LEVEL : GPIO_INTR_LOW_LEVEL);
+        gpio_intr_enable(pin);
+        if (!gpioWake)
+            gpioWake = esp_sleep_enable_gpio_wakeup() == ESP_OK;
+    }
+
+    uint8_t lockCount()
+    {
+        return lockTotal;
+    }
+
+    const Lock *getLock(uint8_t i)
+    {
+        return i < lockTotal ? locks[i] : nullptr;
+    }
+
+    const char *typeName(esp_pm_lock_type_t type)
+    {
+        switch (type)
+        {
+        case ESP_PM_CPU_FREQ_MAX:
+            return "cpu_max";
+        case ESP_PM_APB_FREQ_MAX:
+            return "apb_max";
+        case ESP_PM_NO_LIGHT_SLEEP:
+            return "no_sleep";
+        default:
+            return "?";
+        }
+    }
+
+    void logReport()
+    {
+        const uint32_t awake = std::max<uint32_t>(millis(), 1);
+        for (uint8_t i = 0; i < lockTotal; i++)
+        {
+            const Lock &l = *locks[i];
+            if (l.count() == 0)
+                continue;
+            const uint64_t held = l.heldMs();
+            mqttLogger.printf("pm: %s %s held %lu times, %llu ms, %lu%% awake, longest %lu ms%s\n", l.name(),
+                              typeName(l.type()), (unsigned long)l.count(), (unsigned long long)held,
+                              (unsigned long)(held * 100 / awake), (unsigned long)l.maxMs(), l.held() ? ", still held" : "");
+        }
+    }
+
+    void prepareDeepSleep()
+    {
+        if (gpioWake)
+            esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_GPIO);
+        gpioWake = false;
+    }
+}
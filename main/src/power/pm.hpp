@@ -0,0 +1,99 @@
+/**
+ * @file pm.hpp
+ * @author rami zayat
+ * @brief dynamic frequency scaling, automatic light sleep and the PM locks that hold them off
+ * @version 0.1
+ * @date 2025-12-12
+ *
+ * @copyright Copyright (c) 2025
+ *
+ * While awake the CPU runs between PM_MIN_MHZ and PM_MAX_MHZ and the idle task puts the
+ * chip in light sleep whenever no lock is held and no task is ready for a few ticks.
+ * Subsystems that cannot run through that take a Lock for as long as they need it:
+ *
+ *   CPU_FREQ_MAX    short bursts of work, finished at the maximum clock
+ *   APB_FREQ_MAX    peripherals clocked from APB or the PLL, UART and SDMMC
+ *   NO_LIGHT_SLEEP  anything that must answer without the light sleep wake latency
+ *
+ * Each lock keeps how often and how long it was held, the report shows who keeps the chip
+ * awake.
+ *
+ * GPIO edges are not detected in light sleep, only levels wake the chip. Pins that must not
+ * miss an edge use attachWakeInterrupt(), a level interrupt flipped to the opposite level
+ * each time it fires.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_pm.h"
+#include "driver/gpio.h"
+
+namespace pm
+{
+    static const uint8_t MAX_LOCKS = 8;
+
+    class Lock
+    {
+    public:
+        // locks are static objects of the modules using them, they register themselves
+        Lock(const char *name, esp_pm_lock_type_t type);
+        Lock(const Lock &) = delete;
+        Lock &operator=(const Lock &) = delete;
+
+        // nestable, the esp_pm lock is counted the same way
+        void acquire();
+        void release();
+
+        const char *name() const { return lockName; }
+        esp_pm_lock_type_t type() const { return lockType; }
+        bool held() const { return depth != 0; }
+        uint32_t count() const { return acquired; }
+        // total and longest held time, the current hold is included
+        uint64_t heldMs() const;
+        uint32_t maxMs() const;
+
+    private:
+        const char *lockName;
+        esp_pm_lock_type_t lockType;
+        esp_pm_lock_handle_t handle = nullptr;
+        uint16_t depth = 0;
+        uint32_t acquired = 0;
+        int64_t since_us = 0;
+        uint64_t total_us = 0;
+        uint32_t max_us = 0;
+    };
+
+    // holds a lock for the scope
+    class Guard
+    {
+    public:
+        explicit Guard(Lock &lock) : lock(lock) { lock.acquire(); }
+        ~Guard() { lock.release(); }
+        Guard(const Guard &) = delete;
+        Guard &operator=(const Guard &) = delete;
+
+    private:
+        Lock &lock;
+    };
+
+    // DFS and automatic light sleep from the Kconfig settings, false if esp_pm refused them
+    bool setup();
+
+    /**
+     * @brief attach an interrupt that also wakes the chip from automatic light sleep
+     * @param pin GPIO
+     * @param isr called from the interrupt
+     * @param mode RISING, FALLING or CHANGE, the Arduino constants
+     */
+    void attachWakeInterrupt(gpio_num_t pin, void (*isr)(), int mode);
+
+    uint8_t lockCount();
+    const Lock *getLock(uint8_t i);
+    const char *typeName(esp_pm_lock_type_t type);
+
+    // one log line per lock that was held since boot
+    void logReport();
+
+    // deep sleep wakes from ext1 and the timer only
+    void prepareDeepSleep();
+}
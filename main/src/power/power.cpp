@@ -11,7 +11,15 @@
 #include "pins.hpp"
 #include "wifi/wifi.hpp"
 #include "power/power.hpp"
+#include "power/wakeStub.hpp"
+#include "power/schedule.hpp"
+#include "power/pm.hpp"
+#include "power/wakeProfile.hpp"
 #include "driver/rtc_io.h"
+#include "spool/spool.hpp"
+#include "telemetry/telemetry.hpp"
+#include "system.hpp"
+#include "esp_rtc_time.h"
 #include <atomic>
 
 namespace power
@@ -23,18 +31,47 @@ namespace power
     std::atomic<bool> isCharging;
     std::atomic<bool> isPekeyShortPressed;
 
-    uint64_t VbusInsertTimestamp = 0;
-    uint64_t VbusRemovedTimestamp = 0;
     uint64_t wakeup_mask = 0;
     float cellVoltage = 0.0f, percent = 0.0f, rate = 0.0f;
     esp_sleep_wakeup_cause_t wakeup_reason;
 
-    static RTC_DATA_ATTR TimerWakeReason_t _timerWakeReason;
     static RTC_DATA_ATTR bool PMU_WasSleeping;
     EventGroupHandle_t powerInterruptGroup;
     static const uint8_t BUTTON_EVENT = 0b01;
+    static const uint8_t GAUGE_EVENT = 0b10;
+    static const uint8_t VBUS_EVENT = 0b100;
+    static const int GAUGE_ALERT_PIN = CONFIG_FUEL_GAUGE_ALERT_PIN;
+    static const uint32_t GAUGE_POLL_MS = CONFIG_FUEL_GAUGE_POLL_MS;
+    static const uint32_t GAUGE_SAFETY_POLL_MS = 10U * 60U * 1000U; // with the ALERT pin, in case an edge was missed
+    static const float ALERT_VOLTAGE_MIN = 3.3f;
+    static const float ALERT_VOLTAGE_MAX = 4.3f;
+    static const uint32_t VBUS_DEBOUNCE_MS = 200;      // level must hold this long after the last edge
+    static const uint32_t VBUS_DEBOUNCE_MAX_MS = 2000; // give up waiting for a quiet line, take the level as is
+    static const uint32_t VBUS_MAGIC = 0x56425331;     // "VBS1"
+    // the camera power pin is an output held through deep sleep, never read it as VBUS
+    static const bool VBUS_SENSED = VBUS_INPUT_PIN >= 0 && VBUS_INPUT_PIN != CAM_PIN;
+
+    // edge timestamps on the RTC clock, which keeps counting through deep sleep, 0 if not seen since power on
+    typedef struct
+    {
+        uint32_t magic;
+        bool on;
+        uint64_t inserted_ms;
+        uint64_t removed_ms;
+        uint32_t transitions;
+    } VbusState_t;
+    static RTC_DATA_ATTR VbusState_t vbus;
+
+    // time from app start to deep sleep, per wake reason, the ROM and bootloader before app start are not included
+    typedef struct
+    {
+        uint32_t wakes;
+        uint64_t total_ms;
+    } AwakeStats_t;
+    static RTC_DATA_ATTR AwakeStats_t awakeStats[UNKNOWN + 1];
+    static RTC_DATA_ATTR uint32_t lastAwakeMs;
     void loopPower(void *arg);
-    void handleAlerts();
+    void handleAlerts(uint8_t status_flags);
     Adafruit_MAX17048 PMU;
 
     void interruptButton()
@@ -42,6 +79,135 @@ namespace power
         xEventGroupSetBitsFromISR(powerInterruptGroup, BUTTON_EVENT, NULL);
     }
 
+    void interruptGauge()
+    {
+        xEventGroupSetBitsFromISR(powerInterruptGroup, GAUGE_EVENT, NULL);
+    }
+
+    void interruptVbus()
+    {
+        xEventGroupSetBitsFromISR(powerInterruptGroup, VBUS_EVENT, NULL);
+    }
+
+    uint64_t rtcMillis()
+    {
+        return esp_rtc_get_time_us() / 1000;
+    }
+
+    static inline bool readVbus()
+    {
+        return VBUS_SENSED && digitalRead(VBUS_INPUT_PIN) == HIGH;
+    }
+
+    /**
+     * @brief record a debounced VBUS level, a transition is logged, sent as telemetry and posted to the main loop
+     * @param ts RTC time of the edge
+     */
+    static void updateVbus(bool on, uint64_t ts)
+    {
+        isCharging = on;
+        if (on == vbus.on)
+            return; // bounced back to the level we already had
+        const uint64_t since = on ? vbus.removed_ms : vbus.inserted_ms;
+        const uint32_t previous_s = since != 0 && ts > since ? (uint32_t)((ts - since) / 1000) : 0;
+        vbus.on = on;
+        if (on)
+            vbus.inserted_ms = ts;
+        else
+            vbus.removed_ms = ts;
+        vbus.transitions++;
+        mqttLogger.printf("VBUS %s after %lu s\n", on ? "inserted" : "removed", (unsigned long)previous_s);
+        telemetry::publishIgnition(on, previous_s);
+        postSystemEvent(EVENT_VBUS);
+    }
+
+    // the edge time is taken when the first edge arrives, the level once the line stayed quiet
+    static void debounceVbus()
+    {
+        const uint64_t edge = rtcMillis();
+        const uint32_t start = millis();
+        while (millis() - start < VBUS_DEBOUNCE_MAX_MS &&
+               (xEventGroupWaitBits(powerInterruptGroup, VBUS_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(VBUS_DEBOUNCE_MS)) & VBUS_EVENT))
+        {
+        }
+        updateVbus(readVbus(), edge);
+    }
+
+    // a change while in deep sleep is timestamped at boot, the sleep itself has no edge time
+    static void setupVbus()
+    {
+        if (!VBUS_SENSED)
+        {
+            if (VBUS_INPUT_PIN == CAM_PIN)
+                mqttLogger.printf(MqttLogLevel::Error, "VBUS sense GPIO%d is the camera power pin, not attached\n", VBUS_INPUT_PIN);
+            vbus = {};
+            return;
+        }
+        pinMode(VBUS_INPUT_PIN, INPUT_PULLDOWN);
+        const bool on = readVbus();
+        if (vbus.magic != VBUS_MAGIC)
+        {
+            vbus = {};
+            vbus.magic = VBUS_MAGIC;
+            vbus.on = on;
+            isCharging = on;
+        }
+        else
+        {
+            updateVbus(on, rtcMillis());
+        }
+        pm::attachWakeInterrupt(VBUS_INPUT_PIN, interruptVbus, CHANGE);
+    }
+
+    // alerts: voltage window, 1% SOC change and SOC below the low threshold, all reset with the gauge
+    static void configureGauge()
+    {
+        PMU.setHibernationThreshold(5);
+        PMU.setAlertVoltages(ALERT_VOLTAGE_MIN, ALERT_VOLTAGE_MAX);
+        PMU.enableSOCChangeAlert(true);
+        PMU.setEmptyAlertThreshold(BATTERY_LOW_THRESH);
+        PMU.clearAlert(0x7F);
+    }
+
+    /**
+     * @brief read the gauge once and update the levels, the battery telemetry follows each change
+     * @return false if the gauge did not answer or reports no battery
+     */
+    static bool updateGauge()
+    {
+        MAX17048_snapshot_t snap;
+        if (!PMU.readSnapshot(snap))
+        {
+            mqttLogger.println(MqttLogLevel::Warn, "fuel gauge read failed");
+            return false;
+        }
+        if (snap.status != 0)
+        {
+            handleAlerts(snap.status);
+            PMU.clearAlert(snap.status);
+            if (snap.status & MAX1704X_ALERTFLAG_RESET_INDICATOR)
+                configureGauge();
+        }
+        if (snap.percent == 0)
+        {
+            Serial.println("Failed to read cell voltage, check battery is connected!");
+            return false;
+        }
+        cellVoltage = snap.voltage;
+        percent = snap.percent;
+        rate = snap.rate;
+        const bool low = percent <= BATTERY_LOW_THRESH, critical = percent <= BATTERY_CRITICAL_THRESH;
+        if (low != isBatteryLowLevel || critical != isBatteryCriticalLevel)
+            postSystemEvent(EVENT_BATTERY);
+        isBatteryCriticalLevel = critical;
+        isBatteryLowLevel = low;
+        mqttLogger.printf(MqttLogLevel::Debug, " percent %.2f,  cell %.3f v , rate %.2f %%/h", percent, cellVoltage, rate);
+        telemetry::publishBattery(percent, cellVoltage, rate, (isCharging ? telemetry::BAT_VBUS : 0) |
+                                                                  (isBatteryLowLevel ? telemetry::BAT_LOW : 0) |
+                                                                  (isBatteryCriticalLevel ? telemetry::BAT_CRITICAL : 0));
+        return true;
+    }
+
     bool setupPower()
     {
         Serial.println("PMU setup ");
@@ -50,9 +216,15 @@ namespace power
         isBatteryCriticalLevel = false;
         isPekeyShortPressed = false;
         powerInterruptGroup = xEventGroupCreate();
-        attachInterrupt(BOOT_INPUT_PIN, interruptButton, ONLOW);
+        wakeStub::disarm();
+        uint32_t filteredAgoMs = 0;
+        const uint32_t filtered = wakeStub::takeFiltered(filteredAgoMs);
+        if (filtered != 0)
+            mqttLogger.printf("%lu motion wakes filtered while asleep, last %lu s ago\n", (unsigned long)filtered,
+                              (unsigned long)(filteredAgoMs / 1000));
         pinMode(BOOT_INPUT_PIN, INPUT_PULLUP);
-        pinMode(VBUS_INPUT_PIN, INPUT_PULLDOWN);
+        pm::attachWakeInterrupt(BOOT_INPUT_PIN, interruptButton, FALLING);
+        setupVbus();
         Wire.setPins(I2C_SDA_POWER, I2C_SCL_POWER);
         if (!PMU.begin(&Wire, false))
         {
@@ -79,28 +251,14 @@ namespace power
             PMU.quickStart();
             delay(510);
         }
-        PMU.setHibernationThreshold(5);
-        PMU.setAlertVoltages(3.3f, 4.3f);
-        float alert_min, alert_max;
-        PMU.getAlertVoltages(alert_min, alert_max);
-        Serial.print("Alert voltages: ");
-        Serial.print(alert_min);
-        Serial.print(" ~ ");
-        Serial.print(alert_max);
-        Serial.println(" V");
-        cellVoltage = PMU.cellVoltage();
-        percent = PMU.cellPercent();
-        Serial.print(F("Batt Voltage: "));
-        Serial.print(cellVoltage, 3);
-        Serial.println(" V");
-        Serial.print(F("Batt Percent: "));
-        Serial.print(PMU.cellPercent(), 1);
-        Serial.println(" %");
-        Serial.print(F("(Dis)Charge rate : "));
-        Serial.print(PMU.chargeRate(), 1);
-        Serial.println(" %/hr");
-        xTaskCreate(loopPower, "power", 4096, NULL, 1, NULL);
-        if (isnan(cellVoltage) || isnan(percent) || (percent == 0))
+        configureGauge();
+        if (GAUGE_ALERT_PIN >= 0)
+        {
+            pinMode(GAUGE_ALERT_PIN, INPUT_PULLUP); // open drain, active low
+            pm::attachWakeInterrupt((gpio_num_t)GAUGE_ALERT_PIN, interruptGauge, FALLING);
+        }
+        MAX17048_snapshot_t snap;
+        if (!PMU.readSnapshot(snap) || snap.percent == 0)
         {
             Serial.println("Failed to read cell voltage, check battery is connected!!!!");
             PMU.quickStart();
@@ -108,9 +266,14 @@ namespace power
         }
         else
         {
-            isBatteryCriticalLevel = PMU.cellPercent() <= BATTERY_CRITICAL_THRESH;
-            isBatteryLowLevel = PMU.cellPercent() <= BATTERY_LOW_THRESH;
+            cellVoltage = snap.voltage;
+            percent = snap.percent;
+            rate = snap.rate;
+            isBatteryCriticalLevel = percent <= BATTERY_CRITICAL_THRESH;
+            isBatteryLowLevel = percent <= BATTERY_LOW_THRESH;
+            Serial.printf("Batt %.3f V, %.1f %%, (dis)charge rate %.1f %%/hr\n", cellVoltage, percent, rate);
         }
+        xTaskCreate(loopPower, "power", 4096, NULL, 1, NULL);
         return true;
     }
 
@@ -118,75 +281,36 @@ namespace power
     {
         delay(2500);
         PMU.quickStart();
+        updateGauge();
+        const uint32_t period = GAUGE_ALERT_PIN >= 0 ? GAUGE_SAFETY_POLL_MS : GAUGE_POLL_MS;
         while (1)
         {
-            auto event = xEventGroupWaitBits(powerInterruptGroup, BUTTON_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(10000));
+            // no timer driven reads: the gauge alerts on every 1% and on the voltage window
+            auto event = xEventGroupWaitBits(powerInterruptGroup, BUTTON_EVENT | GAUGE_EVENT | VBUS_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(period));
+            if (event & VBUS_EVENT)
+                debounceVbus();
             if (event & BUTTON_EVENT)
             {
                 isPekeyShortPressed = true;
+                postSystemEvent(EVENT_KEY);
                 delay(100);
                 xEventGroupClearBits(powerInterruptGroup, BUTTON_EVENT);
             }
-            cellVoltage = PMU.cellVoltage();
-            percent = PMU.cellPercent();
-            handleAlerts();
-            if (isnan(cellVoltage) || isnan(percent) || (percent == 0))
-            {
-                Serial.println("Failed to read cell voltage, check battery is connected!");
-                continue;
-            }
-            else
-            {
-                rate = PMU.chargeRate();
-                percent = PMU.cellPercent();
-                isBatteryCriticalLevel = percent <= BATTERY_CRITICAL_THRESH;
-                isBatteryLowLevel = percent <= BATTERY_LOW_THRESH;
-                mqttLogger.printf(" percent %.2f,  cell %.3f v , rate %.2f %%/h \n\r", percent, cellVoltage, rate);
-            }
+            // on a timeout a single status read decides whether the full snapshot is needed
+            if ((event & GAUGE_EVENT) || (event == 0 && PMU.getAlertStatus() != 0))
+                updateGauge();
         }
     }
 
-    void handleAlerts()
+    void handleAlerts(uint8_t status_flags)
     {
-        if (PMU.isActiveAlert())
-        {
-            uint8_t status_flags = PMU.getAlertStatus();
-            Serial.print(F("ALERT! flags = 0x"));
-            Serial.print(status_flags, HEX);
-            if (status_flags & MAX1704X_ALERTFLAG_SOC_CHANGE)
-            {
-                Serial.print(", SOC Change");
-                PMU.clearAlertFlag(MAX1704X_ALERTFLAG_SOC_CHANGE); // clear the alert
-            }
-            if (status_flags & MAX1704X_ALERTFLAG_SOC_LOW)
-            {
-                Serial.print(", SOC Low");
-                PMU.clearAlertFlag(MAX1704X_ALERTFLAG_SOC_LOW); // clear the alert
-            }
-            if (status_flags & MAX1704X_ALERTFLAG_VOLTAGE_RESET)
-            {
-                Serial.print(", Voltage reset");
-                PMU.clearAlertFlag(MAX1704X_ALERTFLAG_VOLTAGE_RESET); // clear the alert
-            }
-            if (status_flags & MAX1704X_ALERTFLAG_VOLTAGE_LOW)
-            {
-                Serial.print(", Voltage low ");
-                Serial.print(cellVoltage, 3);
-                PMU.clearAlertFlag(MAX1704X_ALERTFLAG_VOLTAGE_LOW); // clear the alert
-            }
-            if (status_flags & MAX1704X_ALERTFLAG_VOLTAGE_HIGH)
-            {
-                Serial.print(", Voltage high ");
-                Serial.print(cellVoltage, 3);
-                PMU.clearAlertFlag(MAX1704X_ALERTFLAG_VOLTAGE_HIGH); // clear the alert
-            }
-            if (status_flags & MAX1704X_ALERTFLAG_RESET_INDICATOR)
-            {
-                Serial.print(", Reset Indicator");
-                PMU.clearAlertFlag(MAX1704X_ALERTFLAG_RESET_INDICATOR); // clear the alert
-            }
-            Serial.println();
-        }
+        mqttLogger.printf(MqttLogLevel::Debug, "gauge alert 0x%02x%s%s%s%s%s%s\n", status_flags,
+                          (status_flags & MAX1704X_ALERTFLAG_SOC_CHANGE) ? ", SOC change" : "",
+                          (status_flags & MAX1704X_ALERTFLAG_SOC_LOW) ? ", SOC low" : "",
+                          (status_flags & MAX1704X_ALERTFLAG_VOLTAGE_RESET) ? ", voltage reset" : "",
+                          (status_flags & MAX1704X_ALERTFLAG_VOLTAGE_LOW) ? ", voltage low" : "",
+                          (status_flags & MAX1704X_ALERTFLAG_VOLTAGE_HIGH) ? ", voltage high" : "",
+                          (status_flags & MAX1704X_ALERTFLAG_RESET_INDICATOR) ? ", reset indicator" : "");
     }
 
     esp_sleep_wakeup_cause_t getWakeupReason()
@@ -283,12 +407,17 @@ namespace power
 
     uint64_t getLastVbusInsertedTs()
     {
-        return 0;
+        return vbus.inserted_ms;
     }
 
     uint64_t getLastVbusRemovedTs()
     {
-        return 0;
+        return vbus.removed_ms;
+    }
+
+    uint32_t getVbusTransitions()
+    {
+        return vbus.transitions;
     }
 
     bool isBatLowLevel()
@@ -303,6 +432,7 @@ namespace power
 
     void DeepSleep()
     {
+        wakeProfile::begin(wakeProfile::SLEEP);
         // Configure wakeup source: IMU interrupt pin
         bool shouldPMUSLeep = !(percent == 0);
         if (shouldPMUSLeep && isBatteryLowLevel)
@@ -316,27 +446,22 @@ namespace power
         {
             PMU.hibernate();
         }
+        AwakeStats_t &awake = awakeStats[Get_wake_reason()];
+        mqttLogger.printf("awake %lu ms, %s wakes average %lu ms\n", (unsigned long)millis(), GetWakeReasonName(Get_wake_reason()),
+                          awake.wakes ? (unsigned long)(awake.total_ms / awake.wakes) : 0UL);
+        pm::logReport();
+        pm::prepareDeepSleep();
+        schedule::arm();
+        mqttLogger.flush(MQTT_LOGGER_FLUSH_MS + 150); // log lines are written by the logger task, let it finish
+        spool::flush();
         Serial.flush();
-        delay(10);
+        lastAwakeMs = millis();
+        awake.wakes++;
+        awake.total_ms += lastAwakeMs;
+        wakeProfile::finish(Get_wake_reason(), percent);
         esp_deep_sleep_start();
     }
 
-    void Sleep_DisableTimer()
-    {
-        esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_TIMER);
-        _timerWakeReason = NA;
-    }
-
-    void Sleep_EnableTimer(TimerWakeReason_t cause, uint32_t ms)
-    {
-        if (ms > 100)
-        {
-            mqttLogger.printf("with timer %d seconds , reason %s", ms / 1000, GetTimerSleepCause(cause));
-            esp_sleep_enable_timer_wakeup(1000 * ms);
-            _timerWakeReason = cause;
-        }
-    }
-
     void Sleep_DisableAllWakeup()
     {
         esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_ALL);
@@ -355,12 +480,18 @@ namespace power
 
     void Sleep_EnablePinWakeup(WakeUpPin_t pin)
     {
+        if (pin < 0 || (pin == START_PIN && !VBUS_SENSED))
+            return;
         detachInterrupt(pin);
         rtc_gpio_hold_en((gpio_num_t)(pin));
         wakeup_mask |= (1ULL << (gpio_num_t)pin);
         String str = "sleep with mask " + String(wakeup_mask, BIN);
         mqttLogger.printf(str.c_str());
         esp_sleep_enable_ext1_wakeup_io(wakeup_mask, ESP_EXT1_WAKEUP_ANY_LOW);
+#if CONFIG_MOTION_WAKE_STUB
+        if (pin == MOTION_PIN)
+            wakeStub::arm(MOTION_INTRRUPT_PIN, CONFIG_MOTION_WAKE_STUB_HOLDOFF_S * 1000U, CONFIG_MOTION_WAKE_STUB_BOOT_AFTER);
+#endif
     }
 
     void light_sleep(uint16_t seconds)
@@ -374,9 +505,9 @@ namespace power
         Serial.printf("woke up from light sleep after %ld ms\n", (millis() - now));
     }
 
-    TimerWakeReason_t getTimerWakeReason()
+    uint32_t getLastAwakeMs()
     {
-        return _timerWakeReason;
+        return lastAwakeMs;
     }
 
     WakeUpReason_t Get_wake_reason()
@@ -398,7 +529,7 @@ namespace power
                 wakeUpReason = WakeUpReason_t::MOTION;
                 break;
             }
-            if (wakeup_pin_mask & ((uint64_t)1 << VBUS_INPUT_PIN))
+            if (VBUS_SENSED && (wakeup_pin_mask & ((uint64_t)1 << VBUS_INPUT_PIN)))
             {
                 Serial.println("Wakeup cause detected: PMU interrupt");
                 wakeUpReason = WakeUpReason_t::START;
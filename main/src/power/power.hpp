@@ -27,31 +27,28 @@ namespace power
         START_PIN = VBUS_INPUT_PIN,
     };
 
-    enum TimerWakeReason_t : uint8_t
-    {
-        AFTER_MOTION = 0,
-        SLEEP_SNAP_SHOT = 2,
-        AFTER_ON = 4,
-        Battery_LOW = 5,
-        WORKER = 6,
-        NA
-    };
     bool setupPower();
     esp_sleep_wakeup_cause_t getWakeupReason();
     WakeUpReason_t Get_wake_reason();
-    TimerWakeReason_t getTimerWakeReason();
-    static inline const char *GetTimerSleepCause(TimerWakeReason_t cause)
+
+    static inline const char *GetWakeReasonName(WakeUpReason_t reason)
     {
-        switch (cause)
+        switch (reason)
         {
-        case AFTER_MOTION:
-            return "AFTER_MOTION";
-        case SLEEP_SNAP_SHOT:
-            return "SLEEP_SNAP_SHOT";
+        case MOTION:
+            return "MOTION";
+        case START:
+            return "START";
+        case TIMER:
+            return "TIMER";
+        case MOEDM:
+            return "MODEM";
         default:
-            return "NA";
+            return "UNKNOWN";
         }
     }
+    // the previous wake from app start to deep sleep, 0 after power on
+    uint32_t getLastAwakeMs();
 
     Adafruit_MAX17048 &getPMU();
     bool iskeyShortPressed();
@@ -60,13 +57,16 @@ namespace power
     bool isPowerVBUSOn();
     bool isBatLowLevel();
     bool isBatCriticalLevel();
+    // VBUS / ignition edges in rtcMillis() time, kept across deep sleep, 0 if not seen since power on
     uint64_t getLastVbusInsertedTs();
     uint64_t getLastVbusRemovedTs();
-    void Sleep_EnableTimer(TimerWakeReason_t cause, uint32_t ms);
-    void Sleep_DisableTimer();
+    uint32_t getVbusTransitions();
+    // milliseconds on the RTC clock, counts through deep sleep
+    uint64_t rtcMillis();
     void Sleep_EnablePinWakeup(WakeUpPin_t pin);
     void Sleep_DisablePinWakeup();
     void Sleep_DisableAllWakeup();
+    // the wake timer is programmed from the schedule:: deadlines
     void DeepSleep();
     void light_sleep(uint16_t seconds);
 };
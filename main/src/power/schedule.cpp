@@ -0,0 +1,115 @@
+/**
+ * @file schedule.cpp
+ * @author rami zayat
+ * @brief deep sleep timer wheel, one deadline per job kept in RTC memory
+ * @version 0.1
+ * @date 2025-12-12
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include "power/schedule.hpp"
+#include "power/power.hpp"
+#include "power/wakeStub.hpp"
+#include "wifi/wifi.hpp"
+#include "esp_sleep.h"
+#include <algorithm>
+
+namespace schedule
+{
+    static const uint32_t MIN_SLEEP_MS = 1000; // a deadline that is already due still sleeps this long
+    static const uint32_t EARLY_MS = 1000;     // the sleep timer and the RTC clock may disagree by a little
+
+    typedef struct
+    {
+        uint64_t deadline_ms; // power::rtcMillis(), 0 if not pending
+        uint32_t length_ms;   // as set, the wake stub restarts AFTER_MOTION with it
+        uint32_t slack_ms;
+    } Entry_t;
+    static RTC_DATA_ATTR Entry_t wheel[JOB_COUNT];
+    static uint32_t expiredJobs = 0;
+
+    void set(Job job, uint32_t in_ms, uint32_t slack_ms)
+    {
+        if (job >= JOB_COUNT)
+            return;
+        wheel[job].deadline_ms = power::rtcMillis() + in_ms;
+        wheel[job].length_ms = in_ms;
+        wheel[job].slack_ms = slack_ms;
+    }
+
+    void ensure(Job job, uint32_t in_ms, uint32_t slack_ms)
+    {
+        if (!pending(job))
+            set(job, in_ms, slack_ms);
+    }
+
+    void clear(Job job)
+    {
+        if (job < JOB_COUNT)
+            wheel[job].deadline_ms = 0;
+    }
+
+    void clearAll(uint32_t keep)
+    {
+        for (uint8_t i = 0; i < JOB_COUNT; i++)
+        {
+            if (!(keep & bit((Job)i)))
+                wheel[i].deadline_ms = 0;
+        }
+    }
+
+    bool pending(Job job)
+    {
+        return job < JOB_COUNT && wheel[job].deadline_ms != 0;
+    }
+
+    uint32_t collect()
+    {
+        const uint64_t now = power::rtcMillis();
+        expiredJobs = 0;
+        for (uint8_t i = 0; i < JOB_COUNT; i++)
+        {
+            Entry_t &e = wheel[i];
+            if (e.deadline_ms == 0 || e.deadline_ms > now + e.slack_ms + EARLY_MS)
+                continue;
+            expiredJobs |= bit((Job)i);
+            mqttLogger.printf("job %s expired %lld ms late\n", name((Job)i), (long long)(now - e.deadline_ms));
+            e.deadline_ms = 0;
+        }
+        return expiredJobs;
+    }
+
+    uint32_t expired()
+    {
+        return expiredJobs;
+    }
+
+    bool arm()
+    {
+        int8_t first = -1;
+        for (uint8_t i = 0; i < JOB_COUNT; i++)
+        {
+            if (wheel[i].deadline_ms != 0 && (first < 0 || wheel[i].deadline_ms < wheel[first].deadline_ms))
+                first = i;
+        }
+        esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_TIMER);
+        const uint64_t now = power::rtcMillis();
+        // a motion wake filtered by the stub restarts the no motion timeout, the app does the same on a full wake.
+        // The stub has no wheel, it gets the next other deadline and never restarts the timer past it, however
+        // many filtered wakes come before.
+        uint64_t next_ms = UINT64_MAX;
+        for (uint8_t i = 0; first == AFTER_MOTION && i < JOB_COUNT; i++)
+        {
+            if (i != AFTER_MOTION && wheel[i].deadline_ms != 0)
+                next_ms = std::min<uint64_t>(next_ms, wheel[i].deadline_ms > now ? wheel[i].deadline_ms - now : 0);
+        }
+        wakeStub::setTimerRearm(first == AFTER_MOTION ? wheel[AFTER_MOTION].length_ms : 0, next_ms);
+        if (first < 0)
+            return false;
+        const uint64_t ms = wheel[first].deadline_ms > now + MIN_SLEEP_MS ? wheel[first].deadline_ms - now : MIN_SLEEP_MS;
+        mqttLogger.printf("with timer %lu seconds , reason %s\n", (unsigned long)(ms / 1000), name((Job)first));
+        esp_sleep_enable_timer_wakeup(ms * 1000U);
+        return true;
+    }
+}
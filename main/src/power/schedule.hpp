@@ -0,0 +1,81 @@
+/**
+ * @file schedule.hpp
+ * @author rami zayat
+ * @brief deep sleep timer wheel, one deadline per job kept in RTC memory
+ * @version 0.1
+ * @date 2025-12-12
+ *
+ * @copyright Copyright (c) 2025
+ *
+ * Deadlines are absolute power::rtcMillis() times, so they keep running through deep sleep.
+ * arm() programs the wake timer for the earliest one. At boot collect() takes every job whose
+ * deadline passed, or will pass within its slack, so jobs that tolerate running early share
+ * the wake another job or a motion wake paid for. Collected jobs are removed, periodic jobs
+ * are set again by the app after they ran.
+ */
+#pragma once
+#include <stdint.h>
+
+namespace schedule
+{
+    enum Job : uint8_t
+    {
+        SNAPSHOT = 0,
+        AFTER_MOTION,     // restarted by motion wakes filtered in the wake stub
+        OUTBOX_FLUSH,
+        TELEMETRY_UPLOAD,
+        GNSS_REFRESH,
+        BATTERY_CHECK,
+        JOB_COUNT
+    };
+
+    static inline uint32_t bit(Job job)
+    {
+        return 1UL << job;
+    }
+
+    static inline const char *name(Job job)
+    {
+        switch (job)
+        {
+        case SNAPSHOT:
+            return "SNAPSHOT";
+        case AFTER_MOTION:
+            return "AFTER_MOTION";
+        case OUTBOX_FLUSH:
+            return "OUTBOX_FLUSH";
+        case TELEMETRY_UPLOAD:
+            return "TELEMETRY_UPLOAD";
+        case GNSS_REFRESH:
+            return "GNSS_REFRESH";
+        case BATTERY_CHECK:
+            return "BATTERY_CHECK";
+        default:
+            return "NA";
+        }
+    }
+
+    /**
+     * @brief set or move a deadline
+     * @param in_ms from now
+     * @param slack_ms how early the job may run when the device is awake anyway
+     */
+    void set(Job job, uint32_t in_ms, uint32_t slack_ms = 0);
+    // set only if the job is not pending, for periodic jobs that must not be pushed back by every wake
+    void ensure(Job job, uint32_t in_ms, uint32_t slack_ms = 0);
+    void clear(Job job);
+    // drop every deadline not in `keep`, a bit() mask
+    void clearAll(uint32_t keep = 0);
+    bool pending(Job job);
+
+    // take the expired jobs, called once at boot
+    uint32_t collect();
+    // jobs collected at boot, a bit() mask
+    uint32_t expired();
+
+    /**
+     * @brief program the wake timer for the earliest deadline, called right before deep sleep
+     * @return false if no job is pending and the timer is disabled
+     */
+    bool arm();
+}
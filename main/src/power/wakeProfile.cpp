@@ -0,0 +1,105 @@
+/**
+ * @file wakeProfile.cpp
+ * @author rami zayat
+ * @brief time spent per phase of each wake, kept in an RTC ring and sent as PROFILE telemetry
+ * @version 0.1
+ * @date 2025-12-12
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include "power/wakeProfile.hpp"
+#include "telemetry/telemetry.hpp"
+#include "wifi/wifi.hpp"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include <math.h>
+#include <time.h>
+#include <algorithm>
+
+namespace wakeProfile
+{
+    static const uint32_t RING_MAGIC = 0x50524632; // "PRF2", uint32 durations
+
+    typedef struct
+    {
+        uint32_t magic;
+        uint8_t head;         // oldest record
+        uint8_t count;
+        uint16_t percent;     // 0.01 % at the last finish(), 0 after power on
+        uint32_t overwritten; // records lost to a full ring
+        telemetry::Profile_t records[RING_SIZE];
+    } Ring_t;
+    static RTC_DATA_ATTR Ring_t ring;
+
+    static uint64_t total_us[PHASE_COUNT];
+    static int64_t start_us[PHASE_COUNT]; // 0 when the phase is not running
+
+    static inline uint32_t toMs(uint64_t us)
+    {
+        return (uint32_t)std::min<uint64_t>(us / 1000, UINT32_MAX);
+    }
+
+    void boot()
+    {
+        if (ring.magic != RING_MAGIC)
+        {
+            ring = {};
+            ring.magic = RING_MAGIC;
+        }
+        total_us[BOOT] = esp_timer_get_time();
+    }
+
+    void begin(Phase phase)
+    {
+        if (phase < PHASE_COUNT && start_us[phase] == 0)
+            start_us[phase] = esp_timer_get_time();
+    }
+
+    void end(Phase phase)
+    {
+        if (phase >= PHASE_COUNT || start_us[phase] == 0)
+            return;
+        total_us[phase] += esp_timer_get_time() - start_us[phase];
+        start_us[phase] = 0;
+    }
+
+    void finish(uint8_t reason, float percent)
+    {
+        for (uint8_t i = 0; i < PHASE_COUNT; i++)
+            end((Phase)i);
+        telemetry::Profile_t r = {};
+        r.time = (uint32_t)time(nullptr);
+        r.reason = reason;
+        r.percent = (uint16_t)std::min(10000L, std::max(0L, lroundf(percent * 100.0f)));
+        r.delta = ring.percent != 0 ? (int16_t)((int32_t)r.percent - ring.percent) : 0;
+        r.awake_ms = toMs(esp_timer_get_time());
+        for (uint8_t i = 0; i < PHASE_COUNT; i++)
+            r.phase_ms[i] = toMs(total_us[i]);
+        ring.percent = r.percent;
+        if (ring.count == RING_SIZE)
+        {
+            ring.head = (ring.head + 1) % RING_SIZE; // keep the most recent wakes
+            ring.count--;
+            ring.overwritten++;
+        }
+        ring.records[(ring.head + ring.count) % RING_SIZE] = r;
+        ring.count++;
+    }
+
+    size_t flush(bool force)
+    {
+        if (ring.count == 0 || (!force && ring.count < FLUSH_AT))
+            return 0;
+        size_t sent = 0;
+        while (ring.count > 0 && telemetry::publishProfile(ring.records[ring.head]))
+        {
+            ring.head = (ring.head + 1) % RING_SIZE;
+            ring.count--;
+            sent++;
+        }
+        mqttLogger.printf(MqttLogLevel::Debug, "wake profile: %u records queued, %u kept, %lu overwritten\n", (unsigned)sent,
+                          ring.count, (unsigned long)ring.overwritten);
+        return sent;
+    }
+}
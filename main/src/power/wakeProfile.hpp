@@ -0,0 +1,68 @@
+/**
+ * @file wakeProfile.hpp
+ * @author rami zayat
+ * @brief time spent per phase of each wake, kept in an RTC ring and sent as PROFILE telemetry
+ * @version 0.1
+ * @date 2025-12-12
+ *
+ * @copyright Copyright (c) 2025
+ *
+ * Phases are timed with esp_timer_get_time(), a phase entered several times in one wake
+ * adds up. At sleep entry the wake becomes a telemetry::Profile_t in a ring of RING_SIZE
+ * records in RTC memory. flush() queues the ring as QoS1 PROFILE records, they go out with
+ * the next telemetry upload. tools/wake_profile.py turns them into per phase energy.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "telemetry/telemetryRecord.hpp"
+
+namespace wakeProfile
+{
+    // order of Profile_t::phase_ms
+    enum Phase : uint8_t
+    {
+        BOOT = 0, // reset to setup(), ROM, bootloader and startup code
+        POWER,    // gauge, VBUS and button setup
+        IMU,
+        MODEM,    // power on to network registration
+        ATTACH,   // PPP and MQTT connect
+        SEND,     // SMS and queued MQTT messages
+        SLEEP,    // DeepSleep() to esp_deep_sleep_start()
+        PHASE_COUNT,
+    };
+    static_assert(PHASE_COUNT == telemetry::PROFILE_PHASES, "Profile_t phase count");
+
+    static const uint8_t RING_SIZE = 16;
+    static const uint8_t FLUSH_AT = 12; // records, flush(false) waits for this many
+
+    // first call of setup(), BOOT is the time since reset
+    void boot();
+    void begin(Phase phase);
+    void end(Phase phase);
+
+    // times a scope
+    class Span
+    {
+    public:
+        explicit Span(Phase phase) : phase(phase) { begin(phase); }
+        ~Span() { end(phase); }
+
+    private:
+        const Phase phase;
+    };
+
+    /**
+     * @brief end the wake: close SLEEP and store the record in the RTC ring
+     * @param reason power::WakeUpReason_t
+     * @param percent battery percent at sleep entry
+     */
+    void finish(uint8_t reason, float percent);
+
+    /**
+     * @brief queue the ring records as telemetry
+     * @param force false waits for FLUSH_AT records, true sends whatever is there
+     * @return records queued
+     */
+    size_t flush(bool force);
+}
@@ -0,0 +1,115 @@
+/**
+ * @file wakeStub.cpp
+ * @author rami zayat
+ * @brief filter repeated motion wakes in the deep sleep wake stub, before the bootloader runs
+ * @version 0.1
+ * @date 2025-12-12
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include "power/wakeStub.hpp"
+#include "esp_attr.h"
+#include "esp_sleep.h"
+#include "esp_wake_stub.h"
+#include "esp_private/esp_clk.h"
+#include "hal/rtc_cntl_ll.h"
+#include "soc/rtc.h"
+#include "soc/rtc_io_reg.h"
+#include "driver/rtc_io.h"
+
+namespace wakeStub
+{
+    static const uint32_t ARMED = 0x4D535442; // "MSTB"
+
+    // shared with the stub, everything it touches lives in RTC memory
+    typedef struct
+    {
+        uint32_t armed;
+        uint32_t rtcio;        // RTC IO number of the motion pin
+        uint64_t holdoff_us;
+        uint64_t rearm_us;     // timer restarted by a filtered wake, 0 if none
+        uint64_t rearm_until;  // RTC ticks when the next other job is due, 0 if none
+        uint32_t cal;          // slow clock period, us Q13.19, turns ticks into the us the timer takes
+        uint16_t boot_after;
+        uint16_t in_window;    // filtered since window_start
+        uint64_t window_start; // RTC ticks of the last motion wake that booted the app
+        uint64_t last_filtered;
+        uint32_t filtered;     // since the app last read it
+    } State_t;
+    static RTC_DATA_ATTR State_t state;
+
+    void arm(gpio_num_t pin, uint32_t holdoff_ms, uint16_t boot_after)
+    {
+#if CONFIG_MOTION_WAKE_STUB
+        state.rtcio = (uint32_t)rtc_io_number_get(pin);
+        state.holdoff_us = (uint64_t)holdoff_ms * 1000U;
+        state.boot_after = boot_after;
+        state.armed = ARMED;
+#endif
+    }
+
+    void disarm()
+    {
+        state.armed = 0;
+        state.rearm_us = 0;
+    }
+
+    void setTimerRearm(uint32_t ms, uint64_t next_ms)
+    {
+        state.rearm_us = (uint64_t)ms * 1000U;
+        state.rearm_until = next_ms == UINT64_MAX ? 0 : rtc_cntl_ll_get_rtc_time() + rtc_cntl_ll_time_to_count(next_ms * 1000U);
+        state.cal = esp_clk_slowclk_cal_get();
+    }
+
+    uint32_t takeFiltered(uint32_t &last_ago_ms)
+    {
+        const uint32_t n = state.filtered;
+        if (n != 0)
+        {
+            const uint64_t ticks_per_s = rtc_cntl_ll_time_to_count(1000000);
+            last_ago_ms = (uint32_t)((rtc_cntl_ll_get_rtc_time() - state.last_filtered) * 1000U / ticks_per_s);
+        }
+        state.filtered = 0;
+        return n;
+    }
+}
+
+#if CONFIG_MOTION_WAKE_STUB
+// runs before the bootloader with only RTC memory and registers usable: no flash, no logging, no I2C
+extern "C" void RTC_IRAM_ATTR esp_wake_deep_sleep(void)
+{
+    esp_default_wake_deep_sleep();
+    wakeStub::State_t &s = wakeStub::state;
+    if (s.armed != wakeStub::ARMED)
+        return;
+    if (rtc_cntl_ll_ext1_get_wakeup_status() != (1UL << s.rtcio))
+        return; // timer, VBUS or more than the motion pin
+    if (((REG_READ(RTC_GPIO_IN_REG) >> (RTC_GPIO_IN_NEXT_S + s.rtcio)) & 1U) == 0)
+        return; // still asserted, the app has to clear the IMU
+    const uint64_t now = rtc_cntl_ll_get_rtc_time();
+    if (s.rearm_until != 0 && now >= s.rearm_until)
+        return; // the next job is due, the app runs it
+    if (now - s.window_start >= rtc_cntl_ll_time_to_count(s.holdoff_us) || s.in_window + 1U >= s.boot_after)
+    {
+        s.window_start = now;
+        s.in_window = 0;
+        return;
+    }
+    s.in_window++;
+    s.filtered++;
+    s.last_filtered = now;
+    // restart the no motion timeout, ending no later than the next other job
+    uint64_t rearm = s.rearm_us;
+    if (rearm != 0 && s.rearm_until != 0)
+    {
+        const uint64_t left_us = ((s.rearm_until - now) * s.cal) >> RTC_CLK_CAL_FRACT;
+        if (left_us < rearm)
+            rearm = left_us > 0 ? left_us : 1;
+    }
+    if (rearm != 0)
+        esp_wake_stub_set_wakeup_time(rearm);
+    rtc_cntl_ll_ext1_clear_wakeup_status();
+    esp_wake_stub_sleep(&esp_wake_deep_sleep);
+}
+#endif
@@ -0,0 +1,39 @@
+/**
+ * @file wakeStub.hpp
+ * @author rami zayat
+ * @brief filter repeated motion wakes in the deep sleep wake stub, before the bootloader runs
+ * @version 0.1
+ * @date 2025-12-12
+ *
+ * @copyright Copyright (c) 2025
+ *
+ * The stub runs from RTC fast memory on every deep sleep wake. When armed, a wake caused
+ * only by the motion pin is counted and sent back to sleep unless:
+ *
+ *   - the last motion wake that booted the app is older than the hold-off, a new episode
+ *   - `boot_after` wakes were filtered since, the motion is sustained
+ *   - the pin is still low, the interrupt is latched and needs I2C to be released
+ *
+ * Any other wake cause boots the app as usual. A filtered wake restarts the AFTER_MOTION
+ * timer the same way a booted motion wake does, but never past the next other job, and a
+ * motion wake once that job is due boots the app.
+ */
+#pragma once
+#include <stdint.h>
+#include "driver/gpio.h"
+
+namespace wakeStub
+{
+    // enable filtering for the next deep sleep, `pin` is the ext1 motion pin
+    void arm(gpio_num_t pin, uint32_t holdoff_ms, uint16_t boot_after);
+    // called at boot, the app arms again when it sleeps waiting for motion
+    void disarm();
+    // timer restarted by each filtered wake, 0 keeps the timer as it is. `next_ms` is when the next
+    // other job is due from now, UINT64_MAX for none: the restart never ends after it
+    void setTimerRearm(uint32_t ms, uint64_t next_ms = UINT64_MAX);
+    /**
+     * @brief motion wakes the stub sent back to sleep since the last call
+     * @param last_ago_ms set to how long ago the last one was, when the count is not 0
+     */
+    uint32_t takeFiltered(uint32_t &last_ago_ms);
+}
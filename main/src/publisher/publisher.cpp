@@ -0,0 +1,553 @@
+/**
+ * @file publisher.cpp
+ * @author rami zayat
+ * @brief single MQTT publish path over WiFi, PPP or the modem MQTT stack, with a flash backed QoS1 queue
+ * @version 0.1
+ * @date 2025-12-09
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include "publisher/publisher.hpp"
+#include "publisher/upload.hpp"
+#include "pppos_client.hpp"
+#include "wifi/mqtt_client.hpp"
+#include "wifi/wifi.hpp"
+#include "power/wakeProfile.hpp"
+#include "LittleFS.h"
+#include "esp_attr.h"
+#include <string.h>
+#include <string>
+#include <algorithm>
+
+namespace publisher
+{
+    static const char *QUEUE_DIR = "/pubq";
+    static const uint8_t RECORD_MAGIC = 0xA5;
+    static const uint32_t STATE_MAGIC = 0x50554231; // "PUB1"
+    static const uint32_t MQTT_CONNECT_TIMEOUT_MS = 20U * 1000U;
+    static const uint32_t ACK_TIMEOUT_MS = 10U * 1000U;
+    static const uint32_t WIFI_RETRY_MS = 30U * 1000U;
+
+    typedef struct __attribute__((packed))
+    {
+        uint8_t magic;
+        uint8_t flags;
+        uint16_t topic_len;
+        uint16_t len;
+    } RecordHeader_t;
+
+    typedef struct
+    {
+        uint32_t seg;
+        uint32_t off;
+    } Cursor_t;
+
+    typedef struct
+    {
+        uint32_t magic;
+        Cursor_t head;    // oldest unacknowledged record
+        uint32_t tailSeg; // segment new records are appended to
+        uint32_t count;   // queued records
+    } State_t;
+
+    static RTC_DATA_ATTR State_t state;
+    static Stats_t stats = {};
+    static bool mounted = false;
+    static MqttClient *cell = nullptr; // cellular session, only open inside flush()
+    static Link cellLink = Link::NONE;
+    // PubSubClient only publishes QoS0, queued records go over an esp-mqtt session on the WiFi
+    // station that drain() opens while records wait, a batch is committed once acknowledged
+    static MqttClient *wifiSession = nullptr;
+    static uint32_t wifiOpenMs = 0;
+    static Cursor_t inflightCur; // end of the batch sent on wifiSession
+    static uint32_t inflight = 0;  // its records, 0 when nothing waits for an ack
+    static uint32_t inflightMs = 0;
+    static RTC_DATA_ATTR LinkStats_t linkStats[2]; // PPP, MODEM
+
+    static SemaphoreHandle_t lock()
+    {
+        static SemaphoreHandle_t mutex = xSemaphoreCreateMutex();
+        return mutex;
+    }
+
+    static void segmentPath(uint32_t seg, char *buf, size_t len)
+    {
+        snprintf(buf, len, "%s/%lu.q", QUEUE_DIR, (unsigned long)seg);
+    }
+
+    // false at the end of the segment or on a torn record
+    static bool readRecord(File &f, RecordHeader_t &hdr, std::string &topic, std::string &payload)
+    {
+        if (f.read((uint8_t *)&hdr, sizeof(hdr)) != sizeof(hdr) || hdr.magic != RECORD_MAGIC)
+            return false;
+        topic.resize(hdr.topic_len);
+        payload.resize(hdr.len);
+        return f.read((uint8_t *)topic.data(), hdr.topic_len) == hdr.topic_len &&
+               f.read((uint8_t *)payload.data(), hdr.len) == hdr.len;
+    }
+
+    // cold boot: rebuild the cursors from the segment files
+    static void recover()
+    {
+        memset(&state, 0, sizeof(state));
+        state.magic = STATE_MAGIC;
+        bool any = false;
+        uint32_t lo = 0, hi = 0;
+        RecordHeader_t hdr;
+        std::string topic, payload;
+        File dir = LittleFS.open(QUEUE_DIR);
+        for (File f = dir.openNextFile(); f; f = dir.openNextFile())
+        {
+            const uint32_t seg = strtoul(f.name(), nullptr, 10);
+            lo = any ? std::min(lo, seg) : seg;
+            hi = any ? std::max(hi, seg) : seg;
+            any = true;
+            while (readRecord(f, hdr, topic, payload))
+                state.count++;
+            f.close();
+        }
+        state.head.seg = lo;
+        state.tailSeg = hi;
+        if (state.count > 0)
+            mqttLogger.printf("publisher: %lu queued messages recovered\n", (unsigned long)state.count);
+    }
+
+    static bool mount()
+    {
+        if (mounted)
+            return true;
+        if (!LittleFS.begin(false, "/littlefs", 10, "storage"))
+        {
+            mqttLogger.println("publisher: storage mount failed");
+            return false;
+        }
+        if (!LittleFS.exists(QUEUE_DIR))
+            LittleFS.mkdir(QUEUE_DIR);
+        if (state.magic != STATE_MAGIC)
+            recover();
+        mounted = true;
+        return true;
+    }
+
+    static Result append(const char *topic, const char *payload, size_t len, uint8_t flags)
+    {
+        const size_t topicLen = strlen(topic);
+        const size_t size = sizeof(RecordHeader_t) + topicLen + len;
+        if (topicLen > MAX_TOPIC || size > SEGMENT_SIZE)
+        {
+            mqttLogger.printf("publisher: %u bytes for %s do not fit a segment, dropping\n", (unsigned)len, topic);
+            stats.dropped++;
+            return Result::DROPPED;
+        }
+        char path[32];
+        segmentPath(state.tailSeg, path, sizeof(path));
+        File f = LittleFS.open(path, "a");
+        if (f && f.size() > 0 && f.size() + size > SEGMENT_SIZE)
+        {
+            f.close();
+            if (state.tailSeg + 1 - state.head.seg >= MAX_SEGMENTS)
+            {
+                stats.dropped++;
+                return Result::FULL;
+            }
+            segmentPath(++state.tailSeg, path, sizeof(path));
+            f = LittleFS.open(path, "a");
+        }
+        if (!f)
+        {
+            stats.dropped++;
+            return Result::DROPPED;
+        }
+        const RecordHeader_t hdr = {RECORD_MAGIC, flags, (uint16_t)topicLen, (uint16_t)len};
+        const bool ok = f.write((const uint8_t *)&hdr, sizeof(hdr)) == sizeof(hdr) &&
+                        f.write((const uint8_t *)topic, topicLen) == topicLen &&
+                        f.write((const uint8_t *)payload, len) == len;
+        f.close();
+        if (!ok)
+        {
+            // the torn record ends this segment for the reader, later records go to a new one
+            state.tailSeg++;
+            stats.dropped++;
+            return Result::DROPPED;
+        }
+        state.count++;
+        stats.queued++;
+        return Result::QUEUED;
+    }
+
+    // the client that acknowledges QoS1 on `link`, nullptr if none is open
+    static MqttClient *session(Link link)
+    {
+        if (link == Link::WIFI)
+            return wifiSession != nullptr && wifiSession->isConnected() ? wifiSession : nullptr;
+        return cell != nullptr && link == cellLink ? cell : nullptr;
+    }
+
+    static bool send(Link link, const char *topic, const char *data, size_t len, uint8_t qos)
+    {
+        MqttClient *client = session(link);
+        if (client != nullptr)
+            return client->publish(topic, std::string(data, len), qos) >= 0;
+        return qos == 0 && link == Link::WIFI && mqttclient.publish(topic, (const uint8_t *)data, len, false);
+    }
+
+    static bool sendFile(Link link, const std::string &topic, const std::string &path)
+    {
+        if (!LittleFS.exists(path.c_str()))
+        {
+            mqttLogger.printf("publisher: %s is gone, dropping\n", path.c_str());
+            return true;
+        }
+        MqttClient *client = session(link);
+        const bool ok = client != nullptr && upload::send(*client, topic.c_str(), LittleFS, path.c_str(), 1);
+        if (ok)
+            LittleFS.remove(path.c_str());
+        return ok;
+    }
+
+    /**
+     * @brief send up to `max` publishes starting at `cur`
+     *
+     * Consecutive FLAG_BATCH records of the same topic and flags go out as one publish,
+     * newline joined, or back to back with FLAG_BINARY.
+     * `cur` and `consumed` are advanced past what was sent, the caller commits them.
+     */
+    static size_t sendFrom(Link link, Cursor_t &cur, uint32_t &consumed, size_t max)
+    {
+        size_t sent = 0;
+        std::string topic, payload, nextTopic, nextPayload;
+        char path[32];
+        while (sent < max && consumed < state.count)
+        {
+            segmentPath(cur.seg, path, sizeof(path));
+            File f = LittleFS.open(path, "r");
+            RecordHeader_t hdr;
+            if (!f || !f.seek(cur.off) || !readRecord(f, hdr, topic, payload))
+            {
+                if (f)
+                    f.close();
+                if (cur.seg >= state.tailSeg)
+                    break;
+                cur.seg++; // end of the segment, or a torn record
+                cur.off = 0;
+                continue;
+            }
+            uint32_t next = f.position();
+            uint32_t records = 1;
+            if (hdr.flags & FLAG_BATCH)
+            {
+                RecordHeader_t nextHdr;
+                const size_t sep = (hdr.flags & FLAG_BINARY) ? 0 : 1;
+                while (consumed + records < state.count && readRecord(f, nextHdr, nextTopic, nextPayload) &&
+                       nextHdr.flags == hdr.flags && nextTopic == topic && payload.size() + sep + nextPayload.size() <= MAX_BATCH)
+                {
+                    if (sep)
+                        payload += '\n';
+                    payload += nextPayload;
+                    next = f.position();
+                    records++;
+                }
+            }
+            f.close();
+            const bool ok = (hdr.flags & FLAG_FILE) ? sendFile(link, topic, payload)
+                                                    : send(link, topic.c_str(), payload.data(), payload.size(), 1);
+            if (!ok)
+                break;
+            cur.off = next;
+            consumed += records;
+            sent++;
+            stats.sent += records;
+            stats.batches += records > 1;
+        }
+        return sent;
+    }
+
+    // drop acknowledged records, removing the segments left behind
+    static void commit(const Cursor_t &cur, uint32_t consumed)
+    {
+        char path[32];
+        while (state.head.seg < cur.seg)
+        {
+            segmentPath(state.head.seg++, path, sizeof(path));
+            LittleFS.remove(path);
+        }
+        state.head.off = cur.off;
+        state.count -= std::min(consumed, state.count);
+        if (state.count == 0)
+        {
+            // empty, restart on a fresh segment rather than growing the last one
+            for (uint32_t seg = state.head.seg; seg <= state.tailSeg; seg++)
+            {
+                segmentPath(seg, path, sizeof(path));
+                LittleFS.remove(path);
+            }
+            state.tailSeg++;
+            state.head.seg = state.tailSeg;
+            state.head.off = 0;
+        }
+    }
+
+    Link activeLink()
+    {
+        MqttClientGuard guard;
+        if (GetWifiOn() && mqttclient.connected())
+            return Link::WIFI;
+        if (cell != nullptr && cell->isConnected())
+            return cellLink;
+        return Link::NONE;
+    }
+
+    Result publish(const char *topic, const char *payload, size_t len, uint8_t qos, uint8_t flags)
+    {
+        if (topic == nullptr || payload == nullptr)
+            return Result::DROPPED;
+        MqttClientGuard guard; // before the queue lock, the WiFi task takes them in this order
+        xSemaphoreTake(lock(), portMAX_DELAY);
+        const bool ready = mount();
+        const Link link = activeLink();
+        // QoS1 goes direct only over the modem, whose publish returns after the PUBACK, and only
+        // when nothing older waits; without storage it goes out best effort
+        const bool direct = link != Link::NONE && (flags & FLAG_FILE) == 0 &&
+                            (qos == 0 || !ready || (link == Link::MODEM && state.count == 0));
+        Result ret;
+        if (direct && send(link, topic, payload, len, ready ? qos : 0))
+        {
+            stats.sent++;
+            ret = Result::SENT;
+        }
+        else if (qos == 0 || !ready)
+        {
+            stats.dropped++;
+            ret = Result::DROPPED;
+        }
+        else
+        {
+            ret = append(topic, payload, len, flags);
+        }
+        xSemaphoreGive(lock());
+        return ret;
+    }
+
+    Result publish(const char *topic, const char *payload, uint8_t qos, uint8_t flags)
+    {
+        return publish(topic, payload, payload ? strlen(payload) : 0, qos, flags);
+    }
+
+    Result publishFile(const char *topic, const char *path)
+    {
+        return publish(topic, path, 1, FLAG_FILE);
+    }
+
+    // an unacknowledged batch stays queued and is sent again by the next session
+    static void closeWifiSession()
+    {
+        delete wifiSession;
+        wifiSession = nullptr;
+        inflight = 0;
+        wifiOpenMs = millis();
+    }
+
+    size_t drain(size_t max)
+    {
+        MqttClientGuard guard;
+        xSemaphoreTake(lock(), portMAX_DELAY);
+        size_t sent = 0;
+        // while flush() has a cellular session open it owns the head
+        if (cell != nullptr || activeLink() != Link::WIFI || !mount())
+        {
+            if (wifiSession != nullptr)
+                closeWifiSession();
+        }
+        else if (wifiSession == nullptr)
+        {
+            if (state.count > 0 && (wifiOpenMs == 0 || millis() - wifiOpenMs > WIFI_RETRY_MS))
+            {
+                wifiSession = new MqttClient(MqttClient::Backend::ESP_MQTT);
+                wifiSession->begin(); // connects in the background
+                wifiOpenMs = millis();
+            }
+        }
+        else if (!wifiSession->isConnected())
+        {
+            if (millis() - wifiOpenMs > MQTT_CONNECT_TIMEOUT_MS)
+                closeWifiSession();
+        }
+        else
+        {
+            if (inflight > 0 && wifiSession->outboxSize() == 0)
+            {
+                commit(inflightCur, inflight);
+                inflight = 0;
+            }
+            else if (inflight > 0 && millis() - inflightMs > ACK_TIMEOUT_MS)
+            {
+                mqttLogger.println("publisher: no ack over WiFi, the batch stays queued");
+                closeWifiSession();
+            }
+            if (wifiSession != nullptr && inflight == 0)
+            {
+                Cursor_t cur = state.head;
+                uint32_t consumed = 0;
+                sent = state.count > 0 ? sendFrom(Link::WIFI, cur, consumed, max) : 0;
+                if (consumed > 0)
+                {
+                    inflightCur = cur;
+                    inflight = consumed;
+                    inflightMs = millis();
+                }
+                else if (state.count == 0)
+                {
+                    closeWifiSession(); // all acknowledged, no second connection is kept open
+                    wifiOpenMs = 0;
+                }
+            }
+        }
+        xSemaphoreGive(lock());
+        return sent;
+    }
+
+    static bool waitAcks(MqttClient &client)
+    {
+        const uint32_t start = millis();
+        while (client.outboxSize() > 0)
+        {
+            if (!client.isConnected() || millis() - start > ACK_TIMEOUT_MS)
+                return false;
+            delay(50);
+        }
+        return true;
+    }
+
+    // send batches until the queue is empty, a batch is committed once it is acknowledged
+    static void replay(MqttClient &client, Link link)
+    {
+        while (client.isConnected())
+        {
+            xSemaphoreTake(lock(), portMAX_DELAY);
+            Cursor_t cur = state.head;
+            uint32_t consumed = 0;
+            const size_t sent = state.count > 0 ? sendFrom(link, cur, consumed, DRAIN_BATCH) : 0;
+            xSemaphoreGive(lock());
+            if (sent == 0)
+                return;
+            // publishers may append meanwhile, only flush() moves the head while the session is open
+            if (!waitAcks(client))
+            {
+                mqttLogger.println("publisher: no ack, the batch stays queued");
+                return;
+            }
+            xSemaphoreTake(lock(), portMAX_DELAY);
+            commit(cur, consumed);
+            xSemaphoreGive(lock());
+        }
+    }
+
+    bool flush(ModemSim7670 &modem)
+    {
+        if (pending() == 0)
+            return true;
+        if (activeLink() == Link::WIFI)
+        {
+            // drain() sends and commits in steps, give up once nothing moved for a connect and an ack
+            uint32_t left = pending(), since = millis();
+            while (left > 0 && activeLink() == Link::WIFI && millis() - since < MQTT_CONNECT_TIMEOUT_MS + ACK_TIMEOUT_MS)
+            {
+                drain();
+                delay(50);
+                const uint32_t now = pending();
+                if (now < left)
+                    since = millis();
+                left = now;
+            }
+            return left == 0;
+        }
+        // the modem stack needs no PPP link, it publishes over its own TCP/TLS session
+        const MqttClient::Backend backend = MqttClient::preferredBackend();
+        const bool viaPpp = backend == MqttClient::Backend::ESP_MQTT;
+        LinkStats_t &ls = linkStats[viaPpp ? 0 : 1];
+        ls.sessions++;
+        const uint32_t attachStart = millis();
+        wakeProfile::begin(wakeProfile::ATTACH);
+        if (viaPpp && !modem.connectToInternet())
+        {
+            wakeProfile::end(wakeProfile::ATTACH);
+            ls.failed++;
+            return false;
+        }
+        {
+            MqttClient client(backend);
+            client.setCallback(MqttReceiveCallback);
+            client.begin();
+            auto start = millis();
+            while (!client.isConnected() && millis() - start < MQTT_CONNECT_TIMEOUT_MS)
+            {
+                delay(100);
+            }
+            wakeProfile::end(wakeProfile::ATTACH);
+            ls.attach_ms += millis() - attachStart;
+            if (client.isConnected())
+            {
+                client.subscribe(mqtt_cmd_topic.c_str(), 1);
+                client.subscribe((mqtt_cmd_topic + "/+").c_str(), 1);
+                const uint32_t before = pending();
+                xSemaphoreTake(lock(), portMAX_DELAY);
+                cell = &client;
+                cellLink = viaPpp ? Link::PPP : Link::MODEM;
+                xSemaphoreGive(lock());
+                wakeProfile::begin(wakeProfile::SEND);
+                replay(client, cellLink);
+                wakeProfile::end(wakeProfile::SEND);
+                // commands and their replies, which go out over this session
+                for (start = millis(); client.isConnected() && millis() - start < COMMAND_WINDOW_MS; delay(50))
+                    ls.commands += client.loop();
+                xSemaphoreTake(lock(), portMAX_DELAY);
+                cell = nullptr;
+                cellLink = Link::NONE;
+                xSemaphoreGive(lock());
+                client.disconnect();
+                mqttLogger.printf("publisher: %lu of %lu queued messages delivered\n", (unsigned long)(before - std::min(before, pending())), (unsigned long)before);
+            }
+            else
+            {
+                ls.failed++;
+            }
+            const MqttClient::Stats_t &cs = client.getStats();
+            ls.connect_ms += cs.connect_ms;
+            ls.publishes += cs.publishes;
+            ls.publish_ms += cs.publish_ms;
+            ls.errors += cs.failures;
+            mqttLogger.printf("publisher via %s: connect %lu ms, %lu publishes in %lu ms, %lu failed\n", viaPpp ? "ppp" : "modem",
+                              (unsigned long)cs.connect_ms, (unsigned long)cs.publishes, (unsigned long)cs.publish_ms, (unsigned long)cs.failures);
+        }
+        if (viaPpp)
+            modem.disconnectInternet();
+        return pending() == 0;
+    }
+
+    uint32_t pending()
+    {
+        xSemaphoreTake(lock(), portMAX_DELAY);
+        const uint32_t count = mount() ? state.count : 0;
+        xSemaphoreGive(lock());
+        return count;
+    }
+
+    bool congested()
+    {
+        xSemaphoreTake(lock(), portMAX_DELAY);
+        const bool full = mount() && state.tailSeg + 1 - state.head.seg > HIGH_WATERMARK;
+        xSemaphoreGive(lock());
+        return full;
+    }
+
+    const Stats_t &getStats()
+    {
+        return stats;
+    }
+
+    const LinkStats_t &getLinkStats(Link link)
+    {
+        return linkStats[link == Link::PPP ? 0 : 1];
+    }
+}
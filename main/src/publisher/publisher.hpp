@@ -0,0 +1,142 @@
+/**
+ * @file publisher.hpp
+ * @author rami zayat
+ * @brief single MQTT publish path over WiFi, PPP or the modem MQTT stack, with a flash backed QoS1 queue
+ * @version 0.1
+ * @date 2025-12-09
+ *
+ * @copyright Copyright (c) 2025
+ *
+ * QoS1 messages that cannot be sent right away are appended to segment files of
+ * SEGMENT_SIZE bytes in /pubq on the storage partition. Segments form a ring: the
+ * head segment is removed once all its records are acknowledged, new records go to
+ * the tail segment. Each record is
+ *
+ *   magic     0xA5
+ *   flags     FLAG_*
+ *   topic_len uint16 little endian
+ *   len       uint16 little endian
+ *   topic, payload
+ *
+ * The head cursor lives in RTC memory. After a cold boot it restarts at the start of
+ * the oldest segment, so a few messages may be delivered twice, which QoS1 allows.
+ *
+ * Records leave the queue only once a client acknowledged them: esp-mqtt over PPP or the
+ * WiFi station once its outbox is empty, the modem stack when its publish returns.
+ * PubSubClient publishes QoS0 only, so over WiFi it carries QoS0 messages and the queue
+ * is replayed on a separate esp-mqtt session opened by drain().
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+class ModemSim7670;
+
+namespace publisher
+{
+    enum class Link : uint8_t
+    {
+        NONE = 0,
+        WIFI,  // PubSubClient over the WiFi station
+        PPP,   // esp-mqtt over the modem PPP session
+        MODEM, // modem AT+CMQTT client
+    };
+
+    enum class Result : uint8_t
+    {
+        SENT = 0,
+        QUEUED,  // stored, sent on the next connection
+        FULL,    // QoS1 queue full, the caller keeps the message or drops it
+        DROPPED, // QoS0 without a link, or a message too large to queue
+    };
+
+    static const uint8_t FLAG_FILE = 0x01;  // payload is a path on the storage partition, streamed at send time and removed once sent
+    static const uint8_t FLAG_BATCH = 0x02; // may be joined with the next records of the same topic, one per line
+    static const uint8_t FLAG_BINARY = 0x04; // with FLAG_BATCH, self delimiting records joined without a separator
+
+    static const uint16_t SEGMENT_SIZE = 4096;
+    static const uint8_t MAX_SEGMENTS = 16;       // 64 KB of queued messages
+    static const uint8_t HIGH_WATERMARK = 12;     // segments, above this congested() is true
+    static const uint16_t MAX_BATCH = 900;        // joined payload, below the PubSubClient packet size
+    static const uint8_t MAX_TOPIC = 128;
+    static const uint8_t DRAIN_BATCH = 8;         // publishes per drain() call
+
+    typedef struct
+    {
+        uint32_t sent;    // messages delivered, direct or replayed
+        uint32_t queued;  // messages stored to flash
+        uint32_t batches; // publishes carrying more than one record
+        uint32_t dropped;
+    } Stats_t;
+
+    // flush() sessions of one cellular backend, kept across deep sleep to compare them
+    typedef struct
+    {
+        uint32_t sessions;
+        uint32_t failed;     // sessions that never connected
+        uint32_t attach_ms;  // PPP dial plus broker connect, all sessions
+        uint32_t connect_ms; // broker connect only
+        uint32_t publishes;
+        uint32_t publish_ms;
+        uint32_t errors;     // publishes that failed
+        uint32_t commands;   // messages received on the command topics
+    } LinkStats_t;
+
+    static const uint32_t COMMAND_WINDOW_MS = 1000; // flush() listens this long for commands after the replay
+
+    /**
+     * @brief publish on the active link, queue QoS1 messages when there is none
+     *
+     * Queued messages are always sent before newer QoS1 ones so the order is kept.
+     * @param topic topic
+     * @param payload payload, or a file path with FLAG_FILE
+     * @param len payload length
+     * @param qos 0 is sent only when a link is up, 1 is kept until acknowledged
+     * @param flags FLAG_*
+     */
+    Result publish(const char *topic, const char *payload, size_t len, uint8_t qos = 1, uint8_t flags = 0);
+    Result publish(const char *topic, const char *payload, uint8_t qos = 1, uint8_t flags = 0);
+
+    /**
+     * @brief queue a file of any size, it is removed from the storage partition once sent
+     *
+     * The file is sent by upload::send() as upload::Mode::CHUNKED QoS1 messages on every
+     * link, one chunk in RAM at a time.
+     */
+    Result publishFile(const char *topic, const char *path);
+
+    Link activeLink();
+
+    /**
+     * @brief replay queued messages over WiFi, called from the WiFi task loop
+     *
+     * Never blocks on the network: opens the esp-mqtt session while records wait, sends one
+     * batch, and commits it on a later call once the session acknowledged it.
+     * @param max publishes to send before returning, keeps the caller's loop responsive
+     * @return publishes sent
+     */
+    size_t drain(size_t max = DRAIN_BATCH);
+
+    /**
+     * @brief send everything queued over the cellular link
+     *
+     * Uses WiFi through drain() if it is connected, otherwise opens a session with
+     * MqttClient::preferredBackend(). A batch only leaves the queue once it is acknowledged.
+     * The session subscribes to the command topics and hands what arrives to
+     * commands::dispatch() until COMMAND_WINDOW_MS after the replay.
+     * @param modem initialized modem
+     * @return true if the queue is empty
+     */
+    bool flush(ModemSim7670 &modem);
+
+    // queued QoS1 messages
+    uint32_t pending();
+
+    // the queue is above HIGH_WATERMARK, hold back non essential traffic
+    bool congested();
+
+    const Stats_t &getStats();
+
+    // Link::PPP or Link::MODEM
+    const LinkStats_t &getLinkStats(Link link);
+}
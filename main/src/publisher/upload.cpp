@@ -0,0 +1,221 @@
+/**
+ * @file upload.cpp
+ * @author rami zayat
+ * @brief stream files of any size from LittleFS or the SD card to MQTT with constant RAM
+ * @version 0.1
+ * @date 2025-12-12
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include "publisher/upload.hpp"
+#include "wifi/mqtt_client.hpp"
+#include "wifi/wifi.hpp"
+#include "FS.h"
+#include "esp_random.h"
+#include "esp_rom_crc.h"
+#include <string>
+#include <algorithm>
+
+namespace upload
+{
+    static const uint32_t OUTBOX_LIMIT = 4U * CHUNK_SIZE; // esp-mqtt bytes in flight before waiting for acks
+    static const uint32_t OUTBOX_TIMEOUT_MS = 10U * 1000U;
+
+    static Stats_t stats = {};
+    static uint8_t buf[CHUNK_HEADER_SIZE + CHUNK_SIZE];
+
+    static SemaphoreHandle_t lock()
+    {
+        static SemaphoreHandle_t mutex = xSemaphoreCreateMutex();
+        return mutex;
+    }
+
+    static inline void put16(uint8_t *p, uint16_t v)
+    {
+        p[0] = (uint8_t)v;
+        p[1] = (uint8_t)(v >> 8);
+    }
+
+    static inline void put32(uint8_t *p, uint32_t v)
+    {
+        put16(p, (uint16_t)v);
+        put16(p + 2, (uint16_t)(v >> 16));
+    }
+
+    // read the next chunk into `buf` after its header, returns the message size, 0 on a short read
+    static size_t readChunk(File &f, uint32_t id, uint16_t index, uint16_t count, uint32_t total)
+    {
+        const size_t n = std::min<size_t>(CHUNK_SIZE, total - (size_t)index * CHUNK_SIZE);
+        if (f.read(buf + CHUNK_HEADER_SIZE, n) != n)
+            return 0;
+        put16(buf, CHUNK_MAGIC);
+        buf[2] = CHUNK_VERSION;
+        buf[3] = CHUNK_HEADER_SIZE;
+        put32(buf + 4, id);
+        put16(buf + 8, index);
+        put16(buf + 10, count);
+        put32(buf + 12, total);
+        put32(buf + 16, esp_rom_crc32_le(0, buf + CHUNK_HEADER_SIZE, n));
+        return CHUNK_HEADER_SIZE + n;
+    }
+
+    static bool chunkCount(File &f, const char *path, uint16_t &count)
+    {
+        const uint32_t chunks = ((uint32_t)f.size() + CHUNK_SIZE - 1) / CHUNK_SIZE;
+        if (chunks > UINT16_MAX)
+        {
+            mqttLogger.printf("upload: %s too large for %u chunks\n", path, UINT16_MAX);
+            return false;
+        }
+        count = (uint16_t)std::max<uint32_t>(chunks, 1); // an empty file still sends one message
+        return true;
+    }
+
+    static bool streamSingle(PubSubClient &client, const char *topic, File &f)
+    {
+        const uint32_t total = f.size();
+        if (!client.beginPublish(topic, total, false))
+            return false;
+        for (uint32_t done = 0; done < total;)
+        {
+            const size_t n = f.read(buf, std::min<uint32_t>(COPY_SIZE, total - done));
+            if (n == 0 || client.write(buf, n) != n)
+            {
+                client.disconnect(); // the packet cannot be completed
+                return false;
+            }
+            done += n;
+        }
+        return client.endPublish() > 0;
+    }
+
+    static bool streamChunked(PubSubClient &client, const char *topic, File &f, const char *path)
+    {
+        uint16_t count;
+        if (!chunkCount(f, path, count))
+            return false;
+        const uint32_t id = esp_random();
+        for (uint16_t index = 0; index < count; index++)
+        {
+            const size_t len = readChunk(f, id, index, count, f.size());
+            if (len == 0 || !client.beginPublish(topic, len, false))
+                return false;
+            if (client.write(buf, len) != len)
+            {
+                client.disconnect();
+                return false;
+            }
+            if (client.endPublish() == 0)
+                return false;
+            stats.chunks++;
+        }
+        return true;
+    }
+
+    static File open(fs::FS &fs, const char *path)
+    {
+        File f = fs.open(path, "r");
+        if (!f || f.isDirectory())
+        {
+            mqttLogger.printf("upload: cannot open %s\n", path);
+            return File();
+        }
+        return f;
+    }
+
+    static void done(bool ok, uint32_t size, uint32_t start)
+    {
+        stats.last_ms = millis() - start;
+        if (ok)
+        {
+            stats.files++;
+            stats.bytes += size;
+        }
+        else
+        {
+            stats.failed++;
+        }
+    }
+
+    bool send(PubSubClient &client, const char *topic, fs::FS &fs, const char *path, Mode mode)
+    {
+        if (topic == nullptr || path == nullptr || !client.connected())
+            return false;
+        xSemaphoreTake(lock(), portMAX_DELAY);
+        const uint32_t start = millis();
+        File f = open(fs, path);
+        bool ok = (bool)f;
+        uint32_t size = 0;
+        if (ok)
+        {
+            size = f.size();
+            ok = mode == Mode::SINGLE ? streamSingle(client, topic, f) : streamChunked(client, topic, f, path);
+            f.close();
+        }
+        done(ok, size, start);
+        xSemaphoreGive(lock());
+        if (ok)
+            mqttLogger.printf(MqttLogLevel::Debug, "upload: %s %lu bytes in %lu ms\n", path, (unsigned long)size,
+                              (unsigned long)stats.last_ms);
+        return ok;
+    }
+
+    // esp-mqtt copies QoS1 messages to its outbox, wait for acks rather than holding the whole file
+    static bool waitOutbox(MqttClient &client)
+    {
+        const uint32_t start = millis();
+        while (client.outboxSize() > (int)OUTBOX_LIMIT)
+        {
+            if (millis() - start > OUTBOX_TIMEOUT_MS)
+                return false;
+            vTaskDelay(pdMS_TO_TICKS(20));
+        }
+        return true;
+    }
+
+    bool send(MqttClient &client, const char *topic, fs::FS &fs, const char *path, int qos)
+    {
+        // esp-mqtt keeps QoS1 messages in its outbox even while disconnected, they would count as sent
+        if (topic == nullptr || path == nullptr || !client.isConnected())
+            return false;
+        xSemaphoreTake(lock(), portMAX_DELAY);
+        const uint32_t start = millis();
+        File f = open(fs, path);
+        bool ok = (bool)f;
+        uint16_t count = 0;
+        uint32_t size = 0;
+        if (ok)
+        {
+            size = f.size();
+            ok = chunkCount(f, path, count);
+        }
+        std::string msg;
+        msg.reserve(sizeof(buf));
+        const uint32_t id = esp_random();
+        for (uint16_t index = 0; ok && index < count; index++)
+        {
+            const size_t len = readChunk(f, id, index, count, size);
+            ok = len > 0 && waitOutbox(client) && client.isConnected();
+            if (ok)
+            {
+                msg.assign((const char *)buf, len);
+                ok = client.publish(topic, msg, qos) >= 0;
+                stats.chunks += ok;
+            }
+        }
+        if (f)
+            f.close();
+        done(ok, size, start);
+        xSemaphoreGive(lock());
+        if (ok)
+            mqttLogger.printf(MqttLogLevel::Debug, "upload: %s %lu bytes in %u chunks, %lu ms\n", path,
+                              (unsigned long)size, count, (unsigned long)stats.last_ms);
+        return ok;
+    }
+
+    const Stats_t &getStats()
+    {
+        return stats;
+    }
+}
@@ -0,0 +1,87 @@
+/**
+ * @file upload.hpp
+ * @author rami zayat
+ * @brief stream files of any size from LittleFS or the SD card to MQTT with constant RAM
+ * @version 0.1
+ * @date 2025-12-12
+ *
+ * @copyright Copyright (c) 2025
+ *
+ * Mode::SINGLE sends the whole file as one MQTT message. The PUBLISH header is written
+ * with the file size and the payload follows COPY_SIZE bytes at a time, so the
+ * PubSubClient packet buffer does not limit it. Only PubSubClient (WiFi) can do this.
+ *
+ * Mode::CHUNKED splits the file into messages of at most CHUNK_SIZE data bytes, each
+ * starting with a reassembly header, all fields little endian:
+ *
+ *   magic     uint16, CHUNK_MAGIC ("UP")
+ *   version   uint8, CHUNK_VERSION
+ *   hdr_len   uint8, CHUNK_HEADER_SIZE, data starts here
+ *   id        uint32, same for all chunks of one upload
+ *   index     uint16, 0 based
+ *   count     uint16, chunks in this upload
+ *   total     uint32, file size
+ *   crc       uint32, CRC-32 of this chunk's data
+ *
+ * The broker side orders chunks by `index` and has the file once `count` chunks of one
+ * `id` arrived. Chunked uploads work over every link, the esp-mqtt and modem backends
+ * need the message in RAM and are given one chunk at a time.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+class PubSubClient;
+class MqttClient;
+namespace fs
+{
+    class FS;
+}
+
+namespace upload
+{
+    enum class Mode : uint8_t
+    {
+        SINGLE = 0, // one message, PubSubClient only
+        CHUNKED,    // CHUNK_SIZE messages with a reassembly header
+    };
+
+    static const uint16_t COPY_SIZE = 512;   // bytes read from the file per write to the socket
+    static const uint16_t CHUNK_SIZE = 768;  // data bytes per chunked message, below the PubSubClient packet size
+    static const uint16_t CHUNK_MAGIC = 0x5055; // "UP"
+    static const uint8_t CHUNK_VERSION = 1;
+    static const uint8_t CHUNK_HEADER_SIZE = 20;
+
+    typedef struct
+    {
+        uint32_t files;
+        uint32_t chunks;  // messages sent in CHUNKED mode
+        uint32_t bytes;   // file bytes sent
+        uint32_t failed;  // uploads aborted
+        uint32_t last_ms; // duration of the last upload
+    } Stats_t;
+
+    /**
+     * @brief stream a file over PubSubClient, used by the "file upload" command
+     *
+     * A read or socket error in the middle of a SINGLE message leaves the broker waiting
+     * for the rest of the packet, the connection is closed so the reconnect starts clean.
+     * The caller holds mqttClientLock() when `client` is the shared mqttclient.
+     * @param client connected client
+     * @param topic topic
+     * @param fs LittleFS or SD_MMC
+     * @param path file path on `fs`
+     * @param mode SINGLE or CHUNKED
+     * @return true if the whole file was written
+     */
+    bool send(PubSubClient &client, const char *topic, fs::FS &fs, const char *path, Mode mode = Mode::SINGLE);
+
+    /**
+     * @brief send a file in CHUNKED mode over esp-mqtt or the modem MQTT stack
+     * @param qos chunk QoS
+     * @return true if every chunk was handed to the client
+     */
+    bool send(MqttClient &client, const char *topic, fs::FS &fs, const char *path, int qos = 1);
+
+    const Stats_t &getStats();
+}
@@ -11,6 +11,7 @@
 #include "pins.hpp"
 #include "wifi/wifi.hpp"
 #include "power/power.hpp"
+#include "power/pm.hpp"
 #include "FS.h"
 #include <Update.h>
 #include "esp_https_ota.h"
@@ -20,9 +21,14 @@
 namespace sdcard
 {
     bool sdcardOK = false;
+    // the SDMMC clock comes from the PLL, held while the card is mounted
+    static pm::Lock sdLock("sdcard", ESP_PM_APB_FREQ_MAX);
+
     bool shutdownSdcard()
     {
         SD_MMC.end();
+        if (sdcardOK)
+            sdLock.release();
         sdcardOK = false;
         return true;
     }
@@ -41,10 +47,12 @@ namespace sdcard
         // }
         SD_MMC.setPins(SDMMC_CLK, SDMMC_CMD, SDMMC_DATA);
         delay(200);
+        sdLock.acquire();
         if (!SD_MMC.begin("/sdcard", true, false, BOARD_MAX_SDMMC_FREQ))
         {
             mqttLogger.println("ERROR: SD Card Mount failed!");
             SD_MMC.end();
+            sdLock.release();
             return false;
         }
         uint8_t cardType = SD_MMC.cardType();
@@ -53,6 +61,7 @@ namespace sdcard
         {
             Serial.println("No SD_MMC card attached");
             SD_MMC.end();
+            sdLock.release();
             return false;
         }
 
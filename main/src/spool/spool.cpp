@@ -0,0 +1,317 @@
+/**
+ * @file spool.cpp
+ * @author rami zayat
+ * @brief offline spool of log and telemetry lines on the storage partition, replayed on the next MQTT connection
+ * @version 0.1
+ * @date 2025-12-10
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include "spool/spool.hpp"
+#include "publisher/publisher.hpp"
+#include "wifi/wifi.hpp"
+#include "LittleFS.h"
+#include "esp_attr.h"
+#include "esp_rom_crc.h"
+#include <string.h>
+#include <string>
+#include <algorithm>
+
+namespace spool
+{
+    static const char *SPOOL_DIR = "/spool";
+    static const uint8_t RECORD_MAGIC = 0x5A;
+    static const uint32_t STATE_MAGIC = 0x53504c31; // "SPL1"
+
+    typedef struct __attribute__((packed))
+    {
+        uint8_t magic;
+        uint8_t topic_len;
+        uint16_t len;
+        uint32_t time;
+    } RecordHeader_t;
+
+    static const size_t RECORD_OVERHEAD = sizeof(RecordHeader_t) + sizeof(uint32_t);
+
+    typedef struct
+    {
+        uint32_t magic;
+        uint32_t headFile; // oldest file, replay position `headOff`
+        uint32_t headOff;
+        uint32_t tailFile; // file pages are appended to
+    } State_t;
+
+    enum class Read : uint8_t
+    {
+        OK,
+        END,
+        CORRUPT,
+    };
+
+    static RTC_DATA_ATTR State_t state;
+    static Stats_t stats = {};
+    static uint8_t page[PAGE_SIZE];
+    static uint16_t pageUsed = 0;
+    static uint16_t pageRecords = 0;
+    static bool mounted = false;
+    static bool mountFailed = false; // not retried until the next wake, each try costs a full partition scan
+    static uint32_t tokens = DRAIN_BURST;
+    static uint32_t lastDrainMs = 0;
+
+    static SemaphoreHandle_t lock()
+    {
+        static SemaphoreHandle_t mutex = xSemaphoreCreateMutex();
+        return mutex;
+    }
+
+    static void filePath(uint32_t n, char *buf, size_t len)
+    {
+        snprintf(buf, len, "%s/%lu.log", SPOOL_DIR, (unsigned long)n);
+    }
+
+    static Read readRecord(File &f, RecordHeader_t &hdr, std::string &topic, std::string &payload)
+    {
+        if (f.read((uint8_t *)&hdr, sizeof(hdr)) != sizeof(hdr))
+            return Read::END;
+        if (hdr.magic != RECORD_MAGIC)
+            return Read::CORRUPT;
+        uint32_t crc = 0;
+        topic.resize(hdr.topic_len);
+        payload.resize(hdr.len);
+        if (f.read((uint8_t *)topic.data(), topic.size()) != topic.size() ||
+            f.read((uint8_t *)payload.data(), payload.size()) != payload.size() ||
+            f.read((uint8_t *)&crc, sizeof(crc)) != sizeof(crc))
+            return Read::CORRUPT;
+        uint32_t check = esp_rom_crc32_le(0, (const uint8_t *)&hdr, sizeof(hdr));
+        check = esp_rom_crc32_le(check, (const uint8_t *)topic.data(), topic.size());
+        check = esp_rom_crc32_le(check, (const uint8_t *)payload.data(), payload.size());
+        return check == crc ? Read::OK : Read::CORRUPT;
+    }
+
+    // cold boot: the oldest file is replayed from its start
+    static void recover()
+    {
+        memset(&state, 0, sizeof(state));
+        state.magic = STATE_MAGIC;
+        bool any = false;
+        File dir = LittleFS.open(SPOOL_DIR);
+        for (File f = dir.openNextFile(); f; f = dir.openNextFile())
+        {
+            const uint32_t n = strtoul(f.name(), nullptr, 10);
+            state.headFile = any ? std::min(state.headFile, n) : n;
+            state.tailFile = any ? std::max(state.tailFile, n) : n;
+            any = true;
+            f.close();
+        }
+    }
+
+    static bool mount()
+    {
+        if (mounted)
+            return true;
+        if (mountFailed)
+            return false;
+        if (!LittleFS.begin(false, "/littlefs", 10, "storage"))
+        {
+            mountFailed = true;
+            return false; // no log here, the logger would spool it again
+        }
+        if (!LittleFS.exists(SPOOL_DIR))
+            LittleFS.mkdir(SPOOL_DIR);
+        if (state.magic != STATE_MAGIC)
+            recover();
+        mounted = true;
+        return true;
+    }
+
+    // a page that cannot be written is dropped, the RAM page is free again either way
+    static bool dropPage()
+    {
+        stats.lost += pageRecords;
+        pageUsed = 0;
+        pageRecords = 0;
+        return false;
+    }
+
+    static bool writePage()
+    {
+        if (pageUsed == 0)
+            return true;
+        if (!mount())
+            return dropPage();
+        char path[32];
+        filePath(state.tailFile, path, sizeof(path));
+        File f = LittleFS.open(path, "a");
+        if (f && f.size() + pageUsed > FILE_SIZE)
+        {
+            f.close();
+            filePath(++state.tailFile, path, sizeof(path));
+            // keep the newest MAX_FILES files
+            while (state.tailFile - state.headFile >= MAX_FILES)
+            {
+                char old[32];
+                filePath(state.headFile++, old, sizeof(old));
+                LittleFS.remove(old);
+                state.headOff = 0;
+                stats.rotated++;
+            }
+            f = LittleFS.open(path, "a");
+        }
+        if (!f)
+            return dropPage();
+        const bool ok = f.write(page, pageUsed) == pageUsed;
+        f.close();
+        if (!ok)
+            return dropPage();
+        pageUsed = 0;
+        pageRecords = 0;
+        stats.pages++;
+        return true;
+    }
+
+    bool append(const char *topic, const char *data, size_t len)
+    {
+        if (topic == nullptr || data == nullptr)
+            return false;
+        const size_t topicLen = std::min(strlen(topic), (size_t)UINT8_MAX);
+        len = std::min(len, PAGE_SIZE - RECORD_OVERHEAD - topicLen); // a record never spans pages
+        const RecordHeader_t hdr = {RECORD_MAGIC, (uint8_t)topicLen, (uint16_t)len, (uint32_t)time(nullptr)};
+        uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)&hdr, sizeof(hdr));
+        crc = esp_rom_crc32_le(crc, (const uint8_t *)topic, topicLen);
+        crc = esp_rom_crc32_le(crc, (const uint8_t *)data, len);
+        xSemaphoreTake(lock(), portMAX_DELAY);
+        bool ok = true;
+        if (pageUsed + RECORD_OVERHEAD + topicLen + len > PAGE_SIZE)
+            ok = writePage();
+        uint8_t *p = page + pageUsed;
+        memcpy(p, &hdr, sizeof(hdr));
+        memcpy(p += sizeof(hdr), topic, topicLen);
+        memcpy(p += topicLen, data, len);
+        memcpy(p += len, &crc, sizeof(crc));
+        pageUsed += RECORD_OVERHEAD + topicLen + len;
+        pageRecords++;
+        stats.appended++;
+        xSemaphoreGive(lock());
+        return ok;
+    }
+
+    bool flush()
+    {
+        xSemaphoreTake(lock(), portMAX_DELAY);
+        const bool ok = writePage();
+        xSemaphoreGive(lock());
+        return ok;
+    }
+
+    // drop a fully replayed file, the tail file restarts empty
+    static void consumeHead()
+    {
+        char path[32];
+        filePath(state.headFile, path, sizeof(path));
+        LittleFS.remove(path);
+        if (state.headFile == state.tailFile)
+            state.tailFile++;
+        state.headFile++;
+        state.headOff = 0;
+    }
+
+    size_t drain()
+    {
+        const uint32_t now = millis();
+        const uint32_t elapsed = std::min<uint32_t>(now - lastDrainMs, 10000);
+        tokens = std::min<uint32_t>(DRAIN_BURST, tokens + elapsed * DRAIN_BYTES_PER_S / 1000);
+        lastDrainMs = now;
+        // live lines first, replay only uses idle link time
+        if (tokens < MAX_PUBLISH || mqttLogger.queued() > 0 || publisher::activeLink() == publisher::Link::NONE)
+            return 0;
+        xSemaphoreTake(lock(), portMAX_DELAY);
+        size_t replayed = 0;
+        if (mount())
+        {
+            char path[32];
+            filePath(state.headFile, path, sizeof(path));
+            File f = LittleFS.open(path, "r");
+            const bool exists = (bool)f;
+            std::string topic, nextTopic, nextPayload, batch;
+            uint32_t next = state.headOff;
+            uint32_t records = 0;
+            Read r = Read::END;
+            if (exists && f.seek(state.headOff))
+            {
+                RecordHeader_t hdr;
+                char stamp[24];
+                while ((r = readRecord(f, hdr, nextTopic, nextPayload)) == Read::OK)
+                {
+                    const time_t t = hdr.time;
+                    struct tm timeinfo;
+                    localtime_r(&t, &timeinfo);
+                    const size_t stampLen = strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S ", &timeinfo);
+                    if (records > 0 && (nextTopic != topic || batch.size() + 1 + stampLen + nextPayload.size() > MAX_PUBLISH))
+                        break;
+                    if (records > 0)
+                        batch += '\n';
+                    topic.swap(nextTopic);
+                    batch.append(stamp, stampLen);
+                    batch += nextPayload;
+                    next = f.position();
+                    records++;
+                }
+            }
+            if (exists)
+                f.close();
+            if (records > 0)
+            {
+                if (publisher::publish(topic.c_str(), batch.data(), batch.size(), 0) == publisher::Result::SENT)
+                {
+                    state.headOff = next;
+                    replayed = records;
+                    stats.replayed += records;
+                    tokens -= std::min<uint32_t>(tokens, batch.size());
+                }
+            }
+            else if (r == Read::CORRUPT)
+            {
+                stats.corrupt++;
+                consumeHead(); // a torn record ends the file
+            }
+            else if (state.headFile < state.tailFile || (exists && pageUsed == 0))
+            {
+                consumeHead(); // older file done, or everything replayed
+            }
+            else if (pageUsed > 0)
+            {
+                writePage(); // flash is replayed, the page buffer goes next
+            }
+        }
+        xSemaphoreGive(lock());
+        return replayed;
+    }
+
+    uint32_t size()
+    {
+        xSemaphoreTake(lock(), portMAX_DELAY);
+        uint32_t total = pageUsed;
+        if (mount())
+        {
+            char path[32];
+            for (uint32_t n = state.headFile; n <= state.tailFile; n++)
+            {
+                filePath(n, path, sizeof(path));
+                File f = LittleFS.open(path, "r");
+                if (f)
+                {
+                    total += f.size() - (n == state.headFile ? std::min<uint32_t>(state.headOff, f.size()) : 0);
+                    f.close();
+                }
+            }
+        }
+        xSemaphoreGive(lock());
+        return total;
+    }
+
+    const Stats_t &getStats()
+    {
+        return stats;
+    }
+}
@@ -0,0 +1,66 @@
+/**
+ * @file spool.hpp
+ * @author rami zayat
+ * @brief offline spool of log and telemetry lines on the storage partition, replayed on the next MQTT connection
+ * @version 0.1
+ * @date 2025-12-10
+ *
+ * @copyright Copyright (c) 2025
+ *
+ * Records are appended to /spool/<n>.log files of at most FILE_SIZE bytes. When more
+ * than MAX_FILES exist the oldest is removed, so the spool keeps the most recent data.
+ * Each record is framed as
+ *
+ *   magic     0x5A
+ *   topic_len uint8
+ *   len       uint16 little endian
+ *   time      uint32 unix epoch
+ *   topic, payload
+ *   crc       uint32, CRC-32 of everything above
+ *
+ * Records are collected in a PAGE_SIZE RAM page and written one page at a time.
+ * A record failing its CRC (torn write, power loss) ends the file for the reader.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+namespace spool
+{
+    static const uint16_t PAGE_SIZE = 1024;
+    static const uint32_t FILE_SIZE = 32U * 1024U;
+    static const uint8_t MAX_FILES = 8;
+    static const uint16_t DRAIN_BYTES_PER_S = 2048; // replay rate while connected
+    static const uint16_t DRAIN_BURST = 4096;
+    static const uint16_t MAX_PUBLISH = 900;        // newline joined lines per publish
+
+    typedef struct
+    {
+        uint32_t appended; // records
+        uint32_t pages;    // page writes
+        uint32_t replayed; // records published
+        uint32_t rotated;  // files removed to respect MAX_FILES
+        uint32_t corrupt;  // records failing the CRC
+        uint32_t lost;     // records of pages that could not be written
+    } Stats_t;
+
+    // add a record, it reaches flash when the page fills or on flush()
+    bool append(const char *topic, const char *data, size_t len);
+
+    // write the partial page, call before sleeping
+    bool flush();
+
+    /**
+     * @brief publish spooled records while an MQTT link is up, at most DRAIN_BYTES_PER_S
+     *
+     * Records of the same topic are newline joined into one publish. Nothing is sent while
+     * live log lines are waiting, so replay only uses idle link time.
+     * @return records published
+     */
+    size_t drain();
+
+    // bytes spooled on flash and in the page buffer
+    uint32_t size();
+
+    const Stats_t &getStats();
+}
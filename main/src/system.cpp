@@ -23,6 +23,23 @@ void set_ota_valid(bool valid)
         xEventGroupSetBits(ot_validation_event_group, OTA_INVALID_FLAG);
 }
 
+static EventGroupHandle_t systemEvents()
+{
+    static EventGroupHandle_t group = xEventGroupCreate();
+    return group;
+}
+
+void postSystemEvent(uint32_t events)
+{
+    xEventGroupSetBits(systemEvents(), events);
+}
+
+uint32_t waitSystemEvent(uint32_t timeout_ms)
+{
+    const uint32_t all = EVENT_VBUS | EVENT_KEY | EVENT_BATTERY | EVENT_MOTION | EVENT_COMMAND | EVENT_ENGINE;
+    return xEventGroupWaitBits(systemEvents(), all, pdTRUE, pdFALSE, pdMS_TO_TICKS(timeout_ms)) & all;
+}
+
 void light_sleep(uint16_t seconds)
 {
     Serial.printf("light sleeping for %d seconds\n", seconds);
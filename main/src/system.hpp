@@ -14,4 +14,16 @@
 void light_sleep(uint16_t seconds);
 void set_ota_valid(bool valid);
 bool check_rollback();
-bool GetsystemTimeSynced();
\ No newline at end of file
+bool GetsystemTimeSynced();
+
+// main loop wake-up events, posted by the tasks that produce work for loop()
+static const uint32_t EVENT_VBUS = (1 << 0);    // debounced VBUS / ignition transition
+static const uint32_t EVENT_KEY = (1 << 1);     // boot key pressed
+static const uint32_t EVENT_BATTERY = (1 << 2); // low / critical level changed
+static const uint32_t EVENT_MOTION = (1 << 3);  // IMU motion flag set
+static const uint32_t EVENT_COMMAND = (1 << 4); // MQTT command left work for the main loop
+static const uint32_t EVENT_ENGINE = (1 << 5);  // car battery crank dip, alternator charging started or stopped
+
+void postSystemEvent(uint32_t events);
+// block until an event is posted or `timeout_ms` passed, returns the events and clears them
+uint32_t waitSystemEvent(uint32_t timeout_ms);
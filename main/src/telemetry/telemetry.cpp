@@ -0,0 +1,116 @@
+/**
+ * @file telemetry.cpp
+ * @author rami zayat
+ * @brief publish GNSS, battery, motion, wake and ignition records in the binary telemetry format
+ * @version 0.1
+ * @date 2025-12-11
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include "telemetry/telemetry.hpp"
+#include "publisher/publisher.hpp"
+#include "power/power.hpp"
+#include "Preferences.h"
+#include <math.h>
+#include <time.h>
+#include <algorithm>
+
+namespace telemetry
+{
+    static char topic[64] = "";
+
+    static const char *getTopic()
+    {
+        if (topic[0] == '\0')
+        {
+            Preferences pref;
+            String value = "esp32s3/telemetry";
+            if (pref.begin("telemetry", true))
+            {
+                value = pref.getString("topic", value);
+                pref.end();
+            }
+            strlcpy(topic, value.c_str(), sizeof(topic));
+        }
+        return topic;
+    }
+
+    static bool post(const uint8_t *rec, size_t len, uint8_t qos)
+    {
+        if (len == 0)
+            return false;
+        const uint8_t flags = qos ? (publisher::FLAG_BATCH | publisher::FLAG_BINARY) : 0;
+        const publisher::Result ret = publisher::publish(getTopic(), (const char *)rec, len, qos, flags);
+        return ret == publisher::Result::SENT || ret == publisher::Result::QUEUED;
+    }
+
+    static inline uint16_t clampU16(float v)
+    {
+        return v <= 0.0f ? 0 : v >= 65535.0f ? 65535 : (uint16_t)lroundf(v);
+    }
+
+    static inline int16_t clampI16(float v)
+    {
+        return v <= -32768.0f ? -32768 : v >= 32767.0f ? 32767 : (int16_t)lroundf(v);
+    }
+
+    GnssFix_t toFix(const sim76xx_gps_t &gps)
+    {
+        GnssFix_t r;
+        r.time = (uint32_t)gps.utc_epoch();
+        r.lat = (int32_t)lround((double)gps.latitude * 1e7);
+        r.lon = (int32_t)lround((double)gps.longitude * 1e7);
+        r.alt = clampI16(gps.altitude);
+        r.speed = clampU16(gps.speed * 10.0f);
+        r.course = clampU16(fmodf(gps.cog, 360.0f) * 100.0f);
+        r.hdop = (uint8_t)std::min(255L, lroundf(gps.dop_h * 10.0f));
+        r.sats = gps.sat.num;
+        r.fix = (uint8_t)(gps.fix | (gps.fix_mode << 4));
+        return r;
+    }
+
+    bool publishFix(const sim76xx_gps_t &gps)
+    {
+        if (gps.fix == GPS_FIX_INVALID)
+            return false;
+        uint8_t buf[MAX_RECORD_SIZE];
+        return post(buf, encode(toFix(gps), buf, sizeof(buf)), 1);
+    }
+
+    bool publishMotion(uint32_t counter, uint16_t duration_s, bool ongoing)
+    {
+        const Motion_t r = {(uint32_t)time(nullptr), counter, duration_s, (uint8_t)(ongoing ? MOTION_ONGOING : 0)};
+        uint8_t buf[MAX_RECORD_SIZE];
+        return post(buf, encode(r, buf, sizeof(buf)), 1);
+    }
+
+    bool publishWake(uint8_t reason, uint8_t detail)
+    {
+        const Wake_t r = {(uint32_t)time(nullptr), reason, detail, (uint16_t)std::min<uint32_t>(power::getLastAwakeMs(), UINT16_MAX),
+                          (uint8_t)std::min(100L, lroundf(power::getCellPercent()))};
+        uint8_t buf[MAX_RECORD_SIZE];
+        return post(buf, encode(r, buf, sizeof(buf)), 1);
+    }
+
+    bool publishIgnition(bool on, uint32_t previous_s)
+    {
+        const Ignition_t r = {(uint32_t)time(nullptr), (uint8_t)(on ? IGNITION_ON : 0), previous_s};
+        uint8_t buf[MAX_RECORD_SIZE];
+        return post(buf, encode(r, buf, sizeof(buf)), 1);
+    }
+
+    bool publishProfile(const Profile_t &profile)
+    {
+        uint8_t buf[MAX_RECORD_SIZE];
+        return post(buf, encode(profile, buf, sizeof(buf)), 1);
+    }
+
+    bool publishBattery(float percent, float cell_v, float rate, uint8_t flags, bool queue)
+    {
+        const Battery_t r = {(uint32_t)time(nullptr), clampU16(percent * 100.0f), clampU16(cell_v * 1000.0f),
+                             clampI16(rate * 100.0f), 0, flags};
+        uint8_t buf[MAX_RECORD_SIZE];
+        return post(buf, encode(r, buf, sizeof(buf)), queue ? 1 : 0);
+    }
+}
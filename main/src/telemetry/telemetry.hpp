@@ -0,0 +1,30 @@
+/**
+ * @file telemetry.hpp
+ * @author rami zayat
+ * @brief publish GNSS, battery, motion, wake and ignition records in the binary telemetry format
+ * @version 0.1
+ * @date 2025-12-11
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#pragma once
+#include <stdint.h>
+#include "telemetry/telemetryRecord.hpp"
+#include "sim76xx_gps.h"
+
+namespace telemetry
+{
+    // records queued with QoS1 go out back to back in one publish on the next connection
+    bool publishFix(const sim76xx_gps_t &gps);
+    bool publishMotion(uint32_t counter, uint16_t duration_s, bool ongoing);
+    bool publishWake(uint8_t reason, uint8_t detail);
+    bool publishIgnition(bool on, uint32_t previous_s);
+    bool publishProfile(const Profile_t &profile);
+
+    // QoS0 by default, only sent while a link is up, the battery loop samples too often to queue
+    bool publishBattery(float percent, float cell_v, float rate, uint8_t flags, bool queue = false);
+
+    // record conversion, no I/O
+    GnssFix_t toFix(const sim76xx_gps_t &gps);
+}
@@ -0,0 +1,389 @@
+/**
+ * @file telemetryRecord.hpp
+ * @author rami zayat
+ * @brief versioned binary telemetry records, encoder and decoder
+ * @version 0.1
+ * @date 2025-12-11
+ *
+ * @copyright Copyright (c) 2025
+ *
+ * Plain C++ with no platform dependency, the broker side decoder includes this file as is.
+ * Every record starts with a 7 byte header, all fields little endian:
+ *
+ *   version   uint8, VERSION
+ *   type      uint8, Type
+ *   len       uint8, body bytes following the header
+ *   time      uint32, unix epoch
+ *
+ * Bodies (version 2):
+ *
+ *   GNSS_FIX  lat int32 1e-7 deg, lon int32 1e-7 deg, alt int16 m, speed uint16 0.1 km/h,
+ *             course uint16 0.01 deg, hdop uint8 0.1, sats uint8, fix uint8 (fix | mode << 4)
+ *   BATTERY   percent uint16 0.01 %, cell uint16 mV, rate int16 0.01 %/h, car uint16 mV, flags uint8 BAT_*
+ *   MOTION    counter uint32, duration uint16 s, flags uint8 MOTION_*
+ *   WAKE      reason uint8, detail uint8, awake uint16 ms the previous wake lasted, percent uint8
+ *   IGNITION  flags uint8 IGNITION_*, previous uint32 s spent in the previous state (0 unknown)
+ *   PROFILE   reason uint8, percent uint16 0.01 % at sleep, delta int16 0.01 % since the previous
+ *             PROFILE, awake uint32 ms, phases uint8, then `phases` durations uint32 ms in the order
+ *             boot, power, imu, modem, attach, send, sleep
+ *
+ * Version 1 differs only in PROFILE, whose awake and phase durations were uint16 ms and saturated
+ * at 65.5 s. It is still decoded.
+ *
+ * Records are self delimiting, a payload may carry several back to back. A decoder skips
+ * types it does not know using `len`, and reads only the fields it knows from a longer body.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+namespace telemetry
+{
+    static const uint8_t VERSION = 2;
+    static const uint8_t MIN_VERSION = 1; // oldest version decode() reads
+    static const uint8_t HEADER_SIZE = 7;
+
+    enum class Type : uint8_t
+    {
+        GNSS_FIX = 1,
+        BATTERY = 2,
+        MOTION = 3,
+        WAKE = 4,
+        IGNITION = 5,
+        PROFILE = 6,
+    };
+
+    static const uint8_t BAT_VBUS = 0x01;
+    static const uint8_t BAT_LOW = 0x02;
+    static const uint8_t BAT_CRITICAL = 0x04;
+    static const uint8_t MOTION_ONGOING = 0x01;
+    static const uint8_t IGNITION_ON = 0x01;
+
+    typedef struct
+    {
+        uint32_t time;
+        int32_t lat;
+        int32_t lon;
+        int16_t alt;
+        uint16_t speed;
+        uint16_t course;
+        uint8_t hdop;
+        uint8_t sats;
+        uint8_t fix;
+    } GnssFix_t;
+
+    typedef struct
+    {
+        uint32_t time;
+        uint16_t percent;
+        uint16_t cell_mv;
+        int16_t rate;
+        uint16_t car_mv; // 0 when not measured
+        uint8_t flags;
+    } Battery_t;
+
+    typedef struct
+    {
+        uint32_t time;
+        uint32_t counter;
+        uint16_t duration_s;
+        uint8_t flags;
+    } Motion_t;
+
+    typedef struct
+    {
+        uint32_t time;
+        uint8_t reason; // power::WakeUpReason_t
+        uint8_t detail; // schedule::Job bits collected at this wake
+        uint16_t awake_ms; // previous wake, app start to deep sleep
+        uint8_t percent;
+    } Wake_t;
+
+    typedef struct
+    {
+        uint32_t time;
+        uint8_t flags;
+        uint32_t previous_s;
+    } Ignition_t;
+
+    static const uint8_t PROFILE_PHASES = 7;
+
+    typedef struct
+    {
+        uint32_t time;
+        uint8_t reason;  // power::WakeUpReason_t
+        uint16_t percent;
+        int16_t delta;   // 0 for the first record after power on
+        uint32_t awake_ms;
+        uint32_t phase_ms[PROFILE_PHASES];
+    } Profile_t;
+
+    typedef struct
+    {
+        uint8_t version;
+        Type type;
+        union
+        {
+            GnssFix_t fix;
+            Battery_t battery;
+            Motion_t motion;
+            Wake_t wake;
+            Ignition_t ignition;
+            Profile_t profile;
+        };
+    } Record_t;
+
+    static const uint8_t GNSS_FIX_BODY = 17;
+    static const uint8_t BATTERY_BODY = 9;
+    static const uint8_t MOTION_BODY = 7;
+    static const uint8_t WAKE_BODY = 5;
+    static const uint8_t IGNITION_BODY = 5;
+    static const uint8_t PROFILE_BODY = 10 + 4 * PROFILE_PHASES;
+    static const uint8_t MAX_RECORD_SIZE = HEADER_SIZE + PROFILE_BODY;
+
+    class Writer
+    {
+    public:
+        Writer(uint8_t *out, size_t cap) : p(out), end(out + cap) {}
+        inline void u8(uint8_t v)
+        {
+            if (p < end)
+                *p = v;
+            p++;
+        }
+        inline void u16(uint16_t v)
+        {
+            u8((uint8_t)v);
+            u8((uint8_t)(v >> 8));
+        }
+        inline void u32(uint32_t v)
+        {
+            u16((uint16_t)v);
+            u16((uint16_t)(v >> 16));
+        }
+        inline void header(Type type, uint8_t body, uint32_t time)
+        {
+            u8(VERSION);
+            u8((uint8_t)type);
+            u8(body);
+            u32(time);
+        }
+        // bytes written, 0 if the record did not fit
+        inline size_t done(const uint8_t *start) const
+        {
+            return p <= end ? (size_t)(p - start) : 0;
+        }
+
+    private:
+        uint8_t *p;
+        uint8_t *const end;
+    };
+
+    class Reader
+    {
+    public:
+        Reader(const uint8_t *in) : p(in) {}
+        inline uint8_t u8() { return *p++; }
+        inline uint16_t u16()
+        {
+            const uint16_t v = (uint16_t)(p[0] | (p[1] << 8));
+            p += 2;
+            return v;
+        }
+        inline uint32_t u32()
+        {
+            const uint32_t v = u16();
+            return v | ((uint32_t)u16() << 16);
+        }
+
+    private:
+        const uint8_t *p;
+    };
+
+    /**
+     * @brief encode one record into `out`
+     * @return bytes written, 0 if `cap` is too small
+     */
+    inline size_t encode(const GnssFix_t &r, uint8_t *out, size_t cap)
+    {
+        Writer w(out, cap);
+        w.header(Type::GNSS_FIX, GNSS_FIX_BODY, r.time);
+        w.u32((uint32_t)r.lat);
+        w.u32((uint32_t)r.lon);
+        w.u16((uint16_t)r.alt);
+        w.u16(r.speed);
+        w.u16(r.course);
+        w.u8(r.hdop);
+        w.u8(r.sats);
+        w.u8(r.fix);
+        return w.done(out);
+    }
+
+    inline size_t encode(const Battery_t &r, uint8_t *out, size_t cap)
+    {
+        Writer w(out, cap);
+        w.header(Type::BATTERY, BATTERY_BODY, r.time);
+        w.u16(r.percent);
+        w.u16(r.cell_mv);
+        w.u16((uint16_t)r.rate);
+        w.u16(r.car_mv);
+        w.u8(r.flags);
+        return w.done(out);
+    }
+
+    inline size_t encode(const Motion_t &r, uint8_t *out, size_t cap)
+    {
+        Writer w(out, cap);
+        w.header(Type::MOTION, MOTION_BODY, r.time);
+        w.u32(r.counter);
+        w.u16(r.duration_s);
+        w.u8(r.flags);
+        return w.done(out);
+    }
+
+    inline size_t encode(const Wake_t &r, uint8_t *out, size_t cap)
+    {
+        Writer w(out, cap);
+        w.header(Type::WAKE, WAKE_BODY, r.time);
+        w.u8(r.reason);
+        w.u8(r.detail);
+        w.u16(r.awake_ms);
+        w.u8(r.percent);
+        return w.done(out);
+    }
+
+    inline size_t encode(const Ignition_t &r, uint8_t *out, size_t cap)
+    {
+        Writer w(out, cap);
+        w.header(Type::IGNITION, IGNITION_BODY, r.time);
+        w.u8(r.flags);
+        w.u32(r.previous_s);
+        return w.done(out);
+    }
+
+    inline size_t encode(const Profile_t &r, uint8_t *out, size_t cap)
+    {
+        Writer w(out, cap);
+        w.header(Type::PROFILE, PROFILE_BODY, r.time);
+        w.u8(r.reason);
+        w.u16(r.percent);
+        w.u16((uint16_t)r.delta);
+        w.u32(r.awake_ms);
+        w.u8(PROFILE_PHASES);
+        for (uint8_t i = 0; i < PROFILE_PHASES; i++)
+            w.u32(r.phase_ms[i]);
+        return w.done(out);
+    }
+
+    /**
+     * @brief decode the record at `in`
+     * @param rec filled for known types, for other types or versions only `version` and `type` are set,
+     *        `version` is 0 when a known type has a body too short to read
+     * @return bytes of the record (header and body) to skip to the next one, 0 if `len` truncates it
+     */
+    inline size_t decode(const uint8_t *in, size_t len, Record_t &rec)
+    {
+        if (len < HEADER_SIZE || len < (size_t)HEADER_SIZE + in[2])
+            return 0;
+        Reader r(in);
+        rec.version = r.u8();
+        rec.type = (Type)r.u8();
+        const uint8_t body = r.u8();
+        const uint32_t time = r.u32();
+        const size_t size = HEADER_SIZE + body;
+        if (rec.version < MIN_VERSION || rec.version > VERSION)
+            return size;
+        switch (rec.type)
+        {
+        case Type::GNSS_FIX:
+            if (body < GNSS_FIX_BODY)
+            {
+                rec.version = 0;
+                return size;
+            }
+            rec.fix.time = time;
+            rec.fix.lat = (int32_t)r.u32();
+            rec.fix.lon = (int32_t)r.u32();
+            rec.fix.alt = (int16_t)r.u16();
+            rec.fix.speed = r.u16();
+            rec.fix.course = r.u16();
+            rec.fix.hdop = r.u8();
+            rec.fix.sats = r.u8();
+            rec.fix.fix = r.u8();
+            break;
+        case Type::BATTERY:
+            if (body < BATTERY_BODY)
+            {
+                rec.version = 0;
+                return size;
+            }
+            rec.battery.time = time;
+            rec.battery.percent = r.u16();
+            rec.battery.cell_mv = r.u16();
+            rec.battery.rate = (int16_t)r.u16();
+            rec.battery.car_mv = r.u16();
+            rec.battery.flags = r.u8();
+            break;
+        case Type::MOTION:
+            if (body < MOTION_BODY)
+            {
+                rec.version = 0;
+                return size;
+            }
+            rec.motion.time = time;
+            rec.motion.counter = r.u32();
+            rec.motion.duration_s = r.u16();
+            rec.motion.flags = r.u8();
+            break;
+        case Type::WAKE:
+            if (body < WAKE_BODY)
+            {
+                rec.version = 0;
+                return size;
+            }
+            rec.wake.time = time;
+            rec.wake.reason = r.u8();
+            rec.wake.detail = r.u8();
+            rec.wake.awake_ms = r.u16();
+            rec.wake.percent = r.u8();
+            break;
+        case Type::IGNITION:
+            if (body < IGNITION_BODY)
+            {
+                rec.version = 0;
+                return size;
+            }
+            rec.ignition.time = time;
+            rec.ignition.flags = r.u8();
+            rec.ignition.previous_s = r.u32();
+            break;
+        case Type::PROFILE:
+        {
+            const uint8_t width = rec.version == 1 ? 2 : 4; // bytes per duration
+            if (body < 6 + width)
+            {
+                rec.version = 0;
+                return size;
+            }
+            rec.profile.time = time;
+            rec.profile.reason = r.u8();
+            rec.profile.percent = r.u16();
+            rec.profile.delta = (int16_t)r.u16();
+            rec.profile.awake_ms = width == 2 ? r.u16() : r.u32();
+            // a newer firmware may add phases at the end, a shorter record leaves them at 0
+            const uint8_t phases = r.u8();
+            for (uint8_t i = 0; i < PROFILE_PHASES; i++)
+            {
+                if (i >= phases || 6 + width * (i + 2) > body)
+                    rec.profile.phase_ms[i] = 0;
+                else
+                    rec.profile.phase_ms[i] = width == 2 ? r.u16() : r.u32();
+            }
+            break;
+        }
+        default:
+            break;
+        }
+        return size;
+    }
+}
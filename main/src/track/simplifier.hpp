@@ -0,0 +1,202 @@
+/**
+ * @file simplifier.hpp
+ * @author rami zayat
+ * @brief streaming dead-band + windowed Douglas-Peucker track simplifier
+ * @version 0.1
+ * @date 2025-12-12
+ *
+ * @copyright Copyright (c) 2025
+ *
+ * Plain C++ with no platform dependency, test/host builds it to benchmark the compression
+ * and check the reported deviation against synthetic tracks.
+ */
+#pragma once
+#include <math.h>
+#include "track/trackSimplify.hpp"
+
+namespace track
+{
+    static const double EARTH_RADIUS_M = 6371000.0;
+
+    typedef struct
+    {
+        float x; // metres east of the origin
+        float y; // metres north of the origin
+    } Point_t;
+
+    static inline float segmentDistance(const Point_t &p, const Point_t &a, const Point_t &b)
+    {
+        const float dx = b.x - a.x, dy = b.y - a.y;
+        const float len2 = dx * dx + dy * dy;
+        float t = len2 > 0.0f ? ((p.x - a.x) * dx + (p.y - a.y) * dy) / len2 : 0.0f;
+        t = t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+        return hypotf(p.x - (a.x + t * dx), p.y - (a.y + t * dy));
+    }
+
+    /**
+     * Dead-band filter feeding a fixed window that is reduced with Douglas-Peucker.
+     * The last kept point of a window starts the next one, so the output is continuous.
+     * Each stage uses half the tolerance, bounding the total deviation by `tol`.
+     *
+     * A fix dropped by the dead-band is within `slack` of the window point it was compared
+     * to, which is itself within its Douglas-Peucker distance of the output. max_dev_m is
+     * the largest sum of the two, a bound on the distance of any input fix from the output.
+     */
+    class Simplifier
+    {
+    public:
+        Simplifier(float tol_m, const std::function<void(const Fix_t &)> &out, SimplifyStats_t &stats)
+            : eps(tol_m / 2.0f), out(out), stats(stats) {}
+
+        void push(const Fix_t &fix)
+        {
+            stats.in++;
+            if (!haveOrigin)
+            {
+                lat0 = fix.lat;
+                lon0 = fix.lon;
+                cosLat0 = cos(fix.lat * 1e-7 * M_PI / 180.0);
+                haveOrigin = true;
+            }
+            const Point_t p = project(fix);
+            if (n > 0)
+            {
+                const Point_t &last = pts[n - 1];
+                const float d = hypotf(p.x - last.x, p.y - last.y);
+                if (d < eps)
+                {
+                    pending = fix; // keep the latest dropped fix so the track end is not lost
+                    hasPending = true;
+                    slack[n - 1] = fmaxf(slack[n - 1], d);
+                    return;
+                }
+            }
+            hasPending = false;
+            add(fix, p);
+        }
+
+        void finish()
+        {
+            if (hasPending)
+            {
+                add(pending, project(pending));
+                hasPending = false;
+            }
+            if (n > 0)
+            {
+                reduce(true);
+            }
+        }
+
+    private:
+        Point_t project(const Fix_t &f) const
+        {
+            Point_t p;
+            p.x = (float)((f.lon - lon0) * 1e-7 * M_PI / 180.0 * EARTH_RADIUS_M * cosLat0);
+            p.y = (float)((f.lat - lat0) * 1e-7 * M_PI / 180.0 * EARTH_RADIUS_M);
+            return p;
+        }
+
+        void add(const Fix_t &fix, const Point_t &p)
+        {
+            win[n] = fix;
+            pts[n] = p;
+            slack[n] = 0.0f;
+            n++;
+            if (n == SIMPLIFY_WINDOW)
+            {
+                reduce(false);
+            }
+        }
+
+        // Douglas-Peucker over the window with an explicit stack, then emit the kept points
+        void reduce(bool last)
+        {
+            bool keep[SIMPLIFY_WINDOW] = {};
+            keep[0] = true;
+            keep[n - 1] = true;
+            uint8_t stack[SIMPLIFY_WINDOW][2];
+            uint8_t sp = 0;
+            if (n > 2)
+            {
+                stack[sp][0] = 0;
+                stack[sp][1] = n - 1;
+                sp++;
+            }
+            while (sp > 0)
+            {
+                sp--;
+                const uint8_t s = stack[sp][0], e = stack[sp][1];
+                float dmax = 0.0f;
+                uint8_t imax = s;
+                for (uint8_t i = s + 1; i < e; i++)
+                {
+                    const float d = segmentDistance(pts[i], pts[s], pts[e]);
+                    if (d > dmax)
+                    {
+                        dmax = d;
+                        imax = i;
+                    }
+                }
+                if (dmax > eps)
+                {
+                    keep[imax] = true;
+                    if (imax - s > 1)
+                    {
+                        stack[sp][0] = s;
+                        stack[sp][1] = imax;
+                        sp++;
+                    }
+                    if (e - imax > 1)
+                    {
+                        stack[sp][0] = imax;
+                        stack[sp][1] = e;
+                        sp++;
+                    }
+                }
+                else
+                {
+                    // the segment replaces the points in between, each carries its dead-band slack along
+                    for (uint8_t i = s + 1; i < e; i++)
+                        stats.max_dev_m = fmaxf(stats.max_dev_m, segmentDistance(pts[i], pts[s], pts[e]) + slack[i]);
+                }
+            }
+            // the window start was already emitted as the end of the previous window
+            for (uint8_t i = emittedFirst ? 1 : 0; i < n; i++)
+            {
+                if (keep[i])
+                    stats.max_dev_m = fmaxf(stats.max_dev_m, slack[i]);
+                if (keep[i] && (last || i < n - 1))
+                {
+                    out(win[i]);
+                    stats.out++;
+                }
+            }
+            emittedFirst = true;
+            if (!last)
+            {
+                // carry the window end over, it is emitted by the next window
+                win[0] = win[n - 1];
+                pts[0] = pts[n - 1];
+                slack[0] = slack[n - 1];
+                n = 1;
+                emittedFirst = false;
+            }
+        }
+
+        float eps;
+        const std::function<void(const Fix_t &)> &out;
+        SimplifyStats_t &stats;
+        Fix_t win[SIMPLIFY_WINDOW];
+        Point_t pts[SIMPLIFY_WINDOW];
+        float slack[SIMPLIFY_WINDOW]; // farthest dead-band drop behind each window point
+        uint8_t n = 0;
+        bool emittedFirst = false;
+        Fix_t pending;
+        bool hasPending = false;
+        bool haveOrigin = false;
+        int32_t lat0 = 0;
+        int32_t lon0 = 0;
+        double cosLat0 = 1.0;
+    };
+}
@@ -0,0 +1,355 @@
+/**
+ * @file trackLog.cpp
+ * @author rami zayat
+ * @brief compact GNSS track store on the storage partition
+ * @version 0.1
+ * @date 2025-12-04
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include "track/trackLog.hpp"
+#include "wifi/wifi.hpp"
+#include "LittleFS.h"
+#include <math.h>
+#include <algorithm>
+#include <string.h>
+
+namespace track
+{
+    static const char *TRACK_FILE = "/track.bin";
+    static const char *TRACK_OLD_FILE = "/track.old";
+    static const uint16_t PAYLOAD_SIZE = TRACK_BLOCK_SIZE - sizeof(TrackBlockHeader_t);
+    static const uint8_t MAX_RECORD_SIZE = 6 * 5; // six fields, at most five varint bytes each
+
+    typedef struct __attribute__((packed))
+    {
+        TrackBlockHeader_t hdr;
+        uint8_t data[PAYLOAD_SIZE];
+    } Block_t;
+
+    // shared by encoder and decoder so both predict the same way
+    typedef struct
+    {
+        Fix_t prev;
+        uint32_t dt;
+        int32_t dlat;
+        int32_t dlon;
+    } CodecState_t;
+
+    static Block_t block;
+    static CodecState_t state;
+    static uint32_t blockIndex = 0; // slot of `block` in TRACK_FILE
+    static bool started = false;
+    static bool dirty = false;
+    static uint32_t statFixes = 0;
+    static uint32_t statBytes = 0;
+
+    static inline uint32_t zigzag(int32_t v)
+    {
+        return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+    }
+
+    static inline int32_t unzigzag(uint32_t v)
+    {
+        return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+    }
+
+    static size_t putVarint(uint8_t *out, uint32_t v)
+    {
+        size_t n = 0;
+        while (v >= 0x80)
+        {
+            out[n++] = (uint8_t)(v | 0x80);
+            v >>= 7;
+        }
+        out[n++] = (uint8_t)v;
+        return n;
+    }
+
+    static size_t getVarint(const uint8_t *in, const uint8_t *end, uint32_t &v)
+    {
+        v = 0;
+        for (size_t n = 0; n < 5 && in + n < end; n++)
+        {
+            v |= (uint32_t)(in[n] & 0x7f) << (7 * n);
+            if ((in[n] & 0x80) == 0)
+                return n + 1;
+        }
+        return 0;
+    }
+
+    static int32_t wrapCourse(int32_t d)
+    {
+        while (d >= 180)
+            d -= 360;
+        while (d < -180)
+            d += 360;
+        return d;
+    }
+
+    // position delta predicted from the previous step, scaled to the new time step
+    static inline int32_t predict(const CodecState_t &st, int32_t d, uint32_t dt)
+    {
+        return st.dt ? (int32_t)((int64_t)d * dt / st.dt) : 0;
+    }
+
+    static void resetState(const TrackBlockHeader_t &hdr)
+    {
+        memset(&state, 0, sizeof(state));
+        state.prev.t = hdr.t_first;
+        state.prev.lat = hdr.lat;
+        state.prev.lon = hdr.lon;
+    }
+
+    static size_t encode(CodecState_t &st, const Fix_t &f, uint8_t *out)
+    {
+        const uint32_t dt = f.t - st.prev.t;
+        const int32_t dlat = f.lat - st.prev.lat;
+        const int32_t dlon = f.lon - st.prev.lon;
+        size_t n = 0;
+        n += putVarint(out + n, dt);
+        n += putVarint(out + n, zigzag(dlat - predict(st, st.dlat, dt)));
+        n += putVarint(out + n, zigzag(dlon - predict(st, st.dlon, dt)));
+        n += putVarint(out + n, zigzag((int32_t)f.speed - st.prev.speed));
+        n += putVarint(out + n, zigzag(wrapCourse((int32_t)f.course - st.prev.course)));
+        n += putVarint(out + n, zigzag((int32_t)f.hdop - st.prev.hdop));
+        st.prev = f;
+        st.dt = dt;
+        st.dlat = dlat;
+        st.dlon = dlon;
+        return n;
+    }
+
+    static size_t decode(CodecState_t &st, const uint8_t *in, const uint8_t *end, Fix_t &f)
+    {
+        uint32_t v[6];
+        size_t n = 0;
+        for (uint8_t i = 0; i < 6; i++)
+        {
+            size_t len = getVarint(in + n, end, v[i]);
+            if (len == 0)
+                return 0;
+            n += len;
+        }
+        const uint32_t dt = v[0];
+        const int32_t dlat = unzigzag(v[1]) + predict(st, st.dlat, dt);
+        const int32_t dlon = unzigzag(v[2]) + predict(st, st.dlon, dt);
+        f.t = st.prev.t + dt;
+        f.lat = st.prev.lat + dlat;
+        f.lon = st.prev.lon + dlon;
+        f.speed = (uint16_t)(st.prev.speed + unzigzag(v[3]));
+        f.course = (uint16_t)((st.prev.course + unzigzag(v[4]) + 360) % 360);
+        f.hdop = (uint8_t)(st.prev.hdop + unzigzag(v[5]));
+        st.prev = f;
+        st.dt = dt;
+        st.dlat = dlat;
+        st.dlon = dlon;
+        return n;
+    }
+
+    static bool readHeader(File &f, uint32_t idx, TrackBlockHeader_t &hdr)
+    {
+        if (!f.seek(idx * TRACK_BLOCK_SIZE))
+            return false;
+        if (f.read((uint8_t *)&hdr, sizeof(hdr)) != sizeof(hdr))
+            return false;
+        return hdr.magic == TRACK_MAGIC && hdr.version == TRACK_VERSION;
+    }
+
+    static bool writeBlock()
+    {
+        File f = LittleFS.open(TRACK_FILE, LittleFS.exists(TRACK_FILE) ? "r+" : "w");
+        if (!f)
+        {
+            mqttLogger.println("track: cannot open track file");
+            return false;
+        }
+        f.seek(blockIndex * TRACK_BLOCK_SIZE);
+        const size_t written = f.write((const uint8_t *)&block, sizeof(block));
+        f.close();
+        dirty = false;
+        return written == sizeof(block);
+    }
+
+    static void startBlock(const Fix_t &fix)
+    {
+        memset(&block, 0, sizeof(block));
+        block.hdr.magic = TRACK_MAGIC;
+        block.hdr.version = TRACK_VERSION;
+        block.hdr.t_first = fix.t;
+        block.hdr.t_last = fix.t;
+        block.hdr.lat = fix.lat;
+        block.hdr.lon = fix.lon;
+        resetState(block.hdr);
+    }
+
+    bool begin()
+    {
+        if (started)
+            return true;
+        if (!LittleFS.begin(false, "/littlefs", 10, "storage"))
+        {
+            mqttLogger.println("track: storage mount failed");
+            return false;
+        }
+        memset(&block, 0, sizeof(block));
+        blockIndex = 0;
+        File f = LittleFS.open(TRACK_FILE, "r");
+        if (f)
+        {
+            const uint32_t blocks = f.size() / TRACK_BLOCK_SIZE;
+            blockIndex = blocks;
+            // resume the last block if it still has room, replaying it to rebuild the codec state
+            if (blocks > 0 && f.seek((blocks - 1) * TRACK_BLOCK_SIZE) &&
+                f.read((uint8_t *)&block, sizeof(block)) == sizeof(block) &&
+                block.hdr.magic == TRACK_MAGIC && block.hdr.used + MAX_RECORD_SIZE <= PAYLOAD_SIZE)
+            {
+                blockIndex = blocks - 1;
+                resetState(block.hdr);
+                const uint8_t *p = block.data, *end = block.data + block.hdr.used;
+                Fix_t fix;
+                for (uint16_t i = 0; i < block.hdr.count; i++)
+                {
+                    size_t n = decode(state, p, end, fix);
+                    if (n == 0)
+                        break;
+                    p += n;
+                }
+            }
+            else
+            {
+                memset(&block, 0, sizeof(block));
+            }
+            f.close();
+        }
+        started = true;
+        return true;
+    }
+
+    bool append(const sim76xx_gps_t &gps)
+    {
+        if (gps.fix == GPS_FIX_INVALID || gps.utc_epoch() == 0)
+            return false;
+        Fix_t fix;
+        fix.t = (uint32_t)gps.utc_epoch();
+        fix.lat = (int32_t)lround((double)gps.latitude * 1e7);
+        fix.lon = (int32_t)lround((double)gps.longitude * 1e7);
+        fix.speed = (uint16_t)lroundf(gps.speed * 10.0f);
+        fix.course = (uint16_t)(lroundf(gps.cog) % 360);
+        fix.hdop = (uint8_t)std::min(255L, lroundf(gps.dop_h * 10.0f));
+        return append(fix);
+    }
+
+    bool append(const Fix_t &fix)
+    {
+        if (!begin())
+            return false;
+        if (block.hdr.count > 0 && fix.t < block.hdr.t_last)
+            return false; // blocks must stay sorted by time
+        if (block.hdr.count == 0)
+            startBlock(fix);
+        uint8_t rec[MAX_RECORD_SIZE];
+        CodecState_t next = state;
+        size_t n = encode(next, fix, rec);
+        if (block.hdr.used + n > PAYLOAD_SIZE)
+        {
+            writeBlock();
+            if (++blockIndex >= TRACK_MAX_BLOCKS)
+            {
+                LittleFS.remove(TRACK_OLD_FILE);
+                LittleFS.rename(TRACK_FILE, TRACK_OLD_FILE);
+                blockIndex = 0;
+            }
+            startBlock(fix);
+            next = state;
+            n = encode(next, fix, rec);
+        }
+        memcpy(block.data + block.hdr.used, rec, n);
+        block.hdr.used += n;
+        block.hdr.count++;
+        block.hdr.t_last = fix.t;
+        state = next;
+        dirty = true;
+        statFixes++;
+        statBytes += n;
+        return true;
+    }
+
+    bool flush()
+    {
+        if (!started || !dirty)
+            return true;
+        return writeBlock();
+    }
+
+    static size_t queryFile(const char *path, uint32_t from, uint32_t to, const std::function<bool(const Fix_t &)> &cb, bool &stop)
+    {
+        File f = LittleFS.open(path, "r");
+        if (!f)
+            return 0;
+        const uint32_t blocks = f.size() / TRACK_BLOCK_SIZE;
+        TrackBlockHeader_t hdr;
+        // first block whose time range ends at or after `from`
+        uint32_t lo = 0, hi = blocks;
+        while (lo < hi)
+        {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (readHeader(f, mid, hdr) && hdr.t_last < from)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        size_t visited = 0;
+        Block_t blk;
+        for (uint32_t idx = lo; idx < blocks && !stop; idx++)
+        {
+            if (!f.seek(idx * TRACK_BLOCK_SIZE) || f.read((uint8_t *)&blk, sizeof(blk)) != sizeof(blk))
+                break;
+            if (blk.hdr.magic != TRACK_MAGIC || blk.hdr.t_first > to)
+                break;
+            CodecState_t st = {};
+            st.prev.t = blk.hdr.t_first;
+            st.prev.lat = blk.hdr.lat;
+            st.prev.lon = blk.hdr.lon;
+            const uint8_t *p = blk.data, *end = blk.data + blk.hdr.used;
+            Fix_t fix;
+            for (uint16_t i = 0; i < blk.hdr.count; i++)
+            {
+                size_t n = decode(st, p, end, fix);
+                if (n == 0)
+                    break;
+                p += n;
+                if (fix.t < from)
+                    continue;
+                if (fix.t > to)
+                    break;
+                visited++;
+                if (!cb(fix))
+                {
+                    stop = true;
+                    break;
+                }
+            }
+        }
+        f.close();
+        return visited;
+    }
+
+    size_t query(uint32_t from, uint32_t to, const std::function<bool(const Fix_t &)> &cb)
+    {
+        if (!begin())
+            return 0;
+        flush();
+        bool stop = false;
+        size_t visited = queryFile(TRACK_OLD_FILE, from, to, cb, stop);
+        if (!stop)
+            visited += queryFile(TRACK_FILE, from, to, cb, stop);
+        return visited;
+    }
+
+    uint32_t bytesPerFixX100()
+    {
+        return statFixes ? (statBytes * 100U) / statFixes : 0;
+    }
+}
@@ -0,0 +1,75 @@
+/**
+ * @file trackLog.hpp
+ * @author rami zayat
+ * @brief compact GNSS track store on the storage partition
+ * @version 0.1
+ * @date 2025-12-04
+ *
+ * @copyright Copyright (c) 2025
+ *
+ * Fixes are appended to fixed-size blocks of TRACK_BLOCK_SIZE bytes. Each block
+ * starts with a TrackBlockHeader_t holding the first fix in absolute form and the
+ * time range of the block, followed by varint records:
+ *
+ *   dt        unsigned varint, seconds since the previous fix
+ *   lat, lon  zigzag varint, residual against a linear prediction (1e-7 degrees)
+ *   speed     zigzag varint, delta in 0.1 km/h
+ *   course    zigzag varint, delta in degrees wrapped to [-180, 180)
+ *   hdop      zigzag varint, delta in 0.1 units
+ *
+ * Block headers are sorted by time, so a time query binary searches them without
+ * reading any record data.
+ *
+ * tools/track_decode.py decodes /track.old and /track.bin on a host and checks the headers.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include "sim76xx_gps.h"
+
+namespace track
+{
+    static const uint16_t TRACK_BLOCK_SIZE = 512;
+    static const uint16_t TRACK_MAGIC = 0x4b54; // "TK"
+    static const uint8_t TRACK_VERSION = 1;
+    static const uint32_t TRACK_MAX_BLOCKS = 2048; // 1 MB per file, the previous file is kept as /track.old
+
+    typedef struct __attribute__((packed))
+    {
+        uint16_t magic;
+        uint8_t version;
+        uint8_t reserved;
+        uint16_t count; // number of records
+        uint16_t used;  // bytes of record data after the header
+        uint32_t t_first;
+        uint32_t t_last;
+        int32_t lat; // first fix, 1e-7 degrees
+        int32_t lon;
+    } TrackBlockHeader_t;
+
+    typedef struct
+    {
+        uint32_t t;      // unix epoch
+        int32_t lat;     // 1e-7 degrees
+        int32_t lon;     // 1e-7 degrees
+        uint16_t speed;  // 0.1 km/h
+        uint16_t course; // degrees
+        uint8_t hdop;    // 0.1 units
+    } Fix_t;
+
+    bool begin();
+    // convert and append a modem fix, ignored when it has no fix or no date
+    bool append(const sim76xx_gps_t &gps);
+    bool append(const Fix_t &fix);
+    // write the partially filled block, call before sleeping
+    bool flush();
+    /**
+     * @brief visit fixes in [from, to], oldest first
+     * @param cb return false to stop early
+     * @return number of fixes visited
+     */
+    size_t query(uint32_t from, uint32_t to, const std::function<bool(const Fix_t &)> &cb);
+    // average encoded size of the stored fixes, in bytes * 100
+    uint32_t bytesPerFixX100();
+}
@@ -0,0 +1,144 @@
+/**
+ * @file trackSimplify.cpp
+ * @author rami zayat
+ * @brief streaming track simplification before upload (dead-band + windowed Douglas-Peucker)
+ * @version 0.1
+ * @date 2025-12-05
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include "track/trackSimplify.hpp"
+#include "track/simplifier.hpp"
+#include "outbox/outbox.hpp"
+#include "wifi/wifi.hpp"
+#include "Preferences.h"
+#include "LittleFS.h"
+#include <math.h>
+#include <string>
+
+namespace track
+{
+    static const float DEFAULT_TOLERANCE_M = 10.0f;
+    static float tolerance = -1.0f;
+    static RTC_DATA_ATTR uint32_t lastUploadTs = 0; // NVS "up_ts" is the copy that survives a power loss
+
+    float getSimplifyTolerance()
+    {
+        if (tolerance < 0.0f)
+        {
+            Preferences pref;
+            pref.begin("track", true);
+            tolerance = pref.getFloat("simp_tol", DEFAULT_TOLERANCE_M);
+            pref.end();
+        }
+        return tolerance;
+    }
+
+    void setSimplifyTolerance(float metres)
+    {
+        tolerance = metres;
+        Preferences pref;
+        pref.begin("track", false);
+        pref.putFloat("simp_tol", metres);
+        pref.end();
+    }
+
+    size_t simplify(uint32_t from, uint32_t to, float tol_m, const std::function<void(const Fix_t &)> &out, SimplifyStats_t *stats)
+    {
+        SimplifyStats_t local = {};
+        Simplifier simplifier(tol_m, out, local);
+        query(from, to, [&simplifier](const Fix_t &fix)
+              { simplifier.push(fix); return true; });
+        simplifier.finish();
+        if (stats)
+        {
+            *stats = local;
+        }
+        return local.out;
+    }
+
+    // Google encoded polyline value, 1e-5 degrees, escaped for a JSON string
+    static void polylineValue(int32_t v, std::string &out)
+    {
+        uint32_t u = v < 0 ? ~((uint32_t)v << 1) : ((uint32_t)v << 1);
+        while (u >= 0x20)
+        {
+            const char c = (char)((0x20 | (u & 0x1f)) + 63);
+            if (c == '\\')
+                out += '\\';
+            out += c;
+            u >>= 5;
+        }
+        const char c = (char)(u + 63);
+        if (c == '\\')
+            out += '\\';
+        out += c;
+    }
+
+    static inline int32_t toE5(int32_t e7)
+    {
+        return (e7 + (e7 >= 0 ? 50 : -50)) / 100;
+    }
+
+    bool queueUpload(uint32_t from, uint32_t to)
+    {
+        std::string poly;
+        int32_t plat = 0, plon = 0;
+        SimplifyStats_t stats = {};
+        const float tol = getSimplifyTolerance();
+        const size_t kept = simplify(from, to, tol, [&](const Fix_t &fix)
+                                     {
+                                         const int32_t lat = toE5(fix.lat), lon = toE5(fix.lon);
+                                         polylineValue(lat - plat, poly);
+                                         polylineValue(lon - plon, poly);
+                                         plat = lat;
+                                         plon = lon; },
+                                     &stats);
+        if (kept == 0)
+        {
+            return false;
+        }
+        mqttLogger.printf("track upload %lu..%lu: %lu -> %lu fixes, max dev %.1f m, %u bytes\n",
+                          (unsigned long)from, (unsigned long)to, (unsigned long)stats.in, (unsigned long)stats.out, stats.max_dev_m, (unsigned)poly.size());
+        char path[32];
+        snprintf(path, sizeof(path), "/trk_%lu.json", (unsigned long)from);
+        File f = LittleFS.open(path, "w");
+        if (!f)
+        {
+            return false;
+        }
+        f.printf("{\"from\":%lu,\"to\":%lu,\"raw\":%lu,\"n\":%lu,\"tol\":%.1f,\"poly\":\"",
+                 (unsigned long)from, (unsigned long)to, (unsigned long)stats.in, (unsigned long)stats.out, tol);
+        f.write((const uint8_t *)poly.data(), poly.size());
+        f.print("\"}");
+        f.close();
+
+        Preferences pref;
+        pref.begin("track", true);
+        String topic = pref.getString("topic", "esp32s3/track");
+        pref.end();
+        if (!outbox::post(outbox::Kind::MQTT_FILE, outbox::Key::NONE, topic.c_str(), path, outbox::Priority::LOW))
+        {
+            LittleFS.remove(path);
+            return false;
+        }
+        lastUploadTs = to;
+        pref.begin("track", false);
+        pref.putULong("up_ts", to);
+        pref.end();
+        return true;
+    }
+
+    uint32_t getLastUploadTs()
+    {
+        if (lastUploadTs == 0)
+        {
+            Preferences pref;
+            pref.begin("track", true);
+            lastUploadTs = pref.getULong("up_ts", 0);
+            pref.end();
+        }
+        return lastUploadTs;
+    }
+}
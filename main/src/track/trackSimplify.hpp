@@ -0,0 +1,49 @@
+/**
+ * @file trackSimplify.hpp
+ * @author rami zayat
+ * @brief streaming track simplification before upload (dead-band + windowed Douglas-Peucker)
+ * @version 0.1
+ * @date 2025-12-05
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include "track/trackLog.hpp"
+
+namespace track
+{
+    static const uint8_t SIMPLIFY_WINDOW = 64; // points held in RAM per Douglas-Peucker pass
+
+    typedef struct
+    {
+        uint32_t in;      // fixes read from the track
+        uint32_t out;     // fixes kept
+        float max_dev_m;  // bound on the distance of a dropped fix from the kept polyline, both stages
+    } SimplifyStats_t;
+
+    // error tolerance in metres, persisted in the "track" preferences
+    float getSimplifyTolerance();
+    void setSimplifyTolerance(float metres);
+
+    /**
+     * @brief simplify the stored fixes in [from, to]
+     * @param tol_m maximum deviation of a dropped fix from the output polyline
+     * @param out receives the kept fixes, oldest first
+     * @param stats optional compression/deviation report
+     * @return number of fixes kept
+     */
+    size_t simplify(uint32_t from, uint32_t to, float tol_m, const std::function<void(const Fix_t &)> &out, SimplifyStats_t *stats = nullptr);
+
+    /**
+     * @brief simplify [from, to], encode it as a polyline file and queue it in the outbox for MQTT
+     * @return false if there was nothing to upload or the outbox is full
+     */
+    bool queueUpload(uint32_t from, uint32_t to);
+
+    // end of the last queued upload, the next upload starts there
+    uint32_t getLastUploadTs();
+}
@@ -1,54 +1,789 @@
-
+/**
+ * @file mqttCallback.cpp
+ * @author rami zayat
+ * @brief MQTT command router, the remote counterpart of the web settings pages
+ * @version 0.1
+ * @date 2025-12-12
+ *
+ * @copyright Copyright (c) 2025
+ *
+ * Commands arrive on <cmd_topic>/<suffix> with a payload "<verb> [key=value ...]", or on
+ * <cmd_topic> itself as "<suffix> <verb> [key=value ...]". The reply, "<suffix> <verb> ok ..."
+ * or "<suffix> <verb> error ...", is published with QoS0 on <log_topic>/response.
+ *
+ *   timing get | set wifitm= nomotiontm= securmodetm= SnapShotTime= uploadtm= gnsstm= batterytm=
+ *   imu    get | set M_TH_GX= M_TH_GY= M_TH_GZ= M_TH_ROLL= M_TH_YAW= M_TH_PITCH=
+ *   wom    get | set WOM_THR= WOM_LPF= WOM_RATE= ACC_COMR=
+ *   wifi   get | set ssid= pass= ap_ssid= ap_pass= mqtt_server= mqtt_port= mqtt_user= mqtt_pass= mqtt_topic= mqtt_cmd_topic=
+ *   ble    get | set ibeacon_uuid=
+ *   web    get | set username= password=
+ *   time   get | set datetime=YYYY-MM-DDTHH:MM [timezone=]
+ *   gnss   request [dest=phone number or topic]
+ *   log    get | set level=error|warn|info|debug | throttle level= rate= burst=
+ *   pm     get, per PM lock name=held_ms/times, * if held now
+ *   car    get, voltage, resting drain slope, hours to the low threshold, last hours min/mean/max mV
+ *   modem  get, link baud, the last bench and the MQTT sessions per backend, ppp= and at=
+ *          sessions/failed, attach and connect ms, pub=count/ms, err=, cmd= commands received
+ *          | bench [kb=] UART loopback throughput and errors per rate
+ *   file   upload path= [mode=single|chunked], a storage partition file to <log_topic>/file, WiFi only
+ *   sim    motion | low_power | critical_low_power
+ *   help
+ *
+ * The payload and topic are copied once into static buffers and tokenized in place, the
+ * reply is formatted into a fixed buffer, nothing is allocated per message. Passwords are
+ * never echoed back.
+ */
 #include "wifi/wifi.hpp"
-extern bool simulatedMotionTrigger ;
-extern bool simulatedLowPowerTrigger ;
-extern bool simulatedCriticalLowPowerTrigger ;
+#include "publisher/publisher.hpp"
+#include "publisher/upload.hpp"
+#include "LittleFS.h"
+#include "outbox/outbox.hpp"
+#include "imu6500/imu_DMP6.hpp"
+#include "main.hpp"
+#include "system.hpp"
+#include "power/pm.hpp"
+#include "carBattery/carBattery.hpp"
+#include "idf_modem/pppos_client.hpp"
+#include "idf_modem/linkBench.hpp"
+#include "Preferences.h"
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <algorithm>
+#include <time.h>
+#include <sys/time.h>
 
-void MqttReceiveCallback(char *topic, byte *payload, unsigned int length)
+extern CarBattery carBattery;
+extern bool simulatedMotionTrigger;
+extern bool simulatedLowPowerTrigger;
+extern bool simulatedCriticalLowPowerTrigger;
+extern volatile bool remoteGnssRequest;
+extern char remoteGnssDest[outbox::MAX_DEST];
+extern String mqtt_log_topic;
+
+namespace commands
 {
-    // Safely convert payload (which may not be null-terminated) into a String.
-    static String mqttReceStr;
+    static const size_t MAX_PAYLOAD = 256;
+    static const size_t MAX_TOPIC = 128;
+    static const size_t REPLY_SIZE = 512;
+    static const uint8_t MAX_ARGS = 12;
+
+    enum class Type : uint8_t
+    {
+        U32,
+        U64,
+        F32,
+        STR,
+        SECRET, // string that is never read back
+    };
+
+    typedef struct
+    {
+        const char *key;
+        Type type;
+    } Setting_t;
+
+    typedef struct
+    {
+        const char *ns; // Preferences namespace, same as the web pages
+        const Setting_t *settings;
+        uint8_t count;
+        void (*apply)(); // called after a successful set, may be null
+    } Group_t;
+
+    typedef struct
+    {
+        char *key;
+        char *value; // null for a bare word
+    } Arg_t;
+
+    typedef struct
+    {
+        const char *suffix;
+        const char *verb;
+        Arg_t args[MAX_ARGS];
+        uint8_t count;
+    } Request_t;
+
+    typedef struct
+    {
+        char buf[REPLY_SIZE];
+        size_t len;
+    } Reply_t;
+
+    struct Command_t;
+    typedef bool (*Handler)(const Command_t &cmd, Request_t &req, Reply_t &reply);
+
+    struct Command_t
+    {
+        const char *suffix;
+        const char *verb;
+        Handler fn;
+        const Group_t *group;
+    };
+
+    static void add(Reply_t &reply, const char *format, ...)
+    {
+        if (reply.len >= sizeof(reply.buf) - 1)
+            return;
+        va_list args;
+        va_start(args, format);
+        const int n = vsnprintf(reply.buf + reply.len, sizeof(reply.buf) - reply.len, format, args);
+        va_end(args);
+        if (n > 0)
+            reply.len = std::min(reply.len + n, sizeof(reply.buf) - 1);
+    }
+
+    static const char *find(const Request_t &req, const char *key)
+    {
+        for (uint8_t i = 0; i < req.count; i++)
+        {
+            if (req.args[i].value != nullptr && strcmp(req.args[i].key, key) == 0)
+                return req.args[i].value;
+        }
+        return nullptr;
+    }
+
+    static bool parseU32(const char *s, uint32_t &out)
+    {
+        char *end;
+        const unsigned long v = strtoul(s, &end, 0);
+        if (*s == '\0' || *end != '\0')
+            return false;
+        out = (uint32_t)v;
+        return true;
+    }
+
+    static bool parseU64(const char *s, uint64_t &out)
+    {
+        char *end;
+        const unsigned long long v = strtoull(s, &end, 0);
+        if (*s == '\0' || *end != '\0')
+            return false;
+        out = (uint64_t)v;
+        return true;
+    }
+
+    static bool parseFloat(const char *s, float &out)
+    {
+        char *end;
+        const float v = strtof(s, &end);
+        if (*s == '\0' || *end != '\0')
+            return false;
+        out = v;
+        return true;
+    }
+
+    static bool parseBool(const char *s, bool &out)
+    {
+        if (strcmp(s, "1") == 0 || strcasecmp(s, "true") == 0 || strcasecmp(s, "on") == 0)
+            out = true;
+        else if (strcmp(s, "0") == 0 || strcasecmp(s, "false") == 0 || strcasecmp(s, "off") == 0)
+            out = false;
+        else
+            return false;
+        return true;
+    }
+
+    static const Setting_t *findSetting(const Group_t &group, const char *key)
+    {
+        for (uint8_t i = 0; i < group.count; i++)
+        {
+            if (strcmp(group.settings[i].key, key) == 0)
+                return &group.settings[i];
+        }
+        return nullptr;
+    }
+
+    // ---- Preferences backed groups, same keys as web.cpp ----
+
+    static const Setting_t TIMING[] = {
+        {"wifitm", Type::U32},
+        {"nomotiontm", Type::U32},
+        {"securmodetm", Type::U32},
+        {"SnapShotTime", Type::U64},
+        {"uploadtm", Type::U32},
+        {"gnsstm", Type::U32},
+        {"batterytm", Type::U32},
+    };
+
+    static const Setting_t IMU[] = {
+        {"M_TH_GX", Type::F32},
+        {"M_TH_GY", Type::F32},
+        {"M_TH_GZ", Type::F32},
+        {"M_TH_ROLL", Type::F32},
+        {"M_TH_YAW", Type::F32},
+        {"M_TH_PITCH", Type::F32},
+    };
+
+    static const Setting_t WIFI[] = {
+        {"ssid", Type::STR},
+        {"pass", Type::SECRET},
+        {"ap_ssid", Type::STR},
+        {"ap_pass", Type::SECRET},
+        {"mqtt_server", Type::STR},
+        {"mqtt_port", Type::U32},
+        {"mqtt_user", Type::STR},
+        {"mqtt_pass", Type::SECRET},
+        {"mqtt_topic", Type::STR},
+        {"mqtt_cmd_topic", Type::STR},
+    };
+
+    static const Setting_t BLE[] = {
+        {"ibeacon_uuid", Type::STR},
+    };
+
+    static const Setting_t WEB[] = {
+        {"username", Type::STR},
+        {"password", Type::SECRET},
+    };
+
+    // IMU thresholds and WiFi settings are read at setup, like the web pages they apply on the next boot
+    static const Group_t TIMING_GROUP = {"timing", TIMING, sizeof(TIMING) / sizeof(TIMING[0]), loadTimingPref};
+    static const Group_t IMU_GROUP = {"imu", IMU, sizeof(IMU) / sizeof(IMU[0]), nullptr};
+    static const Group_t WIFI_GROUP = {"wifi", WIFI, sizeof(WIFI) / sizeof(WIFI[0]), nullptr};
+    static const Group_t BLE_GROUP = {"ble-settings", BLE, sizeof(BLE) / sizeof(BLE[0]), nullptr};
+    static const Group_t WEB_GROUP = {"auth-settings", WEB, sizeof(WEB) / sizeof(WEB[0]), nullptr};
+
+    static bool getGroup(const Command_t &cmd, Request_t &, Reply_t &reply)
+    {
+        const Group_t &group = *cmd.group;
+        Preferences pref;
+        if (!pref.begin(group.ns, true))
+        {
+            add(reply, " nothing stored");
+            return true;
+        }
+        char str[96];
+        for (uint8_t i = 0; i < group.count; i++)
+        {
+            const Setting_t &s = group.settings[i];
+            if (!pref.isKey(s.key))
+                continue;
+            switch (s.type)
+            {
+            case Type::U32:
+                add(reply, " %s=%lu", s.key, (unsigned long)pref.getULong(s.key));
+                break;
+            case Type::U64:
+                add(reply, " %s=%llu", s.key, (unsigned long long)pref.getULong64(s.key));
+                break;
+            case Type::F32:
+                add(reply, " %s=%g", s.key, (double)pref.getFloat(s.key));
+                break;
+            case Type::STR:
+                pref.getString(s.key, str, sizeof(str));
+                add(reply, " %s=%s", s.key, str);
+                break;
+            case Type::SECRET:
+                add(reply, " %s=***", s.key);
+                break;
+            }
+        }
+        pref.end();
+        return true;
+    }
+
+    static bool setGroup(const Command_t &cmd, Request_t &req, Reply_t &reply)
+    {
+        const Group_t &group = *cmd.group;
+        // validate everything before writing anything
+        for (uint8_t i = 0; i < req.count; i++)
+        {
+            const Arg_t &a = req.args[i];
+            const Setting_t *s = findSetting(group, a.key);
+            uint32_t u32;
+            uint64_t u64;
+            float f;
+            if (s == nullptr || a.value == nullptr)
+            {
+                add(reply, " unknown or empty %s", a.key);
+                return false;
+            }
+            if ((s->type == Type::U32 && !parseU32(a.value, u32)) || (s->type == Type::U64 && !parseU64(a.value, u64)) ||
+                (s->type == Type::F32 && !parseFloat(a.value, f)))
+            {
+                add(reply, " bad value %s=%s", a.key, a.value);
+                return false;
+            }
+        }
+        if (req.count == 0)
+        {
+            add(reply, " no key=value given");
+            return false;
+        }
+        Preferences pref;
+        if (!pref.begin(group.ns, false))
+        {
+            add(reply, " cannot open %s", group.ns);
+            return false;
+        }
+        for (uint8_t i = 0; i < req.count; i++)
+        {
+            const Arg_t &a = req.args[i];
+            const Setting_t *s = findSetting(group, a.key);
+            uint32_t u32 = 0;
+            uint64_t u64 = 0;
+            float f = 0;
+            switch (s->type)
+            {
+            case Type::U32:
+                parseU32(a.value, u32);
+                pref.putULong(a.key, u32);
+                break;
+            case Type::U64:
+                parseU64(a.value, u64);
+                pref.putULong64(a.key, u64);
+                break;
+            case Type::F32:
+                parseFloat(a.value, f);
+                pref.putFloat(a.key, f);
+                break;
+            case Type::STR:
+            case Type::SECRET:
+                pref.putString(a.key, a.value);
+                break;
+            }
+            add(reply, " %s", a.key);
+        }
+        pref.end();
+        if (group.apply != nullptr)
+            group.apply();
+        return true;
+    }
+
+    // ---- WOM, applied live through the IMU driver which persists it ----
+
+    static bool getWom(const Command_t &, Request_t &, Reply_t &reply)
+    {
+        Preferences pref;
+        pref.begin("imu", true);
+        const float thr = pref.getFloat("WOM_THR", 15.0f);
+        const bool compare = pref.getBool("ACC_COMR", false);
+        pref.end();
+        add(reply, " WOM_THR=%g WOM_LPF=%u WOM_RATE=%u ACC_COMR=%d", (double)thr, (unsigned)imu6500_dmp::get_wom_lpf(),
+            (unsigned)imu6500_dmp::get_wom_acc_output_rate(), compare);
+        return true;
+    }
+
+    static bool setWom(const Command_t &cmd, Request_t &req, Reply_t &reply)
+    {
+        const char *thr = find(req, "WOM_THR");
+        const char *lpf = find(req, "WOM_LPF");
+        const char *rate = find(req, "WOM_RATE");
+        const char *compare = find(req, "ACC_COMR");
+        float fthr = 0;
+        uint32_t ulpf = 0, urate = 0;
+        bool bcompare = false;
+        if ((thr && !parseFloat(thr, fthr)) ||
+            (lpf && (!parseU32(lpf, ulpf) || ulpf > MPU6500_ACCELEROMETER_LOW_PASS_FILTER_7)) ||
+            (rate && (!parseU32(rate, urate) || urate < MPU6500_LOW_POWER_ACCEL_OUTPUT_RATE_0P24 || urate > MPU6500_LOW_POWER_ACCEL_OUTPUT_RATE_500)) ||
+            (compare && !parseBool(compare, bcompare)))
+        {
+            add(reply, " bad value");
+            return false;
+        }
+        if (!thr && !lpf && !rate && !compare)
+        {
+            add(reply, " no key=value given");
+            return false;
+        }
+        if (thr)
+            imu6500_dmp::SetWakeOnMotionThresh(fthr);
+        if (lpf)
+            imu6500_dmp::set_wom_lpf((mpu6500_accelerometer_low_pass_filter_t)ulpf);
+        if (rate)
+            imu6500_dmp::set_wom_acc_output_rate((mpu6500_low_power_accel_output_rate_t)urate);
+        if (compare)
+            imu6500_dmp::SetAccelCompare(bcompare);
+        imu6500_dmp::restart(imu6500_dmp::WOM);
+        return getWom(cmd, req, reply);
+    }
 
-    const unsigned int MAX_PAYLOAD = 1024; // prevent excessive allocation
-    unsigned int len = length;
-    if (len > MAX_PAYLOAD)
+    // ---- time ----
+
+    static bool getTime(const Command_t &, Request_t &, Reply_t &reply)
+    {
+        const time_t now = time(nullptr);
+        struct tm timeinfo;
+        localtime_r(&now, &timeinfo);
+        char buf[32];
+        strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S%z", &timeinfo);
+        add(reply, " datetime=%s epoch=%lld", buf, (long long)now);
+        return true;
+    }
+
+    static bool setTime(const Command_t &cmd, Request_t &req, Reply_t &reply)
+    {
+        const char *datetime = find(req, "datetime");
+        const char *tz = find(req, "timezone");
+        struct tm timeinfo = {};
+        if (datetime == nullptr || strptime(datetime, "%Y-%m-%dT%H:%M", &timeinfo) == nullptr)
+        {
+            add(reply, " datetime=YYYY-MM-DDTHH:MM expected");
+            return false;
+        }
+        setenv("TZ", tz ? tz : "CET-1CEST,M3.5.0,M10.5.0/3", 1);
+        tzset();
+        timeinfo.tm_sec = 0;
+        const struct timeval tv = {.tv_sec = mktime(&timeinfo), .tv_usec = 0};
+        if (settimeofday(&tv, nullptr) != 0)
+        {
+            add(reply, " settimeofday failed");
+            return false;
+        }
+        return getTime(cmd, req, reply);
+    }
+
+    // ---- GNSS, the main loop posts it to the outbox, answered by the next flush ----
+
+    static bool requestGnss(const Command_t &, Request_t &req, Reply_t &reply)
+    {
+        if (remoteGnssRequest)
+        {
+            add(reply, " a request is already pending");
+            return false;
+        }
+        const char *dest = find(req, "dest");
+        if (dest != nullptr)
+            strlcpy(remoteGnssDest, dest, sizeof(remoteGnssDest));
+        else
+            snprintf(remoteGnssDest, sizeof(remoteGnssDest), "%s/response", mqtt_log_topic.c_str());
+        remoteGnssRequest = true;
+        postSystemEvent(EVENT_COMMAND);
+        add(reply, " queued, answer to %s", remoteGnssDest);
+        return true;
+    }
+
+    // ---- logging ----
+
+    static const char *LEVELS[] = {"error", "warn", "info", "debug"};
+
+    static bool parseLevel(const char *s, MqttLogLevel &out)
+    {
+        for (uint8_t i = 0; s && i < sizeof(LEVELS) / sizeof(LEVELS[0]); i++)
+        {
+            if (strcasecmp(s, LEVELS[i]) == 0)
+            {
+                out = (MqttLogLevel)i;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool getLog(const Command_t &, Request_t &, Reply_t &reply)
+    {
+        const MqttLoggerStats &st = mqttLogger.getStats();
+        add(reply, " level=%s published=%lu dropped=%lu spooled=%lu", LEVELS[(uint8_t)mqttLogger.getLevel()],
+            (unsigned long)st.published, (unsigned long)(st.droppedFull + st.droppedOffline), (unsigned long)st.spooled);
+        return true;
+    }
+
+    static bool setLog(const Command_t &cmd, Request_t &req, Reply_t &reply)
     {
-        len = MAX_PAYLOAD;
-        mqttLogger.println("Warning: payload truncated due to size");
+        MqttLogLevel level;
+        if (!parseLevel(find(req, "level"), level))
+        {
+            add(reply, " level=error|warn|info|debug expected");
+            return false;
+        }
+        mqttLogger.setLevel(level);
+        return getLog(cmd, req, reply);
     }
 
-    char *buf = (char *)malloc(len + 1);
-    if (buf == NULL)
+    static bool throttleLog(const Command_t &, Request_t &req, Reply_t &reply)
     {
-        mqttLogger.println("Error: malloc failed in MqttReceiveCallback");
-        return;
+        MqttLogLevel level;
+        const char *rate = find(req, "rate");
+        const char *burst = find(req, "burst");
+        uint32_t urate = 0, uburst = 0;
+        if (!parseLevel(find(req, "level"), level) || rate == nullptr || !parseU32(rate, urate) ||
+            (burst && !parseU32(burst, uburst)) || urate > UINT16_MAX || uburst > UINT16_MAX)
+        {
+            add(reply, " level= rate= [burst=] expected");
+            return false;
+        }
+        mqttLogger.setThrottle(level, urate, burst ? uburst : urate * 2);
+        return true;
     }
 
-    if (len > 0)
+    // ---- power management ----
+
+    static bool getPm(const Command_t &, Request_t &, Reply_t &reply)
     {
-        memcpy(buf, payload, len);
+        add(reply, " cpu=%dMHz awake=%lums", getCpuFrequencyMhz(), (unsigned long)millis());
+        for (uint8_t i = 0; i < pm::lockCount(); i++)
+        {
+            const pm::Lock *l = pm::getLock(i);
+            add(reply, " %s=%llums/%lu%s", l->name(), (unsigned long long)l->heldMs(), (unsigned long)l->count(),
+                l->held() ? "*" : "");
+        }
+        return true;
     }
-    buf[len] = '\0'; // ensure null termination
 
-    mqttReceStr = String(buf);
-    free(buf);
-    if (mqttReceStr.length() < 1)
+    static bool getCar(const Command_t &, Request_t &, Reply_t &reply)
     {
-        mqttLogger.println("Warning: received empty payload");
-        return;
+        static const uint8_t HOURS = 6;
+        const batteryTrend::BatteryTrend_t &trend = carBattery.getTrend();
+        float rate = 0.0f, mv = 0.0f;
+        const bool fit = batteryTrend::slope(trend, rate, mv);
+        add(reply, " v=%.2f engine=%d low=%.2f", carBattery.getBatteryVoltage(), carBattery.isEngineOn(),
+            carBattery.getLowBatteryThreshold());
+        if (fit)
+            add(reply, " rest=%.0fmV slope=%+.1fmV/h hours=%.0f", mv, rate,
+                batteryTrend::hoursTo(trend, (uint16_t)(carBattery.getLowBatteryThreshold() * 1000.0f)));
+        for (uint8_t ago = 0; ago < HOURS; ago++)
+        {
+            const batteryTrend::Bucket_t *b = batteryTrend::get(trend, ago);
+            if (b != nullptr)
+                add(reply, " -%uh=%u/%u/%u%s", ago, b->min_mv, batteryTrend::mean(*b), b->max_mv,
+                    (b->flags & batteryTrend::CHARGED) ? "*" : "");
+        }
+        return true;
     }
-    if (mqttReceStr == "motion_trigger")
+
+    // ---- modem UART link ----
+
+    static bool getModem(const Command_t &, Request_t &, Reply_t &reply)
+    {
+        add(reply, " baud=%lu bench=%s", (unsigned long)modem.getLinkBaud(), linkBench::running() ? "running" : "idle");
+        const linkBench::Result_t *r;
+        const uint8_t n = linkBench::results(r);
+        for (uint8_t i = 0; i < n; i++)
+            add(reply, " %lu%s=%lukbps/%lu/%lu", (unsigned long)r[i].baud, r[i].flow ? "f" : "", (unsigned long)r[i].kbps,
+                (unsigned long)r[i].bad, (unsigned long)r[i].lost);
+        // the two cellular MQTT backends side by side, totals over all flush() sessions
+        const publisher::Link links[] = {publisher::Link::PPP, publisher::Link::MODEM};
+        for (const publisher::Link link : links)
+        {
+            const publisher::LinkStats_t &s = publisher::getLinkStats(link);
+            add(reply, " %s=%lu/%lu attach=%lums connect=%lums pub=%lu/%lums err=%lu cmd=%lu", link == publisher::Link::PPP ? "ppp" : "at",
+                (unsigned long)s.sessions, (unsigned long)s.failed, (unsigned long)s.attach_ms, (unsigned long)s.connect_ms,
+                (unsigned long)s.publishes, (unsigned long)s.publish_ms, (unsigned long)s.errors, (unsigned long)s.commands);
+        }
+        return true;
+    }
+
+    static bool benchModem(const Command_t &, Request_t &req, Reply_t &reply)
+    {
+        uint32_t kb = 64;
+        const char *s = find(req, "kb");
+        if (s != nullptr && (!parseU32(s, kb) || kb == 0 || kb > 1024))
+        {
+            add(reply, " bad kb");
+            return false;
+        }
+        if (!linkBench::start(kb))
+        {
+            add(reply, " already running");
+            return false;
+        }
+        add(reply, " started kb=%lu, results in the log", (unsigned long)kb);
+        return true;
+    }
+
+    // ---- files on the storage partition ----
+
+    // streamed over PubSubClient, so WiFi only; the reply follows once the file is sent
+    static bool uploadFile(const Command_t &, Request_t &req, Reply_t &reply)
+    {
+        const char *path = find(req, "path");
+        const char *mode = find(req, "mode");
+        if (path == nullptr || path[0] != '/')
+        {
+            add(reply, " bad path");
+            return false;
+        }
+        if (mode != nullptr && strcmp(mode, "single") != 0 && strcmp(mode, "chunked") != 0)
+        {
+            add(reply, " bad mode");
+            return false;
+        }
+        MqttClientGuard guard;
+        if (!GetWifiOn() || !mqttclient.connected())
+        {
+            add(reply, " needs the WiFi link");
+            return false;
+        }
+        char topic[MAX_TOPIC];
+        snprintf(topic, sizeof(topic), "%s/file", mqtt_log_topic.c_str());
+        const upload::Mode m = mode != nullptr && strcmp(mode, "chunked") == 0 ? upload::Mode::CHUNKED : upload::Mode::SINGLE;
+        if (!upload::send(mqttclient, topic, LittleFS, path, m))
+        {
+            add(reply, " %s not sent", path);
+            return false;
+        }
+        add(reply, " %s to %s in %lu ms", path, topic, (unsigned long)upload::getStats().last_ms);
+        return true;
+    }
+
+    // ---- simulation triggers, also reachable with the legacy bare payloads ----
+
+    static bool simMotion(const Command_t &, Request_t &, Reply_t &)
     {
         simulatedMotionTrigger = true;
+        return true;
     }
-    if (mqttReceStr == "low_power_trigger")
+
+    static bool simLowPower(const Command_t &, Request_t &, Reply_t &)
     {
         simulatedLowPowerTrigger = true;
+        return true;
     }
-    if (mqttReceStr == "critical_low_power_trigger")
+
+    static bool simCriticalLowPower(const Command_t &, Request_t &, Reply_t &)
     {
         simulatedCriticalLowPowerTrigger = true;
+        return true;
     }
-    Serial.printf("got message on topic %s = %s \n", topic, mqttReceStr.c_str());
-    // handle message arrived
+
+    static bool help(const Command_t &, Request_t &, Reply_t &reply);
+
+    static const Command_t COMMANDS[] = {
+        {"timing", "get", getGroup, &TIMING_GROUP},
+        {"timing", "set", setGroup, &TIMING_GROUP},
+        {"imu", "get", getGroup, &IMU_GROUP},
+        {"imu", "set", setGroup, &IMU_GROUP},
+        {"wom", "get", getWom, nullptr},
+        {"wom", "set", setWom, nullptr},
+        {"wifi", "get", getGroup, &WIFI_GROUP},
+        {"wifi", "set", setGroup, &WIFI_GROUP},
+        {"ble", "get", getGroup, &BLE_GROUP},
+        {"ble", "set", setGroup, &BLE_GROUP},
+        {"web", "get", getGroup, &WEB_GROUP},
+        {"web", "set", setGroup, &WEB_GROUP},
+        {"time", "get", getTime, nullptr},
+        {"time", "set", setTime, nullptr},
+        {"gnss", "request", requestGnss, nullptr},
+        {"log", "get", getLog, nullptr},
+        {"log", "set", setLog, nullptr},
+        {"log", "throttle", throttleLog, nullptr},
+        {"pm", "get", getPm, nullptr},
+        {"car", "get", getCar, nullptr},
+        {"modem", "get", getModem, nullptr},
+        {"modem", "bench", benchModem, nullptr},
+        {"file", "upload", uploadFile, nullptr},
+        {"sim", "motion", simMotion, nullptr},
+        {"sim", "low_power", simLowPower, nullptr},
+        {"sim", "critical_low_power", simCriticalLowPower, nullptr},
+        {"", "motion_trigger", simMotion, nullptr},
+        {"", "low_power_trigger", simLowPower, nullptr},
+        {"", "critical_low_power_trigger", simCriticalLowPower, nullptr},
+        {"", "help", help, nullptr},
+    };
+    static const size_t COMMAND_COUNT = sizeof(COMMANDS) / sizeof(COMMANDS[0]);
+
+    static bool help(const Command_t &, Request_t &, Reply_t &reply)
+    {
+        for (size_t i = 0; i < COMMAND_COUNT; i++)
+        {
+            if (COMMANDS[i].suffix[0] != '\0')
+                add(reply, " %s:%s", COMMANDS[i].suffix, COMMANDS[i].verb);
+        }
+        return true;
+    }
+
+    static const Command_t *lookup(const char *suffix, const char *verb)
+    {
+        for (size_t i = 0; i < COMMAND_COUNT; i++)
+        {
+            if (strcmp(COMMANDS[i].suffix, suffix) == 0 && strcmp(COMMANDS[i].verb, verb) == 0)
+                return &COMMANDS[i];
+        }
+        return nullptr;
+    }
+
+    static bool knownSuffix(const char *suffix)
+    {
+        for (size_t i = 0; i < COMMAND_COUNT; i++)
+        {
+            if (strcmp(COMMANDS[i].suffix, suffix) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    // split on blanks in place, "key=value" words are split at the first '='
+    static char *nextWord(char *&p)
+    {
+        while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+            p++;
+        if (*p == '\0')
+            return nullptr;
+        char *word = p;
+        while (*p != '\0' && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+            p++;
+        if (*p != '\0')
+            *p++ = '\0';
+        return word;
+    }
+
+    static char payloadBuf[MAX_PAYLOAD + 1];
+    static char topicBuf[MAX_TOPIC];
+    static Reply_t detail;
+    static Reply_t reply;
+
+    /**
+     * @brief route one command and publish the reply
+     *
+     * `topic` and `payload` may live in the PubSubClient buffer that the reply publish
+     * reuses, both are copied before anything is sent.
+     */
+    void dispatch(const char *topic, const uint8_t *payload, size_t length)
+    {
+        const size_t cmdLen = mqtt_cmd_topic.length();
+        if (strncmp(topic, mqtt_cmd_topic.c_str(), cmdLen) != 0 || (topic[cmdLen] != '\0' && topic[cmdLen] != '/'))
+            return;
+        strlcpy(topicBuf, topic[cmdLen] == '/' ? topic + cmdLen + 1 : "", sizeof(topicBuf));
+        if (length > MAX_PAYLOAD)
+        {
+            mqttLogger.printf(MqttLogLevel::Warn, "command on %s too long, %u bytes\n", topic, (unsigned)length);
+            return;
+        }
+        memcpy(payloadBuf, payload, length);
+        payloadBuf[length] = '\0';
+
+        Request_t req = {};
+        char *p = payloadBuf;
+        req.suffix = topicBuf;
+        req.verb = nextWord(p);
+        if (req.verb == nullptr)
+        {
+            mqttLogger.println(MqttLogLevel::Warn, "Warning: received empty command");
+            return;
+        }
+        // "<suffix> <verb>" on the bare command topic
+        if (req.suffix[0] == '\0' && lookup("", req.verb) == nullptr && knownSuffix(req.verb))
+        {
+            req.suffix = req.verb;
+            req.verb = nextWord(p);
+            if (req.verb == nullptr)
+                req.verb = "";
+        }
+        for (char *word = nextWord(p); word != nullptr && req.count < MAX_ARGS; word = nextWord(p))
+        {
+            char *eq = strchr(word, '=');
+            if (eq != nullptr)
+                *eq++ = '\0';
+            req.args[req.count++] = {word, eq};
+        }
+
+        detail.len = 0;
+        detail.buf[0] = '\0';
+        const Command_t *cmd = lookup(req.suffix, req.verb);
+        const bool ok = cmd != nullptr && cmd->fn(*cmd, req, detail);
+        reply.len = 0;
+        add(reply, "%s %s %s%s", req.suffix[0] ? req.suffix : "-", req.verb, ok ? "ok" : "error",
+            cmd == nullptr ? " unknown command, try help" : detail.buf);
+        mqttLogger.printf(ok ? MqttLogLevel::Info : MqttLogLevel::Warn, "command: %s\n", reply.buf);
+        char responseTopic[MAX_TOPIC];
+        snprintf(responseTopic, sizeof(responseTopic), "%s/response", mqtt_log_topic.c_str());
+        publisher::publish(responseTopic, reply.buf, reply.len, 0);
+    }
+}
+
+void MqttReceiveCallback(char *topic, byte *payload, unsigned int length)
+{
+    commands::dispatch(topic, payload, length);
 }
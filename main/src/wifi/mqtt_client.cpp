@@ -16,6 +16,9 @@
 #include "nvs_flash.h"
 #include "esp_crt_bundle.h"
 #include "esp_tls.h"
+#include "esp_rom_crc.h"
+#include "wifi/tlsSession.hpp"
+#include "pppos_client.hpp"
 /**
  * Reference to the MQTT event base
  */
@@ -41,6 +44,25 @@ bool check_nvs_storage()
     }
     return ret;
 }
+
+static const char *MQTT_CLIENT_ID = "RAMI SIM7670";
+static const char *MODEM_CA_FILE = "isrgrootx1.pem";
+// +CMQTTCONNECT error codes after which the CA file on the modem is uploaded again
+static const int MODEM_MQTT_HANDSHAKE_FAILED = 32;
+static const int MODEM_MQTT_NO_CERT = 33;
+
+// broker host without the URI scheme
+static String brokerHost()
+{
+    String host = esp_mqtt_server;
+    const int scheme = host.indexOf("://");
+    if (scheme >= 0)
+    {
+        host = host.substring(scheme + 3);
+    }
+    return host;
+}
+
 /**
  * Thin wrapper around C mqtt_client
  */
@@ -52,15 +74,14 @@ struct MqttClientHandle
 
         esp_mqtt_client_config_t config = {};
         // config.broker.verification.
-        config.broker.address.uri = esp_mqtt_server.c_str();
+        // TLS runs in our own transport so the session can be resumed after deep sleep, esp-mqtt only gets the host
+        host = brokerHost();
+        config.broker.address.hostname = host.c_str();
         config.broker.address.port = esp_mqtt_port;
+        config.network.transport = tls::createTransport((const char *)isrgrootx1_pem_start, isrgrootx1_pem_end - isrgrootx1_pem_start);
         config.credentials.username = esp_mqtt_user.c_str();
-        config.credentials.client_id = "RAMI SIM7670";
+        config.credentials.client_id = MQTT_CLIENT_ID;
         config.credentials.authentication.password = esp_mqtt_pass.c_str();
-        config.broker.verification.crt_bundle_attach = esp_crt_bundle_attach;
-        // config.broker.verification.skip_cert_common_name_check = true;
-        config.broker.verification.certificate = (const char *)isrgrootx1_pem_start;
-        // config.broker.verification.certificate_len = isrgrootx1_pem_start -  isrgrootx1_pem_end;
         client = esp_mqtt_client_init(&config);
         if (!client)
         {
@@ -73,24 +94,104 @@ struct MqttClientHandle
     }
 
     esp_mqtt_client_handle_t client;
+    String host;
 };
 
 /**
  * @brief Definitions of MqttClient methods
  */
-MqttClient::MqttClient()
+MqttClient::MqttClient(Backend backend) : backend(backend), receivedLock(xSemaphoreCreateMutex())
+{
+}
+
+MqttClient::Backend MqttClient::preferredBackend()
+{
+    Preferences pref;
+    uint8_t value = 0;
+    if (pref.begin("mqtt", true))
+    {
+        value = pref.getUChar("backend", 0);
+        pref.end();
+    }
+    return value == 1 ? Backend::MODEM : Backend::ESP_MQTT;
+}
+
+MqttClient::Backend MqttClient::getBackend()
 {
+    return backend;
 }
+
+const MqttClient::Stats_t &MqttClient::getStats()
+{
+    return stats;
+}
+
 esp_err_t MqttClient::begin()
 {
+    begin_ms = millis();
+    if (backend == Backend::MODEM)
+    {
+        return connect();
+    }
     h = (std::unique_ptr<MqttClientHandle>(new MqttClientHandle()));
     esp_event_loop_create_default();
     esp_mqtt_client_register_event(h->client, MQTT_EVENT_ANY, MqttClient::handle_event, this);
     return connect();
 }
 
+// the modem connects synchronously; the broker CA is uploaded to the modem once per CA and
+// broker, "modem_ca_id" keeps the CRC32 of both and is dropped when the TLS handshake fails
+static bool modemConnect()
+{
+    if (!modem.isInitialized())
+    {
+        return false;
+    }
+    check_nvs_storage();
+    const String host = brokerHost();
+    const std::string pem((const char *)isrgrootx1_pem_start, isrgrootx1_pem_end - isrgrootx1_pem_start - 1);
+    uint32_t ca_id = esp_rom_crc32_le(0, (const uint8_t *)host.c_str(), host.length());
+    ca_id = esp_rom_crc32_le(ca_id, (const uint8_t *)pem.data(), pem.size());
+    Preferences pref;
+    pref.begin("mqtt", false);
+    bool has_ca = pref.getUInt("modem_ca_id", 0) == ca_id;
+    if (!has_ca && modem.GetDce()->mqtt_upload_cert(MODEM_CA_FILE, pem) == command_result::OK)
+    {
+        pref.putUInt("modem_ca_id", ca_id);
+        has_ca = true;
+    }
+    modem_mqtt_config_t config;
+    config.host = host.c_str();
+    config.port = esp_mqtt_port;
+    config.client_id = MQTT_CLIENT_ID;
+    config.user = esp_mqtt_user.c_str();
+    config.password = esp_mqtt_pass.c_str();
+    config.ca_file = has_ca ? MODEM_CA_FILE : "";
+    int error = -1;
+    const bool ok = modem.GetDce()->mqtt_open(config, &error) == command_result::OK;
+    if (!ok && has_ca && (error == MODEM_MQTT_HANDSHAKE_FAILED || error == MODEM_MQTT_NO_CERT))
+    {
+        ESP_LOGW("MqttClient", "modem TLS error %d, the CA is uploaded again on the next connect", error);
+        pref.remove("modem_ca_id");
+    }
+    pref.end();
+    return ok;
+}
+
 esp_err_t MqttClient::connect()
 {
+    if (backend == Backend::MODEM)
+    {
+        connected = modemConnect();
+        if (connected)
+        {
+            modem.GetDce()->mqtt_set_receive_cb([this](std::string_view topic, std::string_view payload)
+                                                { receive(topic, payload); });
+        }
+        stats.connect_ms = millis() - begin_ms;
+        ESP_LOGI(TAG, "modem mqtt %s after %lu ms", connected ? "connected" : "failed", (unsigned long)stats.connect_ms);
+        return connected ? ESP_OK : ESP_FAIL;
+    }
     if (h->client != nullptr)
     {
         // log all params of connection
@@ -102,6 +203,16 @@ esp_err_t MqttClient::connect()
 
 void MqttClient::disconnect()
 {
+    if (backend == Backend::MODEM)
+    {
+        if (connected)
+        {
+            modem.GetDce()->mqtt_close();
+            modem.GetDce()->mqtt_set_receive_cb(nullptr);
+        }
+        connected = false;
+        return;
+    }
     if (h->client != nullptr)
         esp_mqtt_client_disconnect(h->client);
     ESP_LOGI("TAG", "clien disconnect");
@@ -113,18 +224,69 @@ bool MqttClient::isConnected()
 }
 int MqttClient::publish(const std::string &topic, const std::string &data, int qos)
 {
-    if (h->client != nullptr)
-        return esp_mqtt_client_publish(h->client, topic.c_str(), data.c_str(), 0, qos, 0);
-    return -1;
+    const uint32_t start = millis();
+    int ret = -1;
+    if (backend == Backend::MODEM)
+    {
+        // the modem call returns once the publish is done (PUBACK for QoS 1), there is no message id
+        if (connected && modem.GetDce()->mqtt_publish(topic, data, qos) == command_result::OK)
+            ret = 0;
+    }
+    else if (h->client != nullptr)
+    {
+        ret = esp_mqtt_client_publish(h->client, topic.c_str(), data.c_str(), data.size(), qos, 0);
+    }
+    stats.publish_ms += millis() - start;
+    stats.publishes++;
+    stats.failures += ret < 0;
+    return ret;
 }
 
 int MqttClient::subscribe(const std::string &topic, int qos)
 {
+    if (backend == Backend::MODEM)
+        return connected && modem.GetDce()->mqtt_subscribe(topic, qos) == command_result::OK ? 0 : -1;
     if (h->client != nullptr)
         return esp_mqtt_client_subscribe(h->client, topic.c_str(), qos);
     return -1;
 }
 
+void MqttClient::setCallback(MessageCallback_t cb)
+{
+    callback = cb;
+}
+
+void MqttClient::receive(std::string_view topic, std::string_view payload)
+{
+    xSemaphoreTake(receivedLock, portMAX_DELAY);
+    const bool room = received.size() < MAX_RECEIVED;
+    if (room)
+        received.emplace_back(topic, payload);
+    xSemaphoreGive(receivedLock);
+    if (!room)
+        ESP_LOGW(TAG, "receive queue full, message on %.*s dropped", (int)topic.size(), topic.data());
+}
+
+int MqttClient::loop()
+{
+    std::vector<std::pair<std::string, std::string>> messages;
+    xSemaphoreTake(receivedLock, portMAX_DELAY);
+    messages.swap(received);
+    xSemaphoreGive(receivedLock);
+    if (callback == nullptr)
+        return 0;
+    for (auto &m : messages)
+        callback(m.first.data(), (uint8_t *)m.second.data(), m.second.size());
+    return messages.size();
+}
+
+int MqttClient::outboxSize()
+{
+    if (backend == Backend::MODEM || !h || h->client == nullptr)
+        return 0;
+    return esp_mqtt_client_get_outbox_size(h->client);
+}
+
 std::string MqttClient::get_topic(void *event_data)
 {
     auto event = (esp_mqtt_event_handle_t)event_data;
@@ -145,18 +307,23 @@ std::string MqttClient::get_data(void *event_data)
 
 MqttClient::~MqttClient()
 {
-    if (h->client != nullptr)
+    if (backend == Backend::MODEM)
+    {
+        disconnect();
+    }
+    else if (h && h->client != nullptr)
     {
         esp_mqtt_client_stop(h->client);
         esp_mqtt_client_disconnect(h->client);
         esp_mqtt_client_unregister_event(h->client, MQTT_EVENT_ANY, MqttClient::handle_event);
         esp_mqtt_client_destroy(h->client);
     }
+    vSemaphoreDelete(receivedLock);
 }
 
 void MqttClient::register_handler(esp_mqtt_event_id_t id, esp_event_handler_t event_handler)
 {
-    if (h->client == nullptr)
+    if (!h || h->client == nullptr)
         return;
     esp_mqtt_client_register_event(h->client, id, event_handler, this);
 }
@@ -169,6 +336,8 @@ void MqttClient::handle_event(void *arg, esp_event_base_t base, int32_t event, v
     if (event == MQTT_EVENT_CONNECTED)
     {
         mqtt_client->connected = true;
+        mqtt_client->stats.connect_ms = millis() - mqtt_client->begin_ms;
+        ESP_LOGI(TAG, "mqtt connected after %lu ms", (unsigned long)mqtt_client->stats.connect_ms);
         return;
     }
     if (event == MQTT_EVENT_DISCONNECTED)
@@ -187,7 +356,11 @@ void MqttClient::handle_event(void *arg, esp_event_base_t base, int32_t event, v
 
     if (event == MQTT_EVENT_DATA)
     {
-        ESP_LOGI(TAG, " TOPIC: %s", mqtt_client->get_topic(data).c_str());
-        ESP_LOGI(TAG, " DATA: %s", mqtt_client->get_data(data).c_str());
+        // larger messages come in several events, commands fit in one
+        auto e = (esp_mqtt_event_handle_t)data;
+        if (e->current_data_offset == 0 && e->data_len == e->total_data_len)
+            mqtt_client->receive(std::string_view(e->topic, e->topic_len), std::string_view(e->data, e->data_len));
+        else
+            ESP_LOGW(TAG, "fragmented message of %d bytes dropped", e->total_data_len);
     }
 }
@@ -10,22 +10,60 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <memory>
+#include <vector>
+#include <utility>
 #include "mqtt_client.h"
 #include "esp_event.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 
 struct MqttClientHandle;
 
 /**
  * @brief Simple MQTT client wrapper
+ *
+ * ESP_MQTT runs esp-mqtt over the PPP link (or WiFi), MODEM drives the modem's own
+ * MQTT client with AT+CMQTT* commands, so no PPP session or TLS stack runs on the ESP32.
+ * Both backends queue received messages, loop() hands them to the callback set with
+ * setCallback(), the same one PubSubClient uses over WiFi.
  */
 class MqttClient
 {
 public:
-    MqttClient();
+    enum class Backend
+    {
+        ESP_MQTT = 0,
+        MODEM = 1,
+    };
+
+    typedef struct
+    {
+        uint32_t connect_ms; // begin() until the broker accepted the connection
+        uint32_t publish_ms; // time spent in publish(), all messages
+        uint32_t publishes;
+        uint32_t failures;
+    } Stats_t;
+
+    // same signature as the PubSubClient callback
+    typedef void (*MessageCallback_t)(char *topic, uint8_t *payload, unsigned int length);
+
+    static const uint8_t MAX_RECEIVED = 8; // queued messages, newer ones are dropped until loop() runs
+
+    MqttClient(Backend backend = Backend::ESP_MQTT);
     ~MqttClient();
     esp_err_t begin();
 
+    Backend getBackend();
+
+    const Stats_t &getStats();
+
+    /**
+     * @brief Backend selected in the "mqtt" preferences, key "backend" (0 esp-mqtt, 1 modem)
+     */
+    static Backend preferredBackend();
+
     /**
      * @brief Start the mqtt-client
      */
@@ -45,12 +83,34 @@ public:
 
     /**
      * @brief Subscribe to a topic
+     *
+     * The modem backend waits for the SUBACK and returns 0, its messages come as +CMQTTRX* URCs.
      * @param topic Topic to subscribe
      * @param qos QoS (0 by default)
-     * @return message id
+     * @return message id, -1 on failure
      */
     int subscribe(const std::string &topic, int qos = 0);
 
+    /**
+     * @brief Set the receiver of messages on subscribed topics, called from loop()
+     */
+    void setCallback(MessageCallback_t cb);
+
+    /**
+     * @brief Deliver the queued messages to the callback
+     *
+     * Messages arrive in the esp-mqtt or the modem DTE task; they are handed over here, in
+     * the caller's task, so the callback may publish or send AT commands.
+     * @return messages delivered
+     */
+    int loop();
+
+    /**
+     * @brief Messages published with QoS > 0 and not acknowledged yet
+     * @return bytes held in the esp-mqtt outbox, always 0 for the modem backend (its publish waits for the ack)
+     */
+    int outboxSize();
+
     /**
      * @brief Get topic from event data
      * @return String topic
@@ -73,9 +133,16 @@ public:
 
 protected:
     bool connected = false;
+    Backend backend;
+    Stats_t stats = {};
+    uint32_t begin_ms = 0;
     static inline const char *TAG = {"MqttClient"};
 
 private:
     std::unique_ptr<MqttClientHandle> h;
+    MessageCallback_t callback = nullptr;
+    std::vector<std::pair<std::string, std::string>> received; // guarded by receivedLock
+    SemaphoreHandle_t receivedLock;
+    void receive(std::string_view topic, std::string_view payload);
     static void handle_event(void *arg, esp_event_base_t base, int32_t event, void *data);
 };
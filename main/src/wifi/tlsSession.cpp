@@ -0,0 +1,458 @@
+/**
+ * @file tlsSession.cpp
+ * @author rami zayat
+ * @brief TLS transport for esp-mqtt that resumes the previous session across deep sleep
+ * @version 0.1
+ * @date 2025-12-08
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include "wifi/tlsSession.hpp"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_attr.h"
+#include "esp_crt_bundle.h"
+#include "Preferences.h"
+#include "esp_rom_crc.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+
+namespace tls
+{
+    static const char *TAG = "tls-session";
+    static const size_t HOST_MAX = 64;
+
+    typedef struct
+    {
+        uint16_t len;
+        char host[HOST_MAX];
+        uint8_t data[SESSION_RTC_MAX];
+    } SessionCache_t;
+
+    typedef struct
+    {
+        int sock;
+        bool ready;
+        const char *ca_pem;
+        size_t ca_len;
+        uint32_t bytes_in;
+        uint32_t bytes_out;
+        mbedtls_ssl_context ssl;
+        mbedtls_ssl_config conf;
+        mbedtls_x509_crt ca;
+        mbedtls_entropy_context entropy;
+        mbedtls_ctr_drbg_context drbg;
+    } Context_t;
+
+    static RTC_DATA_ATTR SessionCache_t cache;
+    static RTC_DATA_ATTR uint32_t storedCrc = 0; // CRC32 of host and session in NVS, 0 if unknown
+    static RTC_DATA_ATTR uint32_t handshakes = 0;
+    static RTC_DATA_ATTR uint32_t resumed = 0;
+    static HandshakeStats_t last = {};
+
+    static uint32_t sessionCrc(const char *host, const uint8_t *buf, size_t len)
+    {
+        const uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)host, strlen(host));
+        return esp_rom_crc32_le(crc, buf, len);
+    }
+
+    static bool loadSession(const char *host, mbedtls_ssl_session &session)
+    {
+        if (cache.len > 0 && strncmp(cache.host, host, HOST_MAX) == 0)
+        {
+            return mbedtls_ssl_session_load(&session, cache.data, cache.len) == 0;
+        }
+        // RTC memory is lost on power loss and cannot hold sessions that carry the peer certificate
+        Preferences pref;
+        if (!pref.begin("tls", true))
+        {
+            return false;
+        }
+        bool ok = false;
+        const size_t len = pref.getBytesLength("session");
+        if (len > 0 && pref.getString("host", "") == host)
+        {
+            uint8_t *buf = (uint8_t *)malloc(len);
+            if (buf && pref.getBytes("session", buf, len) == len)
+            {
+                ok = mbedtls_ssl_session_load(&session, buf, len) == 0;
+                storedCrc = sessionCrc(host, buf, len);
+            }
+            free(buf);
+        }
+        pref.end();
+        return ok;
+    }
+
+    static void saveSession(const char *host, const mbedtls_ssl_session &session)
+    {
+        size_t len = 0;
+        mbedtls_ssl_session_save(&session, nullptr, 0, &len);
+        if (len == 0)
+        {
+            return;
+        }
+        uint8_t *buf = (uint8_t *)malloc(len);
+        if (buf == nullptr || mbedtls_ssl_session_save(&session, buf, len, &len) != 0)
+        {
+            free(buf);
+            return;
+        }
+        cache.len = 0;
+        if (len <= SESSION_RTC_MAX)
+        {
+            memcpy(cache.data, buf, len);
+            strncpy(cache.host, host, HOST_MAX - 1);
+            cache.host[HOST_MAX - 1] = '\0';
+            cache.len = len;
+        }
+        // NVS keeps the session over a power loss, it is only rewritten when the session changed,
+        // a resumption without a new ticket hands back the same bytes
+        const uint32_t crc = sessionCrc(host, buf, len);
+        if (crc != storedCrc)
+        {
+            Preferences pref;
+            if (pref.begin("tls", false))
+            {
+                pref.putString("host", host);
+                pref.putBytes("session", buf, len);
+                pref.end();
+                storedCrc = crc;
+            }
+        }
+        free(buf);
+    }
+
+    void forgetSession()
+    {
+        cache.len = 0;
+        storedCrc = 0;
+        Preferences pref;
+        if (pref.begin("tls", false))
+        {
+            pref.clear();
+            pref.end();
+        }
+    }
+
+    const HandshakeStats_t &getLastHandshake()
+    {
+        return last;
+    }
+
+    uint32_t getResumedCount()
+    {
+        return resumed;
+    }
+
+    uint32_t getHandshakeCount()
+    {
+        return handshakes;
+    }
+
+    static int bioSend(void *arg, const unsigned char *buf, size_t len)
+    {
+        Context_t *c = (Context_t *)arg;
+        int ret = send(c->sock, buf, len, 0);
+        if (ret < 0)
+        {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? MBEDTLS_ERR_SSL_WANT_WRITE : MBEDTLS_ERR_NET_SEND_FAILED;
+        }
+        c->bytes_out += ret;
+        return ret;
+    }
+
+    static int bioRecv(void *arg, unsigned char *buf, size_t len)
+    {
+        Context_t *c = (Context_t *)arg;
+        int ret = recv(c->sock, buf, len, 0);
+        if (ret < 0)
+        {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? MBEDTLS_ERR_SSL_WANT_READ : MBEDTLS_ERR_NET_RECV_FAILED;
+        }
+        c->bytes_in += ret;
+        return ret;
+    }
+
+    static void setTimeout(int sock, int timeout_ms)
+    {
+        struct timeval tv;
+        tv.tv_sec = timeout_ms / 1000;
+        tv.tv_usec = (timeout_ms % 1000) * 1000;
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    }
+
+    static int tcpConnect(const char *host, int port, int timeout_ms)
+    {
+        struct addrinfo hints = {};
+        struct addrinfo *res = nullptr;
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        char service[8];
+        snprintf(service, sizeof(service), "%d", port);
+        if (getaddrinfo(host, service, &hints, &res) != 0 || res == nullptr)
+        {
+            ESP_LOGE(TAG, "cannot resolve %s", host);
+            return -1;
+        }
+        int sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+        if (sock >= 0)
+        {
+            // non-blocking connect so the timeout also covers the TCP handshake
+            fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+            int ret = connect(sock, res->ai_addr, res->ai_addrlen);
+            if (ret < 0 && errno == EINPROGRESS)
+            {
+                fd_set wfds;
+                FD_ZERO(&wfds);
+                FD_SET(sock, &wfds);
+                struct timeval tv = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+                int err = 0;
+                socklen_t len = sizeof(err);
+                ret = (select(sock + 1, nullptr, &wfds, nullptr, &tv) > 0 &&
+                       getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0)
+                          ? 0
+                          : -1;
+            }
+            fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) & ~O_NONBLOCK);
+            if (ret < 0)
+            {
+                ESP_LOGE(TAG, "cannot connect to %s:%d", host, port);
+                close(sock);
+                sock = -1;
+            }
+        }
+        freeaddrinfo(res);
+        return sock;
+    }
+
+    static void release(Context_t *c)
+    {
+        if (!c->ready)
+        {
+            return;
+        }
+        mbedtls_ssl_free(&c->ssl);
+        mbedtls_ssl_config_free(&c->conf);
+        mbedtls_x509_crt_free(&c->ca);
+        mbedtls_ctr_drbg_free(&c->drbg);
+        mbedtls_entropy_free(&c->entropy);
+        c->ready = false;
+    }
+
+    static int tlsClose(esp_transport_handle_t t)
+    {
+        Context_t *c = (Context_t *)esp_transport_get_context_data(t);
+        if (c->sock >= 0)
+        {
+            if (c->ready)
+            {
+                mbedtls_ssl_close_notify(&c->ssl);
+            }
+            close(c->sock);
+            c->sock = -1;
+        }
+        release(c);
+        return 0;
+    }
+
+    static bool setup(Context_t *c, const char *host)
+    {
+        mbedtls_ssl_init(&c->ssl);
+        mbedtls_ssl_config_init(&c->conf);
+        mbedtls_x509_crt_init(&c->ca);
+        mbedtls_ctr_drbg_init(&c->drbg);
+        mbedtls_entropy_init(&c->entropy);
+        c->ready = true;
+        if (mbedtls_ctr_drbg_seed(&c->drbg, mbedtls_entropy_func, &c->entropy, nullptr, 0) != 0 ||
+            mbedtls_ssl_config_defaults(&c->conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT) != 0)
+        {
+            return false;
+        }
+        if (c->ca_pem != nullptr)
+        {
+            if (mbedtls_x509_crt_parse(&c->ca, (const unsigned char *)c->ca_pem, c->ca_len) != 0)
+            {
+                ESP_LOGE(TAG, "bad CA certificate");
+                return false;
+            }
+            mbedtls_ssl_conf_ca_chain(&c->conf, &c->ca, nullptr);
+        }
+        else
+        {
+            esp_crt_bundle_attach(&c->conf);
+        }
+        mbedtls_ssl_conf_authmode(&c->conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+        mbedtls_ssl_conf_rng(&c->conf, mbedtls_ctr_drbg_random, &c->drbg);
+        mbedtls_ssl_conf_session_tickets(&c->conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+        if (mbedtls_ssl_setup(&c->ssl, &c->conf) != 0 || mbedtls_ssl_set_hostname(&c->ssl, host) != 0)
+        {
+            return false;
+        }
+        mbedtls_ssl_set_bio(&c->ssl, c, bioSend, bioRecv, nullptr);
+        return true;
+    }
+
+    static int tlsConnect(esp_transport_handle_t t, const char *host, int port, int timeout_ms)
+    {
+        Context_t *c = (Context_t *)esp_transport_get_context_data(t);
+        tlsClose(t);
+        const int64_t start = esp_timer_get_time();
+        c->bytes_in = 0;
+        c->bytes_out = 0;
+        last = {};
+        c->sock = tcpConnect(host, port, timeout_ms);
+        if (c->sock < 0 || !setup(c, host))
+        {
+            tlsClose(t);
+            return -1;
+        }
+        setTimeout(c->sock, timeout_ms);
+
+        mbedtls_ssl_session offered;
+        mbedtls_ssl_session_init(&offered);
+        if (loadSession(host, offered) && mbedtls_ssl_set_session(&c->ssl, &offered) == 0)
+        {
+            last.offered = true;
+        }
+
+        int ret;
+        while ((ret = mbedtls_ssl_handshake(&c->ssl)) != 0)
+        {
+            if ((ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) ||
+                esp_timer_get_time() - start > (int64_t)timeout_ms * 1000)
+            {
+                ESP_LOGE(TAG, "handshake with %s failed, -0x%x", host, -ret);
+                if (last.offered)
+                {
+                    forgetSession(); // do not offer a session the server chokes on again
+                }
+                mbedtls_ssl_session_free(&offered);
+                tlsClose(t);
+                return -1;
+            }
+        }
+
+        mbedtls_ssl_session session;
+        mbedtls_ssl_session_init(&session);
+        if (mbedtls_ssl_get_session(&c->ssl, &session) == 0)
+        {
+            // a resumed session keeps the master secret, a full handshake derives a new one; the
+            // session id is no indication, ticket resumption offers a fresh random one
+            last.resumed = last.offered &&
+                           memcmp(session.MBEDTLS_PRIVATE(master), offered.MBEDTLS_PRIVATE(master), sizeof(session.MBEDTLS_PRIVATE(master))) == 0;
+            saveSession(host, session);
+        }
+        mbedtls_ssl_session_free(&session);
+        mbedtls_ssl_session_free(&offered);
+
+        last.handshake_ms = (uint32_t)((esp_timer_get_time() - start) / 1000);
+        last.bytes_in = c->bytes_in;
+        last.bytes_out = c->bytes_out;
+        handshakes++;
+        resumed += last.resumed;
+        ESP_LOGI(TAG, "%s handshake with %s in %lu ms, %lu bytes out, %lu bytes in (%lu/%lu resumed)",
+                 last.resumed ? "resumed" : "full", host, (unsigned long)last.handshake_ms, (unsigned long)last.bytes_out,
+                 (unsigned long)last.bytes_in, (unsigned long)resumed, (unsigned long)handshakes);
+        return 0;
+    }
+
+    static int tlsPoll(Context_t *c, int timeout_ms, bool write)
+    {
+        if (c->sock < 0)
+        {
+            return -1;
+        }
+        if (!write && mbedtls_ssl_get_bytes_avail(&c->ssl) > 0)
+        {
+            return 1;
+        }
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(c->sock, &fds);
+        struct timeval tv = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+        return select(c->sock + 1, write ? nullptr : &fds, write ? &fds : nullptr, nullptr, &tv);
+    }
+
+    static int tlsPollRead(esp_transport_handle_t t, int timeout_ms)
+    {
+        return tlsPoll((Context_t *)esp_transport_get_context_data(t), timeout_ms, false);
+    }
+
+    static int tlsPollWrite(esp_transport_handle_t t, int timeout_ms)
+    {
+        return tlsPoll((Context_t *)esp_transport_get_context_data(t), timeout_ms, true);
+    }
+
+    static int tlsRead(esp_transport_handle_t t, char *buffer, int len, int timeout_ms)
+    {
+        Context_t *c = (Context_t *)esp_transport_get_context_data(t);
+        const int poll = tlsPoll(c, timeout_ms, false);
+        if (poll <= 0)
+        {
+            return poll == 0 ? ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT : ERR_TCP_TRANSPORT_CONNECTION_FAILED;
+        }
+        int ret = mbedtls_ssl_read(&c->ssl, (unsigned char *)buffer, len);
+        if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE)
+        {
+            return ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT;
+        }
+        if (ret == 0 || ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY)
+        {
+            return ERR_TCP_TRANSPORT_CONNECTION_CLOSED_BY_FIN;
+        }
+        return ret < 0 ? ERR_TCP_TRANSPORT_CONNECTION_FAILED : ret;
+    }
+
+    static int tlsWrite(esp_transport_handle_t t, const char *buffer, int len, int timeout_ms)
+    {
+        Context_t *c = (Context_t *)esp_transport_get_context_data(t);
+        const int poll = tlsPoll(c, timeout_ms, true);
+        if (poll <= 0)
+        {
+            return poll == 0 ? ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT : ERR_TCP_TRANSPORT_CONNECTION_FAILED;
+        }
+        int ret = mbedtls_ssl_write(&c->ssl, (const unsigned char *)buffer, len);
+        if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE)
+        {
+            return 0;
+        }
+        return ret < 0 ? ERR_TCP_TRANSPORT_CONNECTION_FAILED : ret;
+    }
+
+    static int tlsDestroy(esp_transport_handle_t t)
+    {
+        tlsClose(t);
+        free(esp_transport_get_context_data(t));
+        return 0;
+    }
+
+    esp_transport_handle_t createTransport(const char *ca_pem, size_t ca_len)
+    {
+        esp_transport_handle_t t = esp_transport_init();
+        Context_t *c = (Context_t *)calloc(1, sizeof(Context_t));
+        if (t == nullptr || c == nullptr)
+        {
+            free(c);
+            if (t)
+                esp_transport_destroy(t);
+            return nullptr;
+        }
+        c->sock = -1;
+        c->ca_pem = ca_pem;
+        c->ca_len = ca_len;
+        esp_transport_set_context_data(t, c);
+        esp_transport_set_func(t, tlsConnect, tlsRead, tlsWrite, tlsClose, tlsPollRead, tlsPollWrite, tlsDestroy);
+        esp_transport_set_default_port(t, 8883);
+        return t;
+    }
+}
@@ -0,0 +1,47 @@
+/**
+ * @file tlsSession.hpp
+ * @author rami zayat
+ * @brief TLS transport for esp-mqtt that resumes the previous session across deep sleep
+ * @version 0.1
+ * @date 2025-12-08
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_transport.h"
+
+namespace tls
+{
+    static const size_t SESSION_RTC_MAX = 1024; // larger sessions (peer certificate kept) only go to NVS
+
+    typedef struct
+    {
+        uint32_t handshake_ms;
+        uint32_t bytes_out; // handshake bytes sent
+        uint32_t bytes_in;  // handshake bytes received
+        bool offered;       // a cached session was offered
+        bool resumed;       // the server accepted it (abbreviated handshake)
+    } HandshakeStats_t;
+
+    /**
+     * @brief create an esp-mqtt transport doing TLS 1.2 over a plain socket
+     *
+     * The session (ticket or session id) of each handshake is serialized to RTC memory
+     * and NVS and offered on the next connect to the same host, so a wake that only
+     * uploads a few messages skips the certificate exchange.
+     * The transport is owned and destroyed by the esp-mqtt client.
+     * @param ca_pem NUL terminated PEM CA, nullptr to use the certificate bundle
+     * @param ca_len length including the NUL
+     */
+    esp_transport_handle_t createTransport(const char *ca_pem, size_t ca_len);
+
+    const HandshakeStats_t &getLastHandshake();
+    // resumed / total handshakes since power on
+    uint32_t getResumedCount();
+    uint32_t getHandshakeCount();
+    // drop the cached session, e.g. after a broker certificate change
+    void forgetSession();
+}
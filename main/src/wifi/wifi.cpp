@@ -5,8 +5,11 @@
 #include "rtc/rtc.hpp"
 #include "Preferences.h"
 #include "power/power.hpp"
+#include "power/pm.hpp"
 #include "sdcard/sdcard.h"
 #include "WiFi.h"
+#include "publisher/publisher.hpp"
+#include "spool/spool.hpp"
 
 bool timeIsSynced = false;
 bool wifiOn = false;
@@ -25,6 +28,9 @@ String mqtt_pass = ("Rr0033141500!");
 String mqtt_log_topic = ("mqtt_topic");
 String mqtt_cmd_topic = ("mqtt_cmd_topic");
 MqttLogger mqttLogger(mqttclient, mqtt_log_topic.c_str(), MqttLoggerMode::MqttAndSerial);
+// held by the WiFi task, web and OTA clients are answered without the light sleep latency
+static pm::Lock wifiLock("wifi", ESP_PM_NO_LIGHT_SLEEP);
+static pm::Lock otaLock("ota", ESP_PM_CPU_FREQ_MAX);
 
 void setUpWifiOTA(void *arg);
 
@@ -34,13 +40,17 @@ bool setupWifiSTA();
 
 void setUpWifiAP();
 
+SemaphoreHandle_t mqttClientLock()
+{
+  static SemaphoreHandle_t mutex = xSemaphoreCreateRecursiveMutex();
+  return mutex;
+}
+
 bool GetWifiOn()
 {
   return wifiOn;
 }
 
-void MqttReceiveCallback(char *topic, byte *payload, unsigned int length);
-
 void StartWifi()
 {
   if (wifiOn == false)
@@ -64,7 +74,6 @@ void StopWifi()
   delay(50);
   // vTaskDelete(WifiTaskHandle);
   WifiTaskHandle = NULL;
-  setCpuFrequencyMhz(80);
 }
 
 bool syncntpTime()
@@ -125,33 +134,44 @@ void loopWifiStation(void *arg)
       continue;
     }
     mqttReconnectCounter = 0;
-    while (!mqttclient.connected() && mqttReconnectCounter++ < 3)
     {
-      Serial.println("Attempting MQTT connection...");
-      // Attempt to connect
-      if (mqttclient.connect("ESP32Tsim7080Logger", mqtt_user.c_str(), mqtt_pass.c_str()))
+      // the receive callback runs inside loop() with the lock held, it is recursive
+      MqttClientGuard guard;
+      while (!mqttclient.connected() && mqttReconnectCounter++ < 3)
       {
-        // as we have a connection here, this will be the first message published to the mqtt server
-        mqttLogger.println("connected");
-        mqttclient.subscribe(mqtt_cmd_topic.c_str(), 1);
-      }
-      else
-      {
-        mqttLogger.printf("failed, rc=%d \n", mqttclient.state());
-        // Wait before retrying
-        delay(500);
+        Serial.println("Attempting MQTT connection...");
+        // Attempt to connect
+        if (mqttclient.connect("ESP32Tsim7080Logger", mqtt_user.c_str(), mqtt_pass.c_str()))
+        {
+          // as we have a connection here, this will be the first message published to the mqtt server
+          mqttLogger.println("connected");
+          mqttclient.subscribe(mqtt_cmd_topic.c_str(), 1);
+          mqttclient.subscribe((mqtt_cmd_topic + "/+").c_str(), 1);
+        }
+        else
+        {
+          mqttLogger.printf("failed, rc=%d \n", mqttclient.state());
+          // Wait before retrying
+          delay(500);
+        }
       }
+      mqttclient.loop();
     }
-    mqttclient.loop();
+    publisher::drain(); // replay what was queued while offline, a few messages per pass
+    spool::drain();     // then logs spooled while offline, rate limited
     ArduinoOTA.handle();
     fs::GetmyWebServer().run();
   }
-  mqttclient.disconnect();
+  {
+    MqttClientGuard guard;
+    mqttclient.disconnect();
+  }
   ArduinoOTA.end();
   fs::GetmyWebServer().stop();
   sdcard::shutdownSdcard();
   Serial.println("loopWifiStation thread exit");
   WifiTaskHandle = NULL;
+  wifiLock.release();
   vTaskDelete(NULL);
 }
 
@@ -167,6 +187,7 @@ void loopWifiAP(void *arg)
   fs::GetmyWebServer().stop();
   Serial.println("loopWifiAP thread exit");
   WifiTaskHandle = NULL;
+  wifiLock.release();
   vTaskDelete(NULL);
 }
 
@@ -187,6 +208,7 @@ void setUpWifiOTA(void *arg)
   mqtt_cmd_topic = pref.getString("mqtt_cmd_topic", mqtt_cmd_topic);
   pref.end();
   wifiOn = true;
+  wifiLock.acquire(); // released by the task when wifiOn goes false
   if (setupWifiSTA())
   {
     mqttLogger.println("WiFi STA setup complete ");
@@ -210,6 +232,7 @@ void SetupArduinoOTA()
   ArduinoOTA
       .onStart([]()
                {
+      otaLock.acquire();
       String type;
       if (ArduinoOTA.getCommand() == U_FLASH) {
         type = "firmware.......";
@@ -220,7 +243,9 @@ void SetupArduinoOTA()
       // NOTE: if updating SPIFFS this would be the place to unmount SPIFFS using SPIFFS.end()
       Serial.println("Start updating " + type); })
       .onEnd([]()
-             { Serial.println("\nEnd"); })
+             {
+      otaLock.release();
+      Serial.println("\nEnd"); })
       .onProgress([](unsigned int progress, unsigned int total)
                   {
       if (millis() - last_ota_time > 1000) {
@@ -229,6 +254,7 @@ void SetupArduinoOTA()
       } })
       .onError([](ota_error_t error)
                {
+      otaLock.release();
       Serial.printf("Error[%u]: ", error);
       if (error == OTA_AUTH_ERROR) {
         Serial.println("Auth Failed");
@@ -266,6 +292,8 @@ bool setupWifiSTA()
   ArduinoOTA.begin();
   fs::fs_server_setup();
 
+  MqttClientGuard guard;
+  mqttLogger.setClientLock(mqttClientLock());
   mqttclient.setCallback(MqttReceiveCallback);
   // Serial.printf("mqtt user : %s \n", mqtt_user.c_str());
   // Serial.printf("mqtt pass : %s \n", mqtt_pass.c_str());
@@ -274,6 +302,7 @@ bool setupWifiSTA()
   mqttclient.setServer(mqtt_server.c_str(), mqtt_port);
   mqttclient.connect("ESP32Tsim7080", mqtt_user.c_str(), mqtt_pass.c_str());
   mqttclient.subscribe(mqtt_cmd_topic.c_str(), 1);
+  mqttclient.subscribe((mqtt_cmd_topic + "/+").c_str(), 1);
   return true;
 }
 
@@ -4,6 +4,24 @@
 extern MqttLogger mqttLogger;
 extern PubSubClient mqttclient;
 
+// PubSubClient is not thread safe: the WiFi task, the logger task and the publisher hold
+// this recursive mutex around every use of mqttclient. Take it before the publisher lock.
+SemaphoreHandle_t mqttClientLock();
+
+class MqttClientGuard
+{
+public:
+  MqttClientGuard() { xSemaphoreTakeRecursive(mqttClientLock(), portMAX_DELAY); }
+  ~MqttClientGuard() { xSemaphoreGiveRecursive(mqttClientLock()); }
+  MqttClientGuard(const MqttClientGuard &) = delete;
+  MqttClientGuard &operator=(const MqttClientGuard &) = delete;
+};
+
+extern String mqtt_cmd_topic;
+
+// hands a command message to commands::dispatch(), the callback of PubSubClient and MqttClient
+void MqttReceiveCallback(char *topic, byte *payload, unsigned int length);
+
 void StartWifi();
 bool GetWifiOn();
 void StopWifi();
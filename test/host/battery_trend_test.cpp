@@ -0,0 +1,178 @@
+/**
+ * @file battery_trend_test.cpp
+ * @author rami zayat
+ * @brief hourly buckets and resting drain slope of the car battery trend on synthetic curves
+ * @version 0.1
+ * @date 2025-12-12
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include "check.hpp"
+#include "carBattery/batteryTrend.hpp"
+
+using batteryTrend::BatteryTrend_t;
+using batteryTrend::Bucket_t;
+
+static const uint32_t T0 = 1760000400 / 3600 * 3600; // start of an hour
+static const uint32_t SAMPLE_S = 600;                // the firmware adds a reading every 10 minutes
+
+// resting voltage falling `mv_per_hour` from `start_mv`, sampled every SAMPLE_S for `hours`
+static void drain(BatteryTrend_t &t, uint32_t from, uint32_t hours, float start_mv, float mv_per_hour)
+{
+    for (uint32_t s = 0; s < hours * 3600; s += SAMPLE_S)
+        batteryTrend::add(t, from + s, (uint16_t)(start_mv + mv_per_hour * s / 3600.0f + 0.5f), false);
+}
+
+static void empty()
+{
+    BatteryTrend_t t;
+    batteryTrend::reset(t);
+    CHECK(batteryTrend::valid(t));
+    CHECK(batteryTrend::get(t, 0) == nullptr);
+    float rate = 0, mv = 0;
+    CHECK(!batteryTrend::slope(t, rate, mv));
+    CHECK(batteryTrend::hoursTo(t, 11800) == -1.0f);
+}
+
+static void addAndGet()
+{
+    BatteryTrend_t t;
+    batteryTrend::reset(t);
+    CHECK(batteryTrend::add(t, T0 + 60, 12500, false)); // opens the hour
+    CHECK(!batteryTrend::add(t, T0 + 1200, 12300, false));
+    CHECK(!batteryTrend::add(t, T0 + 3599, 12600, false));
+    CHECK(batteryTrend::add(t, T0 + 3600, 12400, false)); // next hour
+    CHECK(t.last_hour == T0 / 3600 + 1);
+
+    const Bucket_t *b = batteryTrend::get(t, 1);
+    CHECK(b != nullptr);
+    if (b != nullptr)
+    {
+        CHECK(b->hour == T0 / 3600);
+        CHECK(b->min_mv == 12300);
+        CHECK(b->max_mv == 12600);
+        CHECK(b->count == 3);
+        CHECK(batteryTrend::mean(*b) == 12467); // 37400 / 3 rounded
+        CHECK(!(b->flags & batteryTrend::CHARGED));
+    }
+    b = batteryTrend::get(t, 0);
+    CHECK(b != nullptr && b->count == 1 && batteryTrend::mean(*b) == 12400);
+    CHECK(batteryTrend::get(t, 2) == nullptr);
+    CHECK(batteryTrend::get(t, batteryTrend::BUCKETS) == nullptr);
+
+    // a late sample of an older hour goes to its own bucket and does not move the newest hour
+    CHECK(!batteryTrend::add(t, T0 + 1800, 12200, false));
+    CHECK(t.last_hour == T0 / 3600 + 1);
+    b = batteryTrend::get(t, 1);
+    CHECK(b != nullptr && b->min_mv == 12200 && b->count == 4);
+}
+
+static void linearDrain()
+{
+    BatteryTrend_t t;
+    batteryTrend::reset(t);
+    drain(t, T0, 30, 12600.0f, -5.0f);
+    float rate = 0, mv = 0;
+    CHECK(batteryTrend::slope(t, rate, mv));
+    CHECK_NEAR(rate, -5.0, 0.1);
+    // bucket means sit at the middle of their hour, 29 hours and 25 minutes in for the newest one
+    CHECK_NEAR(mv, 12600.0 - 5.0 * (29 + 25.0 / 60.0), 1.0);
+    CHECK_NEAR(batteryTrend::hoursTo(t, 11800), (mv - 11800.0) / 5.0, 0.5);
+
+    // a slow day, then a fast one: only the fit window counts
+    BatteryTrend_t fast;
+    batteryTrend::reset(fast);
+    drain(fast, T0, 24, 12800.0f, -2.0f);
+    drain(fast, T0 + 24 * 3600, 24, 12800.0f - 2.0f * 24, -20.0f);
+    CHECK(batteryTrend::slope(fast, rate, mv));
+    CHECK_NEAR(rate, -20.0, 0.1);
+    CHECK_NEAR(batteryTrend::hoursTo(fast, 11800), (mv - 11800.0) / 20.0, 0.5);
+}
+
+static void notFalling()
+{
+    BatteryTrend_t t;
+    batteryTrend::reset(t);
+    drain(t, T0, 12, 12400.0f, 2.0f); // trickle charger
+    float rate = 0, mv = 0;
+    CHECK(batteryTrend::slope(t, rate, mv));
+    CHECK(rate > 0.0f);
+    CHECK(batteryTrend::hoursTo(t, 11800) == -1.0f);
+
+    batteryTrend::reset(t);
+    drain(t, T0, 12, 11700.0f, -3.0f); // already below
+    CHECK(batteryTrend::hoursTo(t, 11800) == 0.0f);
+}
+
+static void chargedBucketsSkipped()
+{
+    BatteryTrend_t t;
+    batteryTrend::reset(t);
+    drain(t, T0, 10, 12600.0f, -5.0f);
+    // a drive: alternator voltage for two hours, then resting again where the drain left off
+    for (uint32_t s = 0; s < 2 * 3600; s += SAMPLE_S)
+        batteryTrend::add(t, T0 + 10 * 3600 + s, 14200, true);
+    drain(t, T0 + 12 * 3600, 10, 12600.0f - 5.0f * 12, -5.0f);
+
+    const Bucket_t *b = batteryTrend::get(t, 10);
+    CHECK(b != nullptr && (b->flags & batteryTrend::CHARGED));
+    float rate = 0, mv = 0;
+    CHECK(batteryTrend::slope(t, rate, mv));
+    CHECK_NEAR(rate, -5.0, 0.1);
+
+    // one engine sample marks the whole hour, its resting samples are dropped with it
+    batteryTrend::add(t, T0 + 21 * 3600 + 3000, 13900, true);
+    b = batteryTrend::get(t, 0);
+    CHECK(b != nullptr && (b->flags & batteryTrend::CHARGED));
+    CHECK(batteryTrend::slope(t, rate, mv));
+    CHECK_NEAR(rate, -5.0, 0.1);
+
+    // a car driven every hour leaves no resting bucket
+    BatteryTrend_t driven;
+    batteryTrend::reset(driven);
+    for (uint32_t s = 0; s < 24 * 3600; s += SAMPLE_S)
+        batteryTrend::add(driven, T0 + s, 12500, s % 3600 == 0);
+    CHECK(!batteryTrend::slope(driven, rate, mv));
+    CHECK(batteryTrend::hoursTo(driven, 11800) == -1.0f);
+}
+
+static void staleSlots()
+{
+    BatteryTrend_t t;
+    batteryTrend::reset(t);
+    drain(t, T0, 24, 12600.0f, -5.0f);
+    // parked without a wake for longer than the ring, the slots now hold hours of the past cycle
+    const uint32_t later = T0 + (24 + batteryTrend::BUCKETS + 5) * 3600;
+    CHECK(batteryTrend::add(t, later, 12300, false));
+    CHECK(batteryTrend::get(t, 0) != nullptr);
+    for (uint8_t ago = 1; ago < batteryTrend::BUCKETS; ago++)
+        CHECK(batteryTrend::get(t, ago) == nullptr);
+    float rate = 0, mv = 0;
+    CHECK(!batteryTrend::slope(t, rate, mv)); // one point
+
+    // a gap inside the window: missing hours are skipped, not read as stale buckets
+    drain(t, later + 3 * 3600, 3, 12290.0f, -5.0f);
+    CHECK(batteryTrend::get(t, 3) == nullptr);
+    CHECK(batteryTrend::slope(t, rate, mv));
+    CHECK(rate < 0.0f);
+
+    // fewer than SLOPE_MIN_POINTS resting hours give no slope
+    BatteryTrend_t few;
+    batteryTrend::reset(few);
+    drain(few, T0, batteryTrend::SLOPE_MIN_POINTS - 1, 12600.0f, -5.0f);
+    CHECK(!batteryTrend::slope(few, rate, mv));
+    drain(few, T0 + (batteryTrend::SLOPE_MIN_POINTS - 1) * 3600, 1, 12600.0f - 5.0f * 3, -5.0f);
+    CHECK(batteryTrend::slope(few, rate, mv));
+}
+
+int main()
+{
+    empty();
+    addAndGet();
+    linearDrain();
+    notFalling();
+    chargedBucketsSkipped();
+    staleSlots();
+    return check_result("battery_trend_test");
+}
@@ -0,0 +1,42 @@
+/**
+ * @file check.hpp
+ * @author rami zayat
+ * @brief minimal assertions for the host tests, no test framework needed
+ * @version 0.1
+ * @date 2025-12-12
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#pragma once
+#include <stdio.h>
+
+static int check_failures = 0;
+
+#define CHECK(cond)                                                            \
+    do                                                                         \
+    {                                                                          \
+        if (!(cond))                                                           \
+        {                                                                      \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond);    \
+            check_failures++;                                                  \
+        }                                                                      \
+    } while (0)
+
+#define CHECK_NEAR(a, b, tol)                                                  \
+    do                                                                         \
+    {                                                                          \
+        const double check_a = (a), check_b = (b);                             \
+        if (!(check_a - check_b <= (tol) && check_b - check_a <= (tol)))       \
+        {                                                                      \
+            printf("%s:%d: CHECK_NEAR(%s, %s) failed, %g vs %g\n", __FILE__,   \
+                   __LINE__, #a, #b, check_a, check_b);                        \
+            check_failures++;                                                  \
+        }                                                                      \
+    } while (0)
+
+static inline int check_result(const char *name)
+{
+    printf("%s: %s, %d failures\n", name, check_failures ? "FAILED" : "passed", check_failures);
+    return check_failures ? 1 : 0;
+}
@@ -0,0 +1,115 @@
+/**
+ * @file mqtt_rx_parse_test.cpp
+ * @author rami zayat
+ * @brief reassembly of +CMQTTRX* messages of the SIM7670 component, in any split of the stream
+ * @version 0.1
+ * @date 2025-12-12
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include "check.hpp"
+#include "SIM7670_mqtt_rx.hpp"
+#include <string>
+#include <vector>
+#include <utility>
+
+typedef std::pair<std::string, std::string> Message_t;
+
+static const std::string ONE =
+    "\r\n+CMQTTRXSTART: 0,13,16\r\n"
+    "+CMQTTRXTOPIC: 0,13\r\n"
+    "car/cmd/modem\r\n"
+    "+CMQTTRXPAYLOAD: 0,16\r\n"
+    "{\"verb\":\"get\"}\r\n\r\n"
+    "+CMQTTRXEND: 0\r\n";
+
+static void feed(mqtt_rx_parser &p, const std::string &s)
+{
+    p.feed(reinterpret_cast<const uint8_t *>(s.data()), s.size());
+}
+
+static void single()
+{
+    std::vector<Message_t> got;
+    mqtt_rx_parser p([&](std::string_view t, std::string_view d)
+                     { got.emplace_back(t, d); });
+    feed(p, ONE);
+    CHECK(got.size() == 1);
+    CHECK(p.delivered() == 1 && p.dropped() == 0);
+    if (got.size() == 1)
+    {
+        CHECK(got[0].first == "car/cmd/modem");
+        CHECK(got[0].second == "{\"verb\":\"get\"}\r\n"); // raw bytes, line breaks included
+    }
+}
+
+static void everySplit()
+{
+    // the UART hands the stream over in arbitrary chunks
+    for (size_t cut = 1; cut < ONE.size(); cut++)
+    {
+        std::vector<Message_t> got;
+        mqtt_rx_parser p([&](std::string_view t, std::string_view d)
+                         { got.emplace_back(t, d); });
+        feed(p, ONE.substr(0, cut));
+        feed(p, ONE.substr(cut));
+        CHECK(got.size() == 1 && got[0].first == "car/cmd/modem");
+    }
+}
+
+static void chunkedPayload()
+{
+    std::vector<Message_t> got;
+    mqtt_rx_parser p([&](std::string_view t, std::string_view d)
+                     { got.emplace_back(t, d); });
+    feed(p, "+CMQTTRXSTART: 0,5,10\r\n+CMQTTRXTOPIC: 0,5\r\na/b/c\r\n"
+            "+CMQTTRXPAYLOAD: 0,4\r\n0123\r\n+CMQTTRXPAYLOAD: 0,6\r\n456789\r\n+CMQTTRXEND: 0\r\n");
+    CHECK(got.size() == 1 && got[0].second == "0123456789");
+}
+
+static void noiseAndDrops()
+{
+    std::vector<Message_t> got;
+    mqtt_rx_parser p([&](std::string_view t, std::string_view d)
+                     { got.emplace_back(t, d); },
+                     8);
+    // other URCs and command responses around the message are ignored
+    feed(p, "OK\r\n+CREG: 1\r\n+CMQTTRXPAYLOAD: 0,2\r\nxx\r\n" + ONE.substr(2) + "+CMQTTCONNLOST: 0,1\r\n");
+    CHECK(got.empty()); // the payload is longer than 8
+    CHECK(p.dropped() == 1);
+
+    // a message cut short by a new start is dropped, the new one is kept
+    feed(p, "+CMQTTRXSTART: 0,3,1\r\n+CMQTTRXTOPIC: 0,3\r\nx/y\r\n"
+            "+CMQTTRXSTART: 0,3,1\r\n+CMQTTRXTOPIC: 0,3\r\na/b\r\n+CMQTTRXPAYLOAD: 0,1\r\n1\r\n+CMQTTRXEND: 0\r\n");
+    CHECK(got.size() == 1 && got[0].first == "a/b" && got[0].second == "1");
+    CHECK(p.dropped() == 2);
+}
+
+static void growingBuffer()
+{
+    // the esp_modem URC handler sees the whole buffer received so far on each read
+    std::vector<Message_t> got;
+    mqtt_rx_parser p([&](std::string_view t, std::string_view d)
+                     { got.emplace_back(t, d); });
+    const std::string buf = "+CSQ: 20,99\r\n" + ONE + ONE;
+    for (size_t len = 7; len < buf.size(); len += 7)
+        p.feed_buffer(reinterpret_cast<const uint8_t *>(buf.data()), len);
+    p.feed_buffer(reinterpret_cast<const uint8_t *>(buf.data()), buf.size());
+    p.feed_buffer(reinterpret_cast<const uint8_t *>(buf.data()), buf.size()); // repeated, nothing new
+    CHECK(got.size() == 2);
+
+    // after a command the buffer starts over
+    p.feed_buffer(reinterpret_cast<const uint8_t *>(ONE.data()), ONE.size());
+    CHECK(got.size() == 3);
+}
+
+int main()
+{
+    single();
+    everySplit();
+    chunkedPayload();
+    noiseAndDrops();
+    growingBuffer();
+    return check_result("mqtt_rx_parse_test");
+}
@@ -0,0 +1,152 @@
+/**
+ * @file sms_parse_test.cpp
+ * @author rami zayat
+ * @brief edge cases of the in-place AT+CMGL parser of the SIM7670 component
+ * @version 0.1
+ * @date 2025-12-12
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include "check.hpp"
+#include "SIM7670_sms.hpp"
+#include <string>
+#include <vector>
+
+typedef struct
+{
+    int index;
+    std::string status;
+    std::string sender;
+    std::string timestamp;
+    std::string content;
+} Sms_t;
+
+static std::vector<Sms_t> parse(const std::string &response, size_t stop_after = 0)
+{
+    std::vector<Sms_t> out;
+    const size_t count = parse_sms_list(response, [&](const sms_view_t &v)
+                                        {
+                                            out.push_back({v.index, std::string(v.status), std::string(v.sender),
+                                                           std::string(v.timestamp), std::string(v.content)});
+                                            return stop_after == 0 || out.size() < stop_after; });
+    CHECK(count == out.size());
+    return out;
+}
+
+static void emptyListing()
+{
+    CHECK(parse("").empty());
+    CHECK(parse("\r\nOK\r\n").empty());
+    CHECK(parse("OK").empty());
+}
+
+static void singleMessage()
+{
+    const auto m = parse("\r\n+CMGL: 3,\"REC UNREAD\",\"+4917012345\",\"\",\"25/12/05,10:00:00+08\"\r\nhello\r\n\r\nOK\r\n");
+    CHECK(m.size() == 1);
+    if (m.size() != 1)
+        return;
+    CHECK(m[0].index == 3);
+    CHECK(m[0].status == "REC UNREAD");
+    CHECK(m[0].sender == "+4917012345");
+    CHECK(m[0].timestamp == "25/12/05,10:00:00+08"); // comma inside quotes
+    CHECK(m[0].content == "hello");
+}
+
+static void atStartOfBuffer()
+{
+    const auto m = parse("+CMGL: 1,\"REC READ\",\"123\",,\"25/12/05,10:00:00+08\"\nbody\nOK");
+    CHECK(m.size() == 1);
+    if (m.size() == 1)
+    {
+        CHECK(m[0].index == 1);
+        CHECK(m[0].timestamp == "25/12/05,10:00:00+08"); // empty unquoted alpha
+        CHECK(m[0].content == "body");
+    }
+}
+
+static void multiLineBodies()
+{
+    const auto m = parse("\r\n+CMGL: 1,\"REC READ\",\"111\",\"\",\"25/12/05,10:00:00+08\"\r\nline one\r\nline two\r\n"
+                         "+CMGL: 2,\"REC READ\",\"222\",\"\",\"25/12/05,11:00:00+08\"\r\nOK then\r\nsee you\r\n\r\nOK\r\n");
+    CHECK(m.size() == 2);
+    if (m.size() != 2)
+        return;
+    CHECK(m[0].content == "line one\r\nline two");
+    CHECK(m[1].index == 2);
+    CHECK(m[1].sender == "222");
+    CHECK(m[1].content == "OK then\r\nsee you"); // only the final line is the result code
+}
+
+static void bodyLooksLikeAResultCode()
+{
+    const auto m = parse("\r\n+CMGL: 4,\"REC READ\",\"444\",\"\",\"25/12/05,10:00:00+08\"\r\nOK\r\n\r\nOK\r\n");
+    CHECK(m.size() == 1);
+    if (m.size() == 1)
+        CHECK(m[0].content == "OK");
+}
+
+static void emptyBody()
+{
+    const auto m = parse("\r\n+CMGL: 5,\"REC READ\",\"555\",\"\",\"25/12/05,10:00:00+08\"\r\n\r\n"
+                         "+CMGL: 6,\"REC READ\",\"666\",\"\",\"25/12/05,10:00:00+08\"\r\nsix\r\n\r\nOK\r\n");
+    CHECK(m.size() == 2);
+    if (m.size() == 2)
+    {
+        CHECK(m[0].content.empty());
+        CHECK(m[1].content == "six");
+    }
+}
+
+static void headerTagInsideBody()
+{
+    // only "+CMGL: " at the start of a line opens a message
+    const auto m = parse("\r\n+CMGL: 7,\"REC READ\",\"777\",\"\",\"25/12/05,10:00:00+08\"\r\nsend +CMGL: 9 to me\r\n\r\nOK\r\n");
+    CHECK(m.size() == 1);
+    if (m.size() == 1)
+        CHECK(m[0].content == "send +CMGL: 9 to me");
+}
+
+static void badIndexSkipped()
+{
+    const auto m = parse("\r\n+CMGL: x,\"REC READ\",\"1\",\"\",\"t\"\r\nskip\r\n"
+                         "+CMGL: 8,\"REC READ\",\"888\",\"\",\"t\"\r\nkeep\r\n\r\nOK\r\n");
+    CHECK(m.size() == 1);
+    if (m.size() == 1)
+    {
+        CHECK(m[0].index == 8);
+        CHECK(m[0].content == "keep");
+    }
+}
+
+static void truncatedHeader()
+{
+    // a header without its line end is incomplete, nothing is reported
+    CHECK(parse("\r\n+CMGL: 9,\"REC READ\",\"999\"").empty());
+}
+
+static void callbackStops()
+{
+    const auto m = parse("\r\n+CMGL: 1,\"REC READ\",\"1\",\"\",\"t\"\r\na\r\n+CMGL: 2,\"REC READ\",\"2\",\"\",\"t\"\r\nb\r\n"
+                         "+CMGL: 3,\"REC READ\",\"3\",\"\",\"t\"\r\nc\r\n\r\nOK\r\n",
+                         2);
+    CHECK(m.size() == 2);
+    if (m.size() == 2)
+        CHECK(m[1].content == "b");
+}
+
+int main()
+{
+    emptyListing();
+    singleMessage();
+    atStartOfBuffer();
+    multiLineBodies();
+    bodyLooksLikeAResultCode();
+    emptyBody();
+    headerTagInsideBody();
+    badIndexSkipped();
+    truncatedHeader();
+    callbackStops();
+    return check_result("sms_parse_test");
+}
@@ -0,0 +1,243 @@
+/**
+ * @file telemetry_record_test.cpp
+ * @author rami zayat
+ * @brief round trips of the binary telemetry records, and their encode cost against the text formats
+ * @version 0.1
+ * @date 2025-12-12
+ *
+ * @copyright Copyright (c) 2025
+ *
+ * The timings are host numbers, they only compare the formats with each other.
+ */
+#include "check.hpp"
+#include "telemetry/telemetryRecord.hpp"
+#include "sim76xx_gps.h"
+#include <chrono>
+#include <string.h>
+
+using namespace telemetry;
+
+static const uint32_t T = 1765500000;
+
+// decode `size` bytes that hold exactly one record
+static bool decodeOne(const uint8_t *buf, size_t size, Record_t &rec)
+{
+    memset(&rec, 0, sizeof(rec));
+    return size > 0 && decode(buf, size, rec) == size && rec.version == VERSION;
+}
+
+static void roundTrip()
+{
+    uint8_t buf[MAX_RECORD_SIZE];
+    Record_t rec;
+
+    const GnssFix_t fix = {T, 481234567, -115432100, -12, 1234, 35999, 9, 11, 1 | (3 << 4)};
+    size_t n = encode(fix, buf, sizeof(buf));
+    CHECK(n == HEADER_SIZE + GNSS_FIX_BODY);
+    CHECK(decodeOne(buf, n, rec) && rec.type == Type::GNSS_FIX);
+    CHECK(rec.fix.time == T && rec.fix.lat == fix.lat && rec.fix.lon == fix.lon && rec.fix.alt == fix.alt);
+    CHECK(rec.fix.speed == fix.speed && rec.fix.course == fix.course && rec.fix.hdop == fix.hdop);
+    CHECK(rec.fix.sats == fix.sats && rec.fix.fix == fix.fix);
+
+    const Battery_t bat = {T + 1, 8734, 3987, -125, 12480, BAT_LOW | BAT_VBUS};
+    n = encode(bat, buf, sizeof(buf));
+    CHECK(n == HEADER_SIZE + BATTERY_BODY);
+    CHECK(decodeOne(buf, n, rec) && rec.type == Type::BATTERY);
+    CHECK(rec.battery.time == T + 1 && rec.battery.percent == 8734 && rec.battery.cell_mv == 3987);
+    CHECK(rec.battery.rate == -125 && rec.battery.car_mv == 12480 && rec.battery.flags == (BAT_LOW | BAT_VBUS));
+
+    const Motion_t motion = {T + 2, 0xDEADBEEF, 65535, MOTION_ONGOING};
+    n = encode(motion, buf, sizeof(buf));
+    CHECK(n == HEADER_SIZE + MOTION_BODY);
+    CHECK(decodeOne(buf, n, rec) && rec.type == Type::MOTION);
+    CHECK(rec.motion.time == T + 2 && rec.motion.counter == 0xDEADBEEF && rec.motion.duration_s == 65535);
+    CHECK(rec.motion.flags == MOTION_ONGOING);
+
+    const Wake_t wake = {T + 3, 4, 0x12, 4321, 87};
+    n = encode(wake, buf, sizeof(buf));
+    CHECK(n == HEADER_SIZE + WAKE_BODY);
+    CHECK(decodeOne(buf, n, rec) && rec.type == Type::WAKE);
+    CHECK(rec.wake.time == T + 3 && rec.wake.reason == 4 && rec.wake.detail == 0x12);
+    CHECK(rec.wake.awake_ms == 4321 && rec.wake.percent == 87);
+
+    const Ignition_t ign = {T + 4, IGNITION_ON, 86400 * 3};
+    n = encode(ign, buf, sizeof(buf));
+    CHECK(n == HEADER_SIZE + IGNITION_BODY);
+    CHECK(decodeOne(buf, n, rec) && rec.type == Type::IGNITION);
+    CHECK(rec.ignition.time == T + 4 && rec.ignition.flags == IGNITION_ON && rec.ignition.previous_s == 86400 * 3);
+
+    const Profile_t prof = {T + 5, 2, 5012, -37, 95000, {120, 300, 80, 7000, 70000, 9000, 15}};
+    n = encode(prof, buf, sizeof(buf));
+    CHECK(n == MAX_RECORD_SIZE);
+    CHECK(decodeOne(buf, n, rec) && rec.type == Type::PROFILE);
+    CHECK(rec.profile.time == T + 5 && rec.profile.reason == 2 && rec.profile.percent == 5012);
+    CHECK(rec.profile.delta == -37 && rec.profile.awake_ms == 95000); // above the 16 bit limit of version 1
+    for (uint8_t i = 0; i < PROFILE_PHASES; i++)
+        CHECK(rec.profile.phase_ms[i] == prof.phase_ms[i]);
+
+    // every encoder refuses a buffer one byte short
+    CHECK(encode(fix, buf, HEADER_SIZE + GNSS_FIX_BODY - 1) == 0);
+    CHECK(encode(bat, buf, HEADER_SIZE + BATTERY_BODY - 1) == 0);
+    CHECK(encode(motion, buf, HEADER_SIZE + MOTION_BODY - 1) == 0);
+    CHECK(encode(wake, buf, HEADER_SIZE + WAKE_BODY - 1) == 0);
+    CHECK(encode(ign, buf, HEADER_SIZE + IGNITION_BODY - 1) == 0);
+    CHECK(encode(prof, buf, MAX_RECORD_SIZE - 1) == 0);
+}
+
+static void profileVersion1()
+{
+    // written by the previous firmware: uint16 durations, only five phases
+    const uint8_t v1[] = {
+        1, (uint8_t)Type::PROFILE, 6 + 2 + 2 * 5, 0x60, 0x64, 0x3B, 0x69, // header, T
+        3,                                                                // reason
+        0x10, 0x27,                                                       // percent 10000
+        0xF6, 0xFF,                                                       // delta -10
+        0xFF, 0xFF,                                                       // awake 65535, saturated
+        5,                                                                // phases
+        0x64, 0x00, 0xC8, 0x00, 0x2C, 0x01, 0x90, 0x01, 0xF4, 0x01,       // 100 200 300 400 500
+    };
+    Record_t rec;
+    memset(&rec, 0xAA, sizeof(rec));
+    CHECK(decode(v1, sizeof(v1), rec) == sizeof(v1));
+    CHECK(rec.version == 1 && rec.type == Type::PROFILE);
+    CHECK(rec.profile.time == T && rec.profile.reason == 3 && rec.profile.percent == 10000);
+    CHECK(rec.profile.delta == -10 && rec.profile.awake_ms == 65535);
+    for (uint8_t i = 0; i < 5; i++)
+        CHECK(rec.profile.phase_ms[i] == 100U * (i + 1));
+    CHECK(rec.profile.phase_ms[5] == 0 && rec.profile.phase_ms[6] == 0);
+
+    // a phase count larger than the body does not read past it
+    uint8_t lying[sizeof(v1)];
+    memcpy(lying, v1, sizeof(v1));
+    lying[HEADER_SIZE + 7] = 200;
+    CHECK(decode(lying, sizeof(lying), rec) == sizeof(lying));
+    CHECK(rec.version == 1 && rec.profile.phase_ms[4] == 500 && rec.profile.phase_ms[5] == 0);
+
+    // too short for the fixed fields of version 1
+    uint8_t shortBody[HEADER_SIZE + 7];
+    memcpy(shortBody, v1, sizeof(shortBody));
+    shortBody[2] = 7;
+    CHECK(decode(shortBody, sizeof(shortBody), rec) == sizeof(shortBody));
+    CHECK(rec.version == 0);
+}
+
+static void skipping()
+{
+    uint8_t buf[3 * MAX_RECORD_SIZE];
+    const Motion_t motion = {T, 7, 30, 0};
+    const Battery_t bat = {T, 5000, 3800, 0, 0, 0};
+    size_t n = encode(motion, buf, sizeof(buf));
+    // a type from a newer firmware, with a body this decoder cannot read
+    const uint8_t unknown[] = {VERSION, 42, 3, 0, 0, 0, 0, 1, 2, 3};
+    memcpy(buf + n, unknown, sizeof(unknown));
+    n += sizeof(unknown);
+    // a newer version of a known type
+    const uint8_t newer[] = {VERSION + 1, (uint8_t)Type::WAKE, 2, 0, 0, 0, 0, 9, 9};
+    memcpy(buf + n, newer, sizeof(newer));
+    n += sizeof(newer);
+    n += encode(bat, buf + n, sizeof(buf) - n);
+
+    Record_t rec;
+    size_t at = 0, step;
+    Type types[4];
+    uint8_t versions[4];
+    int count = 0;
+    while (count < 4 && (step = decode(buf + at, n - at, rec)) > 0)
+    {
+        types[count] = rec.type;
+        versions[count++] = rec.version;
+        at += step;
+    }
+    CHECK(count == 4 && at == n);
+    CHECK(types[0] == Type::MOTION && versions[0] == VERSION);
+    CHECK((uint8_t)types[1] == 42);
+    CHECK(types[2] == Type::WAKE && versions[2] == VERSION + 1);
+    CHECK(types[3] == Type::BATTERY && versions[3] == VERSION && rec.battery.cell_mv == 3800);
+
+    // truncated: the header, or the body the header announces, runs past the data
+    CHECK(decode(buf, HEADER_SIZE - 1, rec) == 0);
+    CHECK(decode(buf, HEADER_SIZE + MOTION_BODY - 1, rec) == 0);
+    CHECK(decode(buf, 0, rec) == 0);
+
+    // a known type whose body is shorter than its fields
+    uint8_t shortFix[HEADER_SIZE + 4] = {VERSION, (uint8_t)Type::GNSS_FIX, 4};
+    CHECK(decode(shortFix, sizeof(shortFix), rec) == sizeof(shortFix));
+    CHECK(rec.version == 0);
+}
+
+// keeps the encoded bytes observable so the loops are not optimized away
+static volatile uint32_t sink;
+
+template <typename F>
+static double nsPer(int iterations, F f)
+{
+    uint32_t acc = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+        acc += f(i);
+    const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    sink = sink + acc;
+    return ns / iterations;
+}
+
+static void bench()
+{
+    const int N = 200000;
+    uint8_t buf[MAX_RECORD_SIZE];
+    char text[96];
+    size_t textLen = 0, binLen = 0;
+
+    sim76xx_gps_t gps = {};
+    gps.run = GPS_RUN_GPS;
+    gps.fix = GPS_FIX_GPS;
+    gps.fix_mode = GPS_MODE_3D;
+    gps.sat.num = 11;
+    gps.latitude = 48.1234567f;
+    gps.longitude = 11.5432100f;
+    gps.altitude = 521.3f;
+    gps.speed = 13.9f;
+    gps.cog = 271.25f;
+    gps.dop_h = 0.9f;
+    gps.dop_p = 1.4f;
+    gps.dop_v = 1.1f;
+    gps.hpa = 2.5f;
+    gps.vpa = 3.5f;
+
+    // the inputs change with i, and a byte of every output goes to the sink
+    const double gnssText = nsPer(N, [&](int i)
+                                  {
+                                      gps.latitude = 48.1234567f + i * 1e-6f;
+                                      const std::string s = gps.packed_string();
+                                      textLen = s.size();
+                                      return (uint32_t)s.size() + (uint8_t)s[i % s.size()]; });
+    const double gnssBin = nsPer(N, [&](int i)
+                                 {
+                                     const GnssFix_t fix = {T + (uint32_t)i, 481234567 + i, 115432100, 521, 500, 27125, 9, 11, 1 | (3 << 4)};
+                                     binLen = encode(fix, buf, sizeof(buf));
+                                     return (uint32_t)binLen + buf[i % binLen]; });
+    printf("GNSS fix:    packed_string() %3zu B %8.1f ns, record %2zu B %6.1f ns\n", textLen, gnssText, binLen, gnssBin);
+    CHECK(binLen < textLen);
+
+    const double batText = nsPer(N, [&](int i)
+                                 {
+                                     const int len = snprintf(text, sizeof(text), " percent %.2f,  cell %.3f v , rate %.2f %%/h",
+                                                              87.34 + i * 1e-4, 3.987, -1.25);
+                                     textLen = (size_t)len;
+                                     return (uint32_t)len + (uint8_t)text[i % len]; });
+    const double batBin = nsPer(N, [&](int i)
+                                {
+                                    const Battery_t bat = {T + (uint32_t)i, (uint16_t)(8734 + i), 3987, -125, 12480, 0};
+                                    binLen = encode(bat, buf, sizeof(buf));
+                                    return (uint32_t)binLen + buf[i % binLen]; });
+    printf("battery:     printf line     %3zu B %8.1f ns, record %2zu B %6.1f ns\n", textLen, batText, binLen, batBin);
+    CHECK(binLen < textLen);
+}
+
+int main()
+{
+    roundTrip();
+    profileVersion1();
+    skipping();
+    bench();
+    return check_result("telemetry_record_test");
+}
@@ -0,0 +1,132 @@
+/**
+ * @file track_simplify_bench.cpp
+ * @author rami zayat
+ * @brief compression, speed and deviation of the track simplifier on synthetic tracks
+ * @version 0.1
+ * @date 2025-12-12
+ *
+ * @copyright Copyright (c) 2025
+ *
+ * Every input fix is measured against the output polyline and checked against the
+ * reported max_dev_m, which has to bound it and stay within the tolerance.
+ */
+#include "check.hpp"
+#include "track/simplifier.hpp"
+#include <chrono>
+#include <random>
+#include <vector>
+
+using track::Fix_t;
+
+static const double LAT0 = 48.1;
+static const double LON0 = 11.5;
+static const double M_PER_DEG = track::EARTH_RADIUS_M * M_PI / 180.0;
+
+typedef struct
+{
+    double x;
+    double y;
+} Xy_t;
+
+static Fix_t makeFix(uint32_t t, double x, double y)
+{
+    Fix_t f = {};
+    f.t = t;
+    f.lat = (int32_t)lround((LAT0 + y / M_PER_DEG) * 1e7);
+    f.lon = (int32_t)lround((LON0 + x / (M_PER_DEG * cos(LAT0 * M_PI / 180.0))) * 1e7);
+    f.speed = 500;
+    f.hdop = 9;
+    return f;
+}
+
+static Xy_t toXy(const Fix_t &f)
+{
+    return {(f.lon * 1e-7 - LON0) * M_PER_DEG * cos(LAT0 * M_PI / 180.0), (f.lat * 1e-7 - LAT0) * M_PER_DEG};
+}
+
+static double segment(const Xy_t &p, const Xy_t &a, const Xy_t &b)
+{
+    const double dx = b.x - a.x, dy = b.y - a.y, len2 = dx * dx + dy * dy;
+    double t = len2 > 0 ? ((p.x - a.x) * dx + (p.y - a.y) * dy) / len2 : 0;
+    t = t < 0 ? 0 : (t > 1 ? 1 : t);
+    return hypot(p.x - (a.x + t * dx), p.y - (a.y + t * dy));
+}
+
+// 1 Hz drive at `speed_mps`, heading changed by `turn` after every `leg_m`, GPS noise of `noise_m`
+static std::vector<Fix_t> drive(uint32_t seconds, double speed_mps, double leg_m, double turn, double noise_m, uint32_t seed)
+{
+    std::mt19937 rng(seed);
+    std::normal_distribution<double> noise(0.0, noise_m);
+    std::vector<Fix_t> fixes;
+    double x = 0, y = 0, heading = 0.3, leg = 0;
+    for (uint32_t t = 0; t < seconds; t++)
+    {
+        fixes.push_back(makeFix(1760000000 + t, x + noise(rng), y + noise(rng)));
+        x += speed_mps * cos(heading);
+        y += speed_mps * sin(heading);
+        leg += speed_mps;
+        if (leg_m > 0 && leg >= leg_m)
+        {
+            heading += turn;
+            leg = 0;
+        }
+        else
+        {
+            heading += 0.002; // slow bend
+        }
+    }
+    return fixes;
+}
+
+static void run(const char *name, const std::vector<Fix_t> &in, float tol)
+{
+    std::vector<Fix_t> out;
+    track::SimplifyStats_t stats = {};
+    const std::function<void(const Fix_t &)> sink = [&out](const Fix_t &f)
+    { out.push_back(f); };
+    const auto start = std::chrono::steady_clock::now();
+    {
+        track::Simplifier simplifier(tol, sink, stats);
+        for (const Fix_t &f : in)
+            simplifier.push(f);
+        simplifier.finish();
+    }
+    const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<Xy_t> poly;
+    for (const Fix_t &f : out)
+        poly.push_back(toXy(f));
+    double actual = 0;
+    for (const Fix_t &f : in)
+    {
+        const Xy_t p = toXy(f);
+        double best = poly.size() == 1 ? hypot(p.x - poly[0].x, p.y - poly[0].y) : 1e30;
+        for (size_t i = 1; i < poly.size(); i++)
+            best = fmin(best, segment(p, poly[i - 1], poly[i]));
+        actual = fmax(actual, best);
+    }
+    printf("%-8s tol %4.1f m: %5u -> %4u fixes (%5.1f%%), dev %5.2f m, bound %5.2f m, %6.1f ns/fix\n", name, tol,
+           (unsigned)stats.in, (unsigned)stats.out, 100.0 * stats.out / stats.in, actual, stats.max_dev_m, ns / stats.in);
+    CHECK(stats.in == in.size());
+    CHECK(stats.out == out.size());
+    CHECK(out.front().t == in.front().t);
+    CHECK(out.back().t == in.back().t);
+    for (size_t i = 1; i < out.size(); i++)
+        CHECK(out[i].t > out[i - 1].t);
+    CHECK(actual <= stats.max_dev_m + 0.05); // float projection on the device side
+    CHECK(stats.max_dev_m <= tol + 0.05);
+}
+
+int main()
+{
+    const std::vector<Fix_t> highway = drive(3600, 30.0, 0, 0, 2.0, 1);
+    const std::vector<Fix_t> city = drive(3600, 10.0, 200.0, M_PI / 2, 3.0, 2);
+    const std::vector<Fix_t> parked = drive(900, 0.0, 0, 0, 3.0, 3);
+    for (float tol : {5.0f, 10.0f, 20.0f})
+    {
+        run("highway", highway, tol);
+        run("city", city, tol);
+        run("parked", parked, tol);
+    }
+    return check_result("track_simplify_bench");
+}
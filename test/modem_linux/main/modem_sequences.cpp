@@ -0,0 +1,189 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file modem_sequences.cpp
+ * @brief Replays the modem sequences of the firmware on the scripted terminal and times them.
+ *
+ * ModemSim7670 lives in main and needs the Arduino core, so the sequences are the command
+ * order of ModemSim7670::init(), sleep(), EnableGnss()/waitGnssFix() and the SMS wake path,
+ * issued through the same SIM7670_gnss calls. Bring-up runs once with the set commands one
+ * per line and once batched, at a fixed modem latency, and reports the time saved.
+ * The process exits with the number of failed checks.
+ */
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "esp_log.h"
+#include "esp_modem_config.h"
+#include "SIM7670_gnss.hpp"
+#include "SIM7670_scripted_term.hpp"
+
+using esp_modem::command_result;
+
+constexpr auto const TAG = "sequences";
+
+/**
+ * @brief Assumed reply latency of the modem to a short AT command, every scripted step uses it.
+ */
+static constexpr uint32_t MODEM_LATENCY_MS = 40;
+
+static int failures = 0;
+
+#define EXPECT(cond)                                                        \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            ESP_LOGE(TAG, "%s:%d: EXPECT(%s) failed", __FILE__, __LINE__, #cond); \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+/**
+ * @brief Checks that the script ran to its end without unexpected commands, returns its wall time.
+ */
+static uint32_t finish(SIM7670_scripted_term *term, const char *name)
+{
+    term->report();
+    EXPECT(term->finished());
+    for (const auto &r : term->trace()) {
+        EXPECT(r.outcome != SIM7670_scripted_term::outcome_t::UNEXPECTED);
+    }
+    const uint32_t ms = term->elapsed_ms();
+    ESP_LOGI(TAG, "%s: %u round trips, %u ms", name, (unsigned)term->trace().size(), (unsigned)ms);
+    term->reset_trace();
+    return ms;
+}
+
+/**
+ * @brief The command mode part of ModemSim7670::init(), after the UART rate is settled.
+ *
+ * @param batched True for the current send_batch() form, false for one set command per line.
+ */
+static uint32_t bring_up(SIM7670_gnss &device, SIM7670_scripted_term *term, bool batched)
+{
+    term->expect("AT")
+        .expect("AT+CSCLK=0")
+        .expect("AT+CPIN?", "+CPIN: READY\r\n\r\nOK");
+    if (batched) {
+        term->expect("AT+CFUN=1,0;S0=2");
+    } else {
+        term->expect("AT+CFUN=1,0").expect("ATS0=2");
+    }
+    term->expect_error("AT+CPMVT=0")
+        .expect("AT+COPS?", "+COPS: 0,0,\"Operator\",7\r\n\r\nOK")
+        .expect("AT+COPS?", "+COPS: 0,0,\"Operator\",7\r\n\r\nOK")
+        .expect("AT+CIMI", "262011234567890\r\n\r\nOK");
+
+    EXPECT(device.sync() == command_result::OK);
+    EXPECT(device.enable_terminal_sleep_mode(false) == command_result::OK);
+    bool pin_ok = false;
+    EXPECT(device.read_pin(pin_ok) == command_result::OK);
+    EXPECT(pin_ok);
+    if (batched) {
+        std::vector<command_result> results;
+        EXPECT(device.send_batch({"+CFUN=1,0", "S0=2"}, results) == command_result::OK);
+        EXPECT(results.size() == 2);
+    } else {
+        EXPECT(device.set_functionality_level(functionality_level_t::FULL) == command_result::OK);
+        EXPECT(device.set_auto_answer(2) == command_result::OK);
+    }
+    std::string out;
+    EXPECT(device.at("AT+CPMVT=0", out, 4000) != command_result::OK);
+    EXPECT(device.at("AT+COPS?", out, 1000) == command_result::OK);
+    EXPECT(device.get_operator_name(out) == command_result::OK);
+    EXPECT(out == "Operator");
+    EXPECT(device.get_imsi(out) == command_result::OK);
+    EXPECT(out == "262011234567890");
+    return finish(term, batched ? "bring-up, batched" : "bring-up, one command per line");
+}
+
+/**
+ * @brief The SMS wake path: one listing of the unread messages, one bulk delete.
+ */
+static void sms_sequence(SIM7670_gnss &device, SIM7670_scripted_term *term)
+{
+    term->expect("AT+CMGF=1")
+        .expect("AT+CMGL=\"REC UNREAD\"",
+                "+CMGL: 1,\"REC UNREAD\",\"+4917012345\",\"\",\"25/12/05,10:00:00+08\"\r\nstatus\r\n"
+                "+CMGL: 2,\"REC UNREAD\",\"+4917012345\",\"\",\"25/12/05,10:01:00+08\"\r\ngps\r\nnow\r\n\r\nOK",
+                120)
+        .urc("+CMTI: \"SM\",3", 10)
+        .expect("AT+CMGD=1,1");
+
+    std::vector<std::string> bodies;
+    EXPECT(device.list_sms(sms_list_status_t::UNREAD, [&bodies](const sms_view_t &sms) {
+        bodies.emplace_back(sms.content);
+        return true;
+    }) == command_result::OK);
+    EXPECT(bodies.size() == 2);
+    EXPECT(bodies.size() == 2 && bodies[0] == "status" && bodies[1] == "gps\r\nnow");
+    EXPECT(device.delete_all_sms(sms_delete_flag_t::READ) == command_result::OK);
+    finish(term, "sms");
+}
+
+/**
+ * @brief EnableGnss(true) on a hot start, then the fix polling of waitGnssFix().
+ */
+static void gnss_sequence(SIM7670_gnss &device, SIM7670_scripted_term *term)
+{
+    term->expect("AT+CGPSXE=1")
+        .expect("AT+CGPSXDAUTO=1")
+        .expect("AT+CG*") // the power command differs between esp_modem releases
+        .expect("AT+CGPSHOT")
+        .expect("AT+CGNSINF", "+CGNSINF: 1,0,,,,,,,0,,,,,,0,,,\r\n\r\nOK", 200)
+        .expect("AT+CGNSINF", "+CGNSINF: 1,1,20251205100000.000,48.100000,11.500000,520.0,12.5,90.0,1,,0.9,1.2,0.8,,10,,1.0,2.0\r\n\r\nOK", 200)
+        .expect_timeout("AT+CGNSINF");
+
+    EXPECT(device.enable_gnss_xtra(true) == command_result::OK);
+    EXPECT(device.set_gnss_power_mode(0) == command_result::OK);
+    EXPECT(device.set_gnss_start_mode(gnss_start_mode_t::HOT) == command_result::OK);
+    sim76xx_gps_t gps = {};
+    EXPECT(device.get_gnss_information_sim76xx(gps) == command_result::OK);
+    EXPECT(gps.fix == GPS_FIX_INVALID);
+    EXPECT(device.get_gnss_information_sim76xx(gps) == command_result::OK);
+    EXPECT(gps.fix != GPS_FIX_INVALID);
+    EXPECT(gps.latitude > 48.09f && gps.latitude < 48.11f);
+    EXPECT(gps.dop_h > 0.0f && gps.dop_h < 1.0f);
+    EXPECT(device.get_gnss_information_sim76xx(gps) == command_result::TIMEOUT);
+    finish(term, "gnss");
+}
+
+/**
+ * @brief ModemSim7670::sleep(SLEEP), then the same group refused as a whole and retried singly.
+ */
+static void sleep_sequence(SIM7670_gnss &device, SIM7670_scripted_term *term)
+{
+    term->expect("AT+CSCLK=1;+CFUN=0,0")
+        .expect_error("AT+CSCLK=1;+CFUN=0,0")
+        .expect("AT+CSCLK=1")
+        .expect_error("AT+CFUN=0,0");
+
+    std::vector<command_result> results;
+    EXPECT(device.send_batch({"+CSCLK=1", "+CFUN=0,0"}, results) == command_result::OK);
+    EXPECT(device.send_batch({"+CSCLK=1", "+CFUN=0,0"}, results) == command_result::FAIL);
+    EXPECT(results.size() == 2 && results[0] == command_result::OK && results[1] != command_result::OK);
+    finish(term, "sleep");
+}
+
+extern "C" void app_main(void)
+{
+    SIM7670_scripted_term *term;
+    auto dte = create_scripted_dte(term);
+    term->set_default_latency(MODEM_LATENCY_MS);
+    esp_modem_dce_config_t dce_config = ESP_MODEM_DCE_DEFAULT_CONFIG("internet");
+    SIM7670_gnss device(dte, &dce_config);
+
+    const uint32_t single = bring_up(device, term, false);
+    const uint32_t batched = bring_up(device, term, true);
+    ESP_LOGI(TAG, "bring-up at %u ms per round trip: %u ms one per line, %u ms batched, %d ms saved",
+             (unsigned)MODEM_LATENCY_MS, (unsigned)single, (unsigned)batched, (int)single - (int)batched);
+    EXPECT(batched < single);
+    sms_sequence(device, term);
+    gnss_sequence(device, term);
+    sleep_sequence(device, term);
+
+    ESP_LOGI(TAG, "%s, %d failed checks", failures ? "FAILED" : "passed", failures);
+    std::exit(failures);
+}
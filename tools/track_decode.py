@@ -0,0 +1,150 @@
+#!/usr/bin/env python3
+"""Decode and validate the GNSS track files of the storage partition.
+
+Reads /track.old and /track.bin as copied off the device (LittleFS image tools,
+the SD card or the upload topic), checks every block header and prints the
+fixes as CSV, or only the check summary with --check.
+
+The block format is the one of main/src/track/trackLog.hpp: TRACK_BLOCK_SIZE
+byte blocks, each a packed little endian TrackBlockHeader_t followed by varint
+records predicted from the previous fix.
+
+Exit status is 1 when a header or a record does not check out.
+"""
+import argparse
+import struct
+import sys
+
+BLOCK_SIZE = 512
+MAGIC = 0x4B54  # "TK"
+VERSION = 1
+HEADER = struct.Struct("<HBBHHIIii")  # magic version reserved count used t_first t_last lat lon
+PAYLOAD_SIZE = BLOCK_SIZE - HEADER.size
+
+
+def unzigzag(v):
+    return (v >> 1) ^ -(v & 1)
+
+
+def to_i32(v):
+    v &= 0xFFFFFFFF
+    return v - (1 << 32) if v & 0x80000000 else v
+
+
+def varint(data, i, end):
+    """(value, next index), next index is None on a truncated or too long varint"""
+    v = 0
+    for n in range(5):
+        if i + n >= end:
+            break
+        v |= (data[i + n] & 0x7F) << (7 * n)
+        if data[i + n] & 0x80 == 0:
+            return v & 0xFFFFFFFF, i + n + 1
+    return 0, None
+
+
+def predict(d, dt, prev_dt):
+    # C integer division truncates towards zero
+    if prev_dt == 0:
+        return 0
+    q = abs(d * dt) // prev_dt
+    return q if d * dt >= 0 else -q
+
+
+class Codec:
+    def __init__(self, t, lat, lon):
+        self.t, self.lat, self.lon = t, lat, lon
+        self.speed = self.course = self.hdop = 0
+        self.dt = self.dlat = self.dlon = 0
+
+    def decode(self, data, i, end):
+        v = []
+        for _ in range(6):
+            x, i = varint(data, i, end)
+            if i is None:
+                return None, None
+            v.append(x)
+        dt = v[0]
+        dlat = to_i32(unzigzag(v[1]) + predict(self.dlat, dt, self.dt))
+        dlon = to_i32(unzigzag(v[2]) + predict(self.dlon, dt, self.dt))
+        self.t = (self.t + dt) & 0xFFFFFFFF
+        self.lat = to_i32(self.lat + dlat)
+        self.lon = to_i32(self.lon + dlon)
+        self.speed = (self.speed + unzigzag(v[3])) & 0xFFFF
+        self.course = (self.course + unzigzag(v[4]) + 360) % 360
+        self.hdop = (self.hdop + unzigzag(v[5])) & 0xFF
+        self.dt, self.dlat, self.dlon = dt, dlat, dlon
+        return (self.t, self.lat, self.lon, self.speed, self.course, self.hdop), i
+
+
+def check_file(path, fixes, errors):
+    """decode one track file, appending fixes and error strings, returns the block count"""
+    with open(path, "rb") as f:
+        data = f.read()
+    if len(data) % BLOCK_SIZE:
+        errors.append("%s: size %d is not a multiple of %d" % (path, len(data), BLOCK_SIZE))
+    blocks = len(data) // BLOCK_SIZE
+    prev_last = None
+    for idx in range(blocks):
+        base = idx * BLOCK_SIZE
+        magic, version, _, count, used, t_first, t_last, lat, lon = HEADER.unpack_from(data, base)
+        where = "%s block %d" % (path, idx)
+        if magic != MAGIC or version != VERSION:
+            errors.append("%s: bad magic %04x or version %d" % (where, magic, version))
+            continue
+        if used > PAYLOAD_SIZE:
+            errors.append("%s: used %d above the payload size %d" % (where, used, PAYLOAD_SIZE))
+            continue
+        if t_first > t_last:
+            errors.append("%s: t_first %d after t_last %d" % (where, t_first, t_last))
+        if prev_last is not None and t_first < prev_last:
+            errors.append("%s: starts at %d before the previous block ended at %d" % (where, t_first, prev_last))
+        prev_last = t_last
+        codec = Codec(t_first, lat, lon)
+        i, end = base + HEADER.size, base + HEADER.size + used
+        decoded = []
+        for n in range(count):
+            fix, i = codec.decode(data, i, end)
+            if fix is None:
+                errors.append("%s: record %d of %d truncated" % (where, n, count))
+                break
+            decoded.append(fix)
+        else:
+            if i != end:
+                errors.append("%s: %d record bytes left after %d records" % (where, end - i, count))
+        if decoded:
+            # the first record repeats the header fix with dt 0
+            if decoded[0][0] != t_first:
+                errors.append("%s: first record at %d, header says %d" % (where, decoded[0][0], t_first))
+            if decoded[-1][0] != t_last:
+                errors.append("%s: last record at %d, header says %d" % (where, decoded[-1][0], t_last))
+        fixes.extend(decoded)
+    return blocks
+
+
+def main():
+    p = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    p.add_argument("files", nargs="+", help="track.old then track.bin, oldest first")
+    p.add_argument("--check", action="store_true", help="only validate, print the summary")
+    args = p.parse_args()
+
+    fixes, errors = [], []
+    blocks = sum(check_file(path, fixes, errors) for path in args.files)
+    for n in range(1, len(fixes)):
+        if fixes[n][0] < fixes[n - 1][0]:
+            errors.append("fix %d at %d goes back from %d" % (n, fixes[n][0], fixes[n - 1][0]))
+            break
+
+    if not args.check:
+        print("time,lat,lon,speed_kmh,course,hdop")
+        for t, lat, lon, speed, course, hdop in fixes:
+            print("%d,%.7f,%.7f,%.1f,%d,%.1f" % (t, lat / 1e7, lon / 1e7, speed / 10.0, course, hdop / 10.0))
+    for e in errors:
+        print(e, file=sys.stderr)
+    print("%d blocks, %d fixes, %d errors" % (blocks, len(fixes), len(errors)),
+          file=sys.stderr if not args.check else sys.stdout)
+    return 1 if errors else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
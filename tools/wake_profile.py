@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+"""Per phase energy estimate from the PROFILE telemetry records.
+
+Input is the telemetry topic as hex, one payload per line, for example
+    mosquitto_sub -t esp32s3/telemetry -F %x > telemetry.hex
+or raw payloads with --binary. Other record types in the stream are skipped.
+Record version 2 carries the durations as uint32 ms, version 1 as uint16 ms
+saturated at 65.5 s; both are read.
+
+The current drawn in each phase is an estimate, pass measured values with
+--current phase=mA. With --capacity the battery percent deltas are turned into
+mAh to compare against the estimate.
+"""
+import argparse
+import struct
+import sys
+from collections import defaultdict
+
+PHASES = ["boot", "power", "imu", "modem", "attach", "send", "sleep"]
+REASONS = ["motion", "start", "timer", "modem", "unknown"]  # power::WakeUpReason_t
+DEFAULT_MA = {"boot": 45, "power": 40, "imu": 40, "modem": 120, "attach": 180, "send": 220, "sleep": 40}
+PROFILE = 6
+HEADER = 7
+WIDTH = {1: 2, 2: 4}  # record version: bytes of the awake and phase durations
+
+
+def records(data):
+    """yield (version, time, body) of the PROFILE records in one payload"""
+    i = 0
+    while i + HEADER <= len(data):
+        version, rtype, blen = data[i], data[i + 1], data[i + 2]
+        (ts,) = struct.unpack_from("<I", data, i + 3)
+        body = data[i + HEADER:i + HEADER + blen]
+        if len(body) < blen:
+            return
+        if version in WIDTH and rtype == PROFILE and blen >= 6 + WIDTH[version]:
+            yield version, ts, body
+        i += HEADER + blen
+
+
+def decode(version, ts, body):
+    width = WIDTH[version]
+    ms = "<H" if width == 2 else "<I"
+    reason, percent, delta = struct.unpack_from("<BHh", body)
+    (awake,) = struct.unpack_from(ms, body, 5)
+    count = body[5 + width]
+    phases = [0] * len(PHASES)
+    start = 6 + width
+    for n in range(min(count, len(PHASES), (len(body) - start) // width)):
+        (phases[n],) = struct.unpack_from(ms, body, start + width * n)
+    return {"time": ts, "reason": reason, "percent": percent / 100.0, "delta": delta / 100.0,
+            "awake": awake, "phases": phases}
+
+
+def payloads(args):
+    for path in args.files or ["-"]:
+        f = sys.stdin.buffer if path == "-" else open(path, "rb")
+        with f:
+            if args.binary:
+                yield f.read()
+                continue
+            for line in f:
+                line = line.strip()
+                if line:
+                    yield bytes.fromhex(line.decode())
+
+
+def main():
+    p = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    p.add_argument("files", nargs="*", help="hex lines, - or nothing for stdin")
+    p.add_argument("--binary", action="store_true", help="files hold raw payloads")
+    p.add_argument("--current", action="append", default=[], metavar="PHASE=MA")
+    p.add_argument("--deep-sleep-ua", type=float, default=60.0, help="board current in deep sleep")
+    p.add_argument("--capacity", type=float, default=0.0, help="battery mAh, to convert percent deltas")
+    args = p.parse_args()
+
+    ma = dict(DEFAULT_MA)
+    for item in args.current:
+        name, value = item.split("=", 1)
+        if name not in ma:
+            p.error("unknown phase %s, one of %s" % (name, ", ".join(PHASES)))
+        ma[name] = float(value)
+
+    recs = sorted((decode(version, ts, body) for data in payloads(args) for version, ts, body in records(data)),
+                  key=lambda r: r["time"])
+    if not recs:
+        print("no PROFILE records")
+        return 1
+
+    by_reason = defaultdict(list)
+    for r in recs:
+        by_reason[REASONS[r["reason"]] if r["reason"] < len(REASONS) else str(r["reason"])].append(r)
+
+    print("%-8s %5s " % ("reason", "wakes") + " ".join("%8s" % ph for ph in PHASES) + " %8s %9s" % ("awake", "mAh/wake"))
+    total_mah = 0.0
+    for reason, rs in sorted(by_reason.items()):
+        mean = [sum(r["phases"][n] for r in rs) / len(rs) for n in range(len(PHASES))]
+        awake = sum(r["awake"] for r in rs) / len(rs)
+        # the part of the wake no phase covers is charged at the boot current
+        other = max(0.0, awake - sum(mean))
+        mah = (sum(m * ma[ph] for m, ph in zip(mean, PHASES)) + other * ma["boot"]) / 3.6e6
+        total_mah += mah * len(rs)
+        print("%-8s %5d " % (reason, len(rs)) + " ".join("%8.0f" % m for m in mean) + " %8.0f %9.4f" % (awake, mah))
+
+    span_h = (recs[-1]["time"] - recs[0]["time"]) / 3600.0
+    awake_h = sum(r["awake"] for r in recs[1:]) / 3.6e6
+    sleep_mah = max(0.0, span_h - awake_h) * args.deep_sleep_ua / 1000.0
+    print("\n%d wakes over %.1f h: %.2f mAh awake, %.2f mAh deep sleep" % (len(recs), span_h, total_mah, sleep_mah))
+    if span_h > 0:
+        print("estimated average %.3f mA" % ((total_mah + sleep_mah) / span_h))
+    measured = -sum(r["delta"] for r in recs[1:])
+    if args.capacity > 0:
+        print("battery dropped %.2f %%, %.2f mAh" % (measured, measured * args.capacity / 100.0))
+    else:
+        print("battery dropped %.2f %%, pass --capacity to compare in mAh" % measured)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())